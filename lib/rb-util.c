@@ -40,6 +40,7 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <gtk/gtk.h>
 #include <glib/gi18n.h>
@@ -415,6 +416,27 @@ rb_is_main_thread (void)
 	}
 }
 
+/**
+ * rb_get_num_processors:
+ *
+ * Returns the number of processors currently online, for sizing pools
+ * of worker threads.
+ *
+ * Return value: number of online processors, at least 1
+ */
+int
+rb_get_num_processors (void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long n;
+
+	n = sysconf (_SC_NPROCESSORS_ONLN);
+	if (n > 0)
+		return (int) n;
+#endif
+	return 1;
+}
+
 static gboolean
 purge_useless_threads (gpointer data)
 {
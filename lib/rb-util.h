@@ -60,6 +60,7 @@ GtkWidget *rb_image_new_from_stock (const gchar *stock_id, GtkIconSize size);
 
 void rb_threads_init (void);
 gboolean rb_is_main_thread (void);
+int rb_get_num_processors (void);
 
 gchar* rb_search_fold (const char *original);
 gchar** rb_string_split_words (const gchar *string);
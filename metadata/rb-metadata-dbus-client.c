@@ -44,6 +44,13 @@
  * child is still capable of handling messages, and it ensures the child
  * doesn't time out between when we check the child is still running and when
  * we actually send it the request.
+ *
+ * Several metadata helpers can be running at once, so metadata can be read
+ * from several threads at the same time.  Each request takes a helper that
+ * isn't busy, starting a new one if there are fewer than the maximum number
+ * of helpers (see rb_metadata_set_max_helpers), or waiting for one to become
+ * available otherwise.  When a helper reports missing plugins, all helpers
+ * are restarted before they're used again, so they reread the registry.
  */
 
 /**
@@ -77,10 +84,22 @@ static void rb_metadata_class_init (RBMetaDataClass *klass);
 static void rb_metadata_init (RBMetaData *md);
 static void rb_metadata_finalize (GObject *object);
 
+typedef struct
+{
+	DBusConnection *connection;
+	GPid child;
+	int child_stdout;
+	gboolean busy;
+	guint generation;
+} RBMetaDataHelper;
+
+/* conn_mutex protects the helper list and saveable types */
 static gboolean tried_env_address = FALSE;
-static DBusConnection *dbus_connection = NULL;
-static GPid metadata_child = 0;
-static int metadata_stdout = -1;
+static gboolean using_env_address = FALSE;
+static GPtrArray *helpers = NULL;
+static guint max_helpers = 1;
+static guint helper_generation = 0;
+static GCond *helper_cond = NULL;
 static GMainContext *main_context = NULL;
 static GStaticMutex conn_mutex = G_STATIC_MUTEX_INIT;
 static char **saveable_types = NULL;
@@ -143,41 +162,131 @@ rb_metadata_new (void)
 	return RB_METADATA (g_object_new (RB_TYPE_METADATA, NULL));
 }
 
+/**
+ * rb_metadata_set_max_helpers:
+ * @count: the maximum number of metadata helpers
+ *
+ * Sets the maximum number of metadata helper processes to run at once,
+ * which is also the number of threads that can read metadata at the
+ * same time.  Helpers beyond the new maximum are stopped once they're
+ * no longer in use.
+ */
+void
+rb_metadata_set_max_helpers (guint count)
+{
+	g_static_mutex_lock (&conn_mutex);
+	max_helpers = MAX (count, 1);
+	if (helper_cond != NULL)
+		g_cond_broadcast (helper_cond);
+	g_static_mutex_unlock (&conn_mutex);
+}
+
 static void
-kill_metadata_service (void)
+kill_metadata_service (RBMetaDataHelper *helper)
 {
-	if (dbus_connection) {
-		if (dbus_connection_get_is_connected (dbus_connection)) {
+	if (helper->connection) {
+		if (dbus_connection_get_is_connected (helper->connection)) {
 			rb_debug ("closing dbus connection");
-			dbus_connection_close (dbus_connection);
+			dbus_connection_close (helper->connection);
 		} else {
 			rb_debug ("dbus connection already closed");
 		}
-		dbus_connection_unref (dbus_connection);
-		dbus_connection = NULL;
+		dbus_connection_unref (helper->connection);
+		helper->connection = NULL;
 	}
 
-	if (metadata_child) {
+	if (helper->child) {
 		rb_debug ("killing child process");
-		kill (metadata_child, SIGINT);
-		g_spawn_close_pid (metadata_child);
-		metadata_child = 0;
+		kill (helper->child, SIGINT);
+		g_spawn_close_pid (helper->child);
+		helper->child = 0;
 	}
 
-	if (metadata_stdout != -1) {
+	if (helper->child_stdout != -1) {
 		rb_debug ("closing metadata child process stdout pipe");
-		close (metadata_stdout);
-		metadata_stdout = -1;
+		close (helper->child_stdout);
+		helper->child_stdout = -1;
 	}
 }
 
+/* takes a helper that isn't in use, waiting for one if necessary */
+static RBMetaDataHelper *
+acquire_metadata_helper (void)
+{
+	RBMetaDataHelper *helper = NULL;
+	guint limit;
+	guint i;
+
+	g_static_mutex_lock (&conn_mutex);
+	if (helpers == NULL) {
+		helpers = g_ptr_array_new ();
+		helper_cond = g_cond_new ();
+	}
+
+	while (helper == NULL) {
+		/* an externally started service can only be used once */
+		limit = using_env_address ? 1 : max_helpers;
+
+		for (i = 0; i < helpers->len && i < limit; i++) {
+			RBMetaDataHelper *h = g_ptr_array_index (helpers, i);
+			if (h->busy == FALSE) {
+				helper = h;
+				break;
+			}
+		}
+
+		if (helper == NULL && helpers->len < limit) {
+			helper = g_new0 (RBMetaDataHelper, 1);
+			helper->child_stdout = -1;
+			helper->generation = helper_generation;
+			g_ptr_array_add (helpers, helper);
+		}
+
+		if (helper == NULL)
+			g_cond_wait (helper_cond, g_static_mutex_get_mutex (&conn_mutex));
+	}
+
+	helper->busy = TRUE;
+	if (helper->generation != helper_generation) {
+		rb_debug ("restarting metadata helper to reload the registry");
+		kill_metadata_service (helper);
+		helper->generation = helper_generation;
+	}
+	g_static_mutex_unlock (&conn_mutex);
+
+	return helper;
+}
+
+static void
+release_metadata_helper (RBMetaDataHelper *helper)
+{
+	guint i;
+
+	g_static_mutex_lock (&conn_mutex);
+	helper->busy = FALSE;
+
+	/* stop helpers beyond the maximum */
+	for (i = helpers->len; i > max_helpers; i--) {
+		RBMetaDataHelper *h = g_ptr_array_index (helpers, i - 1);
+		if (h->busy)
+			break;
+
+		kill_metadata_service (h);
+		g_ptr_array_remove_index (helpers, i - 1);
+		g_free (h);
+	}
+
+	g_cond_signal (helper_cond);
+	g_static_mutex_unlock (&conn_mutex);
+}
+
 static gboolean
-ping_metadata_service (GError **error)
+ping_metadata_service (RBMetaDataHelper *helper, GError **error)
 {
 	DBusMessage *message, *response;
 	DBusError dbus_error = {0,};
 
-	if (!dbus_connection_get_is_connected (dbus_connection))
+	if (!dbus_connection_get_is_connected (helper->connection))
 		return FALSE;
 
 	message = dbus_message_new_method_call (RB_METADATA_DBUS_NAME,
@@ -187,7 +296,7 @@ ping_metadata_service (GError **error)
 	if (!message) {
 		return FALSE;
 	}
-	response = dbus_connection_send_with_reply_and_block (dbus_connection,
+	response = dbus_connection_send_with_reply_and_block (helper->connection,
 							      message,
 							      RB_METADATA_DBUS_TIMEOUT,
 							      &dbus_error);
@@ -204,8 +313,9 @@ ping_metadata_service (GError **error)
 	return TRUE;
 }
 
+/* must be called with the helper acquired */
 static gboolean
-start_metadata_service (GError **error)
+start_metadata_service (RBMetaDataHelper *helper, GError **error)
 {
 	DBusError dbus_error = {0,};
 	DBusMessage *message;
@@ -215,29 +325,33 @@ start_metadata_service (GError **error)
 	GIOStatus status;
 	gchar *dbus_address = NULL;
 	char *saveable_type_list;
+	char **types;
 
-	if (dbus_connection) {
-		if (ping_metadata_service (error))
+	if (helper->connection) {
+		if (ping_metadata_service (helper, error))
 			return TRUE;
 
 		/* Metadata service is broken.  Kill it, and if we haven't run
 		 * into any errors yet, we can try to restart it.
 		 */
-		kill_metadata_service ();
+		kill_metadata_service (helper);
 
 		if (*error)
 			return FALSE;
 	}
 
+	g_static_mutex_lock (&conn_mutex);
 	if (!tried_env_address) {
 		const char *addr = g_getenv ("RB_DBUS_METADATA_ADDRESS");
 		tried_env_address = TRUE;
 		if (addr) {
 			rb_debug ("trying metadata service address %s (from environment)", addr);
 			dbus_address = g_strdup (addr);
-			metadata_child = 0;
+			using_env_address = TRUE;
+			helper->child = 0;
 		}
 	}
+	g_static_mutex_unlock (&conn_mutex);
 
 	if (dbus_address == NULL) {
 		GPtrArray *argv;
@@ -273,9 +387,9 @@ start_metadata_service (GError **error)
 						NULL,
 						0,
 						NULL, NULL,
-						&metadata_child,
+						&helper->child,
 						NULL,
-						&metadata_stdout,
+						&helper->child_stdout,
 						NULL,
 						&local_error);
 		g_ptr_array_free (argv, TRUE);
@@ -286,11 +400,11 @@ start_metadata_service (GError **error)
 			return FALSE;
 		}
 
-		stdout_channel = g_io_channel_unix_new (metadata_stdout);
+		stdout_channel = g_io_channel_unix_new (helper->child_stdout);
 		status = g_io_channel_read_line (stdout_channel, &dbus_address, NULL, NULL, error);
 		g_io_channel_unref (stdout_channel);
 		if (status != G_IO_STATUS_NORMAL) {
-			kill_metadata_service ();
+			kill_metadata_service (helper);
 			return FALSE;
 		}
 
@@ -298,25 +412,22 @@ start_metadata_service (GError **error)
 		rb_debug ("Got metadata helper D-BUS address %s", dbus_address);
 	}
 
-	dbus_connection = dbus_connection_open_private (dbus_address, &dbus_error);
+	helper->connection = dbus_connection_open_private (dbus_address, &dbus_error);
 	g_free (dbus_address);
-	if (!dbus_connection) {
-		kill_metadata_service ();
+	if (!helper->connection) {
+		kill_metadata_service (helper);
 
 		dbus_set_g_error (error, &dbus_error);
 		dbus_error_free (&dbus_error);
 		return FALSE;
 	}
-	dbus_connection_set_exit_on_disconnect (dbus_connection, FALSE);
+	dbus_connection_set_exit_on_disconnect (helper->connection, FALSE);
 
-	dbus_connection_setup_with_g_main (dbus_connection, main_context);
+	dbus_connection_setup_with_g_main (helper->connection, main_context);
 
-	rb_debug ("Metadata process %d started", metadata_child);
+	rb_debug ("Metadata process %d started", helper->child);
 
 	/* now ask it what types it can re-tag */
-	if (saveable_types != NULL) {
-		g_strfreev (saveable_types);
-	}
 
 	message = dbus_message_new_method_call (RB_METADATA_DBUS_NAME,
 						RB_METADATA_DBUS_OBJECT_PATH,
@@ -329,7 +440,7 @@ start_metadata_service (GError **error)
 	}
 
 	rb_debug ("sending metadata saveable types query");
-	response = dbus_connection_send_with_reply_and_block (dbus_connection,
+	response = dbus_connection_send_with_reply_and_block (helper->connection,
 							      message,
 							      RB_METADATA_DBUS_TIMEOUT,
 							      &dbus_error);
@@ -344,19 +455,24 @@ start_metadata_service (GError **error)
 		return FALSE;
 	}
 
-	if (!rb_metadata_dbus_get_strv (&iter, &saveable_types)) {
+	if (!rb_metadata_dbus_get_strv (&iter, &types)) {
 		rb_debug ("couldn't get saveable type data from response message");
 		return FALSE;
 	}
 
-	if (saveable_types != NULL) {
-		saveable_type_list = g_strjoinv (", ", saveable_types);
+	if (types != NULL) {
+		saveable_type_list = g_strjoinv (", ", types);
 		rb_debug ("saveable types from metadata helper: %s", saveable_type_list);
 		g_free (saveable_type_list);
 	} else {
 		rb_debug ("unable to save metadata for any file types");
 	}
 
+	g_static_mutex_lock (&conn_mutex);
+	g_strfreev (saveable_types);
+	saveable_types = types;
+	g_static_mutex_unlock (&conn_mutex);
+
 	if (message)
 		dbus_message_unref (message);
 	if (response)
@@ -365,7 +481,7 @@ start_metadata_service (GError **error)
 }
 
 static void
-handle_dbus_error (RBMetaData *md, DBusError *dbus_error, GError **error)
+handle_dbus_error (RBMetaDataHelper *helper, DBusError *dbus_error, GError **error)
 {
 	/*
 	 * If the error is 'no reply within the specified time',
@@ -373,7 +489,7 @@ handle_dbus_error (RBMetaData *md, DBusError *dbus_error, GError **error)
 	 * it's stuck in a loop and needs to be killed.
 	 */
 	if (strcmp (dbus_error->name, DBUS_ERROR_NO_REPLY) == 0) {
-		kill_metadata_service ();
+		kill_metadata_service (helper);
 
 		g_set_error (error,
 			     RB_METADATA_ERROR,
@@ -406,6 +522,79 @@ read_error_from_message (RBMetaData *md, DBusMessageIter *iter, GError **error)
 	g_free (error_message);
 }
 
+/*
+ * Reads the results of a metadata load, as written by the service's
+ * append_load_result.  Returns FALSE if the message couldn't be read;
+ * errors from the load itself are returned in @error.
+ */
+static gboolean
+read_load_result (RBMetaData *md, DBusMessageIter *iter, GError **error)
+{
+	gboolean ok;
+
+	if (!rb_metadata_dbus_get_strv (iter, &md->priv->missing_plugins)) {
+		rb_debug ("couldn't get missing plugin data from response message");
+		return FALSE;
+	}
+
+	if (!rb_metadata_dbus_get_strv (iter, &md->priv->plugin_descriptions)) {
+		rb_debug ("couldn't get missing plugin descriptions from response message");
+		return FALSE;
+	}
+
+	if (!rb_metadata_dbus_get_boolean (iter, &md->priv->has_audio)) {
+		rb_debug ("couldn't get has-audio flag from response message");
+		return FALSE;
+	}
+	rb_debug ("has audio: %d", md->priv->has_audio);
+
+	if (!rb_metadata_dbus_get_boolean (iter, &md->priv->has_video)) {
+		rb_debug ("couldn't get has-video flag from response message");
+		return FALSE;
+	}
+	rb_debug ("has video: %d", md->priv->has_video);
+
+	if (!rb_metadata_dbus_get_boolean (iter, &md->priv->has_other_data)) {
+		rb_debug ("couldn't get has-other-data flag from response message");
+		return FALSE;
+	}
+	rb_debug ("has other data: %d", md->priv->has_other_data);
+
+	if (!rb_metadata_dbus_get_string (iter, &md->priv->mimetype)) {
+		rb_debug ("couldn't get mimetype from response message");
+		return FALSE;
+	}
+	rb_debug ("got mimetype: %s", md->priv->mimetype);
+
+	if (!rb_metadata_dbus_get_boolean (iter, &ok)) {
+		rb_debug ("couldn't get success flag from response message");
+		return FALSE;
+	}
+
+	if (ok == FALSE) {
+		read_error_from_message (md, iter, error);
+	} else {
+		rb_metadata_dbus_read_from_message (md, md->priv->metadata, iter);
+	}
+	return TRUE;
+}
+
+/* if we're missing some plugins, we'll need to make sure the
+ * metadata helpers reread the registry before the next load.
+ * the easiest way to do this is to kill them.
+ */
+static void
+reload_metadata_helpers (RBMetaDataHelper *helper)
+{
+	rb_debug ("missing plugins; killing metadata services to force registry reload");
+	kill_metadata_service (helper);
+
+	g_static_mutex_lock (&conn_mutex);
+	helper_generation++;
+	helper->generation = helper_generation;
+	g_static_mutex_unlock (&conn_mutex);
+}
+
 /**
  * rb_metadata_reset:
  * @md: a #RBMetaData
@@ -440,11 +629,11 @@ rb_metadata_load (RBMetaData *md,
 		  const char *uri,
 		  GError **error)
 {
+	RBMetaDataHelper *helper;
 	DBusMessage *message = NULL;
 	DBusMessage *response = NULL;
 	DBusMessageIter iter;
 	DBusError dbus_error = {0,};
-	gboolean ok;
 	GError *fake_error = NULL;
 	GError *dbus_gerror;
 
@@ -463,9 +652,9 @@ rb_metadata_load (RBMetaData *md,
 
 	rb_metadata_reset (md);
 
-	g_static_mutex_lock (&conn_mutex);
+	helper = acquire_metadata_helper ();
 
-	start_metadata_service (error);
+	start_metadata_service (helper, error);
 
 	if (*error == NULL) {
 		message = dbus_message_new_method_call (RB_METADATA_DBUS_NAME,
@@ -481,103 +670,166 @@ rb_metadata_load (RBMetaData *md,
 
 	if (*error == NULL) {
 		rb_debug ("sending metadata load request");
-		response = dbus_connection_send_with_reply_and_block (dbus_connection,
+		response = dbus_connection_send_with_reply_and_block (helper->connection,
 								      message,
 								      RB_METADATA_DBUS_TIMEOUT,
 								      &dbus_error);
 
 		if (!response)
-			handle_dbus_error (md, &dbus_error, error);
+			handle_dbus_error (helper, &dbus_error, error);
 	}
 
 	if (*error == NULL) {
-		if (!dbus_message_iter_init (response, &iter)) {
+		if (!dbus_message_iter_init (response, &iter) ||
+		    !read_load_result (md, &iter, error)) {
 			g_propagate_error (error, dbus_gerror);
 			rb_debug ("couldn't read response message");
-		}
-	}
-	
-	if (*error == NULL) {
-		if (!rb_metadata_dbus_get_strv (&iter, &md->priv->missing_plugins)) {
-			g_propagate_error (error, dbus_gerror);
-			rb_debug ("couldn't get missing plugin data from response message");
+		} else if (md->priv->missing_plugins != NULL) {
+			reload_metadata_helpers (helper);
 		}
 	}
 
-	if (*error == NULL) {
-		if (!rb_metadata_dbus_get_strv (&iter, &md->priv->plugin_descriptions)) {
-			g_propagate_error (error, dbus_gerror);
-			rb_debug ("couldn't get missing plugin descriptions from response message");
-		}
-	}
+	if (message)
+		dbus_message_unref (message);
+	if (response)
+		dbus_message_unref (response);
+	if (*error != dbus_gerror)
+		g_error_free (dbus_gerror);
+	if (fake_error)
+		g_error_free (fake_error);
 
-	/* if we're missing some plugins, we'll need to make sure the
-	 * metadata helper rereads the registry before the next load.
-	 * the easiest way to do this is to kill it.
-	 */
-	if (*error == NULL && md->priv->missing_plugins != NULL) {
-		rb_debug ("missing plugins; killing metadata service to force registry reload");
-		kill_metadata_service ();
-	}
+	release_metadata_helper (helper);
+}
 
-	if (*error == NULL) {
-		if (!rb_metadata_dbus_get_boolean (&iter, &md->priv->has_audio)) {
-			g_propagate_error (error, dbus_gerror);
-			rb_debug ("couldn't get has-audio flag from response message");
-		} else {
-			rb_debug ("has audio: %d", md->priv->has_audio);
-		}
-	}
+/**
+ * rb_metadata_load_batch:
+ * @uris: NULL-terminated array of URIs from which to load metadata
+ * @func: function to call with the results for each URI
+ * @data: data to pass to @func
+ *
+ * Reads metadata information from each of the specified URIs, using a
+ * single request to the metadata helper.  @func is called once for each
+ * URI, in order, as soon as its metadata has been read.  It is passed a
+ * new #RBMetaData, the index of the URI in @uris, and any error that
+ * occurred while loading it, and takes ownership of the #RBMetaData and
+ * the error.
+ */
+void
+rb_metadata_load_batch (char **uris,
+			RBMetaDataLoadFunc func,
+			gpointer data)
+{
+	RBMetaDataHelper *helper;
+	DBusMessage *message = NULL;
+	DBusMessageIter iter;
+	dbus_uint32_t serial;
+	GError *error = NULL;
+	GTimer *timer;
+	gboolean missing_plugins = FALSE;
+	gboolean done = FALSE;
+	guint count;
+	guint next = 0;
+
+	count = g_strv_length (uris);
+	if (count == 0)
+		return;
 
-	if (*error == NULL) {
-		if (!rb_metadata_dbus_get_boolean (&iter, &md->priv->has_video)) {
-			g_propagate_error (error, dbus_gerror);
-			rb_debug ("couldn't get has-video flag from response message");
-		} else {
-			rb_debug ("has video: %d", md->priv->has_video);
-		}
+	helper = acquire_metadata_helper ();
+
+	if (start_metadata_service (helper, &error)) {
+		message = dbus_message_new_method_call (RB_METADATA_DBUS_NAME,
+							RB_METADATA_DBUS_OBJECT_PATH,
+							RB_METADATA_DBUS_INTERFACE,
+							"loadBatch");
 	}
 
-	if (*error == NULL) {
-		if (!rb_metadata_dbus_get_boolean (&iter, &md->priv->has_other_data)) {
-			g_propagate_error (error, dbus_gerror);
-			rb_debug ("couldn't get has-other-data flag from response message");
-		} else {
-			rb_debug ("has other data: %d", md->priv->has_other_data);
+	if (message != NULL) {
+		dbus_message_iter_init_append (message, &iter);
+		if (!rb_metadata_dbus_add_strv (&iter, uris) ||
+		    !dbus_connection_send (helper->connection, message, &serial)) {
+			rb_debug ("couldn't send metadata batch load request");
+			done = TRUE;
 		}
+		dbus_message_unref (message);
+	} else {
+		done = TRUE;
 	}
 
-	if (*error == NULL) {
-		if (!rb_metadata_dbus_get_string (&iter, &md->priv->mimetype)) {
-			g_propagate_error (error, dbus_gerror);
-		} else {
-			rb_debug ("got mimetype: %s", md->priv->mimetype);
+	/* results arrive as loadResult signals, followed by the method reply */
+	rb_debug ("sent metadata batch load request for %u URIs", count);
+	timer = g_timer_new ();
+	while (done == FALSE) {
+		DBusMessage *response;
+		int remaining;
+
+		response = dbus_connection_pop_message (helper->connection);
+		if (response == NULL) {
+			remaining = RB_METADATA_DBUS_TIMEOUT - (int)(g_timer_elapsed (timer, NULL) * 1000);
+			if (remaining <= 0) {
+				rb_debug ("timed out waiting for metadata batch result %u", next);
+				kill_metadata_service (helper);
+				done = TRUE;
+			} else if (!dbus_connection_read_write (helper->connection, remaining)) {
+				rb_debug ("metadata helper disconnected during batch load");
+				kill_metadata_service (helper);
+				done = TRUE;
+			}
+			continue;
 		}
-	}
 
-	if (*error == NULL) {
-		if (!rb_metadata_dbus_get_boolean (&iter, &ok)) {
-			g_propagate_error (error, dbus_gerror);
-			rb_debug ("couldn't get success flag from response message");
-		} else if (ok == FALSE) {
-			read_error_from_message (md, &iter, error);
+		if (dbus_message_is_signal (response, RB_METADATA_DBUS_INTERFACE, "loadResult")) {
+			RBMetaData *md;
+			GError *load_error = NULL;
+			guint32 index;
+
+			md = rb_metadata_new ();
+			if (!dbus_message_iter_init (response, &iter) ||
+			    !rb_metadata_dbus_get_uint32 (&iter, &index) ||
+			    index != next ||
+			    !read_load_result (md, &iter, &load_error)) {
+				rb_debug ("couldn't read metadata batch result %u", next);
+				g_object_unref (md);
+				g_clear_error (&load_error);
+				kill_metadata_service (helper);
+				done = TRUE;
+			} else {
+				if (md->priv->missing_plugins != NULL)
+					missing_plugins = TRUE;
+
+				func (md, next, load_error, data);
+				next++;
+				g_timer_start (timer);
+			}
+		} else if (dbus_message_get_reply_serial (response) == serial) {
+			rb_debug ("metadata batch load finished after %u results", next);
+			done = TRUE;
 		}
+
+		dbus_message_unref (response);
 	}
+	g_timer_destroy (timer);
 
-	if (*error == NULL) {
-		rb_metadata_dbus_read_from_message (md, md->priv->metadata, &iter);
+	if (missing_plugins) {
+		reload_metadata_helpers (helper);
 	}
 
-	if (message)
-		dbus_message_unref (message);
-	if (response)
-		dbus_message_unref (response);
-	if (*error != dbus_gerror)
-		g_error_free (dbus_gerror);
-	if (fake_error)
-		g_error_free (fake_error);
+	release_metadata_helper (helper);
 
-	g_static_mutex_unlock (&conn_mutex);
+	/* if the batch failed part way through, load the rest one at a time,
+	 * so a file that breaks the helper only fails its own load.
+	 */
+	if (error != NULL) {
+		rb_debug ("couldn't start metadata service for batch load: %s", error->message);
+		g_error_free (error);
+	}
+	for (; next < count; next++) {
+		RBMetaData *md;
+		GError *load_error = NULL;
+
+		md = rb_metadata_new ();
+		rb_metadata_load (md, uris[next], &load_error);
+		func (md, next, load_error, data);
+	}
 }
 
 /**
@@ -711,17 +963,26 @@ rb_metadata_can_save (RBMetaData *md, const char *mimetype)
 {
 	GError *error = NULL;
 	gboolean result = FALSE;
+	gboolean started;
 	int i = 0;
 
 	g_static_mutex_lock (&conn_mutex);
+	started = (saveable_types != NULL);
+	g_static_mutex_unlock (&conn_mutex);
+
+	if (started == FALSE) {
+		RBMetaDataHelper *helper;
 
-	if (saveable_types == NULL) {
-		if (start_metadata_service (&error) == FALSE) {
-			g_error_free (error);
+		helper = acquire_metadata_helper ();
+		started = start_metadata_service (helper, &error);
+		release_metadata_helper (helper);
+		if (started == FALSE) {
+			g_clear_error (&error);
 			return FALSE;
 		}
 	}
 
+	g_static_mutex_lock (&conn_mutex);
 	if (saveable_types != NULL) {
 		for (i = 0; saveable_types[i] != NULL; i++) {
 			if (g_str_equal (mimetype, saveable_types[i])) {
@@ -748,7 +1009,13 @@ rb_metadata_can_save (RBMetaData *md, const char *mimetype)
 char **
 rb_metadata_get_saveable_types (RBMetaData *md)
 {
-	return g_strdupv (saveable_types);
+	char **types;
+
+	g_static_mutex_lock (&conn_mutex);
+	types = g_strdupv (saveable_types);
+	g_static_mutex_unlock (&conn_mutex);
+
+	return types;
 }
 
 /**
@@ -763,6 +1030,7 @@ rb_metadata_get_saveable_types (RBMetaData *md)
 void
 rb_metadata_save (RBMetaData *md, const char *uri, GError **error)
 {
+	RBMetaDataHelper *helper;
 	GError *fake_error = NULL;
 	DBusMessage *message = NULL;
 	DBusMessage *response = NULL;
@@ -772,9 +1040,9 @@ rb_metadata_save (RBMetaData *md, const char *uri, GError **error)
 	if (error == NULL)
 		error = &fake_error;
 
-	g_static_mutex_lock (&conn_mutex);
+	helper = acquire_metadata_helper ();
 
-	start_metadata_service (error);
+	start_metadata_service (helper, error);
 
 	if (*error == NULL) {
 		message = dbus_message_new_method_call (RB_METADATA_DBUS_NAME,
@@ -808,12 +1076,12 @@ rb_metadata_save (RBMetaData *md, const char *uri, GError **error)
 	}
 
 	if (*error == NULL) {
-		response = dbus_connection_send_with_reply_and_block (dbus_connection,
+		response = dbus_connection_send_with_reply_and_block (helper->connection,
 								      message,
 								      RB_METADATA_SAVE_DBUS_TIMEOUT,
 								      &dbus_error);
 		if (!response) {
-			handle_dbus_error (md, &dbus_error, error);
+			handle_dbus_error (helper, &dbus_error, error);
 		} else if (dbus_message_iter_init (response, &iter)) {
 			/* if there's any return data at all, it'll be an error */
 			read_error_from_message (md, &iter, error);
@@ -827,7 +1095,7 @@ rb_metadata_save (RBMetaData *md, const char *uri, GError **error)
 	if (fake_error)
 		g_error_free (fake_error);
 
-	g_static_mutex_unlock (&conn_mutex);
+	release_metadata_helper (helper);
 }
 
 gboolean
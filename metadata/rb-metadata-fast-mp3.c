@@ -0,0 +1,608 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+/*
+ * Fast reader for MP3 files: ID3v2.2-2.4 and ID3v1 tags, with the
+ * duration taken from the Xing/Info or VBRI header if there is one,
+ * or worked out from the bitrate of the first frame otherwise.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <gst/tag/tag.h>
+
+#include "rb-metadata-fast.h"
+#include "rb-debug.h"
+
+/* largest tag frame we'll read; anything bigger is probably a picture */
+#define MAX_FRAME_SIZE		(64 * 1024)
+
+/* how far past the tags to look for the first audio frame */
+#define FRAME_SEARCH_SIZE	(16 * 1024)
+
+typedef struct
+{
+	int version;		/* 1, 2, or 25 for MPEG 2.5 */
+	gboolean mono;
+	guint bitrate;		/* kbps */
+	guint samplerate;
+	guint samples;		/* per frame */
+	guint length;		/* bytes */
+} MP3Frame;
+
+static const guint mpeg1_bitrates[16] = {
+	0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0
+};
+static const guint mpeg2_bitrates[16] = {
+	0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0
+};
+static const guint samplerates[3][3] = {
+	{ 44100, 48000, 32000 },	/* MPEG 1 */
+	{ 22050, 24000, 16000 },	/* MPEG 2 */
+	{ 11025, 12000, 8000 }		/* MPEG 2.5 */
+};
+
+static const char * const mp3_decoders[] = {
+	"mad", "flump3dec", "ffdec_mp3", "mpg123audiodec", NULL
+};
+
+/* parses a layer 3 frame header */
+static gboolean
+parse_frame_header (const guint8 *data, MP3Frame *frame)
+{
+	guint version_bits;
+	guint bitrate_index;
+	guint samplerate_index;
+	int rate_row;
+
+	if (data[0] != 0xff || (data[1] & 0xe0) != 0xe0)
+		return FALSE;
+
+	/* layer 3 only */
+	if ((data[1] & 0x06) != 0x02)
+		return FALSE;
+
+	version_bits = (data[1] >> 3) & 0x03;
+	switch (version_bits) {
+	case 0:
+		frame->version = 25;
+		rate_row = 2;
+		break;
+	case 2:
+		frame->version = 2;
+		rate_row = 1;
+		break;
+	case 3:
+		frame->version = 1;
+		rate_row = 0;
+		break;
+	default:
+		return FALSE;
+	}
+
+	bitrate_index = data[2] >> 4;
+	samplerate_index = (data[2] >> 2) & 0x03;
+	if (bitrate_index == 0 || bitrate_index == 15 || samplerate_index == 3)
+		return FALSE;
+
+	frame->bitrate = (frame->version == 1) ? mpeg1_bitrates[bitrate_index] : mpeg2_bitrates[bitrate_index];
+	frame->samplerate = samplerates[rate_row][samplerate_index];
+	frame->samples = (frame->version == 1) ? 1152 : 576;
+	frame->mono = ((data[3] >> 6) == 0x03);
+	frame->length = (frame->samples / 8) * frame->bitrate * 1000 / frame->samplerate;
+	if (data[2] & 0x02)
+		frame->length++;
+
+	return TRUE;
+}
+
+static guint32
+read_uint32_be (const guint8 *data)
+{
+	return ((guint32)data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+static guint32
+read_syncsafe (const guint8 *data)
+{
+	return ((data[0] & 0x7f) << 21) | ((data[1] & 0x7f) << 14) | ((data[2] & 0x7f) << 7) | (data[3] & 0x7f);
+}
+
+static gboolean
+mp3_identify (const guint8 *header, gsize len)
+{
+	MP3Frame frame;
+
+	if (len >= 3 && memcmp (header, "ID3", 3) == 0)
+		return TRUE;
+
+	return (len >= 4 && parse_frame_header (header, &frame));
+}
+
+/* finds the end of a possibly NUL-terminated string in the given encoding */
+static gsize
+text_length (int encoding, const guint8 *data, gsize len)
+{
+	gsize i;
+
+	if (encoding == 1 || encoding == 2) {
+		for (i = 0; i + 1 < len; i += 2) {
+			if (data[i] == 0 && data[i+1] == 0)
+				return i;
+		}
+		return len & ~1;
+	}
+
+	for (i = 0; i < len; i++) {
+		if (data[i] == 0)
+			return i;
+	}
+	return len;
+}
+
+/* decodes an ID3v2 string to UTF-8, returning the number of bytes used in *used */
+static char *
+decode_text (int encoding, const guint8 *data, gsize len, gsize *used)
+{
+	const char *charset;
+	gsize n;
+
+	n = text_length (encoding, data, len);
+	if (used != NULL)
+		*used = MIN (len, n + ((encoding == 1 || encoding == 2) ? 2 : 1));
+
+	switch (encoding) {
+	case 0:
+		charset = "ISO-8859-1";
+		break;
+	case 1:
+		charset = "UTF-16LE";
+		if (n >= 2 && data[0] == 0xfe && data[1] == 0xff) {
+			charset = "UTF-16BE";
+			data += 2;
+			n -= 2;
+		} else if (n >= 2 && data[0] == 0xff && data[1] == 0xfe) {
+			data += 2;
+			n -= 2;
+		}
+		break;
+	case 2:
+		charset = "UTF-16BE";
+		break;
+	case 3:
+		return g_strndup ((const char *)data, n);
+	default:
+		return NULL;
+	}
+
+	return g_convert ((const char *)data, n, "UTF-8", charset, NULL, NULL, NULL);
+}
+
+static void
+set_genre (GHashTable *metadata, const char *value)
+{
+	const char *genre = NULL;
+	char *end;
+	gulong n;
+
+	/* ID3v1 genre references look like "(17)" or just "17" */
+	if (value[0] == '(') {
+		n = strtoul (value + 1, &end, 10);
+		if (end != value + 1 && *end == ')') {
+			genre = gst_tag_id3_genre_get (n);
+			if (end[1] != '\0')
+				genre = end + 1;
+		}
+	} else if (g_ascii_isdigit (value[0])) {
+		n = strtoul (value, &end, 10);
+		if (*end == '\0')
+			genre = gst_tag_id3_genre_get (n);
+	}
+
+	rb_metadata_fast_set_string (metadata, RB_METADATA_FIELD_GENRE, genre ? genre : value);
+}
+
+static void
+handle_text_frame (GHashTable *metadata, const char *id, const char *value)
+{
+	static const struct {
+		const char *id;
+		const char *v22_id;
+		RBMetaDataField field;
+	} string_frames[] = {
+		{ "TIT2", "TT2", RB_METADATA_FIELD_TITLE },
+		{ "TPE1", "TP1", RB_METADATA_FIELD_ARTIST },
+		{ "TALB", "TAL", RB_METADATA_FIELD_ALBUM },
+		{ "TCOP", "TCR", RB_METADATA_FIELD_COPYRIGHT },
+		{ "TSRC", "TRC", RB_METADATA_FIELD_ISRC },
+		{ "TSOP", "TSP", RB_METADATA_FIELD_ARTIST_SORTNAME },
+		{ "TSOA", "TSA", RB_METADATA_FIELD_ALBUM_SORTNAME },
+	};
+	int i;
+
+	for (i = 0; i < G_N_ELEMENTS (string_frames); i++) {
+		if (strcmp (id, string_frames[i].id) == 0 ||
+		    strcmp (id, string_frames[i].v22_id) == 0) {
+			rb_metadata_fast_set_string (metadata, string_frames[i].field, value);
+			return;
+		}
+	}
+
+	if (strcmp (id, "TCON") == 0 || strcmp (id, "TCO") == 0) {
+		set_genre (metadata, value);
+	} else if (strcmp (id, "TRCK") == 0 || strcmp (id, "TRK") == 0) {
+		rb_metadata_fast_set_number_pair (metadata,
+						  RB_METADATA_FIELD_TRACK_NUMBER,
+						  RB_METADATA_FIELD_MAX_TRACK_NUMBER,
+						  value);
+	} else if (strcmp (id, "TPOS") == 0 || strcmp (id, "TPA") == 0) {
+		rb_metadata_fast_set_number_pair (metadata,
+						  RB_METADATA_FIELD_DISC_NUMBER,
+						  RB_METADATA_FIELD_MAX_DISC_NUMBER,
+						  value);
+	} else if (strcmp (id, "TDRC") == 0 || strcmp (id, "TYER") == 0 || strcmp (id, "TYE") == 0) {
+		rb_metadata_fast_set_date (metadata, value);
+	}
+}
+
+static void
+handle_user_text_frame (GHashTable *metadata, const char *description, const char *value)
+{
+	if (g_ascii_strcasecmp (description, "MusicBrainz Artist Id") == 0) {
+		rb_metadata_fast_set_string (metadata, RB_METADATA_FIELD_MUSICBRAINZ_ARTISTID, value);
+	} else if (g_ascii_strcasecmp (description, "MusicBrainz Album Id") == 0) {
+		rb_metadata_fast_set_string (metadata, RB_METADATA_FIELD_MUSICBRAINZ_ALBUMID, value);
+	} else if (g_ascii_strcasecmp (description, "MusicBrainz Album Artist Id") == 0) {
+		rb_metadata_fast_set_string (metadata, RB_METADATA_FIELD_MUSICBRAINZ_ALBUMARTISTID, value);
+	} else if (g_ascii_strcasecmp (description, "replaygain_track_gain") == 0) {
+		rb_metadata_fast_set_gain (metadata, RB_METADATA_FIELD_TRACK_GAIN, value);
+	} else if (g_ascii_strcasecmp (description, "replaygain_track_peak") == 0) {
+		rb_metadata_fast_set_gain (metadata, RB_METADATA_FIELD_TRACK_PEAK, value);
+	} else if (g_ascii_strcasecmp (description, "replaygain_album_gain") == 0) {
+		rb_metadata_fast_set_gain (metadata, RB_METADATA_FIELD_ALBUM_GAIN, value);
+	} else if (g_ascii_strcasecmp (description, "replaygain_album_peak") == 0) {
+		rb_metadata_fast_set_gain (metadata, RB_METADATA_FIELD_ALBUM_PEAK, value);
+	}
+}
+
+static void
+handle_frame (GHashTable *metadata, const char *id, const guint8 *data, gsize len)
+{
+	char *first;
+	char *second;
+	gsize used;
+
+	if (len < 1)
+		return;
+
+	if (strcmp (id, "UFID") == 0 || strcmp (id, "UFI") == 0) {
+		/* owner, then binary identifier */
+		used = text_length (0, data, len);
+		if (used < len &&
+		    used == strlen ("http://musicbrainz.org") &&
+		    strncmp ((const char *)data, "http://musicbrainz.org", used) == 0) {
+			second = g_strndup ((const char *)data + used + 1, len - used - 1);
+			rb_metadata_fast_set_string (metadata, RB_METADATA_FIELD_MUSICBRAINZ_TRACKID, second);
+			g_free (second);
+		}
+	} else if (strcmp (id, "TXXX") == 0 || strcmp (id, "TXX") == 0) {
+		/* encoding, description, value */
+		first = decode_text (data[0], data + 1, len - 1, &used);
+		second = decode_text (data[0], data + 1 + used, len - 1 - used, NULL);
+		if (first != NULL && second != NULL)
+			handle_user_text_frame (metadata, first, second);
+		g_free (first);
+		g_free (second);
+	} else if (strcmp (id, "COMM") == 0 || strcmp (id, "COM") == 0) {
+		/* encoding, language, description, text; only use comments without a description */
+		if (len < 4)
+			return;
+		first = decode_text (data[0], data + 4, len - 4, &used);
+		if (first != NULL && first[0] == '\0') {
+			second = decode_text (data[0], data + 4 + used, len - 4 - used, NULL);
+			if (second != NULL)
+				rb_metadata_fast_set_string (metadata, RB_METADATA_FIELD_COMMENT, second);
+			g_free (second);
+		}
+		g_free (first);
+	} else if (id[0] == 'T') {
+		first = decode_text (data[0], data + 1, len - 1, NULL);
+		if (first != NULL)
+			handle_text_frame (metadata, id, first);
+		g_free (first);
+	}
+}
+
+static gboolean
+wanted_frame (const char *id)
+{
+	/* text frames, user text, comments and unique file ids */
+	return (id[0] == 'T' || strncmp (id, "COM", 3) == 0 || strncmp (id, "UFI", 3) == 0);
+}
+
+/* reads an ID3v2 tag at the start of the file; returns the size of the tag in *tag_size */
+static gboolean
+read_id3v2 (RBMetaDataFastFile *file, GHashTable *metadata, goffset *tag_size)
+{
+	guint8 header[10];
+	guint8 frame_header[10];
+	int major;
+	guint32 size;
+	goffset pos;
+	goffset end;
+
+	if (!rb_metadata_fast_read (file, 0, header, sizeof (header)))
+		return FALSE;
+
+	major = header[3];
+	size = read_syncsafe (header + 6);
+	*tag_size = 10 + size + ((header[5] & 0x10) ? 10 : 0);
+	end = 10 + size;
+
+	if (major < 2 || major > 4) {
+		rb_debug ("unsupported ID3v2 version 2.%d", major);
+		return FALSE;
+	}
+
+	/* unsynchronisation changes the frame data; leave it to the pipeline */
+	if (header[5] & 0x80) {
+		rb_debug ("ID3v2 tag is unsynchronised");
+		return FALSE;
+	}
+
+	pos = 10;
+	if (major > 2 && (header[5] & 0x40)) {
+		guint8 ext[4];
+
+		if (!rb_metadata_fast_read (file, pos, ext, sizeof (ext)))
+			return FALSE;
+		pos += (major == 4) ? read_syncsafe (ext) : read_uint32_be (ext) + 4;
+	}
+
+	while (pos < end) {
+		char id[5] = {0,};
+		guint32 frame_size;
+		gsize header_size = (major == 2) ? 6 : 10;
+		gboolean skip = FALSE;
+
+		if (pos + header_size > end ||
+		    !rb_metadata_fast_read (file, pos, frame_header, header_size))
+			break;
+
+		/* padding */
+		if (frame_header[0] == 0)
+			break;
+
+		if (major == 2) {
+			memcpy (id, frame_header, 3);
+			frame_size = (frame_header[3] << 16) | (frame_header[4] << 8) | frame_header[5];
+		} else {
+			memcpy (id, frame_header, 4);
+			frame_size = (major == 4) ? read_syncsafe (frame_header + 4) : read_uint32_be (frame_header + 4);
+
+			/* compressed, encrypted, grouped or unsynchronised frames */
+			if (major == 3)
+				skip = (frame_header[9] & 0xe0) != 0;
+			else
+				skip = (frame_header[9] & 0x4f) != 0;
+		}
+		pos += header_size;
+
+		if (pos + frame_size > end)
+			return FALSE;
+
+		if (!skip && frame_size <= MAX_FRAME_SIZE && wanted_frame (id)) {
+			guint8 *data;
+
+			data = g_malloc (frame_size);
+			if (!rb_metadata_fast_read (file, pos, data, frame_size)) {
+				g_free (data);
+				return FALSE;
+			}
+			handle_frame (metadata, id, data, frame_size);
+			g_free (data);
+		}
+
+		pos += frame_size;
+	}
+
+	return TRUE;
+}
+
+static char *
+id3v1_string (const guint8 *data, gsize len)
+{
+	return g_convert ((const char *)data, text_length (0, data, len), "UTF-8", "ISO-8859-1", NULL, NULL, NULL);
+}
+
+/* reads an ID3v1 tag at the end of the file, for any fields not set by ID3v2 */
+static gboolean
+read_id3v1 (RBMetaDataFastFile *file, GHashTable *metadata)
+{
+	guint8 tag[128];
+	char *str;
+
+	if (file->size < 128 ||
+	    !rb_metadata_fast_read (file, file->size - 128, tag, sizeof (tag)) ||
+	    memcmp (tag, "TAG", 3) != 0)
+		return FALSE;
+
+	str = id3v1_string (tag + 3, 30);
+	rb_metadata_fast_set_string (metadata, RB_METADATA_FIELD_TITLE, str);
+	g_free (str);
+
+	str = id3v1_string (tag + 33, 30);
+	rb_metadata_fast_set_string (metadata, RB_METADATA_FIELD_ARTIST, str);
+	g_free (str);
+
+	str = id3v1_string (tag + 63, 30);
+	rb_metadata_fast_set_string (metadata, RB_METADATA_FIELD_ALBUM, str);
+	g_free (str);
+
+	str = g_strndup ((const char *)tag + 93, 4);
+	rb_metadata_fast_set_date (metadata, str);
+	g_free (str);
+
+	/* ID3v1.1 puts the track number at the end of the comment */
+	if (tag[125] == 0 && tag[126] != 0) {
+		rb_metadata_fast_set_ulong (metadata, RB_METADATA_FIELD_TRACK_NUMBER, tag[126]);
+		str = id3v1_string (tag + 97, 28);
+	} else {
+		str = id3v1_string (tag + 97, 30);
+	}
+	rb_metadata_fast_set_string (metadata, RB_METADATA_FIELD_COMMENT, str);
+	g_free (str);
+
+	if (gst_tag_id3_genre_get (tag[127]) != NULL)
+		rb_metadata_fast_set_string (metadata, RB_METADATA_FIELD_GENRE, gst_tag_id3_genre_get (tag[127]));
+
+	return TRUE;
+}
+
+/* finds the first of two consecutive frame headers */
+static gboolean
+find_first_frame (RBMetaDataFastFile *file, goffset start, goffset *offset, MP3Frame *frame)
+{
+	guint8 *buf;
+	gsize len;
+	gsize i;
+	gboolean found = FALSE;
+
+	if (start + 4 > file->size)
+		return FALSE;
+	len = MIN (FRAME_SEARCH_SIZE, file->size - start);
+
+	buf = g_malloc (len);
+	if (!rb_metadata_fast_read (file, start, buf, len)) {
+		g_free (buf);
+		return FALSE;
+	}
+
+	for (i = 0; i + 4 <= len && !found; i++) {
+		MP3Frame next;
+		guint8 next_header[4];
+		gsize next_pos;
+
+		if (!parse_frame_header (buf + i, frame))
+			continue;
+
+		next_pos = i + frame->length;
+		if (next_pos + 4 <= len) {
+			memcpy (next_header, buf + next_pos, 4);
+		} else if (!rb_metadata_fast_read (file, start + next_pos, next_header, 4)) {
+			/* a file with only one frame */
+			found = (start + next_pos == file->size);
+			if (found)
+				*offset = start + i;
+			continue;
+		}
+
+		found = parse_frame_header (next_header, &next) &&
+			next.version == frame->version &&
+			next.samplerate == frame->samplerate;
+		if (found)
+			*offset = start + i;
+	}
+
+	g_free (buf);
+	return found;
+}
+
+static gboolean
+mp3_read (RBMetaDataFastFile *file, GHashTable *metadata, char **mimetype)
+{
+	goffset tag_size = 0;
+	goffset audio_start;
+	goffset audio_end;
+	gboolean have_id3v2 = FALSE;
+	MP3Frame frame;
+	guint8 header[4 + 32 + 24];
+	gsize side_info;
+	guint64 frames = 0;
+	gulong duration;
+	gulong bitrate;
+
+	if (file->size >= 10) {
+		guint8 magic[3];
+		if (rb_metadata_fast_read (file, 0, magic, 3) && memcmp (magic, "ID3", 3) == 0) {
+			if (!read_id3v2 (file, metadata, &tag_size))
+				return FALSE;
+			have_id3v2 = TRUE;
+		}
+	}
+
+	audio_end = file->size;
+	if (read_id3v1 (file, metadata))
+		audio_end -= 128;
+
+	if (!find_first_frame (file, tag_size, &audio_start, &frame)) {
+		rb_debug ("couldn't find the first MPEG audio frame");
+		return FALSE;
+	}
+
+	/* look for a Xing/Info or VBRI header in the first frame */
+	memset (header, 0, sizeof (header));
+	rb_metadata_fast_read (file, audio_start, header, MIN (sizeof (header), (gsize)(audio_end - audio_start)));
+	if (frame.version == 1)
+		side_info = frame.mono ? 17 : 32;
+	else
+		side_info = frame.mono ? 9 : 17;
+
+	if (memcmp (header + 4 + side_info, "Xing", 4) == 0 ||
+	    memcmp (header + 4 + side_info, "Info", 4) == 0) {
+		const guint8 *xing = header + 4 + side_info;
+		if (read_uint32_be (xing + 4) & 0x01)
+			frames = read_uint32_be (xing + 8);
+		audio_start += frame.length;
+	} else if (memcmp (header + 4 + 32, "VBRI", 4) == 0) {
+		frames = read_uint32_be (header + 4 + 32 + 14);
+		audio_start += frame.length;
+	}
+
+	if (frames > 0) {
+		duration = (frames * frame.samples) / frame.samplerate;
+		bitrate = (duration > 0) ? ((audio_end - audio_start) * 8 / duration) / 1000 : frame.bitrate;
+	} else {
+		/* assume constant bitrate */
+		duration = ((audio_end - audio_start) * 8) / (frame.bitrate * 1000);
+		bitrate = frame.bitrate;
+	}
+
+	rb_metadata_fast_set_ulong (metadata, RB_METADATA_FIELD_DURATION, duration);
+	rb_metadata_fast_set_ulong (metadata, RB_METADATA_FIELD_BITRATE, bitrate);
+
+	*mimetype = g_strdup (have_id3v2 ? "application/x-id3" : "audio/mpeg");
+	return TRUE;
+}
+
+const RBMetaDataFastReader rb_metadata_fast_mp3_reader = {
+	"mp3",
+	mp3_decoders,
+	mp3_identify,
+	mp3_read
+};
@@ -0,0 +1,327 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+/*
+ * Fast readers for Ogg Vorbis and native FLAC files.  Both store tags
+ * as vorbis comments near the start of the file.  FLAC files give the
+ * total number of samples in the stream info block; for Ogg Vorbis the
+ * duration comes from the granule position of the last page.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "rb-metadata-fast.h"
+#include "rb-debug.h"
+
+/* largest comment block we'll read; bigger ones usually hold pictures */
+#define MAX_COMMENT_SIZE	(1024 * 1024)
+
+/* how far from the end of an Ogg file to look for the last page */
+#define OGG_TAIL_SIZE		(64 * 1024)
+
+#define OGG_PAGE_HEADER_SIZE	27
+
+static const char * const vorbis_decoders[] = {
+	"vorbisdec", "ivorbisdec", NULL
+};
+
+static const char * const flac_decoders[] = {
+	"flacdec", "ffdec_flac", NULL
+};
+
+static guint32
+read_uint32_le (const guint8 *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((guint32)data[3] << 24);
+}
+
+static guint64
+read_uint64_le (const guint8 *data)
+{
+	return read_uint32_le (data) | ((guint64)read_uint32_le (data + 4) << 32);
+}
+
+/* Ogg Vorbis */
+
+static gboolean
+vorbis_identify (const guint8 *header, gsize len)
+{
+	/* the first page holds just the identification header */
+	return (len >= 35 &&
+		memcmp (header, "OggS", 4) == 0 &&
+		header[26] == 1 &&
+		memcmp (header + 28, "\001vorbis", 7) == 0);
+}
+
+/* reads the segment table of the page at *pos, leaving *pos at the start of the page data */
+static gboolean
+read_ogg_page (RBMetaDataFastFile *file, goffset *pos, guint32 serial, guint8 *segments, int *nsegments)
+{
+	guint8 header[OGG_PAGE_HEADER_SIZE];
+
+	if (!rb_metadata_fast_read (file, *pos, header, sizeof (header)) ||
+	    memcmp (header, "OggS", 4) != 0)
+		return FALSE;
+
+	/* other logical streams; leave those to the pipeline */
+	if (read_uint32_le (header + 14) != serial)
+		return FALSE;
+
+	*nsegments = header[26];
+	if (!rb_metadata_fast_read (file, *pos + OGG_PAGE_HEADER_SIZE, segments, *nsegments))
+		return FALSE;
+
+	*pos += OGG_PAGE_HEADER_SIZE + *nsegments;
+	return TRUE;
+}
+
+/* reads the packet starting at the beginning of the page at pos */
+static guint8 *
+read_ogg_packet (RBMetaDataFastFile *file, goffset pos, guint32 serial, gsize *len)
+{
+	GByteArray *packet;
+	guint8 segments[255];
+	int nsegments;
+	gboolean done = FALSE;
+
+	packet = g_byte_array_new ();
+	while (!done) {
+		gsize page_len = 0;
+		int i;
+
+		if (!read_ogg_page (file, &pos, serial, segments, &nsegments)) {
+			g_byte_array_free (packet, TRUE);
+			return NULL;
+		}
+
+		for (i = 0; i < nsegments && !done; i++) {
+			page_len += segments[i];
+			done = (segments[i] < 255);
+		}
+
+		if (packet->len + page_len > MAX_COMMENT_SIZE) {
+			rb_debug ("vorbis comment packet is too big");
+			g_byte_array_free (packet, TRUE);
+			return NULL;
+		}
+
+		g_byte_array_set_size (packet, packet->len + page_len);
+		if (!rb_metadata_fast_read (file, pos, packet->data + packet->len - page_len, page_len)) {
+			g_byte_array_free (packet, TRUE);
+			return NULL;
+		}
+
+		/* skip to the next page */
+		for (i = 0; i < nsegments; i++)
+			pos += segments[i];
+	}
+
+	*len = packet->len;
+	return g_byte_array_free (packet, FALSE);
+}
+
+/* finds the granule position of the last page of the stream */
+static gboolean
+find_last_granule (RBMetaDataFastFile *file, guint32 serial, guint64 *granule)
+{
+	guint8 *buf;
+	gsize len;
+	goffset start;
+	gssize i;
+	gboolean found = FALSE;
+
+	len = MIN (OGG_TAIL_SIZE, file->size);
+	start = file->size - len;
+	buf = g_malloc (len);
+	if (!rb_metadata_fast_read (file, start, buf, len)) {
+		g_free (buf);
+		return FALSE;
+	}
+
+	for (i = (gssize) len - OGG_PAGE_HEADER_SIZE; i >= 0 && !found; i--) {
+		if (memcmp (buf + i, "OggS", 4) != 0 ||
+		    read_uint32_le (buf + i + 14) != serial)
+			continue;
+
+		*granule = read_uint64_le (buf + i + 6);
+		found = (*granule != G_MAXUINT64);
+	}
+
+	g_free (buf);
+	return found;
+}
+
+static gboolean
+vorbis_read (RBMetaDataFastFile *file, GHashTable *metadata, char **mimetype)
+{
+	guint8 ident[28 + 30];
+	guint8 *comments;
+	gsize comments_len;
+	guint32 serial;
+	guint32 rate;
+	gint32 nominal_bitrate;
+	guint64 granule;
+	gulong duration;
+
+	if (!rb_metadata_fast_read (file, 0, ident, sizeof (ident)))
+		return FALSE;
+
+	serial = read_uint32_le (ident + 14);
+	rate = read_uint32_le (ident + 28 + 12);
+	nominal_bitrate = (gint32) read_uint32_le (ident + 28 + 20);
+	if (rate == 0)
+		return FALSE;
+
+	/* the comment header starts on the second page */
+	comments = read_ogg_packet (file, 28 + ident[27], serial, &comments_len);
+	if (comments == NULL)
+		return FALSE;
+
+	if (comments_len < 7 ||
+	    memcmp (comments, "\003vorbis", 7) != 0 ||
+	    !rb_metadata_fast_read_vorbis_comments (comments + 7, comments_len - 7, metadata)) {
+		rb_debug ("couldn't read vorbis comment header");
+		g_free (comments);
+		return FALSE;
+	}
+	g_free (comments);
+
+	if (!find_last_granule (file, serial, &granule)) {
+		rb_debug ("couldn't find the end of the vorbis stream");
+		return FALSE;
+	}
+
+	duration = granule / rate;
+	rb_metadata_fast_set_ulong (metadata, RB_METADATA_FIELD_DURATION, duration);
+	if (nominal_bitrate > 0) {
+		rb_metadata_fast_set_ulong (metadata, RB_METADATA_FIELD_BITRATE, nominal_bitrate / 1000);
+	} else if (duration > 0) {
+		rb_metadata_fast_set_ulong (metadata, RB_METADATA_FIELD_BITRATE, (file->size * 8 / duration) / 1000);
+	}
+
+	*mimetype = g_strdup ("application/ogg");
+	return TRUE;
+}
+
+const RBMetaDataFastReader rb_metadata_fast_vorbis_reader = {
+	"vorbis",
+	vorbis_decoders,
+	vorbis_identify,
+	vorbis_read
+};
+
+/* FLAC */
+
+#define FLAC_BLOCK_STREAMINFO		0
+#define FLAC_BLOCK_VORBIS_COMMENT	4
+
+static gboolean
+flac_identify (const guint8 *header, gsize len)
+{
+	return (len >= 4 && memcmp (header, "fLaC", 4) == 0);
+}
+
+static gboolean
+flac_read (RBMetaDataFastFile *file, GHashTable *metadata, char **mimetype)
+{
+	guint8 block_header[4];
+	guint8 streaminfo[34];
+	gboolean have_streaminfo = FALSE;
+	gboolean last = FALSE;
+	goffset pos = 4;
+	guint32 rate = 0;
+	guint64 samples = 0;
+	gulong duration;
+
+	while (!last) {
+		guint32 block_len;
+		int type;
+
+		if (!rb_metadata_fast_read (file, pos, block_header, sizeof (block_header)))
+			return FALSE;
+
+		last = (block_header[0] & 0x80) != 0;
+		type = block_header[0] & 0x7f;
+		block_len = (block_header[1] << 16) | (block_header[2] << 8) | block_header[3];
+		pos += sizeof (block_header);
+
+		if (pos + block_len > file->size) {
+			rb_debug ("FLAC metadata block extends past the end of the file");
+			return FALSE;
+		}
+
+		if (type == FLAC_BLOCK_STREAMINFO) {
+			if (block_len < sizeof (streaminfo) ||
+			    !rb_metadata_fast_read (file, pos, streaminfo, sizeof (streaminfo)))
+				return FALSE;
+
+			rate = (streaminfo[10] << 12) | (streaminfo[11] << 4) | (streaminfo[12] >> 4);
+			samples = ((guint64)(streaminfo[13] & 0x0f) << 32) |
+				((guint32)streaminfo[14] << 24) |
+				(streaminfo[15] << 16) |
+				(streaminfo[16] << 8) |
+				streaminfo[17];
+			have_streaminfo = TRUE;
+		} else if (type == FLAC_BLOCK_VORBIS_COMMENT && block_len <= MAX_COMMENT_SIZE) {
+			guint8 *comments;
+			gboolean ok;
+
+			comments = g_malloc (block_len);
+			ok = rb_metadata_fast_read (file, pos, comments, block_len) &&
+			     rb_metadata_fast_read_vorbis_comments (comments, block_len, metadata);
+			g_free (comments);
+			if (!ok) {
+				rb_debug ("couldn't read FLAC vorbis comment block");
+				return FALSE;
+			}
+		} else if (type == 127) {
+			/* invalid */
+			return FALSE;
+		}
+
+		pos += block_len;
+	}
+
+	/* the total can be left out, in which case we'd need to decode the whole stream */
+	if (!have_streaminfo || rate == 0 || samples == 0)
+		return FALSE;
+
+	duration = samples / rate;
+	rb_metadata_fast_set_ulong (metadata, RB_METADATA_FIELD_DURATION, duration);
+	if (duration > 0 && file->size > pos)
+		rb_metadata_fast_set_ulong (metadata, RB_METADATA_FIELD_BITRATE, ((file->size - pos) * 8 / duration) / 1000);
+
+	*mimetype = g_strdup ("audio/x-flac");
+	return TRUE;
+}
+
+const RBMetaDataFastReader rb_metadata_fast_flac_reader = {
+	"flac",
+	flac_decoders,
+	flac_identify,
+	flac_read
+};
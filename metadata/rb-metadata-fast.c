@@ -0,0 +1,551 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+/*
+ * Reading tags through a GStreamer pipeline means typefinding, plugging
+ * a demuxer and decoder, and prerolling, which costs a lot more than
+ * the few kilobytes of I/O needed to read the tags of most files.  For
+ * formats where the tags and enough information to work out the duration
+ * are at known places in the file, we read them directly instead.
+ *
+ * Each reader checks the first few bytes of the file to see if it
+ * recognises it.  If a reader can't handle something in the file, it
+ * gives up and the file is loaded through the pipeline as usual, so
+ * readers only need to handle the common cases.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <gst/gst.h>
+
+#include "rb-metadata-fast.h"
+#include "rb-debug.h"
+#include "rb-util.h"
+
+typedef struct
+{
+	const RBMetaDataFastReader *reader;
+	gboolean usable;
+} RBMetaDataFastReaderInfo;
+
+G_LOCK_DEFINE_STATIC (readers);
+static GSList *readers = NULL;
+static gboolean readers_initialized = FALSE;
+static gboolean fast_path_enabled = TRUE;
+
+static gboolean
+decoder_available (const RBMetaDataFastReader *reader)
+{
+	int i;
+
+	for (i = 0; reader->decoders[i] != NULL; i++) {
+		GstPluginFeature *feature;
+
+		feature = gst_default_registry_find_feature (reader->decoders[i], GST_TYPE_ELEMENT_FACTORY);
+		if (feature != NULL) {
+			gst_object_unref (feature);
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/* must be called with the readers lock held */
+static void
+add_reader_internal (const RBMetaDataFastReader *reader)
+{
+	RBMetaDataFastReaderInfo *info;
+
+	info = g_new0 (RBMetaDataFastReaderInfo, 1);
+	info->reader = reader;
+	info->usable = decoder_available (reader);
+	rb_debug ("%s reader %s", reader->name, info->usable ? "enabled" : "disabled; no decoder available");
+
+	/* existing list nodes are never modified, so the list can be walked without the lock */
+	readers = g_slist_prepend (readers, info);
+}
+
+static GSList *
+get_readers (void)
+{
+	GSList *list;
+
+	G_LOCK (readers);
+	if (readers_initialized == FALSE) {
+		add_reader_internal (&rb_metadata_fast_flac_reader);
+		add_reader_internal (&rb_metadata_fast_vorbis_reader);
+		add_reader_internal (&rb_metadata_fast_mp3_reader);
+		readers_initialized = TRUE;
+	}
+	list = readers;
+	G_UNLOCK (readers);
+
+	return list;
+}
+
+/**
+ * rb_metadata_fast_add_reader:
+ * @reader: the reader to add
+ *
+ * Adds a reader to try before loading metadata through a GStreamer
+ * pipeline.  Readers added later are tried first.
+ */
+void
+rb_metadata_fast_add_reader (const RBMetaDataFastReader *reader)
+{
+	get_readers ();
+
+	G_LOCK (readers);
+	add_reader_internal (reader);
+	G_UNLOCK (readers);
+}
+
+/**
+ * rb_metadata_fast_set_enabled:
+ * @enabled: whether to use the fast readers
+ *
+ * Enables or disables the fast readers, so all metadata is read
+ * through a GStreamer pipeline.
+ */
+void
+rb_metadata_fast_set_enabled (gboolean enabled)
+{
+	fast_path_enabled = enabled;
+}
+
+/**
+ * rb_metadata_fast_load:
+ * @uri: URI to load metadata from
+ * @metadata: hash table to add metadata fields to
+ * @mimetype: returns the media type of the file
+ *
+ * Tries to read metadata from @uri using one of the fast readers.
+ * Only local files are handled.
+ *
+ * Return value: %TRUE if the metadata was read, %FALSE if the file
+ * should be loaded through a pipeline instead.  Nothing is added to
+ * @metadata in that case.
+ */
+gboolean
+rb_metadata_fast_load (const char *uri,
+		       GHashTable *metadata,
+		       char **mimetype)
+{
+	RBMetaDataFastFile file;
+	GFile *gfile;
+	GFileInfo *info;
+	GFileInputStream *stream;
+	guint8 header[RB_METADATA_FAST_HEADER_SIZE];
+	gsize header_len = 0;
+	gboolean result = FALSE;
+	GSList *l;
+
+	if (fast_path_enabled == FALSE)
+		return FALSE;
+
+	gfile = g_file_new_for_uri (uri);
+	if (g_file_is_native (gfile) == FALSE) {
+		g_object_unref (gfile);
+		return FALSE;
+	}
+
+	stream = g_file_read (gfile, NULL, NULL);
+	g_object_unref (gfile);
+	if (stream == NULL)
+		return FALSE;
+
+	info = g_file_input_stream_query_info (stream, G_FILE_ATTRIBUTE_STANDARD_SIZE, NULL, NULL);
+	if (info == NULL) {
+		g_object_unref (stream);
+		return FALSE;
+	}
+
+	file.stream = G_INPUT_STREAM (stream);
+	file.size = g_file_info_get_size (info);
+	g_object_unref (info);
+
+	g_input_stream_read_all (file.stream, header, sizeof (header), &header_len, NULL, NULL);
+
+	for (l = get_readers (); l != NULL; l = l->next) {
+		RBMetaDataFastReaderInfo *reader_info = l->data;
+		const RBMetaDataFastReader *reader = reader_info->reader;
+
+		if (reader_info->usable == FALSE ||
+		    reader->identify (header, header_len) == FALSE)
+			continue;
+
+		rb_debug ("reading metadata from %s using %s reader", uri, reader->name);
+		result = reader->read (&file, metadata, mimetype);
+		if (result == FALSE) {
+			rb_debug ("%s reader couldn't handle %s", reader->name, uri);
+			g_hash_table_remove_all (metadata);
+			g_free (*mimetype);
+			*mimetype = NULL;
+		}
+		break;
+	}
+
+	g_object_unref (stream);
+	return result;
+}
+
+/**
+ * rb_metadata_fast_read:
+ * @file: the file to read from
+ * @offset: offset in the file to start reading from
+ * @buffer: buffer to read into
+ * @len: number of bytes to read
+ *
+ * Return value: %TRUE if @len bytes were read
+ */
+gboolean
+rb_metadata_fast_read (RBMetaDataFastFile *file,
+		       goffset offset,
+		       gpointer buffer,
+		       gsize len)
+{
+	gsize nread = 0;
+
+	if (offset < 0 || offset + (goffset) len > file->size)
+		return FALSE;
+
+	if (!g_seekable_seek (G_SEEKABLE (file->stream), offset, G_SEEK_SET, NULL, NULL))
+		return FALSE;
+
+	if (!g_input_stream_read_all (file->stream, buffer, len, &nread, NULL, NULL))
+		return FALSE;
+
+	return (nread == len);
+}
+
+static void
+set_value (GHashTable *metadata, RBMetaDataField field, GValue *value)
+{
+	g_hash_table_insert (metadata, GINT_TO_POINTER (field), value);
+}
+
+/**
+ * rb_metadata_fast_set_string:
+ * @metadata: metadata hash table
+ * @field: field to set
+ * @value: UTF-8 string value
+ *
+ * Sets a string field, if it isn't already set.  As with tags read
+ * through the pipeline, invalid UTF-8 is ignored and leading and
+ * trailing whitespace is removed.
+ */
+void
+rb_metadata_fast_set_string (GHashTable *metadata,
+			     RBMetaDataField field,
+			     const char *value)
+{
+	GValue *newval;
+	char *str;
+
+	if (value == NULL ||
+	    g_hash_table_lookup (metadata, GINT_TO_POINTER (field)) != NULL)
+		return;
+
+	if (!g_utf8_validate (value, -1, NULL)) {
+		rb_debug ("Got invalid UTF-8 tag data");
+		return;
+	}
+
+	str = g_strstrip (g_strdup (value));
+	if (str[0] == '\0') {
+		g_free (str);
+		return;
+	}
+
+	newval = g_slice_new0 (GValue);
+	g_value_init (newval, G_TYPE_STRING);
+	g_value_take_string (newval, str);
+	set_value (metadata, field, newval);
+}
+
+/**
+ * rb_metadata_fast_set_ulong:
+ * @metadata: metadata hash table
+ * @field: field to set
+ * @value: value to set
+ *
+ * Sets an integer field, if it isn't already set.
+ */
+void
+rb_metadata_fast_set_ulong (GHashTable *metadata,
+			    RBMetaDataField field,
+			    gulong value)
+{
+	GValue *newval;
+
+	if (g_hash_table_lookup (metadata, GINT_TO_POINTER (field)) != NULL)
+		return;
+
+	newval = g_slice_new0 (GValue);
+	g_value_init (newval, G_TYPE_ULONG);
+	g_value_set_ulong (newval, value);
+	set_value (metadata, field, newval);
+}
+
+/**
+ * rb_metadata_fast_set_number_pair:
+ * @metadata: metadata hash table
+ * @field: field to set from the first number
+ * @total_field: field to set from the second number
+ * @value: string of the form "3" or "3/12"
+ *
+ * Sets a track or disc number, and the total, from a tag value.
+ */
+void
+rb_metadata_fast_set_number_pair (GHashTable *metadata,
+				  RBMetaDataField field,
+				  RBMetaDataField total_field,
+				  const char *value)
+{
+	char *end;
+	gulong n;
+
+	n = strtoul (value, &end, 10);
+	if (end == value)
+		return;
+	if (n > 0)
+		rb_metadata_fast_set_ulong (metadata, field, n);
+
+	if (*end == '/') {
+		value = end + 1;
+		n = strtoul (value, &end, 10);
+		if (end != value && n > 0)
+			rb_metadata_fast_set_ulong (metadata, total_field, n);
+	}
+}
+
+/**
+ * rb_metadata_fast_set_date:
+ * @metadata: metadata hash table
+ * @value: date string, "YYYY", "YYYY-MM" or "YYYY-MM-DD"
+ *
+ * Sets the date field from a tag value.
+ */
+void
+rb_metadata_fast_set_date (GHashTable *metadata,
+			   const char *value)
+{
+	GDate *date;
+	guint year;
+	guint month = 1;
+	guint day = 1;
+	char *end;
+
+	year = strtoul (value, &end, 10);
+	if (end - value != 4 || year == 0)
+		return;
+
+	if (end[0] == '-' && g_ascii_isdigit (end[1])) {
+		value = end + 1;
+		month = strtoul (value, &end, 10);
+		if (end[0] == '-' && g_ascii_isdigit (end[1])) {
+			value = end + 1;
+			day = strtoul (value, &end, 10);
+		}
+	}
+
+	if (!g_date_valid_dmy (day, month, year)) {
+		day = 1;
+		month = 1;
+	}
+
+	date = g_date_new_dmy (day, month, year);
+	rb_metadata_fast_set_ulong (metadata, RB_METADATA_FIELD_DATE, g_date_get_julian (date));
+	g_date_free (date);
+}
+
+/**
+ * rb_metadata_fast_set_gain:
+ * @metadata: metadata hash table
+ * @field: replaygain field to set
+ * @value: string of the form "-6.5 dB" or "0.98"
+ *
+ * Sets a replaygain gain or peak field from a tag value.
+ */
+void
+rb_metadata_fast_set_gain (GHashTable *metadata,
+			   RBMetaDataField field,
+			   const char *value)
+{
+	GValue *newval;
+	double v;
+	char *end;
+
+	if (g_hash_table_lookup (metadata, GINT_TO_POINTER (field)) != NULL)
+		return;
+
+	v = g_ascii_strtod (value, &end);
+	if (end == value)
+		return;
+
+	newval = g_slice_new0 (GValue);
+	g_value_init (newval, G_TYPE_DOUBLE);
+	g_value_set_double (newval, v);
+	set_value (metadata, field, newval);
+}
+
+static guint32
+read_uint32_le (const guint8 *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((guint32)data[3] << 24);
+}
+
+static void
+set_vorbis_comment (GHashTable *metadata, const char *key, const char *value)
+{
+	static const struct {
+		const char *key;
+		RBMetaDataField field;
+	} string_fields[] = {
+		{ "TITLE", RB_METADATA_FIELD_TITLE },
+		{ "ARTIST", RB_METADATA_FIELD_ARTIST },
+		{ "ALBUM", RB_METADATA_FIELD_ALBUM },
+		{ "GENRE", RB_METADATA_FIELD_GENRE },
+		{ "COMMENT", RB_METADATA_FIELD_COMMENT },
+		{ "DESCRIPTION", RB_METADATA_FIELD_DESCRIPTION },
+		{ "PERFORMER", RB_METADATA_FIELD_PERFORMER },
+		{ "ISRC", RB_METADATA_FIELD_ISRC },
+		{ "ORGANIZATION", RB_METADATA_FIELD_ORGANIZATION },
+		{ "COPYRIGHT", RB_METADATA_FIELD_COPYRIGHT },
+		{ "CONTACT", RB_METADATA_FIELD_CONTACT },
+		{ "LICENSE", RB_METADATA_FIELD_LICENSE },
+		{ "VERSION", RB_METADATA_FIELD_VERSION },
+		{ "MUSICBRAINZ_TRACKID", RB_METADATA_FIELD_MUSICBRAINZ_TRACKID },
+		{ "MUSICBRAINZ_ARTISTID", RB_METADATA_FIELD_MUSICBRAINZ_ARTISTID },
+		{ "MUSICBRAINZ_ALBUMID", RB_METADATA_FIELD_MUSICBRAINZ_ALBUMID },
+		{ "MUSICBRAINZ_ALBUMARTISTID", RB_METADATA_FIELD_MUSICBRAINZ_ALBUMARTISTID },
+		{ "ARTISTSORT", RB_METADATA_FIELD_ARTIST_SORTNAME },
+		{ "ALBUMSORT", RB_METADATA_FIELD_ALBUM_SORTNAME },
+	};
+	int i;
+
+	for (i = 0; i < G_N_ELEMENTS (string_fields); i++) {
+		if (g_ascii_strcasecmp (key, string_fields[i].key) == 0) {
+			rb_metadata_fast_set_string (metadata, string_fields[i].field, value);
+			return;
+		}
+	}
+
+	if (g_ascii_strcasecmp (key, "TRACKNUMBER") == 0) {
+		rb_metadata_fast_set_number_pair (metadata,
+						  RB_METADATA_FIELD_TRACK_NUMBER,
+						  RB_METADATA_FIELD_MAX_TRACK_NUMBER,
+						  value);
+	} else if (g_ascii_strcasecmp (key, "TRACKTOTAL") == 0 ||
+		   g_ascii_strcasecmp (key, "TOTALTRACKS") == 0) {
+		rb_metadata_fast_set_number_pair (metadata,
+						  RB_METADATA_FIELD_MAX_TRACK_NUMBER,
+						  RB_METADATA_FIELD_MAX_TRACK_NUMBER,
+						  value);
+	} else if (g_ascii_strcasecmp (key, "DISCNUMBER") == 0) {
+		rb_metadata_fast_set_number_pair (metadata,
+						  RB_METADATA_FIELD_DISC_NUMBER,
+						  RB_METADATA_FIELD_MAX_DISC_NUMBER,
+						  value);
+	} else if (g_ascii_strcasecmp (key, "DISCTOTAL") == 0 ||
+		   g_ascii_strcasecmp (key, "TOTALDISCS") == 0) {
+		rb_metadata_fast_set_number_pair (metadata,
+						  RB_METADATA_FIELD_MAX_DISC_NUMBER,
+						  RB_METADATA_FIELD_MAX_DISC_NUMBER,
+						  value);
+	} else if (g_ascii_strcasecmp (key, "DATE") == 0) {
+		rb_metadata_fast_set_date (metadata, value);
+	} else if (g_ascii_strcasecmp (key, "REPLAYGAIN_TRACK_GAIN") == 0) {
+		rb_metadata_fast_set_gain (metadata, RB_METADATA_FIELD_TRACK_GAIN, value);
+	} else if (g_ascii_strcasecmp (key, "REPLAYGAIN_TRACK_PEAK") == 0) {
+		rb_metadata_fast_set_gain (metadata, RB_METADATA_FIELD_TRACK_PEAK, value);
+	} else if (g_ascii_strcasecmp (key, "REPLAYGAIN_ALBUM_GAIN") == 0) {
+		rb_metadata_fast_set_gain (metadata, RB_METADATA_FIELD_ALBUM_GAIN, value);
+	} else if (g_ascii_strcasecmp (key, "REPLAYGAIN_ALBUM_PEAK") == 0) {
+		rb_metadata_fast_set_gain (metadata, RB_METADATA_FIELD_ALBUM_PEAK, value);
+	}
+}
+
+/**
+ * rb_metadata_fast_read_vorbis_comments:
+ * @data: vorbis comment block, without any framing
+ * @len: length of @data
+ * @metadata: metadata hash table
+ *
+ * Reads tags from a vorbis comment block, as found in Ogg Vorbis
+ * and FLAC files.
+ *
+ * Return value: %FALSE if the block is corrupt
+ */
+gboolean
+rb_metadata_fast_read_vorbis_comments (const guint8 *data,
+				       gsize len,
+				       GHashTable *metadata)
+{
+	guint32 vendor_len;
+	guint32 count;
+	guint32 i;
+	gsize pos;
+
+	if (len < 8)
+		return FALSE;
+
+	vendor_len = read_uint32_le (data);
+	if (vendor_len > len - 8)
+		return FALSE;
+	pos = 4 + vendor_len;
+
+	count = read_uint32_le (data + pos);
+	pos += 4;
+
+	for (i = 0; i < count; i++) {
+		guint32 comment_len;
+		char *comment;
+		char *eq;
+
+		if (len - pos < 4)
+			return FALSE;
+		comment_len = read_uint32_le (data + pos);
+		pos += 4;
+		if (comment_len > len - pos)
+			return FALSE;
+
+		comment = g_strndup ((const char *)data + pos, comment_len);
+		pos += comment_len;
+
+		eq = strchr (comment, '=');
+		if (eq != NULL) {
+			*eq = '\0';
+			set_vorbis_comment (metadata, comment, eq + 1);
+		}
+		g_free (comment);
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,103 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+/*
+ * Readers that get tags and duration for common formats straight from
+ * the file, without building a GStreamer pipeline.
+ */
+
+#ifndef RB_METADATA_FAST_H
+#define RB_METADATA_FAST_H
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include <metadata/rb-metadata.h>
+
+G_BEGIN_DECLS
+
+/* number of bytes from the start of the file passed to identify functions */
+#define RB_METADATA_FAST_HEADER_SIZE	64
+
+typedef struct
+{
+	GInputStream *stream;
+	goffset size;
+} RBMetaDataFastFile;
+
+typedef struct
+{
+	const char *name;
+
+	/* elements that can decode the format; the reader is only used
+	 * if one of them is installed, so missing plugins are still
+	 * reported by the pipeline.
+	 */
+	const char * const *decoders;
+
+	gboolean (*identify) (const guint8 *header, gsize len);
+	gboolean (*read) (RBMetaDataFastFile *file, GHashTable *metadata, char **mimetype);
+} RBMetaDataFastReader;
+
+extern const RBMetaDataFastReader rb_metadata_fast_mp3_reader;
+extern const RBMetaDataFastReader rb_metadata_fast_vorbis_reader;
+extern const RBMetaDataFastReader rb_metadata_fast_flac_reader;
+
+void		rb_metadata_fast_add_reader (const RBMetaDataFastReader *reader);
+void		rb_metadata_fast_set_enabled (gboolean enabled);
+
+gboolean	rb_metadata_fast_load (const char *uri,
+				       GHashTable *metadata,
+				       char **mimetype);
+
+/* for use by readers */
+gboolean	rb_metadata_fast_read (RBMetaDataFastFile *file,
+				       goffset offset,
+				       gpointer buffer,
+				       gsize len);
+
+void		rb_metadata_fast_set_string (GHashTable *metadata,
+					     RBMetaDataField field,
+					     const char *value);
+void		rb_metadata_fast_set_ulong (GHashTable *metadata,
+					    RBMetaDataField field,
+					    gulong value);
+void		rb_metadata_fast_set_number_pair (GHashTable *metadata,
+						  RBMetaDataField field,
+						  RBMetaDataField total_field,
+						  const char *value);
+void		rb_metadata_fast_set_date (GHashTable *metadata,
+					   const char *value);
+void		rb_metadata_fast_set_gain (GHashTable *metadata,
+					   RBMetaDataField field,
+					   const char *value);
+
+gboolean	rb_metadata_fast_read_vorbis_comments (const guint8 *data,
+						       gsize len,
+						       GHashTable *metadata);
+
+G_END_DECLS
+
+#endif /* RB_METADATA_FAST_H */
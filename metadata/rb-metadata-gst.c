@@ -39,6 +39,7 @@
 
 #include "rb-metadata.h"
 #include "rb-metadata-gst-common.h"
+#include "rb-metadata-fast.h"
 #include "rb-debug.h"
 #include "rb-util.h"
 #include "rb-file-helpers.h"
@@ -731,6 +732,13 @@ rb_metadata_load (RBMetaData *md,
 
 	rb_debug ("loading metadata for uri: %s", uri);
 
+	/* most files can be read without a pipeline */
+	if (rb_metadata_fast_load (uri, md->priv->metadata, &md->priv->type)) {
+		rb_debug ("read metadata for %s (type %s) without a pipeline", uri, md->priv->type);
+		md->priv->has_audio = TRUE;
+		return;
+	}
+
 	/* The main tagfinding pipeline looks like this:
  	 * <src> ! decodebin ! fakesink
  	 *
@@ -870,6 +878,29 @@ rb_metadata_load (RBMetaData *md,
 	md->priv->pipeline = NULL;
 }
 
+void
+rb_metadata_load_batch (char **uris,
+			RBMetaDataLoadFunc func,
+			gpointer data)
+{
+	guint i;
+
+	for (i = 0; uris[i] != NULL; i++) {
+		RBMetaData *md;
+		GError *error = NULL;
+
+		md = rb_metadata_new ();
+		rb_metadata_load (md, uris[i], &error);
+		func (md, i, error, data);
+	}
+}
+
+void
+rb_metadata_set_max_helpers (guint count)
+{
+	/* metadata is read in-process here, so there are no helpers */
+}
+
 gboolean
 rb_metadata_can_save (RBMetaData *md, const char *mimetype)
 {
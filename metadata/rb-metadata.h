@@ -112,6 +112,8 @@ struct _RBMetaDataClass
 	GObjectClass parent_class;
 };
 
+typedef void (*RBMetaDataLoadFunc) (RBMetaData *md, guint index, GError *error, gpointer data);
+
 GType		rb_metadata_get_type	(void);
 
 GType		rb_metadata_field_get_type (void);
@@ -123,6 +125,8 @@ const char *	rb_metadata_get_field_name (RBMetaDataField field);
 
 RBMetaData *	rb_metadata_new		(void);
 
+void		rb_metadata_set_max_helpers (guint count);
+
 gboolean	rb_metadata_can_save	(RBMetaData *md, const char *mimetype);
 char **		rb_metadata_get_saveable_types (RBMetaData *md);
 
@@ -132,6 +136,10 @@ void		rb_metadata_load	(RBMetaData *md,
 					 const char *uri,
 					 GError **error);
 
+void		rb_metadata_load_batch	(char **uris,
+					 RBMetaDataLoadFunc func,
+					 gpointer data);
+
 void		rb_metadata_save	(RBMetaData *md,
 					 const char *uri,
 					 GError **error);
@@ -33,17 +33,39 @@
 #include "rb-cut-and-paste-code.h"
 #include "rb-refstring.h"
 
-GHashTable *rb_refstrings;
-GMutex *rb_refstrings_mutex;
+/*
+ * The intern table is split into shards, each with its own lock, chosen by
+ * the hash of the string.  This keeps threads interning different strings
+ * (the loader, metadata import, query models) from serialising on a single
+ * lock.  References other than the last one are dropped without taking
+ * any lock; the last reference is dropped while holding the shard lock,
+ * so a string can never be found in the table with a zero refcount.
+ */
+#define RB_REFSTRING_SHARDS	64
+
+typedef struct
+{
+	GMutex *mutex;
+	GHashTable *table;
+} RBRefStringShard;
+
+static RBRefStringShard rb_refstring_shards[RB_REFSTRING_SHARDS];
 
 struct RBRefString
 {
 	gint refcount;
+	guint hash;
 	gpointer folded;
 	gpointer sortkey;
 	char value[1];
 };
 
+static inline RBRefStringShard *
+rb_refstring_shard (guint hash)
+{
+	return &rb_refstring_shards[(hash ^ (hash >> 16)) % RB_REFSTRING_SHARDS];
+}
+
 static void
 rb_refstring_free (RBRefString *refstr)
 {
@@ -63,10 +85,13 @@ rb_refstring_free (RBRefString *refstr)
 void
 rb_refstring_system_init ()
 {
-	rb_refstrings_mutex = g_mutex_new ();
+	int i;
 
-	rb_refstrings = g_hash_table_new_full (g_str_hash, g_str_equal,
-					       NULL, (GDestroyNotify) rb_refstring_free);
+	for (i = 0; i < RB_REFSTRING_SHARDS; i++) {
+		rb_refstring_shards[i].mutex = g_mutex_new ();
+		rb_refstring_shards[i].table = g_hash_table_new_full (g_str_hash, g_str_equal,
+								      NULL, (GDestroyNotify) rb_refstring_free);
+	}
 }
 
 /**
@@ -82,14 +107,19 @@ rb_refstring_system_init ()
 RBRefString *
 rb_refstring_new (const char *init)
 {
+	RBRefStringShard *shard;
 	RBRefString *ret;
+	guint hash;
 
-	g_mutex_lock (rb_refstrings_mutex);
-	ret = g_hash_table_lookup (rb_refstrings, init);
+	hash = g_str_hash (init);
+	shard = rb_refstring_shard (hash);
+
+	g_mutex_lock (shard->mutex);
+	ret = g_hash_table_lookup (shard->table, init);
 
 	if (ret) {
-		rb_refstring_ref (ret);
-		g_mutex_unlock (rb_refstrings_mutex);
+		g_atomic_int_inc (&ret->refcount);
+		g_mutex_unlock (shard->mutex);
 		return ret;
 	}
 
@@ -97,11 +127,12 @@ rb_refstring_new (const char *init)
 
 	strcpy (ret->value, init);
 	g_atomic_int_set (&ret->refcount, 1);
+	ret->hash = hash;
 	ret->folded = NULL;
 	ret->sortkey = NULL;
 
-	g_hash_table_insert (rb_refstrings, ret->value, ret);
-	g_mutex_unlock (rb_refstrings_mutex);
+	g_hash_table_insert (shard->table, ret->value, ret);
+	g_mutex_unlock (shard->mutex);
 	return ret;
 }
 
@@ -118,15 +149,18 @@ rb_refstring_new (const char *init)
 RBRefString *
 rb_refstring_find (const char *init)
 {
+	RBRefStringShard *shard;
 	RBRefString *ret;
 
-	g_mutex_lock (rb_refstrings_mutex);
-	ret = g_hash_table_lookup (rb_refstrings, init);
+	shard = rb_refstring_shard (g_str_hash (init));
+
+	g_mutex_lock (shard->mutex);
+	ret = g_hash_table_lookup (shard->table, init);
 
 	if (ret)
-		rb_refstring_ref (ret);
+		g_atomic_int_inc (&ret->refcount);
 
-	g_mutex_unlock (rb_refstrings_mutex);
+	g_mutex_unlock (shard->mutex);
 	return ret;
 }
 
@@ -145,13 +179,28 @@ rb_refstring_unref (RBRefString *val)
 
 	g_return_if_fail (g_atomic_int_get (&val->refcount) > 0);
 
-	if (g_atomic_int_dec_and_test (&val->refcount)) {
-		g_mutex_lock (rb_refstrings_mutex);
-		/* ensure it's still not referenced, as something may have called
-		 * rb_refstring_new since we decremented the count */
-		if (g_atomic_int_get (&val->refcount) == 0)
-			g_hash_table_remove (rb_refstrings, val->value);
-		g_mutex_unlock (rb_refstrings_mutex);
+	for (;;) {
+		RBRefStringShard *shard;
+		gint refcount;
+
+		refcount = g_atomic_int_get (&val->refcount);
+		if (refcount > 1) {
+			if (g_atomic_int_compare_and_exchange (&val->refcount, refcount, refcount - 1))
+				return;
+			continue;
+		}
+
+		/* this may be the last reference.  rb_refstring_new and
+		 * rb_refstring_find only add references while holding the
+		 * shard lock, so once we hold it, the count can only go
+		 * down from here.
+		 */
+		shard = rb_refstring_shard (val->hash);
+		g_mutex_lock (shard->mutex);
+		if (g_atomic_int_dec_and_test (&val->refcount))
+			g_hash_table_remove (shard->table, val->value);
+		g_mutex_unlock (shard->mutex);
+		return;
 	}
 }
 
@@ -164,8 +213,12 @@ rb_refstring_unref (RBRefString *val)
 void
 rb_refstring_system_shutdown (void)
 {
-	g_hash_table_destroy (rb_refstrings);
-	g_mutex_free (rb_refstrings_mutex);
+	int i;
+
+	for (i = 0; i < RB_REFSTRING_SHARDS; i++) {
+		g_hash_table_destroy (rb_refstring_shards[i].table);
+		g_mutex_free (rb_refstring_shards[i].mutex);
+	}
 }
 
 /**
@@ -291,6 +344,92 @@ rb_refstring_get_sort_key (RBRefString *val)
 	return string;
 }
 
+/**
+ * rb_refstring_peek_folded:
+ * @val: an #RBRefString
+ *
+ * Returns the case-folded version of the string underlying @val if it
+ * has already been computed.
+ *
+ * Return value: case-folded string or NULL, must not be freed
+ */
+const char *
+rb_refstring_peek_folded (RBRefString *val)
+{
+	if (val == NULL)
+		return NULL;
+
+	return (const char *)g_atomic_pointer_get (&val->folded);
+}
+
+/**
+ * rb_refstring_peek_sort_key:
+ * @val: an #RBRefString
+ *
+ * Returns the sort key version of the string underlying @val if it
+ * has already been computed.
+ *
+ * Return value: sort key string or NULL, must not be freed
+ */
+const char *
+rb_refstring_peek_sort_key (RBRefString *val)
+{
+	if (val == NULL)
+		return NULL;
+
+	return (const char *)g_atomic_pointer_get (&val->sortkey);
+}
+
+static void
+set_cached_string (gpointer *ptr, const char *string)
+{
+	char *newstring;
+
+	if (g_atomic_pointer_get (ptr) != NULL)
+		return;
+
+	newstring = g_strdup (string);
+	if (g_atomic_pointer_compare_and_exchange (ptr, NULL, newstring) == FALSE)
+		g_free (newstring);
+}
+
+/**
+ * rb_refstring_set_folded:
+ * @val: an #RBRefString
+ * @folded: the case-folded version of the string
+ *
+ * Stores a previously computed case-folded version of the string
+ * underlying @val, so that #rb_refstring_get_folded does not need to
+ * compute it.  Does nothing if the case-folded string is already known.
+ */
+void
+rb_refstring_set_folded (RBRefString *val, const char *folded)
+{
+	g_return_if_fail (val != NULL);
+	g_return_if_fail (folded != NULL);
+
+	set_cached_string (&val->folded, folded);
+}
+
+/**
+ * rb_refstring_set_sort_key:
+ * @val: an #RBRefString
+ * @sortkey: the sort key for the string
+ *
+ * Stores a previously computed sort key for the string underlying @val,
+ * so that #rb_refstring_get_sort_key does not need to compute it.  The
+ * sort key must have been generated for the current collation locale.
+ * Does nothing if the sort key is already known.
+ */
+void
+rb_refstring_set_sort_key (RBRefString *val, const char *sortkey)
+{
+	g_return_if_fail (val != NULL);
+	g_return_if_fail (sortkey != NULL);
+
+	set_cached_string (&val->sortkey, sortkey);
+}
+
 /**
  * rb_refstring_hash:
  * @p: an #RBRefString
@@ -303,7 +442,7 @@ guint
 rb_refstring_hash (gconstpointer p)
 {
 	const RBRefString *ref = p;
-	return g_str_hash (rb_refstring_get (ref));
+	return ref->hash;
 }
 
 /**
@@ -47,6 +47,11 @@ const char *	rb_refstring_get (const RBRefString *val);
 const char *	rb_refstring_get_folded (RBRefString *val);
 const char *	rb_refstring_get_sort_key (RBRefString *val);
 
+const char *	rb_refstring_peek_folded (RBRefString *val);
+const char *	rb_refstring_peek_sort_key (RBRefString *val);
+void		rb_refstring_set_folded (RBRefString *val, const char *folded);
+void		rb_refstring_set_sort_key (RBRefString *val, const char *sortkey);
+
 guint rb_refstring_hash (gconstpointer p);
 gboolean rb_refstring_equal (gconstpointer ap, gconstpointer bp);
 
@@ -0,0 +1,773 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+/*
+ * Compiled queries.
+ *
+ * Evaluating a query directly means looking up the type of each property
+ * and going through the generic entry accessors for every criteria and
+ * every entry.  A compiled query does all of that once: each criteria is
+ * turned into an operation holding a function that performs the specific
+ * comparison, the offset of the entry field to read (where the property
+ * maps directly onto one), and the value to compare against.
+ *
+ * The operations for all conjunctions of a query are stored in a single
+ * array.  Each conjunction is terminated by an operation with no function,
+ * and each operation holds the index of the first operation of the next
+ * conjunction, which is where evaluation continues if it doesn't match.
+ * Subqueries are compiled separately.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "rhythmdb.h"
+#include "rhythmdb-private.h"
+#include "rb-refstring.h"
+
+#define NO_OFFSET	((gssize) -1)
+
+typedef enum {
+	STRING_GENERIC,
+	STRING_FIELD,
+	STRING_FIELD_FOLDED,
+	STRING_FIELD_SORT_KEY
+} RhythmDBCompiledStringKind;
+
+typedef struct _RhythmDBCompiledOp RhythmDBCompiledOp;
+
+typedef gboolean (*RhythmDBCompiledOpFunc) (const RhythmDBCompiledOp *op,
+					    RhythmDBEntry *entry,
+					    gulong now);
+
+struct _RhythmDBCompiledOp
+{
+	RhythmDBCompiledOpFunc func;
+	guint next;
+
+	RhythmDBPropType propid;
+	gssize offset;
+	RhythmDBCompiledStringKind string_kind;
+	gboolean owns_string;
+
+	union {
+		gulong ulong_val;
+		gdouble double_val;
+		guint64 uint64_val;
+		gboolean boolean_val;
+		gpointer pointer_val;
+		char *string_val;
+		char **words;
+		RhythmDBCompiledQuery *subquery;
+	} v;
+	RhythmDB *db;
+};
+
+struct _RhythmDBCompiledQuery
+{
+	RhythmDBCompiledOp *ops;
+	guint n_ops;
+	gboolean time_relative;
+};
+
+/* value accessors */
+
+static inline gulong
+op_get_ulong (const RhythmDBCompiledOp *op,
+	      RhythmDBEntry *entry)
+{
+	if (op->offset != NO_OFFSET)
+		return G_STRUCT_MEMBER (gulong, entry, op->offset);
+	return rhythmdb_entry_get_ulong (entry, op->propid);
+}
+
+static inline gdouble
+op_get_double (const RhythmDBCompiledOp *op,
+	       RhythmDBEntry *entry)
+{
+	if (op->offset != NO_OFFSET)
+		return G_STRUCT_MEMBER (gdouble, entry, op->offset);
+	return rhythmdb_entry_get_double (entry, op->propid);
+}
+
+static inline guint64
+op_get_uint64 (const RhythmDBCompiledOp *op,
+	       RhythmDBEntry *entry)
+{
+	if (op->offset != NO_OFFSET)
+		return G_STRUCT_MEMBER (guint64, entry, op->offset);
+	return rhythmdb_entry_get_uint64 (entry, op->propid);
+}
+
+static inline gboolean
+op_get_boolean (const RhythmDBCompiledOp *op,
+		RhythmDBEntry *entry)
+{
+	return rhythmdb_entry_get_boolean (entry, op->propid);
+}
+
+static inline gpointer
+op_get_pointer (const RhythmDBCompiledOp *op,
+		RhythmDBEntry *entry)
+{
+	if (op->offset != NO_OFFSET)
+		return G_STRUCT_MEMBER (gpointer, entry, op->offset);
+	return rhythmdb_entry_get_pointer (entry, op->propid);
+}
+
+static inline const char *
+op_get_string (const RhythmDBCompiledOp *op,
+	       RhythmDBEntry *entry)
+{
+	switch (op->string_kind) {
+	case STRING_FIELD:
+		return rb_refstring_get (G_STRUCT_MEMBER (RBRefString *, entry, op->offset));
+	case STRING_FIELD_FOLDED:
+		return rb_refstring_get_folded (G_STRUCT_MEMBER (RBRefString *, entry, op->offset));
+	case STRING_FIELD_SORT_KEY:
+		return rb_refstring_get_sort_key (G_STRUCT_MEMBER (RBRefString *, entry, op->offset));
+	case STRING_GENERIC:
+	default:
+		return rhythmdb_entry_get_string (entry, op->propid);
+	}
+}
+
+/* comparison operations.  as in the query evaluation in the database
+ * backends, 'greater' means greater than or equal and 'less' means less
+ * than or equal.
+ */
+
+#define DEFINE_COMPARE_OPS(type, getter, field)						\
+static gboolean										\
+op_##type##_equals (const RhythmDBCompiledOp *op, RhythmDBEntry *entry, gulong now)	\
+{											\
+	return getter (op, entry) == op->v.field;					\
+}											\
+static gboolean										\
+op_##type##_greater (const RhythmDBCompiledOp *op, RhythmDBEntry *entry, gulong now)	\
+{											\
+	return getter (op, entry) >= op->v.field;					\
+}											\
+static gboolean										\
+op_##type##_less (const RhythmDBCompiledOp *op, RhythmDBEntry *entry, gulong now)	\
+{											\
+	return getter (op, entry) <= op->v.field;					\
+}
+
+DEFINE_COMPARE_OPS (ulong, op_get_ulong, ulong_val)
+DEFINE_COMPARE_OPS (double, op_get_double, double_val)
+DEFINE_COMPARE_OPS (uint64, op_get_uint64, uint64_val)
+DEFINE_COMPARE_OPS (boolean, op_get_boolean, boolean_val)
+DEFINE_COMPARE_OPS (pointer, op_get_pointer, pointer_val)
+
+static gboolean
+op_string_equals (const RhythmDBCompiledOp *op, RhythmDBEntry *entry, gulong now)
+{
+	return g_strcmp0 (op_get_string (op, entry), op->v.string_val) == 0;
+}
+
+static gboolean
+op_string_greater (const RhythmDBCompiledOp *op, RhythmDBEntry *entry, gulong now)
+{
+	return g_strcmp0 (op_get_string (op, entry), op->v.string_val) >= 0;
+}
+
+static gboolean
+op_string_less (const RhythmDBCompiledOp *op, RhythmDBEntry *entry, gulong now)
+{
+	return g_strcmp0 (op_get_string (op, entry), op->v.string_val) <= 0;
+}
+
+static gboolean
+op_string_like (const RhythmDBCompiledOp *op, RhythmDBEntry *entry, gulong now)
+{
+	const char *entry_string = op_get_string (op, entry);
+
+	return (entry_string != NULL && strstr (entry_string, op->v.string_val) != NULL);
+}
+
+static gboolean
+op_string_not_like (const RhythmDBCompiledOp *op, RhythmDBEntry *entry, gulong now)
+{
+	const char *entry_string = op_get_string (op, entry);
+
+	/* entries without the property don't match either way */
+	return (entry_string != NULL && strstr (entry_string, op->v.string_val) == NULL);
+}
+
+static gboolean
+op_string_prefix (const RhythmDBCompiledOp *op, RhythmDBEntry *entry, gulong now)
+{
+	return g_str_has_prefix (op_get_string (op, entry), op->v.string_val);
+}
+
+static gboolean
+op_string_suffix (const RhythmDBCompiledOp *op, RhythmDBEntry *entry, gulong now)
+{
+	return g_str_has_suffix (op_get_string (op, entry), op->v.string_val);
+}
+
+static gboolean
+op_search_match (const RhythmDBCompiledOp *op, RhythmDBEntry *entry, gulong now)
+{
+	RBRefString *props[4];
+	char **word;
+	guint i;
+
+	props[0] = entry->title;
+	props[1] = entry->album;
+	props[2] = entry->artist;
+	props[3] = entry->genre;
+
+	for (word = op->v.words; *word != NULL; word++) {
+		gboolean found = FALSE;
+
+		for (i = 0; i < G_N_ELEMENTS (props); i++) {
+			const char *folded = rb_refstring_get_folded (props[i]);
+			if (folded != NULL && strstr (folded, *word) != NULL) {
+				found = TRUE;
+				break;
+			}
+		}
+		if (!found)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+op_keyword_has (const RhythmDBCompiledOp *op, RhythmDBEntry *entry)
+{
+	RBRefString *keyword;
+	gboolean has;
+
+	/* the keyword may be created after the query is compiled */
+	keyword = rb_refstring_find (op->v.string_val);
+	if (keyword == NULL)
+		return FALSE;
+
+	has = rhythmdb_entry_keyword_has (op->db, entry, keyword);
+	rb_refstring_unref (keyword);
+	return has;
+}
+
+static gboolean
+op_keyword_like (const RhythmDBCompiledOp *op, RhythmDBEntry *entry, gulong now)
+{
+	return op_keyword_has (op, entry);
+}
+
+static gboolean
+op_keyword_not_like (const RhythmDBCompiledOp *op, RhythmDBEntry *entry, gulong now)
+{
+	return !op_keyword_has (op, entry);
+}
+
+static gboolean
+op_time_within (const RhythmDBCompiledOp *op, RhythmDBEntry *entry, gulong now)
+{
+	return op_get_ulong (op, entry) >= (now - op->v.ulong_val);
+}
+
+static gboolean
+op_time_not_within (const RhythmDBCompiledOp *op, RhythmDBEntry *entry, gulong now)
+{
+	return op_get_ulong (op, entry) < (now - op->v.ulong_val);
+}
+
+static gboolean evaluate_compiled (RhythmDBCompiledQuery *query, RhythmDBEntry *entry, gulong now);
+
+static gboolean
+op_subquery (const RhythmDBCompiledOp *op, RhythmDBEntry *entry, gulong now)
+{
+	return evaluate_compiled (op->v.subquery, entry, now);
+}
+
+/* compilation */
+
+static gssize
+ulong_field_offset (RhythmDBPropType propid)
+{
+	/* play_count is a glong, but it is returned as a gulong anyway */
+	switch (propid) {
+	case RHYTHMDB_PROP_TRACK_NUMBER:
+		return G_STRUCT_OFFSET (RhythmDBEntry, tracknum);
+	case RHYTHMDB_PROP_DISC_NUMBER:
+		return G_STRUCT_OFFSET (RhythmDBEntry, discnum);
+	case RHYTHMDB_PROP_DURATION:
+		return G_STRUCT_OFFSET (RhythmDBEntry, duration);
+	case RHYTHMDB_PROP_BITRATE:
+		return G_STRUCT_OFFSET (RhythmDBEntry, bitrate);
+	case RHYTHMDB_PROP_MTIME:
+		return G_STRUCT_OFFSET (RhythmDBEntry, mtime);
+	case RHYTHMDB_PROP_FIRST_SEEN:
+		return G_STRUCT_OFFSET (RhythmDBEntry, first_seen);
+	case RHYTHMDB_PROP_LAST_SEEN:
+		return G_STRUCT_OFFSET (RhythmDBEntry, last_seen);
+	case RHYTHMDB_PROP_PLAY_COUNT:
+		return G_STRUCT_OFFSET (RhythmDBEntry, play_count);
+	case RHYTHMDB_PROP_LAST_PLAYED:
+		return G_STRUCT_OFFSET (RhythmDBEntry, last_played);
+	default:
+		return NO_OFFSET;
+	}
+}
+
+static RhythmDBCompiledStringKind
+string_field_offset (RhythmDBPropType propid, gssize *offset)
+{
+	switch (propid) {
+	case RHYTHMDB_PROP_TITLE:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, title);
+		return STRING_FIELD;
+	case RHYTHMDB_PROP_ARTIST:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, artist);
+		return STRING_FIELD;
+	case RHYTHMDB_PROP_ALBUM:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, album);
+		return STRING_FIELD;
+	case RHYTHMDB_PROP_GENRE:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, genre);
+		return STRING_FIELD;
+	case RHYTHMDB_PROP_ARTIST_SORTNAME:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, artist_sortname);
+		return STRING_FIELD;
+	case RHYTHMDB_PROP_ALBUM_SORTNAME:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, album_sortname);
+		return STRING_FIELD;
+	case RHYTHMDB_PROP_LOCATION:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, location);
+		return STRING_FIELD;
+	case RHYTHMDB_PROP_MOUNTPOINT:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, mountpoint);
+		return STRING_FIELD;
+	case RHYTHMDB_PROP_MIMETYPE:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, mimetype);
+		return STRING_FIELD;
+
+	case RHYTHMDB_PROP_TITLE_FOLDED:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, title);
+		return STRING_FIELD_FOLDED;
+	case RHYTHMDB_PROP_ARTIST_FOLDED:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, artist);
+		return STRING_FIELD_FOLDED;
+	case RHYTHMDB_PROP_ALBUM_FOLDED:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, album);
+		return STRING_FIELD_FOLDED;
+	case RHYTHMDB_PROP_GENRE_FOLDED:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, genre);
+		return STRING_FIELD_FOLDED;
+	case RHYTHMDB_PROP_ARTIST_SORTNAME_FOLDED:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, artist_sortname);
+		return STRING_FIELD_FOLDED;
+	case RHYTHMDB_PROP_ALBUM_SORTNAME_FOLDED:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, album_sortname);
+		return STRING_FIELD_FOLDED;
+
+	case RHYTHMDB_PROP_TITLE_SORT_KEY:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, title);
+		return STRING_FIELD_SORT_KEY;
+	case RHYTHMDB_PROP_ARTIST_SORT_KEY:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, artist);
+		return STRING_FIELD_SORT_KEY;
+	case RHYTHMDB_PROP_ALBUM_SORT_KEY:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, album);
+		return STRING_FIELD_SORT_KEY;
+	case RHYTHMDB_PROP_GENRE_SORT_KEY:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, genre);
+		return STRING_FIELD_SORT_KEY;
+	case RHYTHMDB_PROP_ARTIST_SORTNAME_SORT_KEY:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, artist_sortname);
+		return STRING_FIELD_SORT_KEY;
+	case RHYTHMDB_PROP_ALBUM_SORTNAME_SORT_KEY:
+		*offset = G_STRUCT_OFFSET (RhythmDBEntry, album_sortname);
+		return STRING_FIELD_SORT_KEY;
+
+	default:
+		*offset = NO_OFFSET;
+		return STRING_GENERIC;
+	}
+}
+
+#define SELECT_COMPARE_OP(op, qtype, type)				\
+	switch (qtype) {						\
+	case RHYTHMDB_QUERY_PROP_GREATER:				\
+		(op)->func = op_##type##_greater;			\
+		break;							\
+	case RHYTHMDB_QUERY_PROP_LESS:					\
+		(op)->func = op_##type##_less;				\
+		break;							\
+	default:							\
+		(op)->func = op_##type##_equals;			\
+		break;							\
+	}
+
+static RhythmDBCompiledQuery *compile_query (RhythmDB *db, GPtrArray *query, gboolean toplevel);
+
+static void
+compile_criteria (RhythmDB *db,
+		  RhythmDBQueryData *data,
+		  RhythmDBCompiledOp *op,
+		  gboolean *time_relative)
+{
+	RhythmDBQueryType qtype = data->type;
+	GType proptype;
+
+	op->propid = data->propid;
+	op->offset = NO_OFFSET;
+	op->string_kind = STRING_GENERIC;
+	op->db = db;
+
+	if (qtype == RHYTHMDB_QUERY_SUBQUERY) {
+		op->func = op_subquery;
+		op->v.subquery = compile_query (db, data->subquery, FALSE);
+		if (op->v.subquery->time_relative)
+			*time_relative = TRUE;
+		return;
+	}
+
+	switch (qtype) {
+	case RHYTHMDB_QUERY_PROP_LIKE:
+	case RHYTHMDB_QUERY_PROP_NOT_LIKE:
+		if (data->propid == RHYTHMDB_PROP_KEYWORD) {
+			op->func = (qtype == RHYTHMDB_QUERY_PROP_LIKE) ? op_keyword_like : op_keyword_not_like;
+			op->v.string_val = g_value_dup_string (data->val);
+			op->owns_string = TRUE;
+			return;
+		} else if (data->propid == RHYTHMDB_PROP_SEARCH_MATCH) {
+			/* only the 'like' form is meaningful */
+			g_assert (qtype == RHYTHMDB_QUERY_PROP_LIKE);
+			op->func = op_search_match;
+			op->v.words = g_strdupv (g_value_get_boxed (data->val));
+			return;
+		}
+
+		/* 'like' criteria for non-string properties are treated as
+		 * 'equals' criteria.
+		 */
+		if (rhythmdb_get_property_type (db, data->propid) != G_TYPE_STRING)
+			qtype = RHYTHMDB_QUERY_PROP_EQUALS;
+		break;
+
+	case RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN:
+	case RHYTHMDB_QUERY_PROP_CURRENT_TIME_NOT_WITHIN:
+		g_assert (rhythmdb_get_property_type (db, data->propid) == G_TYPE_ULONG);
+
+		op->func = (qtype == RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN) ? op_time_within : op_time_not_within;
+		op->offset = ulong_field_offset (data->propid);
+		op->v.ulong_val = g_value_get_ulong (data->val);
+		*time_relative = TRUE;
+		return;
+
+	case RHYTHMDB_QUERY_PROP_EQUALS:
+	case RHYTHMDB_QUERY_PROP_GREATER:
+	case RHYTHMDB_QUERY_PROP_LESS:
+	case RHYTHMDB_QUERY_PROP_PREFIX:
+	case RHYTHMDB_QUERY_PROP_SUFFIX:
+		break;
+
+	default:
+		/* year criteria are converted to date criteria when the
+		 * query is preprocessed.
+		 */
+		g_assert_not_reached ();
+		break;
+	}
+
+	proptype = rhythmdb_get_property_type (db, data->propid);
+	switch (proptype) {
+	case G_TYPE_STRING:
+		op->string_kind = string_field_offset (data->propid, &op->offset);
+		op->v.string_val = g_value_dup_string (data->val);
+		op->owns_string = TRUE;
+		switch (qtype) {
+		case RHYTHMDB_QUERY_PROP_LIKE:
+			op->func = op_string_like;
+			break;
+		case RHYTHMDB_QUERY_PROP_NOT_LIKE:
+			op->func = op_string_not_like;
+			break;
+		case RHYTHMDB_QUERY_PROP_PREFIX:
+			op->func = op_string_prefix;
+			break;
+		case RHYTHMDB_QUERY_PROP_SUFFIX:
+			op->func = op_string_suffix;
+			break;
+		default:
+			SELECT_COMPARE_OP (op, qtype, string);
+			break;
+		}
+		break;
+	case G_TYPE_ULONG:
+		g_assert (qtype != RHYTHMDB_QUERY_PROP_PREFIX && qtype != RHYTHMDB_QUERY_PROP_SUFFIX);
+		op->offset = ulong_field_offset (data->propid);
+		op->v.ulong_val = g_value_get_ulong (data->val);
+		SELECT_COMPARE_OP (op, qtype, ulong);
+		break;
+	case G_TYPE_DOUBLE:
+		g_assert (qtype != RHYTHMDB_QUERY_PROP_PREFIX && qtype != RHYTHMDB_QUERY_PROP_SUFFIX);
+		if (data->propid == RHYTHMDB_PROP_RATING)
+			op->offset = G_STRUCT_OFFSET (RhythmDBEntry, rating);
+		op->v.double_val = g_value_get_double (data->val);
+		SELECT_COMPARE_OP (op, qtype, double);
+		break;
+	case G_TYPE_UINT64:
+		g_assert (qtype != RHYTHMDB_QUERY_PROP_PREFIX && qtype != RHYTHMDB_QUERY_PROP_SUFFIX);
+		if (data->propid == RHYTHMDB_PROP_FILE_SIZE)
+			op->offset = G_STRUCT_OFFSET (RhythmDBEntry, file_size);
+		op->v.uint64_val = g_value_get_uint64 (data->val);
+		SELECT_COMPARE_OP (op, qtype, uint64);
+		break;
+	case G_TYPE_BOOLEAN:
+		g_assert (qtype != RHYTHMDB_QUERY_PROP_PREFIX && qtype != RHYTHMDB_QUERY_PROP_SUFFIX);
+		op->v.boolean_val = g_value_get_boolean (data->val);
+		SELECT_COMPARE_OP (op, qtype, boolean);
+		break;
+	case G_TYPE_POINTER:
+		g_assert (qtype != RHYTHMDB_QUERY_PROP_PREFIX && qtype != RHYTHMDB_QUERY_PROP_SUFFIX);
+		if (data->propid == RHYTHMDB_PROP_TYPE)
+			op->offset = G_STRUCT_OFFSET (RhythmDBEntry, type);
+		op->v.pointer_val = g_value_get_pointer (data->val);
+		SELECT_COMPARE_OP (op, qtype, pointer);
+		break;
+	default:
+		g_warning ("Unexpected type: %s", g_type_name (proptype));
+		g_assert_not_reached ();
+	}
+}
+
+static RhythmDBCompiledQuery *
+compile_query (RhythmDB *db,
+	       GPtrArray *query,
+	       gboolean toplevel)
+{
+	RhythmDBCompiledQuery *compiled;
+	GArray *ops;
+	guint conjunction_start;
+	guint i;
+	guint j;
+
+	compiled = g_new0 (RhythmDBCompiledQuery, 1);
+	ops = g_array_sized_new (FALSE, TRUE, sizeof (RhythmDBCompiledOp), query->len + 1);
+
+	conjunction_start = 0;
+	for (i = 0; i <= query->len; i++) {
+		RhythmDBQueryData *data = NULL;
+		RhythmDBCompiledOp op = {0,};
+
+		if (i < query->len)
+			data = g_ptr_array_index (query, i);
+
+		if (data == NULL || data->type == RHYTHMDB_QUERY_DISJUNCTION) {
+			/* an empty final conjunction matches everything at the
+			 * top level, but is ignored in subqueries, unless it's
+			 * the only one.
+			 */
+			if (data == NULL &&
+			    ops->len == conjunction_start &&
+			    toplevel == FALSE &&
+			    conjunction_start > 0)
+				break;
+
+			/* terminate the conjunction and point its
+			 * operations at the next one.
+			 */
+			g_array_append_val (ops, op);
+			for (j = conjunction_start; j < ops->len; j++) {
+				g_array_index (ops, RhythmDBCompiledOp, j).next = ops->len;
+			}
+			conjunction_start = ops->len;
+			continue;
+		}
+
+		compile_criteria (db, data, &op, &compiled->time_relative);
+		g_array_append_val (ops, op);
+	}
+
+	compiled->n_ops = ops->len;
+	compiled->ops = (RhythmDBCompiledOp *) g_array_free (ops, FALSE);
+	return compiled;
+}
+
+static gboolean
+evaluate_compiled (RhythmDBCompiledQuery *query,
+		   RhythmDBEntry *entry,
+		   gulong now)
+{
+	guint i = 0;
+
+	while (i < query->n_ops) {
+		const RhythmDBCompiledOp *op = &query->ops[i];
+
+		/* reaching the end of a conjunction means it matched */
+		if (op->func == NULL)
+			return TRUE;
+
+		if (op->func (op, entry, now))
+			i++;
+		else
+			i = op->next;
+	}
+	return FALSE;
+}
+
+/**
+ * rhythmdb_query_compile:
+ * @db: a #RhythmDB instance
+ * @query: a preprocessed query
+ *
+ * Compiles a query into a form that can be evaluated against entries more
+ * quickly than the query itself.  The query must already have been
+ * preprocessed using #rhythmdb_query_preprocess.  The compiled query does
+ * not refer to the query, which can be freed or modified afterwards.
+ * It must not outlive @db.
+ *
+ * Return value: the compiled query, free with #rhythmdb_compiled_query_free.
+ */
+RhythmDBCompiledQuery *
+rhythmdb_query_compile (RhythmDB *db,
+			GPtrArray *query)
+{
+	g_return_val_if_fail (RHYTHMDB_IS (db), NULL);
+	g_return_val_if_fail (query != NULL, NULL);
+
+	return compile_query (db, query, TRUE);
+}
+
+/**
+ * rhythmdb_compiled_query_evaluate:
+ * @query: a compiled query
+ * @entry: a #RhythmDBEntry to evaluate the query against
+ *
+ * Evaluates a compiled query against an entry.  This gives the same
+ * result as evaluating the original query using #rhythmdb_evaluate_query.
+ *
+ * Return value: TRUE if the entry matches the query
+ */
+gboolean
+rhythmdb_compiled_query_evaluate (RhythmDBCompiledQuery *query,
+				  RhythmDBEntry *entry)
+{
+	GTimeVal current_time = {0,};
+
+	if (query->time_relative)
+		g_get_current_time (&current_time);
+
+	return evaluate_compiled (query, entry, current_time.tv_sec);
+}
+
+static gulong
+next_change_compiled (RhythmDBCompiledQuery *query,
+		      RhythmDBEntry *entry,
+		      gulong now)
+{
+	gulong next = 0;
+	guint i;
+
+	for (i = 0; i < query->n_ops; i++) {
+		const RhythmDBCompiledOp *op = &query->ops[i];
+		gulong change = 0;
+
+		if (op->func == op_subquery) {
+			if (op->v.subquery->time_relative)
+				change = next_change_compiled (op->v.subquery, entry, now);
+		} else if (op->func == op_time_within || op->func == op_time_not_within) {
+			gulong value = op_get_ulong (op, entry);
+
+			/* the comparison flips once now - window passes the value */
+			if (value < G_MAXULONG - op->v.ulong_val)
+				change = value + op->v.ulong_val + 1;
+			if (change <= now)
+				change = 0;
+		}
+
+		if (change != 0 && (next == 0 || change < next))
+			next = change;
+	}
+
+	return next;
+}
+
+/**
+ * rhythmdb_compiled_query_get_next_change:
+ * @query: a compiled query
+ * @entry: a #RhythmDBEntry
+ *
+ * Finds the next time at which the result of evaluating a time-relative
+ * query against an entry may change, assuming the entry itself doesn't
+ * change in the meantime.  The result doesn't change before the returned
+ * time, but may stay the same after it, in which case this should be
+ * called again then.
+ *
+ * Return value: the time (in seconds since the epoch) at which the result
+ * may change, or 0 if it can't change.
+ */
+gulong
+rhythmdb_compiled_query_get_next_change (RhythmDBCompiledQuery *query,
+					 RhythmDBEntry *entry)
+{
+	GTimeVal current_time;
+
+	if (query->time_relative == FALSE)
+		return 0;
+
+	g_get_current_time (&current_time);
+	return next_change_compiled (query, entry, current_time.tv_sec);
+}
+
+/**
+ * rhythmdb_compiled_query_free:
+ * @query: a compiled query
+ *
+ * Frees a compiled query.
+ */
+void
+rhythmdb_compiled_query_free (RhythmDBCompiledQuery *query)
+{
+	guint i;
+
+	if (query == NULL)
+		return;
+
+	for (i = 0; i < query->n_ops; i++) {
+		RhythmDBCompiledOp *op = &query->ops[i];
+
+		if (op->func == op_subquery) {
+			rhythmdb_compiled_query_free (op->v.subquery);
+		} else if (op->func == op_search_match) {
+			g_strfreev (op->v.words);
+		} else if (op->owns_string) {
+			g_free (op->v.string_val);
+		}
+	}
+
+	g_free (query->ops);
+	g_free (query);
+}
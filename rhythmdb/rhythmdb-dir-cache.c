@@ -0,0 +1,459 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+/*
+ * Modification times of directories holding files in the database.
+ *
+ * When a directory is enumerated, its modification time and the number of
+ * files in it are recorded, and the records are saved next to the database
+ * (rhythmdb.xml.dirs).  At startup, if a directory still has the recorded
+ * modification time, and the database holds as many entries for files in
+ * it as it had files, nothing has been added, removed or renamed in it, so
+ * the files in it don't need to be checked individually.
+ *
+ * Files rewritten in place don't change the modification time of their
+ * directory, so changes made that way are only picked up by the file
+ * monitors while we're running.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "rb-debug.h"
+#include "rhythmdb.h"
+#include "rhythmdb-private.h"
+
+#define RHYTHMDB_DIR_CACHE_SUFFIX	".dirs"
+#define RHYTHMDB_DIR_CACHE_HEADER	"rhythmdb-dirs 1\n"
+
+typedef struct {
+	guint64 mtime;
+	guint n_files;
+	gboolean seen;
+} RhythmDBDirInfo;
+
+static char *
+dir_cache_filename (RhythmDB *db)
+{
+	if (db->priv->name == NULL)
+		return NULL;
+	return g_strconcat (db->priv->name, RHYTHMDB_DIR_CACHE_SUFFIX, NULL);
+}
+
+static void
+free_dir_info (RhythmDBDirInfo *info)
+{
+	g_slice_free (RhythmDBDirInfo, info);
+}
+
+void
+rhythmdb_init_dir_cache (RhythmDB *db)
+{
+	db->priv->dir_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+						     g_free, (GDestroyNotify) free_dir_info);
+	db->priv->dir_entry_counts = g_hash_table_new_full (g_str_hash, g_str_equal,
+							    g_free, NULL);
+	db->priv->dir_cache_mutex = g_mutex_new ();
+}
+
+void
+rhythmdb_finalize_dir_cache (RhythmDB *db)
+{
+	g_hash_table_destroy (db->priv->dir_cache);
+	if (db->priv->dir_entry_counts != NULL)
+		g_hash_table_destroy (db->priv->dir_entry_counts);
+	g_mutex_free (db->priv->dir_cache_mutex);
+}
+
+/**
+ * rhythmdb_dir_cache_parent:
+ * @uri: a file URI
+ *
+ * Returns: the URI of the directory containing @uri, or NULL
+ */
+char *
+rhythmdb_dir_cache_parent (const char *uri)
+{
+	const char *slash;
+
+	slash = strrchr (uri, '/');
+	if (slash == NULL || slash == uri || slash[-1] == '/')
+		return NULL;
+	return g_strndup (uri, slash - uri);
+}
+
+/**
+ * rhythmdb_dir_cache_load:
+ * @db: the #RhythmDB
+ *
+ * Reads the saved directory records.  Called from the load thread,
+ * before the database contents are loaded.
+ */
+void
+rhythmdb_dir_cache_load (RhythmDB *db)
+{
+	char *filename;
+	char *contents;
+	char *line;
+	gsize len;
+	guint count = 0;
+
+	filename = dir_cache_filename (db);
+	if (filename == NULL)
+		return;
+
+	if (!g_file_get_contents (filename, &contents, &len, NULL)) {
+		rb_debug ("no directory records in %s", filename);
+		g_free (filename);
+		return;
+	}
+
+	if (!g_str_has_prefix (contents, RHYTHMDB_DIR_CACHE_HEADER)) {
+		rb_debug ("ignoring directory records in %s: unknown format", filename);
+		g_free (contents);
+		g_free (filename);
+		return;
+	}
+
+	g_mutex_lock (db->priv->dir_cache_mutex);
+	line = contents + strlen (RHYTHMDB_DIR_CACHE_HEADER);
+	while (*line != '\0') {
+		RhythmDBDirInfo *info;
+		char *end;
+		char *uri;
+		guint64 mtime;
+		guint64 n_files;
+
+		end = strchr (line, '\n');
+		if (end == NULL)
+			break;		/* truncated */
+		*end = '\0';
+
+		/* mtime, number of files, uri */
+		mtime = g_ascii_strtoull (line, &uri, 10);
+		if (*uri == ' ') {
+			n_files = g_ascii_strtoull (uri + 1, &uri, 10);
+			if (*uri == ' ' && uri[1] != '\0') {
+				info = g_slice_new0 (RhythmDBDirInfo);
+				info->mtime = mtime;
+				info->n_files = n_files;
+				g_hash_table_replace (db->priv->dir_cache, g_strdup (uri + 1), info);
+				count++;
+			}
+		}
+
+		line = end + 1;
+	}
+	db->priv->dir_cache_dirty = FALSE;
+	g_mutex_unlock (db->priv->dir_cache_mutex);
+
+	rb_debug ("loaded %u directory records from %s", count, filename);
+	g_free (contents);
+	g_free (filename);
+}
+
+static void
+append_dir_info (const char *uri, RhythmDBDirInfo *info, GString *str)
+{
+	g_string_append_printf (str, "%" G_GUINT64_FORMAT " %u %s\n", info->mtime, info->n_files, uri);
+}
+
+/**
+ * rhythmdb_dir_cache_save:
+ * @db: the #RhythmDB
+ *
+ * Writes out the directory records if they've changed since they
+ * were loaded or last saved.  Called from the save thread.
+ */
+void
+rhythmdb_dir_cache_save (RhythmDB *db)
+{
+	GError *error = NULL;
+	GString *str;
+	char *filename;
+
+	filename = dir_cache_filename (db);
+	if (filename == NULL)
+		return;
+
+	g_mutex_lock (db->priv->dir_cache_mutex);
+	if (db->priv->dir_cache_dirty == FALSE) {
+		g_mutex_unlock (db->priv->dir_cache_mutex);
+		g_free (filename);
+		return;
+	}
+
+	str = g_string_new (RHYTHMDB_DIR_CACHE_HEADER);
+	g_hash_table_foreach (db->priv->dir_cache, (GHFunc) append_dir_info, str);
+	db->priv->dir_cache_dirty = FALSE;
+	g_mutex_unlock (db->priv->dir_cache_mutex);
+
+	/* written to a temporary file and renamed over the old one */
+	if (!g_file_set_contents (filename, str->str, str->len, &error)) {
+		rb_debug ("unable to save directory records to %s: %s", filename, error->message);
+		g_error_free (error);
+	}
+
+	g_string_free (str, TRUE);
+	g_free (filename);
+}
+
+/**
+ * rhythmdb_dir_cache_count_entry:
+ * @db: the #RhythmDB
+ * @uri: location of an entry loaded from the database
+ *
+ * Counts an entry for a file towards the number of entries
+ * in its directory.  Only used while loading the database.
+ */
+void
+rhythmdb_dir_cache_count_entry (RhythmDB *db, const char *uri)
+{
+	char *dir;
+	guint count;
+
+	dir = rhythmdb_dir_cache_parent (uri);
+	if (dir == NULL)
+		return;
+
+	g_mutex_lock (db->priv->dir_cache_mutex);
+	if (db->priv->dir_entry_counts != NULL) {
+		count = GPOINTER_TO_UINT (g_hash_table_lookup (db->priv->dir_entry_counts, dir));
+		g_hash_table_replace (db->priv->dir_entry_counts, dir, GUINT_TO_POINTER (count + 1));
+		dir = NULL;
+	}
+	g_mutex_unlock (db->priv->dir_cache_mutex);
+	g_free (dir);
+}
+
+/**
+ * rhythmdb_dir_cache_record:
+ * @db: the #RhythmDB
+ * @uri: directory URI
+ * @mtime: modification time of the directory, read before enumerating it
+ * @scan_time: time the enumeration started
+ * @n_files: number of files found in the directory
+ *
+ * Records the state of a directory after enumerating it.
+ */
+void
+rhythmdb_dir_cache_record (RhythmDB *db, const char *uri, guint64 mtime, guint64 scan_time, guint n_files)
+{
+	RhythmDBDirInfo *info;
+
+	g_mutex_lock (db->priv->dir_cache_mutex);
+
+	/* something could have changed after we read the directory within
+	 * the same second, without changing the modification time again.
+	 */
+	if (mtime >= scan_time) {
+		rb_debug ("not recording %s: modified too recently", uri);
+		if (g_hash_table_remove (db->priv->dir_cache, uri))
+			db->priv->dir_cache_dirty = TRUE;
+		g_mutex_unlock (db->priv->dir_cache_mutex);
+		return;
+	}
+
+	info = g_hash_table_lookup (db->priv->dir_cache, uri);
+	if (info == NULL) {
+		info = g_slice_new0 (RhythmDBDirInfo);
+		g_hash_table_insert (db->priv->dir_cache, g_strdup (uri), info);
+	}
+	if (info->mtime != mtime || info->n_files != n_files) {
+		info->mtime = mtime;
+		info->n_files = n_files;
+		db->priv->dir_cache_dirty = TRUE;
+	}
+	info->seen = TRUE;
+
+	g_mutex_unlock (db->priv->dir_cache_mutex);
+}
+
+/**
+ * rhythmdb_dir_cache_scan:
+ * @db: the #RhythmDB
+ * @uri: directory URI
+ * @cancel: a #GCancellable
+ *
+ * Enumerates a directory to record its current state.
+ */
+void
+rhythmdb_dir_cache_scan (RhythmDB *db, const char *uri, GCancellable *cancel)
+{
+	GFileEnumerator *dir_enum;
+	GFileInfo *info;
+	GTimeVal now;
+	GFile *dir;
+	guint64 mtime;
+	guint n_files = 0;
+	GError *error = NULL;
+
+	g_get_current_time (&now);
+	dir = g_file_new_for_uri (uri);
+	info = g_file_query_info (dir,
+				  G_FILE_ATTRIBUTE_TIME_MODIFIED,
+				  G_FILE_QUERY_INFO_NONE,
+				  cancel,
+				  &error);
+	if (error != NULL) {
+		rb_debug ("unable to get modification time of %s: %s", uri, error->message);
+		g_error_free (error);
+		g_object_unref (dir);
+		return;
+	}
+	mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+	g_object_unref (info);
+
+	dir_enum = g_file_enumerate_children (dir,
+					      G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+					      G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN,
+					      G_FILE_QUERY_INFO_NONE,
+					      cancel,
+					      &error);
+	g_object_unref (dir);
+	if (error != NULL) {
+		rb_debug ("unable to enumerate children of %s: %s", uri, error->message);
+		g_error_free (error);
+		return;
+	}
+
+	while ((info = g_file_enumerator_next_file (dir_enum, cancel, &error)) != NULL) {
+		if (g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_STANDARD_TYPE) == G_FILE_TYPE_REGULAR &&
+		    g_file_info_get_attribute_boolean (info, G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN) == FALSE)
+			n_files++;
+		g_object_unref (info);
+	}
+	g_file_enumerator_close (dir_enum, NULL, NULL);
+	g_object_unref (dir_enum);
+
+	if (error != NULL) {
+		/* we don't know what we missed */
+		rb_debug ("error enumerating children of %s: %s", uri, error->message);
+		g_error_free (error);
+		return;
+	}
+
+	rhythmdb_dir_cache_record (db, uri, mtime, now.tv_sec, n_files);
+}
+
+/**
+ * rhythmdb_dir_cache_check:
+ * @db: the #RhythmDB
+ * @uri: directory URI
+ * @cancel: a #GCancellable
+ *
+ * Checks whether a directory is unchanged since it was recorded, and the
+ * database has an entry for each file in it.
+ *
+ * Returns: %TRUE if the files in the directory don't need to be checked
+ */
+gboolean
+rhythmdb_dir_cache_check (RhythmDB *db, const char *uri, GCancellable *cancel)
+{
+	RhythmDBDirInfo *info;
+	GFileInfo *file_info;
+	GFile *dir;
+	guint64 mtime;
+	guint n_files;
+	guint n_entries = 0;
+
+	g_mutex_lock (db->priv->dir_cache_mutex);
+	info = g_hash_table_lookup (db->priv->dir_cache, uri);
+	if (info == NULL) {
+		g_mutex_unlock (db->priv->dir_cache_mutex);
+		return FALSE;
+	}
+	info->seen = TRUE;
+	mtime = info->mtime;
+	n_files = info->n_files;
+	if (db->priv->dir_entry_counts != NULL)
+		n_entries = GPOINTER_TO_UINT (g_hash_table_lookup (db->priv->dir_entry_counts, uri));
+	g_mutex_unlock (db->priv->dir_cache_mutex);
+
+	if (n_entries != n_files) {
+		rb_debug ("%s had %u files, but there are %u entries for it", uri, n_files, n_entries);
+		return FALSE;
+	}
+
+	dir = g_file_new_for_uri (uri);
+	file_info = g_file_query_info (dir,
+				       G_FILE_ATTRIBUTE_TIME_MODIFIED,
+				       G_FILE_QUERY_INFO_NONE,
+				       cancel,
+				       NULL);
+	g_object_unref (dir);
+	if (file_info == NULL)
+		return FALSE;
+
+	if (g_file_info_get_attribute_uint64 (file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED) != mtime) {
+		rb_debug ("%s has been modified", uri);
+		g_object_unref (file_info);
+		return FALSE;
+	}
+
+	g_object_unref (file_info);
+	return TRUE;
+}
+
+static gboolean
+remove_unseen (const char *uri, RhythmDBDirInfo *info, RhythmDB *db)
+{
+	if (info->seen)
+		return FALSE;
+
+	db->priv->dir_cache_dirty = TRUE;
+	return TRUE;
+}
+
+/**
+ * rhythmdb_dir_cache_prune:
+ * @db: the #RhythmDB
+ *
+ * Forgets directories that weren't checked or enumerated since the
+ * database was loaded, as no entries refer to them any more, and frees
+ * the entry counts gathered while loading.  Called once all the files
+ * loaded from the database have been checked.
+ */
+void
+rhythmdb_dir_cache_prune (RhythmDB *db)
+{
+	guint removed;
+
+	g_mutex_lock (db->priv->dir_cache_mutex);
+	removed = g_hash_table_foreach_remove (db->priv->dir_cache, (GHRFunc) remove_unseen, db);
+	if (db->priv->dir_entry_counts != NULL) {
+		g_hash_table_destroy (db->priv->dir_entry_counts);
+		db->priv->dir_entry_counts = NULL;
+	}
+	g_mutex_unlock (db->priv->dir_cache_mutex);
+
+	rb_debug ("forgot %u directories", removed);
+}
@@ -0,0 +1,209 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+/*
+ * Slab allocation for database entries.
+ *
+ * Each entry type has its own pool.  Entries are carved out of large slabs
+ * so entries of the same type sit next to each other in memory, and freed
+ * entries go on a free list to be reused by the next entry of that type.
+ * Slabs are never returned to the system, as entry types live as long
+ * as the database.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "rb-debug.h"
+#include "rb-util.h"
+#include "rhythmdb-private.h"
+
+/* each slab holds at least this many entries */
+#define RHYTHMDB_ENTRY_POOL_MIN_SLAB_ENTRIES	16
+#define RHYTHMDB_ENTRY_POOL_SLAB_SIZE		(64 * 1024)
+#define RHYTHMDB_ENTRY_POOL_ALIGN		MAX (sizeof (gdouble), sizeof (gpointer))
+
+typedef struct _RhythmDBEntryPoolFree RhythmDBEntryPoolFree;
+struct _RhythmDBEntryPoolFree
+{
+	RhythmDBEntryPoolFree *next;
+};
+
+struct _RhythmDBEntryPool
+{
+	GMutex *lock;
+
+	gsize entry_size;
+	gsize slab_entries;
+	GSList *slabs;
+
+	/* unused space at the end of the newest slab */
+	char *next;
+	char *end;
+
+	RhythmDBEntryPoolFree *free_list;
+
+	guint n_slabs;
+	guint n_entries;
+	guint n_free;
+};
+
+RhythmDBEntryPool *
+rhythmdb_entry_pool_new (void)
+{
+	RhythmDBEntryPool *pool;
+
+	pool = g_new0 (RhythmDBEntryPool, 1);
+	pool->lock = g_mutex_new ();
+	return pool;
+}
+
+/* must be called with the pool lock held */
+static void
+rhythmdb_entry_pool_add_slab (RhythmDBEntryPool *pool)
+{
+	char *slab;
+	gsize slab_size;
+
+	slab_size = pool->entry_size * pool->slab_entries;
+	slab = g_malloc (slab_size);
+	pool->slabs = g_slist_prepend (pool->slabs, slab);
+	pool->next = slab;
+	pool->end = slab + slab_size;
+	pool->n_slabs++;
+}
+
+/**
+ * rhythmdb_entry_pool_alloc:
+ * @pool: a #RhythmDBEntryPool
+ * @size: size of an entry, including its type-specific data
+ *
+ * Allocates zeroed memory for an entry.  All entries allocated from a pool
+ * must be the same size.
+ *
+ * Return value: the new entry memory
+ */
+gpointer
+rhythmdb_entry_pool_alloc (RhythmDBEntryPool *pool,
+			   gsize size)
+{
+	gpointer ret;
+
+	g_mutex_lock (pool->lock);
+
+	if (G_UNLIKELY (pool->entry_size == 0)) {
+		/* keep the entries' pointer and double fields aligned */
+		pool->entry_size = MAX (sizeof (RhythmDBEntryPoolFree),
+					(size + RHYTHMDB_ENTRY_POOL_ALIGN - 1) & ~(RHYTHMDB_ENTRY_POOL_ALIGN - 1));
+		pool->slab_entries = MAX (RHYTHMDB_ENTRY_POOL_MIN_SLAB_ENTRIES,
+					  RHYTHMDB_ENTRY_POOL_SLAB_SIZE / pool->entry_size);
+	}
+	g_assert (size <= pool->entry_size);
+
+	if (pool->free_list != NULL) {
+		ret = pool->free_list;
+		pool->free_list = pool->free_list->next;
+		pool->n_free--;
+	} else {
+		if (pool->next == pool->end)
+			rhythmdb_entry_pool_add_slab (pool);
+		ret = pool->next;
+		pool->next += pool->entry_size;
+	}
+	pool->n_entries++;
+
+	g_mutex_unlock (pool->lock);
+
+	memset (ret, 0, pool->entry_size);
+	return ret;
+}
+
+/**
+ * rhythmdb_entry_pool_free:
+ * @pool: the #RhythmDBEntryPool the entry was allocated from
+ * @entry: entry memory to free
+ *
+ * Returns an entry to the pool's free list.
+ */
+void
+rhythmdb_entry_pool_free (RhythmDBEntryPool *pool,
+			  gpointer entry)
+{
+	RhythmDBEntryPoolFree *node = entry;
+
+	g_mutex_lock (pool->lock);
+	node->next = pool->free_list;
+	pool->free_list = node;
+	pool->n_free++;
+	pool->n_entries--;
+	g_mutex_unlock (pool->lock);
+}
+
+/**
+ * rhythmdb_entry_pool_get_usage:
+ * @pool: a #RhythmDBEntryPool
+ * @n_entries: returns the number of entries allocated from the pool
+ * @entry_size: returns the size of each entry in the pool
+ * @bytes: returns the total size of the pool's slabs
+ *
+ * Returns the memory allocated for the pool's slabs, and the entries
+ * using it.
+ */
+void
+rhythmdb_entry_pool_get_usage (RhythmDBEntryPool *pool,
+			       guint *n_entries,
+			       gsize *entry_size,
+			       gsize *bytes)
+{
+	g_mutex_lock (pool->lock);
+	*n_entries = pool->n_entries;
+	*entry_size = pool->entry_size;
+	*bytes = pool->n_slabs * pool->entry_size * pool->slab_entries;
+	g_mutex_unlock (pool->lock);
+}
+
+/**
+ * rhythmdb_entry_pool_report:
+ * @pool: a #RhythmDBEntryPool
+ * @name: name of the entry type, for the report
+ *
+ * Logs the memory allocated for the pool's slabs.
+ */
+void
+rhythmdb_entry_pool_report (RhythmDBEntryPool *pool,
+			    const char *name)
+{
+	guint n_entries;
+	gsize entry_size;
+	gsize bytes;
+
+	rhythmdb_entry_pool_get_usage (pool, &n_entries, &entry_size, &bytes);
+	rb_debug ("%s: %u entries of %" G_GSIZE_FORMAT " bytes in %" G_GSIZE_FORMAT " bytes of slabs",
+		  name, n_entries, entry_size, bytes);
+}
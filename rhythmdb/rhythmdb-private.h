@@ -64,6 +64,25 @@ enum {
 	RHYTHMDB_ENTRY_PRIVATE_FLAG_BASE = 65536,
 };
 
+/* Entry data that is seldom used by queries or sorting.  This is kept out
+ * of the main entry structure so that scans over entries touch less memory,
+ * and is only allocated when one of the fields is set.
+ */
+typedef struct {
+	RBRefString *musicbrainz_trackid;
+	RBRefString *musicbrainz_artistid;
+	RBRefString *musicbrainz_albumid;
+	RBRefString *musicbrainz_albumartistid;
+
+	/* cached data */
+	gpointer last_played_str;
+	gpointer first_seen_str;
+	gpointer last_seen_str;
+
+	/* playback error string */
+	RBRefString *playback_error;
+} RhythmDBEntryColdFields;
+
 struct RhythmDBEntry_ {
 	/* internal bits */
 	guint flags;
@@ -77,10 +96,6 @@ struct RhythmDBEntry_ {
 	RBRefString *artist;
 	RBRefString *album;
 	RBRefString *genre;
-	RBRefString *musicbrainz_trackid;
-	RBRefString *musicbrainz_artistid;
-	RBRefString *musicbrainz_albumid;
-	RBRefString *musicbrainz_albumartistid;
 	RBRefString *artist_sortname;
 	RBRefString *album_sortname;
 	gulong tracknum;
@@ -103,13 +118,8 @@ struct RhythmDBEntry_ {
 	glong play_count;
 	gulong last_played;
 
-	/* cached data */
-	gpointer last_played_str;
-	gpointer first_seen_str;
-	gpointer last_seen_str;
-
-	/* playback error string */
-	RBRefString *playback_error;
+	/* rarely used data, see rhythmdb_entry_get_cold_fields */
+	RhythmDBEntryColdFields *cold;
 };
 
 struct _RhythmDBPrivate
@@ -123,6 +133,12 @@ struct _RhythmDBPrivate
 	GMutex *metadata_lock;
 	GCond *metadata_cond;
 
+	guint metadata_workers;
+	GThreadPool *load_thread_pool;
+	GMutex *load_mutex;
+	GCond *load_cond;
+	GHashTable *loading_uris;	/* uri -> GQueue of deferred load actions */
+
 	xmlChar **column_xml_names;
 
 	RBRefString *empty_string;
@@ -140,6 +156,13 @@ struct _RhythmDBPrivate
 	GList *outstanding_stats;
 	GMutex *stat_mutex;
 	gboolean stat_thread_running;
+	gint stat_total;
+	gint stat_done;
+
+	GHashTable *dir_cache;		/* directory uri -> recorded mtime and file count */
+	GHashTable *dir_entry_counts;	/* directory uri -> entries loaded for files in it */
+	GMutex *dir_cache_mutex;
+	gboolean dir_cache_dirty;
 
 	GVolumeMonitor *volume_monitor;
 	GHashTable *monitored_directories;
@@ -152,11 +175,16 @@ struct _RhythmDBPrivate
 
 	gboolean dry_run;
 	gboolean no_update;
+	gboolean precompute_keys;
+	gboolean profile_queries;
 
 	GMutex *change_mutex;
 	GHashTable *added_entries;
 	GHashTable *changed_entries;
 	GHashTable *deleted_entries;
+	GHashTable *journal_entries;	/* entry -> RhythmDBJournalOp, changes since the last save */
+	guint64 generation;		/* bumped by each commit that changes anything */
+	guint64 emitted_generation;	/* generation of the changes signalled so far */
 
 	GHashTable *propname_map;
 
@@ -187,6 +215,12 @@ struct _RhythmDBPrivate
 	gint next_entry_id;
 };
 
+typedef enum
+{
+	RHYTHMDB_JOURNAL_ENTRY_CHANGED = 1,
+	RHYTHMDB_JOURNAL_ENTRY_DELETED
+} RhythmDBJournalOp;
+
 typedef struct
 {
 	enum {
@@ -211,10 +245,12 @@ typedef struct
 
 	/* STAT */
 	GFileInfo *file_info;
+	gboolean unchanged;	/* not checked, as its directory is unchanged */
 	/* LOAD */
 	RBMetaData *metadata;
 	/* QUERY_COMPLETE */
 	RhythmDBQueryResults *results;
+	gpointer query_data;
 	/* ENTRY_SET */
 	RhythmDBEntry *entry;
 	/* ENTRY_SET */
@@ -229,7 +265,12 @@ void rhythmdb_entry_set_internal (RhythmDB *db, RhythmDBEntry *entry,
 				  gboolean notify_if_inserted, guint propid,
 				  const GValue *value);
 void rhythmdb_entry_type_foreach (RhythmDB *db, GHFunc func, gpointer data);
+RhythmDBEntryColdFields *rhythmdb_entry_get_cold_fields (RhythmDBEntry *entry, gboolean create);
 RhythmDBEntry *	rhythmdb_entry_lookup_by_location_refstring (RhythmDB *db, RBRefString *uri);
+GHashTable *	rhythmdb_journal_take (RhythmDB *db, guint64 *generation);
+void		rhythmdb_journal_clear (RhythmDB *db);
+void		rhythmdb_set_generation (RhythmDB *db, guint64 generation);
+void		rhythmdb_unblock_metadata (RhythmDB *db);
 
 /* from rhythmdb-monitor.c */
 void rhythmdb_init_monitoring (RhythmDB *db);
@@ -239,6 +280,44 @@ void rhythmdb_stop_monitoring (RhythmDB *db);
 void rhythmdb_start_monitoring (RhythmDB *db);
 void rhythmdb_monitor_uri_path (RhythmDB *db, const char *uri, GError **error);
 
+/* from rhythmdb-dir-cache.c */
+void	 rhythmdb_init_dir_cache (RhythmDB *db);
+void	 rhythmdb_finalize_dir_cache (RhythmDB *db);
+char	*rhythmdb_dir_cache_parent (const char *uri);
+void	 rhythmdb_dir_cache_load (RhythmDB *db);
+void	 rhythmdb_dir_cache_save (RhythmDB *db);
+void	 rhythmdb_dir_cache_count_entry (RhythmDB *db, const char *uri);
+void	 rhythmdb_dir_cache_record (RhythmDB *db, const char *uri, guint64 mtime, guint64 scan_time, guint n_files);
+void	 rhythmdb_dir_cache_scan (RhythmDB *db, const char *uri, GCancellable *cancel);
+gboolean rhythmdb_dir_cache_check (RhythmDB *db, const char *uri, GCancellable *cancel);
+void	 rhythmdb_dir_cache_prune (RhythmDB *db);
+
+/* from rhythmdb-entry-pool.c */
+typedef struct _RhythmDBEntryPool RhythmDBEntryPool;
+
+RhythmDBEntryPool *rhythmdb_entry_pool_new (void);
+gpointer   rhythmdb_entry_pool_alloc (RhythmDBEntryPool *pool, gsize size);
+void       rhythmdb_entry_pool_free (RhythmDBEntryPool *pool, gpointer entry);
+void       rhythmdb_entry_pool_get_usage (RhythmDBEntryPool *pool, guint *n_entries, gsize *entry_size, gsize *bytes);
+void       rhythmdb_entry_pool_report (RhythmDBEntryPool *pool, const char *name);
+
+/* entry types are allocated with room for the pool their entries come from */
+typedef struct {
+	RhythmDBEntryType_ type;
+	RhythmDBEntryPool *pool;
+} RhythmDBEntryTypePrivate;
+
+#define RHYTHMDB_ENTRY_TYPE_GET_POOL(t) (((RhythmDBEntryTypePrivate *) (t))->pool)
+
+/* from rhythmdb-word-index.c */
+typedef struct _RhythmDBWordIndex RhythmDBWordIndex;
+
+RhythmDBWordIndex *rhythmdb_word_index_new (void);
+void       rhythmdb_word_index_free (RhythmDBWordIndex *index);
+void       rhythmdb_word_index_add (RhythmDBWordIndex *index, RBRefString *string, RhythmDBEntry *entry);
+void       rhythmdb_word_index_remove (RhythmDBWordIndex *index, RBRefString *string, RhythmDBEntry *entry);
+GHashTable *rhythmdb_word_index_lookup (RhythmDBWordIndex *index, const char *word);
+
 /* from rhythmdb-query.c */
 GPtrArray *rhythmdb_query_parse_valist (RhythmDB *db, va_list args);
 void       rhythmdb_read_encoded_property (RhythmDB *db, const char *data, RhythmDBPropType propid, GValue *val);
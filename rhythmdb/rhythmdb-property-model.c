@@ -353,10 +353,93 @@ _add_entry_cb (GtkTreeModel *model,
 	return FALSE;
 }
 
+static void
+rhythmdb_property_model_connect_query_model (RhythmDBPropertyModel *model)
+{
+	g_signal_connect_object (model->priv->query_model,
+				 "row_inserted",
+				 G_CALLBACK (rhythmdb_property_model_row_inserted_cb),
+				 model,
+				 0);
+	g_signal_connect_object (model->priv->query_model,
+				 "post-entry-delete",
+				 G_CALLBACK (rhythmdb_property_model_entry_removed_cb),
+				 model,
+				 0);
+	g_signal_connect_object (model->priv->query_model,
+				 "entry-prop-changed",
+				 G_CALLBACK (rhythmdb_property_model_prop_changed_cb),
+				 model,
+				 0);
+}
+
+/* applies the differences between the old and new query models,
+ * rather than removing every entry in the old model and adding every
+ * entry in the new one.  entries in both models are left alone, so
+ * switching between overlapping models (such as when changing the
+ * browser selection) only updates the properties that change.
+ */
+static void
+rhythmdb_property_model_apply_delta (RhythmDBPropertyModel *model,
+				     RhythmDBQueryModel *old_model,
+				     RhythmDBQueryModel *new_model)
+{
+	GtkTreeIter iter;
+	GtkTreeIter other;
+	RhythmDBEntry *entry;
+
+	if (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (old_model), &iter)) {
+		do {
+			entry = rhythmdb_query_model_iter_to_entry (old_model, &iter);
+			if (rhythmdb_query_model_entry_to_iter (new_model, entry, &other) == FALSE) {
+				/* hidden entries aren't counted */
+				if (g_hash_table_remove (model->priv->entries, entry) == FALSE)
+					rhythmdb_property_model_delete (model, entry);
+			}
+			rhythmdb_entry_unref (entry);
+		} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (old_model), &iter));
+	}
+
+	if (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (new_model), &iter)) {
+		do {
+			entry = rhythmdb_query_model_iter_to_entry (new_model, &iter);
+			if (rhythmdb_query_model_entry_to_iter (old_model, entry, &other) == FALSE)
+				rhythmdb_property_model_insert (model, entry);
+			rhythmdb_entry_unref (entry);
+		} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (new_model), &iter));
+	}
+
+	rhythmdb_property_model_sync (model);
+}
+
 static void
 rhythmdb_property_model_set_query_model_internal (RhythmDBPropertyModel *model,
 						  RhythmDBQueryModel    *query_model)
 {
+	RhythmDBQueryModel *old_model = model->priv->query_model;
+
+	if (old_model != NULL && query_model != NULL) {
+		if (old_model == query_model)
+			return;
+
+		g_signal_handlers_disconnect_by_func (old_model,
+						      G_CALLBACK (rhythmdb_property_model_row_inserted_cb),
+						      model);
+		g_signal_handlers_disconnect_by_func (old_model,
+						      G_CALLBACK (rhythmdb_property_model_entry_removed_cb),
+						      model);
+		g_signal_handlers_disconnect_by_func (old_model,
+						      G_CALLBACK (rhythmdb_property_model_prop_changed_cb),
+						      model);
+
+		rhythmdb_property_model_apply_delta (model, old_model, query_model);
+
+		model->priv->query_model = g_object_ref (query_model);
+		g_object_unref (old_model);
+		rhythmdb_property_model_connect_query_model (model);
+		return;
+	}
+
 	if (model->priv->query_model != NULL) {
 		g_signal_handlers_disconnect_by_func (model->priv->query_model,
 						      G_CALLBACK (rhythmdb_property_model_row_inserted_cb),
@@ -381,21 +464,7 @@ rhythmdb_property_model_set_query_model_internal (RhythmDBPropertyModel *model,
 	if (model->priv->query_model != NULL) {
 		g_object_ref (model->priv->query_model);
 
-		g_signal_connect_object (model->priv->query_model,
-					 "row_inserted",
-					 G_CALLBACK (rhythmdb_property_model_row_inserted_cb),
-					 model,
-					 0);
-		g_signal_connect_object (model->priv->query_model,
-					 "post-entry-delete",
-					 G_CALLBACK (rhythmdb_property_model_entry_removed_cb),
-					 model,
-					 0);
-		g_signal_connect_object (model->priv->query_model,
-					 "entry-prop-changed",
-					 G_CALLBACK (rhythmdb_property_model_prop_changed_cb),
-					 model,
-					 0);
+		rhythmdb_property_model_connect_query_model (model);
 		gtk_tree_model_foreach (GTK_TREE_MODEL (model->priv->query_model),
 					(GtkTreeModelForeachFunc)_add_entry_cb,
 					model);
@@ -79,12 +79,20 @@ static void rhythmdb_query_model_get_property (GObject *object,
 static void rhythmdb_query_model_do_insert (RhythmDBQueryModel *model,
 					    RhythmDBEntry *entry,
 					    gint index);
+static void rhythmdb_query_model_do_insert_bulk (RhythmDBQueryModel *model,
+						 GPtrArray *entries);
 static void rhythmdb_query_model_entry_added_cb (RhythmDB *db, RhythmDBEntry *entry,
 						 RhythmDBQueryModel *model);
 static void rhythmdb_query_model_entry_changed_cb (RhythmDB *db, RhythmDBEntry *entry,
 						   GValueArray *changes, RhythmDBQueryModel *model);
 static void rhythmdb_query_model_entry_deleted_cb (RhythmDB *db, RhythmDBEntry *entry,
 						   RhythmDBQueryModel *model);
+static void rhythmdb_query_model_entries_added_cb (RhythmDB *db, GPtrArray *entries,
+						   RhythmDBQueryModel *model);
+static void rhythmdb_query_model_entries_changed_cb (RhythmDB *db, GPtrArray *entries,
+						     GPtrArray *changes, RhythmDBQueryModel *model);
+static void rhythmdb_query_model_entries_deleted_cb (RhythmDB *db, GPtrArray *entries,
+						     RhythmDBQueryModel *model);
 
 static void rhythmdb_query_model_filter_out_entry (RhythmDBQueryModel *model,
 						   RhythmDBEntry *entry);
@@ -171,7 +179,19 @@ static int rhythmdb_query_model_child_index_to_base_index (RhythmDBQueryModel *m
 static gint _reverse_sorting_func (gpointer a, gpointer b, struct ReverseSortData *model);
 static gboolean rhythmdb_query_model_within_limit (RhythmDBQueryModel *model,
 						   RhythmDBEntry *entry);
-static gboolean rhythmdb_query_model_reapply_query_cb (RhythmDBQueryModel *model);
+static void rhythmdb_query_model_reset_expiry (RhythmDBQueryModel *model);
+static void rhythmdb_query_model_schedule_entry (RhythmDBQueryModel *model,
+						 RhythmDBEntry *entry);
+static void rhythmdb_query_model_unschedule_entry (RhythmDBQueryModel *model,
+						   RhythmDBEntry *entry);
+static void rhythmdb_query_model_cancel_candidates (RhythmDBQueryModel *model);
+
+typedef struct {
+	gulong time;
+	RhythmDBEntry *entry;
+} RhythmDBQueryModelExpiry;
+
+static void rhythmdb_query_model_expiry_free (RhythmDBQueryModelExpiry *expiry);
 
 struct RhythmDBQueryModelUpdate
 {
@@ -220,6 +240,7 @@ struct _RhythmDBQueryModelPrivate
 
 	GPtrArray *query;
 	GPtrArray *original_query;
+	RhythmDBCompiledQuery *compiled_query;
 
 	guint stamp;
 
@@ -236,13 +257,36 @@ struct _RhythmDBQueryModelPrivate
 	GHashTable *hidden_entry_map;
 
 	gint pending_update_count;
+	GCancellable *cancellable;
 
 	gboolean reorder_drag_and_drop;
 	gboolean show_hidden;
 
-	gint query_reapply_timeout_id;
+	/* time-relative queries: entries whose match state will change,
+	 * ordered by the time at which it changes.
+	 */
+	gboolean time_relative;
+	GSequence *expiry_queue;
+	GHashTable *expiry_map;
+	guint expiry_id;
+	gulong expiry_time;
+	RhythmDBQueryModel *candidate_model;
+
+	/* while frozen, database changes are ignored.  frozen_generation
+	 * is the database generation the model was frozen at.
+	 */
+	gboolean frozen;
+	guint64 frozen_generation;
+
+	/* insert costs for query profiling */
+	guint profile_chunks;
+	guint profile_inserted;
+	gdouble profile_insert_time;
 };
 
+/* the longest time-relative expiry timeout, in seconds */
+#define RHYTHMDB_QUERY_MODEL_MAX_EXPIRY_DELAY	(24 * 60 * 60)
+
 #define RHYTHMDB_QUERY_MODEL_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), RHYTHMDB_TYPE_QUERY_MODEL, RhythmDBQueryModelPrivate))
 
 enum
@@ -258,6 +302,7 @@ enum
 	PROP_LIMIT_VALUE,
 	PROP_SHOW_HIDDEN,
 	PROP_BASE_MODEL,
+	PROP_CANCELLABLE,
 };
 
 enum
@@ -390,6 +435,21 @@ rhythmdb_query_model_class_init (RhythmDBQueryModelClass *klass)
 							      "base RhythmDBQueryModel",
 							      RHYTHMDB_TYPE_QUERY_MODEL,
 							      G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+	/**
+	 * RhythmDBQueryModel:cancellable:
+	 *
+	 * If set, results from the query populating the model are discarded
+	 * once this is cancelled, and the RhythmDBQueryModel::complete signal
+	 * is not emitted.  Used for queries that have been superseded by newer
+	 * ones before they finished.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_CANCELLABLE,
+					 g_param_spec_object ("cancellable",
+							      "cancellable",
+							      "GCancellable for the query populating the model",
+							      G_TYPE_CANCELLABLE,
+							      G_PARAM_READWRITE));
 
 	/**
 	 * RhythmDBQueryModel::entry-prop-changed:
@@ -557,18 +617,16 @@ rhythmdb_query_model_set_query_internal (RhythmDBQueryModel *model,
 	model->priv->original_query = rhythmdb_query_copy (model->priv->query);
 	rhythmdb_query_preprocess (model->priv->db, model->priv->query);
 
-	/* if the query contains time-relative criteria, re-run it periodically.
-	 * currently it's just every minute, but perhaps it could be smarter.
+	rhythmdb_compiled_query_free (model->priv->compiled_query);
+	model->priv->compiled_query = NULL;
+	if (model->priv->query != NULL)
+		model->priv->compiled_query = rhythmdb_query_compile (model->priv->db, model->priv->query);
+
+	/* if the query contains time-relative criteria, track when each
+	 * entry will move in or out of the time window.
 	 */
-	if (rhythmdb_query_is_time_relative (model->priv->db, model->priv->query)) {
-		if (model->priv->query_reapply_timeout_id == 0) {
-			model->priv->query_reapply_timeout_id =
-				g_timeout_add_seconds (60, (GSourceFunc) rhythmdb_query_model_reapply_query_cb, model);
-		}
-	} else if (model->priv->query_reapply_timeout_id) {
-		g_source_remove (model->priv->query_reapply_timeout_id);
-		model->priv->query_reapply_timeout_id = 0;
-	}
+	model->priv->time_relative = rhythmdb_query_is_time_relative (model->priv->db, model->priv->query);
+	rhythmdb_query_model_reset_expiry (model);
 }
 
 static void
@@ -615,6 +673,11 @@ rhythmdb_query_model_set_property (GObject *object,
 	case PROP_BASE_MODEL:
 		rhythmdb_query_model_chain (model, g_value_get_object (value), TRUE);
 		break;
+	case PROP_CANCELLABLE:
+		if (model->priv->cancellable)
+			g_object_unref (model->priv->cancellable);
+		model->priv->cancellable = g_value_dup_object (value);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -660,6 +723,9 @@ rhythmdb_query_model_get_property (GObject *object,
 	case PROP_BASE_MODEL:
 		g_value_set_object (value, model->priv->base_model);
 		break;
+	case PROP_CANCELLABLE:
+		g_value_set_object (value, model->priv->cancellable);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -690,6 +756,9 @@ rhythmdb_query_model_init (RhythmDBQueryModel *model)
 							       (GDestroyNotify)rhythmdb_entry_unref,
 							       NULL);
 
+	model->priv->expiry_queue = g_sequence_new ((GDestroyNotify) rhythmdb_query_model_expiry_free);
+	model->priv->expiry_map = g_hash_table_new (g_direct_hash, g_direct_equal);
+
 	model->priv->reorder_drag_and_drop = FALSE;
 }
 
@@ -702,16 +771,16 @@ rhythmdb_query_model_constructed (GObject *object)
 	model = RHYTHMDB_QUERY_MODEL (object);
 
 	g_signal_connect_object (G_OBJECT (model->priv->db),
-				 "entry_added",
-				 G_CALLBACK (rhythmdb_query_model_entry_added_cb),
+				 "entries_added",
+				 G_CALLBACK (rhythmdb_query_model_entries_added_cb),
 				 model, 0);
 	g_signal_connect_object (G_OBJECT (model->priv->db),
-				 "entry_changed",
-				 G_CALLBACK (rhythmdb_query_model_entry_changed_cb),
+				 "entries_changed",
+				 G_CALLBACK (rhythmdb_query_model_entries_changed_cb),
 				 model, 0);
 	g_signal_connect_object (G_OBJECT (model->priv->db),
-				 "entry_deleted",
-				 G_CALLBACK (rhythmdb_query_model_entry_deleted_cb),
+				 "entries_deleted",
+				 G_CALLBACK (rhythmdb_query_model_entries_deleted_cb),
 				 model, 0);
 }
 
@@ -755,9 +824,15 @@ rhythmdb_query_model_dispose (GObject *object)
 		model->priv->base_model = NULL;
 	}
 
-	if (model->priv->query_reapply_timeout_id != 0) {
-		g_source_remove (model->priv->query_reapply_timeout_id);
-		model->priv->query_reapply_timeout_id = 0;
+	if (model->priv->expiry_id != 0) {
+		g_source_remove (model->priv->expiry_id);
+		model->priv->expiry_id = 0;
+	}
+	rhythmdb_query_model_cancel_candidates (model);
+
+	if (model->priv->cancellable != NULL) {
+		g_object_unref (model->priv->cancellable);
+		model->priv->cancellable = NULL;
 	}
 
 	G_OBJECT_CLASS (rhythmdb_query_model_parent_class)->dispose (object);
@@ -785,10 +860,14 @@ rhythmdb_query_model_finalize (GObject *object)
 
 	g_hash_table_destroy (model->priv->hidden_entry_map);
 
+	g_hash_table_destroy (model->priv->expiry_map);
+	g_sequence_free (model->priv->expiry_queue);
+
 	if (model->priv->query)
 		rhythmdb_query_free (model->priv->query);
 	if (model->priv->original_query)
 		rhythmdb_query_free (model->priv->original_query);
+	rhythmdb_compiled_query_free (model->priv->compiled_query);
 
 	if (model->priv->sort_data_destroy && model->priv->sort_data)
 		model->priv->sort_data_destroy (model->priv->sort_data);
@@ -851,13 +930,20 @@ rhythmdb_query_model_new_empty (RhythmDB *db)
 			     "db", db, NULL);
 }
 
+struct RhythmDBQueryModelCopyData
+{
+	RhythmDBQueryModel *dest;
+	GPtrArray *entries;
+};
+
 static void
-_copy_contents_foreach_cb (RhythmDBEntry *entry, RhythmDBQueryModel *dest)
+_copy_contents_foreach_cb (RhythmDBEntry *entry, struct RhythmDBQueryModelCopyData *data)
 {
+	RhythmDBQueryModel *dest = data->dest;
+
 	if (dest->priv->query == NULL ||
-	    rhythmdb_evaluate_query (dest->priv->db, dest->priv->query, entry)) {
-		if (dest->priv->show_hidden || (rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN) == FALSE))
-			rhythmdb_query_model_do_insert (dest, entry, -1);
+	    rhythmdb_compiled_query_evaluate (dest->priv->compiled_query, entry)) {
+		g_ptr_array_add (data->entries, entry);
 	}
 }
 
@@ -866,16 +952,26 @@ _copy_contents_foreach_cb (RhythmDBEntry *entry, RhythmDBQueryModel *dest)
  * @dest: destination #RhythmDBQueryModel
  * @src: source #RhythmDBQueryModel
  *
- * Copies all entries from @src to @dest.
+ * Copies all entries from @src to @dest.  If @dest has a query, only
+ * the entries that match it are copied.
  */
 void
 rhythmdb_query_model_copy_contents (RhythmDBQueryModel *dest,
 				    RhythmDBQueryModel *src)
 {
+	struct RhythmDBQueryModelCopyData data;
+
 	if (src->priv->entries == NULL)
 		return;
 
-	g_sequence_foreach (src->priv->entries, (GFunc)_copy_contents_foreach_cb, dest);
+	/* filter the source entries first, then insert the matches
+	 * in one go, rather than finding a position for each one.
+	 */
+	data.dest = dest;
+	data.entries = g_ptr_array_sized_new (g_sequence_get_length (src->priv->entries));
+	g_sequence_foreach (src->priv->entries, (GFunc)_copy_contents_foreach_cb, &data);
+	rhythmdb_query_model_do_insert_bulk (dest, data.entries);
+	g_ptr_array_free (data.entries, TRUE);
 }
 
 /**
@@ -961,6 +1057,50 @@ rhythmdb_query_model_chain (RhythmDBQueryModel *model,
 	}
 }
 
+/**
+ * rhythmdb_query_model_freeze:
+ * @model: a #RhythmDBQueryModel
+ *
+ * Stops @model from following changes to the database, so models that
+ * are kept around but aren't being used don't have to process every
+ * change.  Use #rhythmdb_query_model_thaw to find out whether the
+ * contents are still current and follow changes again.
+ */
+void
+rhythmdb_query_model_freeze (RhythmDBQueryModel *model)
+{
+	if (model->priv->frozen)
+		return;
+
+	model->priv->frozen = TRUE;
+	model->priv->frozen_generation = rhythmdb_get_generation (model->priv->db);
+	g_signal_handlers_block_matched (model->priv->db, G_SIGNAL_MATCH_DATA,
+					 0, 0, NULL, NULL, model);
+}
+
+/**
+ * rhythmdb_query_model_thaw:
+ * @model: a #RhythmDBQueryModel
+ *
+ * Makes a model frozen with #rhythmdb_query_model_freeze follow changes
+ * to the database again.  Any changes made while it was frozen are not
+ * applied to it.
+ *
+ * Return value: %TRUE if the database hasn't changed since the model
+ * was frozen, so its contents are still current
+ */
+gboolean
+rhythmdb_query_model_thaw (RhythmDBQueryModel *model)
+{
+	if (model->priv->frozen == FALSE)
+		return TRUE;
+
+	model->priv->frozen = FALSE;
+	g_signal_handlers_unblock_matched (model->priv->db, G_SIGNAL_MATCH_DATA,
+					   0, 0, NULL, NULL, model);
+	return (rhythmdb_get_generation (model->priv->db) == model->priv->frozen_generation);
+}
+
 /**
  * rhythmdb_query_model_has_pending_changes:
  * @model: a #RhythmDBQueryModel
@@ -1001,7 +1141,7 @@ rhythmdb_query_model_entry_added_cb (RhythmDB *db,
 	}
 
 	if (model->priv->query != NULL) {
-		insert = rhythmdb_evaluate_query (db, model->priv->query, entry);
+		insert = rhythmdb_compiled_query_evaluate (model->priv->compiled_query, entry);
 	} else {
 		index = GPOINTER_TO_INT (g_hash_table_lookup (model->priv->hidden_entry_map, entry));
 		insert = g_hash_table_remove (model->priv->hidden_entry_map, entry);
@@ -1011,6 +1151,9 @@ rhythmdb_query_model_entry_added_cb (RhythmDB *db,
 
 	if (insert) {
 		rhythmdb_query_model_do_insert (model, entry, index);
+	} else {
+		/* it may match later on */
+		rhythmdb_query_model_schedule_entry (model, entry);
 	}
 }
 
@@ -1085,6 +1228,8 @@ rhythmdb_query_model_entry_changed_cb (RhythmDB *db,
 		return;
 	}
 
+	rhythmdb_query_model_schedule_entry (model, entry);
+
 	/* emit separate change signals for each property
 	 * unless this is a chained query model, in which
 	 * case we propagate the parent model's signals instead.
@@ -1109,7 +1254,7 @@ rhythmdb_query_model_entry_changed_cb (RhythmDB *db,
 	}
 
 	if (model->priv->query &&
-	    !rhythmdb_evaluate_query (db, model->priv->query, entry)) {
+	    !rhythmdb_compiled_query_evaluate (model->priv->compiled_query, entry)) {
 		rhythmdb_query_model_filter_out_entry (model, entry);
 		return;
 	}
@@ -1151,12 +1296,59 @@ rhythmdb_query_model_entry_deleted_cb (RhythmDB *db,
 				       RhythmDBEntry *entry,
 				       RhythmDBQueryModel *model)
 {
+	rhythmdb_query_model_unschedule_entry (model, entry);
 
 	if (g_hash_table_lookup (model->priv->reverse_map, entry) ||
 	    g_hash_table_lookup (model->priv->limited_reverse_map, entry))
 		rhythmdb_query_model_remove_entry (model, entry);
 }
 
+static void
+rhythmdb_query_model_entries_added_cb (RhythmDB *db,
+				       GPtrArray *entries,
+				       RhythmDBQueryModel *model)
+{
+	guint i;
+
+	for (i = 0; i < entries->len; i++) {
+		rhythmdb_query_model_entry_added_cb (db, g_ptr_array_index (entries, i), model);
+	}
+}
+
+static void
+rhythmdb_query_model_entries_changed_cb (RhythmDB *db,
+					 GPtrArray *entries,
+					 GPtrArray *changes,
+					 RhythmDBQueryModel *model)
+{
+	guint i;
+
+	for (i = 0; i < entries->len; i++) {
+		rhythmdb_query_model_entry_changed_cb (db,
+						       g_ptr_array_index (entries, i),
+						       g_ptr_array_index (changes, i),
+						       model);
+	}
+}
+
+static void
+rhythmdb_query_model_entries_deleted_cb (RhythmDB *db,
+					 GPtrArray *entries,
+					 RhythmDBQueryModel *model)
+{
+	guint i;
+
+	/* nothing to do if the model is empty */
+	if (g_hash_table_size (model->priv->reverse_map) == 0 &&
+	    g_hash_table_size (model->priv->limited_reverse_map) == 0 &&
+	    g_hash_table_size (model->priv->expiry_map) == 0)
+		return;
+
+	for (i = 0; i < entries->len; i++) {
+		rhythmdb_query_model_entry_deleted_cb (db, g_ptr_array_index (entries, i), model);
+	}
+}
+
 static gboolean
 idle_process_update_idle (struct RhythmDBQueryModelUpdate *update)
 {
@@ -1176,31 +1368,51 @@ rhythmdb_query_model_process_update (struct RhythmDBQueryModelUpdate *update)
 		g_idle_add ((GSourceFunc) idle_process_update_idle, update);
 }
 
+static gboolean
+rhythmdb_query_model_is_cancelled (RhythmDBQueryModel *model)
+{
+	return (model->priv->cancellable != NULL &&
+		g_cancellable_is_cancelled (model->priv->cancellable));
+}
+
+static gboolean
+rhythmdb_query_model_is_profiling (RhythmDBQueryModel *model)
+{
+	gboolean profile;
+
+	g_object_get (model->priv->db, "profile-queries", &profile, NULL);
+	return profile;
+}
+
 static void
 idle_process_update (struct RhythmDBQueryModelUpdate *update)
 {
+	RhythmDBQueryModel *model = update->model;
+
 	switch (update->type) {
 	case RHYTHMDB_QUERY_MODEL_UPDATE_ROWS_INSERTED:
 	{
-		guint i;
-
-		rb_debug ("inserting %d rows", update->entrydata.entries->len);
-
-		for (i = 0; i < update->entrydata.entries->len; i++ ) {
-			RhythmDBEntry *entry = g_ptr_array_index (update->entrydata.entries, i);
-
-			if (update->model->priv->show_hidden || !rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN)) {
-				RhythmDBQueryModel *base_model = update->model->priv->base_model;
-				if (base_model &&
-				    g_hash_table_lookup (base_model->priv->reverse_map, entry) == NULL)
-					       continue;
-
-				rhythmdb_query_model_do_insert (update->model, entry, -1);
-			}
-
-			rhythmdb_entry_unref (entry);
+		if (rhythmdb_query_model_is_cancelled (update->model)) {
+			rb_debug ("discarding %d rows from cancelled query", update->entrydata.entries->len);
+		} else if (rhythmdb_query_model_is_profiling (model)) {
+			GTimer *timer;
+			guint before;
+
+			rb_debug ("inserting %d rows", update->entrydata.entries->len);
+			before = g_hash_table_size (model->priv->reverse_map);
+			timer = g_timer_new ();
+			rhythmdb_query_model_do_insert_bulk (model, update->entrydata.entries);
+			model->priv->profile_insert_time += g_timer_elapsed (timer, NULL);
+			g_timer_destroy (timer);
+
+			model->priv->profile_chunks++;
+			model->priv->profile_inserted += g_hash_table_size (model->priv->reverse_map) - before;
+		} else {
+			rb_debug ("inserting %d rows", update->entrydata.entries->len);
+			rhythmdb_query_model_do_insert_bulk (update->model, update->entrydata.entries);
 		}
 
+		g_ptr_array_foreach (update->entrydata.entries, (GFunc) rhythmdb_entry_unref, NULL);
 		g_ptr_array_free (update->entrydata.entries, TRUE);
 
 		break;
@@ -1213,6 +1425,20 @@ idle_process_update (struct RhythmDBQueryModelUpdate *update)
 		break;
 	}
 	case RHYTHMDB_QUERY_MODEL_UPDATE_QUERY_COMPLETE:
+		if (rhythmdb_query_model_is_cancelled (update->model)) {
+			rb_debug ("not emitting complete signal for cancelled query");
+			break;
+		}
+		if (model->priv->profile_chunks > 0) {
+			g_message ("query model %p: inserted %u rows in %u chunks, %.3f ms",
+				   model,
+				   model->priv->profile_inserted,
+				   model->priv->profile_chunks,
+				   model->priv->profile_insert_time * 1000.0);
+			model->priv->profile_chunks = 0;
+			model->priv->profile_inserted = 0;
+			model->priv->profile_insert_time = 0.0;
+		}
 		g_signal_emit (G_OBJECT (update->model), rhythmdb_query_model_signals[COMPLETE], 0);
 		break;
 	}
@@ -1624,6 +1850,7 @@ rhythmdb_query_model_do_insert (RhythmDBQueryModel *model,
 	}
 
 	rhythmdb_query_model_insert_into_main_list (model, entry, index);
+	rhythmdb_query_model_schedule_entry (model, entry);
 
 	/* release temporary ref */
 	rhythmdb_entry_unref (entry);
@@ -1641,6 +1868,183 @@ rhythmdb_query_model_do_insert (RhythmDBQueryModel *model,
 	rhythmdb_query_model_update_limited_entries (model);
 }
 
+struct RhythmDBQueryModelBulkSortData
+{
+	GCompareDataFunc func;
+	gpointer data;
+	GHashTable *positions;
+};
+
+static gint
+_bulk_sorting_func (RhythmDBEntry **a,
+		    RhythmDBEntry **b,
+		    struct RhythmDBQueryModelBulkSortData *sort_data)
+{
+	gint ret;
+
+	ret = sort_data->func (*a, *b, sort_data->data);
+	if (ret == 0) {
+		/* keep entries that compare equal in the order they were added */
+		ret = GPOINTER_TO_INT (g_hash_table_lookup (sort_data->positions, *a)) -
+		      GPOINTER_TO_INT (g_hash_table_lookup (sort_data->positions, *b));
+	}
+	return ret;
+}
+
+/*
+ * Inserts a chunk of entries, such as a batch of query results, at the
+ * end of the model or in sorted order.  Rather than inserting each entry
+ * into the sequence separately, the chunk is sorted once and merged into
+ * the sequence, and the row-inserted signals are emitted afterwards in
+ * ascending order, so views see each row appear at its final position.
+ */
+static void
+rhythmdb_query_model_do_insert_bulk (RhythmDBQueryModel *model,
+				     GPtrArray *entries)
+{
+	RhythmDBQueryModel *base_model = model->priv->base_model;
+	GPtrArray *insert;
+	GPtrArray *inserted;
+	GHashTable *positions;
+	GSequenceIter *ptr;
+	guint i;
+
+	/* limits involve moving entries between the main and limited lists
+	 * as each entry is added, so use the normal path there.
+	 */
+	if (model->priv->limit_type != RHYTHMDB_QUERY_MODEL_LIMIT_NONE) {
+		for (i = 0; i < entries->len; i++) {
+			RhythmDBEntry *entry = g_ptr_array_index (entries, i);
+
+			if (!model->priv->show_hidden && rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN))
+				continue;
+			if (base_model &&
+			    g_hash_table_lookup (base_model->priv->reverse_map, entry) == NULL)
+				continue;
+
+			rhythmdb_query_model_do_insert (model, entry, -1);
+		}
+		return;
+	}
+
+	insert = g_ptr_array_sized_new (entries->len);
+	/* maps entries to their position in the chunk, plus one */
+	positions = g_hash_table_new (g_direct_hash, g_direct_equal);
+	for (i = 0; i < entries->len; i++) {
+		RhythmDBEntry *entry = g_ptr_array_index (entries, i);
+
+		if (!model->priv->show_hidden && rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN))
+			continue;
+		if (base_model &&
+		    g_hash_table_lookup (base_model->priv->reverse_map, entry) == NULL)
+			continue;
+		if (g_hash_table_lookup (model->priv->reverse_map, entry) != NULL)
+			continue;
+		if (g_hash_table_lookup (positions, entry) != NULL)
+			continue;
+
+		g_ptr_array_add (insert, entry);
+		g_hash_table_insert (positions, entry, GINT_TO_POINTER (insert->len));
+	}
+
+	if (insert->len == 0) {
+		g_hash_table_destroy (positions);
+		g_ptr_array_free (insert, TRUE);
+		return;
+	}
+
+	inserted = g_ptr_array_sized_new (insert->len);
+
+	if (model->priv->sort_func) {
+		struct RhythmDBQueryModelBulkSortData sort_data;
+		struct ReverseSortData reverse_data;
+		gint length;
+
+		sort_data.positions = positions;
+		if (model->priv->sort_reverse) {
+			sort_data.func = (GCompareDataFunc) _reverse_sorting_func;
+			sort_data.data = &reverse_data;
+			reverse_data.func = model->priv->sort_func;
+			reverse_data.data = model->priv->sort_data;
+		} else {
+			sort_data.func = model->priv->sort_func;
+			sort_data.data = model->priv->sort_data;
+		}
+
+		/* entries that compare equal stay in the order they were
+		 * added, as they would when inserted one at a time.
+		 */
+		g_ptr_array_sort_with_data (insert, (GCompareDataFunc) _bulk_sorting_func, &sort_data);
+
+		length = g_sequence_get_length (model->priv->entries);
+		if (insert->len * 8 < length) {
+			/* a few entries going into a large model; searching
+			 * for each position is cheaper than walking the model.
+			 */
+			for (i = 0; i < insert->len; i++) {
+				RhythmDBEntry *entry = g_ptr_array_index (insert, i);
+
+				ptr = g_sequence_insert_sorted (model->priv->entries, entry,
+								sort_data.func, sort_data.data);
+				g_ptr_array_add (inserted, ptr);
+			}
+		} else {
+			/* merge the sorted entries into the model, placing
+			 * each one after any existing entries that compare
+			 * equal to it.
+			 */
+			ptr = g_sequence_get_begin_iter (model->priv->entries);
+			for (i = 0; i < insert->len; i++) {
+				RhythmDBEntry *entry = g_ptr_array_index (insert, i);
+
+				while (!g_sequence_iter_is_end (ptr) &&
+				       sort_data.func (g_sequence_get (ptr), entry, sort_data.data) <= 0) {
+					ptr = g_sequence_iter_next (ptr);
+				}
+
+				g_ptr_array_add (inserted, g_sequence_insert_before (ptr, entry));
+			}
+		}
+	} else {
+		for (i = 0; i < insert->len; i++) {
+			ptr = g_sequence_append (model->priv->entries, g_ptr_array_index (insert, i));
+			g_ptr_array_add (inserted, ptr);
+		}
+	}
+
+	for (i = 0; i < insert->len; i++) {
+		RhythmDBEntry *entry = g_ptr_array_index (insert, i);
+
+		/* the hash owns this reference to the entry */
+		g_hash_table_insert (model->priv->reverse_map,
+				     rhythmdb_entry_ref (entry),
+				     g_ptr_array_index (inserted, i));
+
+		model->priv->total_duration += rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DURATION);
+		model->priv->total_size += rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE);
+
+		rhythmdb_query_model_schedule_entry (model, entry);
+	}
+
+	/* the inserted rows are in ascending order, so each row-inserted
+	 * signal reports the row's final position.
+	 */
+	for (i = 0; i < inserted->len; i++) {
+		GtkTreePath *path;
+		GtkTreeIter iter;
+
+		iter.stamp = model->priv->stamp;
+		iter.user_data = g_ptr_array_index (inserted, i);
+		path = rhythmdb_query_model_get_path (GTK_TREE_MODEL (model), &iter);
+		gtk_tree_model_row_inserted (GTK_TREE_MODEL (model), path, &iter);
+		gtk_tree_path_free (path);
+	}
+
+	g_hash_table_destroy (positions);
+	g_ptr_array_free (inserted, TRUE);
+	g_ptr_array_free (insert, TRUE);
+}
+
 static void
 rhythmdb_query_model_filter_out_entry (RhythmDBQueryModel *model,
 				       RhythmDBEntry *entry)
@@ -2245,6 +2649,12 @@ rhythmdb_query_model_add_results (RhythmDBQueryResults *results,
 	struct RhythmDBQueryModelUpdate *update;
 	guint i;
 
+	/* the query thread may not have noticed the cancellation yet */
+	if (rhythmdb_query_model_is_cancelled (model)) {
+		g_ptr_array_free (entries, TRUE);
+		return;
+	}
+
 	rb_debug ("adding %d entries", entries->len);
 
 	update = g_new (struct RhythmDBQueryModelUpdate, 1);
@@ -2519,6 +2929,221 @@ apply_updated_entry_sequence (RhythmDBQueryModel *model,
 	g_free (reorder_map);
 }
 
+/*
+ * The album, artist and genre sort functions compare several properties of
+ * each entry, looking each one up again on every comparison.  To re-sort a
+ * whole model by one of them, the properties are extracted once per entry
+ * into an array of keys, the keys are sorted, and the entry sequence is
+ * rebuilt from the sorted keys.  The first bytes of the most significant
+ * string are packed into an integer, so most comparisons are decided
+ * without looking at the strings.
+ */
+#define RHYTHMDB_QUERY_MODEL_SORT_KEY_STRINGS 3
+
+typedef struct {
+	guint64 prefix;
+	const char *strings[RHYTHMDB_QUERY_MODEL_SORT_KEY_STRINGS];
+	gulong disc;
+	gulong track;
+	const char *location;
+	RhythmDBEntry *entry;
+	guint index;
+} RhythmDBQueryModelSortKey;
+
+struct RhythmDBQueryModelSortKeyData
+{
+	guint n_strings;
+	gboolean reverse;
+	GPtrArray *refs;
+};
+
+/* returns the number of string keys the sort function compares before
+ * disc and track numbers, or 0 if it can't be sorted using keys.
+ */
+static guint
+sort_key_string_count (GCompareDataFunc sort_func)
+{
+	if (sort_func == (GCompareDataFunc) rhythmdb_query_model_album_sort_func ||
+	    sort_func == (GCompareDataFunc) rhythmdb_query_model_track_sort_func)
+		return 1;
+	if (sort_func == (GCompareDataFunc) rhythmdb_query_model_artist_sort_func)
+		return 2;
+	if (sort_func == (GCompareDataFunc) rhythmdb_query_model_genre_sort_func)
+		return 3;
+	return 0;
+}
+
+static guint64
+sort_key_prefix (const char *str)
+{
+	guint64 prefix = 0;
+	guint i;
+
+	/* compares the same way as strcmp; NULL packs like an empty string,
+	 * which the full comparison then orders first.
+	 */
+	for (i = 0; i < sizeof (prefix); i++) {
+		prefix <<= 8;
+		if (str != NULL && *str != '\0')
+			prefix |= (guchar) *str++;
+	}
+	return prefix;
+}
+
+static const char *
+sort_key_string (struct RhythmDBQueryModelSortKeyData *data,
+		 RhythmDBEntry *entry,
+		 RhythmDBPropType prop)
+{
+	RBRefString *str;
+
+	/* hold a reference so the sort key stays valid while sorting */
+	str = rhythmdb_entry_get_refstring (entry, prop);
+	g_ptr_array_add (data->refs, str);
+	return rb_refstring_get_sort_key (str);
+}
+
+static const char *
+sort_key_sortname_string (struct RhythmDBQueryModelSortKeyData *data,
+			  RhythmDBEntry *entry,
+			  RhythmDBPropType sortname_prop,
+			  RhythmDBPropType prop)
+{
+	RBRefString *str;
+	const char *key;
+
+	str = rhythmdb_entry_get_refstring (entry, sortname_prop);
+	key = rb_refstring_get_sort_key (str);
+	if (key[0] == '\0') {
+		rb_refstring_unref (str);
+		return sort_key_string (data, entry, prop);
+	}
+
+	g_ptr_array_add (data->refs, str);
+	return key;
+}
+
+static void
+sort_key_init (struct RhythmDBQueryModelSortKeyData *data,
+	       RhythmDBQueryModelSortKey *key,
+	       RhythmDBEntry *entry,
+	       guint index)
+{
+	RBRefString *location;
+	guint i = 0;
+
+	memset (key, 0, sizeof (*key));
+
+	if (data->n_strings >= 3)
+		key->strings[i++] = sort_key_string (data, entry, RHYTHMDB_PROP_GENRE);
+	if (data->n_strings >= 2)
+		key->strings[i++] = sort_key_sortname_string (data, entry, RHYTHMDB_PROP_ARTIST_SORTNAME, RHYTHMDB_PROP_ARTIST);
+	key->strings[i++] = sort_key_sortname_string (data, entry, RHYTHMDB_PROP_ALBUM_SORTNAME, RHYTHMDB_PROP_ALBUM);
+	key->prefix = sort_key_prefix (key->strings[0]);
+
+	/* assume disc 1 if there's no disc number */
+	key->disc = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DISC_NUMBER);
+	key->disc = (key->disc ? key->disc : 1);
+	key->track = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_TRACK_NUMBER);
+
+	location = rhythmdb_entry_get_refstring (entry, RHYTHMDB_PROP_LOCATION);
+	g_ptr_array_add (data->refs, location);
+	key->location = rb_refstring_get (location);
+
+	key->entry = entry;
+	key->index = index;
+}
+
+static gint
+sort_key_strcmp (const char *a, const char *b)
+{
+	if (a == NULL)
+		return (b == NULL) ? 0 : -1;
+	else if (b == NULL)
+		return 1;
+	else
+		return strcmp (a, b);
+}
+
+static gint
+_sort_key_compare (const RhythmDBQueryModelSortKey *a,
+		   const RhythmDBQueryModelSortKey *b,
+		   struct RhythmDBQueryModelSortKeyData *data)
+{
+	const RhythmDBQueryModelSortKey *first = a;
+	const RhythmDBQueryModelSortKey *second = b;
+	guint i;
+	gint ret;
+
+	if (data->reverse) {
+		first = b;
+		second = a;
+	}
+
+	if (first->prefix != second->prefix)
+		return (first->prefix < second->prefix ? -1 : 1);
+
+	for (i = 0; i < data->n_strings; i++) {
+		ret = sort_key_strcmp (first->strings[i], second->strings[i]);
+		if (ret != 0)
+			return ret;
+	}
+
+	if (first->disc != second->disc)
+		return (first->disc < second->disc ? -1 : 1);
+	if (first->track != second->track)
+		return (first->track < second->track ? -1 : 1);
+
+	ret = sort_key_strcmp (first->location, second->location);
+	if (ret != 0)
+		return ret;
+
+	/* keep the existing order of entries that compare equal */
+	return (a->index < b->index ? -1 : (a->index > b->index ? 1 : 0));
+}
+
+/* must be called with the new sort order already set on the model */
+static gboolean
+rhythmdb_query_model_sort_by_keys (RhythmDBQueryModel *model)
+{
+	struct RhythmDBQueryModelSortKeyData data;
+	RhythmDBQueryModelSortKey *keys;
+	GSequence *new_entries;
+	GSequenceIter *ptr;
+	guint length;
+	guint i;
+
+	data.n_strings = sort_key_string_count (model->priv->sort_func);
+	if (data.n_strings == 0)
+		return FALSE;
+	data.reverse = model->priv->sort_reverse;
+
+	length = g_sequence_get_length (model->priv->entries);
+	keys = g_new (RhythmDBQueryModelSortKey, length);
+	data.refs = g_ptr_array_sized_new (length * (data.n_strings + 1));
+
+	ptr = g_sequence_get_begin_iter (model->priv->entries);
+	for (i = 0; i < length; i++) {
+		sort_key_init (&data, &keys[i], g_sequence_get (ptr), i);
+		ptr = g_sequence_iter_next (ptr);
+	}
+
+	g_qsort_with_data (keys, length, sizeof (RhythmDBQueryModelSortKey),
+			   (GCompareDataFunc) _sort_key_compare, &data);
+
+	new_entries = g_sequence_new (NULL);
+	for (i = 0; i < length; i++) {
+		g_sequence_append (new_entries, keys[i].entry);
+	}
+
+	g_ptr_array_foreach (data.refs, (GFunc) rb_refstring_unref, NULL);
+	g_ptr_array_free (data.refs, TRUE);
+	g_free (keys);
+
+	apply_updated_entry_sequence (model, new_entries);
+	return TRUE;
+}
+
 /**
  * rhythmdb_query_model_set_sort_order:
  * @model: a #RhythmDBQueryModel
@@ -2561,6 +3186,10 @@ rhythmdb_query_model_set_sort_order (RhythmDBQueryModel *model,
 	model->priv->sort_data_destroy = sort_data_destroy;
 	model->priv->sort_reverse = sort_reverse;
 
+	length = g_sequence_get_length (model->priv->entries);
+	if (length > 0 && rhythmdb_query_model_sort_by_keys (model))
+		return;
+
 	if (model->priv->sort_reverse) {
 		reverse_data.func = sort_func;
 		reverse_data.data = sort_data;
@@ -2569,7 +3198,6 @@ rhythmdb_query_model_set_sort_order (RhythmDBQueryModel *model,
 	}
 
 	/* create the new sorted entry sequence */
-	length = g_sequence_get_length (model->priv->entries);
 	if (length > 0) {
 		new_entries = g_sequence_new (NULL);
 		ptr = g_sequence_get_begin_iter (model->priv->entries);
@@ -2659,7 +3287,7 @@ rhythmdb_query_model_base_row_inserted (GtkTreeModel *tree_model,
 	if (!model->priv->show_hidden && rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN))
 		goto out;
 
-	if (rhythmdb_evaluate_query (model->priv->db, model->priv->query, entry)) {
+	if (rhythmdb_compiled_query_evaluate (model->priv->compiled_query, entry)) {
 		/* find the closest previous entry that is in the filter model, and it it after that */
 		prev_entry = rhythmdb_query_model_get_previous_from_entry (base_model, entry);
 		while (prev_entry && g_hash_table_lookup (model->priv->reverse_map, prev_entry) == NULL) {
@@ -2679,6 +3307,8 @@ rhythmdb_query_model_base_row_inserted (GtkTreeModel *tree_model,
 
 		rb_debug ("inserting entry %p from base model %p to model %p in position %d", entry, base_model, model, index);
 		rhythmdb_query_model_do_insert (model, entry, index);
+	} else {
+		rhythmdb_query_model_schedule_entry (model, entry);
 	}
  out:
 	rhythmdb_entry_unref (entry);
@@ -2768,9 +3398,7 @@ typedef struct {
 static void
 _reapply_query_foreach_cb (RhythmDBEntry *entry, _ReapplyQueryForeachData *data)
 {
-	if (!rhythmdb_evaluate_query (data->model->priv->db,
-				      data->model->priv->query,
-				      entry)) {
+	if (!rhythmdb_compiled_query_evaluate (data->model->priv->compiled_query, entry)) {
 		data->remove = g_list_prepend (data->remove, entry);
 	}
 }
@@ -3348,14 +3976,318 @@ rhythmdb_query_model_limit_type_get_type (void)
 	return etype;
 }
 
+/*
+ * Time-relative queries
+ *
+ * The result of a time-relative query changes for an entry when the current
+ * time moves past the edge of a time window.  Rather than re-running the
+ * whole query every so often, the model keeps a queue of the entries whose
+ * result will change, ordered by when it changes, and re-evaluates just
+ * those entries when their time comes.  Entries in the model are always
+ * queued.  Entries that aren't in the model are queued when they are added
+ * or changed, and when the query is set, a one-off query finds the entries
+ * that are currently kept out of the model by a 'not within' criterion.
+ */
+
+static void
+rhythmdb_query_model_expiry_free (RhythmDBQueryModelExpiry *expiry)
+{
+	rhythmdb_entry_unref (expiry->entry);
+	g_free (expiry);
+}
+
+static gint
+_expiry_compare (RhythmDBQueryModelExpiry *a,
+		 RhythmDBQueryModelExpiry *b,
+		 gpointer data)
+{
+	if (a->time < b->time)
+		return -1;
+	else if (a->time > b->time)
+		return 1;
+	return 0;
+}
+
+static gboolean rhythmdb_query_model_expiry_cb (RhythmDBQueryModel *model);
+
+static void
+rhythmdb_query_model_update_expiry_timeout (RhythmDBQueryModel *model)
+{
+	RhythmDBQueryModelExpiry *head;
+	GSequenceIter *ptr;
+	GTimeVal now;
+	gulong delay;
+
+	ptr = g_sequence_get_begin_iter (model->priv->expiry_queue);
+	if (g_sequence_iter_is_end (ptr)) {
+		if (model->priv->expiry_id != 0) {
+			g_source_remove (model->priv->expiry_id);
+			model->priv->expiry_id = 0;
+		}
+		return;
+	}
+
+	/* if the timeout fires too early, it'll just be set again */
+	head = g_sequence_get (ptr);
+	if (model->priv->expiry_id != 0 && model->priv->expiry_time <= head->time)
+		return;
+
+	if (model->priv->expiry_id != 0)
+		g_source_remove (model->priv->expiry_id);
+
+	g_get_current_time (&now);
+	delay = 1;
+	if (head->time > now.tv_sec + 1)
+		delay = head->time - now.tv_sec;
+
+	/* older versions of glib convert the interval to milliseconds in
+	 * a guint, so delays of more than a few weeks would overflow.
+	 * longer delays are covered by setting the timeout again.
+	 */
+	delay = MIN (delay, RHYTHMDB_QUERY_MODEL_MAX_EXPIRY_DELAY);
+
+	model->priv->expiry_time = now.tv_sec + delay;
+	model->priv->expiry_id = g_timeout_add_seconds (delay,
+							(GSourceFunc) rhythmdb_query_model_expiry_cb,
+							model);
+}
+
+static void
+rhythmdb_query_model_unschedule_entry (RhythmDBQueryModel *model,
+				       RhythmDBEntry *entry)
+{
+	GSequenceIter *ptr;
+
+	ptr = g_hash_table_lookup (model->priv->expiry_map, entry);
+	if (ptr != NULL) {
+		g_hash_table_remove (model->priv->expiry_map, entry);
+		g_sequence_remove (ptr);
+	}
+}
+
+static void
+rhythmdb_query_model_schedule_entry (RhythmDBQueryModel *model,
+				     RhythmDBEntry *entry)
+{
+	RhythmDBQueryModelExpiry *expiry;
+	GSequenceIter *ptr;
+	gulong time;
+
+	if (model->priv->time_relative == FALSE)
+		return;
+
+	time = rhythmdb_compiled_query_get_next_change (model->priv->compiled_query, entry);
+
+	ptr = g_hash_table_lookup (model->priv->expiry_map, entry);
+	if (ptr != NULL) {
+		expiry = g_sequence_get (ptr);
+		if (expiry->time == time)
+			return;
+		rhythmdb_query_model_unschedule_entry (model, entry);
+	}
+
+	if (time != 0) {
+		expiry = g_new0 (RhythmDBQueryModelExpiry, 1);
+		expiry->time = time;
+		expiry->entry = rhythmdb_entry_ref (entry);
+
+		ptr = g_sequence_insert_sorted (model->priv->expiry_queue,
+						expiry,
+						(GCompareDataFunc) _expiry_compare,
+						NULL);
+		g_hash_table_insert (model->priv->expiry_map, entry, ptr);
+	}
+
+	rhythmdb_query_model_update_expiry_timeout (model);
+}
+
+static void
+rhythmdb_query_model_expire_entry (RhythmDBQueryModel *model,
+				   RhythmDBEntry *entry)
+{
+	if (g_hash_table_lookup (model->priv->reverse_map, entry) == NULL &&
+	    g_hash_table_lookup (model->priv->limited_reverse_map, entry) == NULL) {
+		/* the entry may have moved into the time window */
+		rhythmdb_query_model_entry_added_cb (model->priv->db, entry, model);
+		return;
+	}
+
+	if (rhythmdb_compiled_query_evaluate (model->priv->compiled_query, entry) == FALSE) {
+		if (g_hash_table_lookup (model->priv->reverse_map, entry) != NULL) {
+			g_signal_emit (G_OBJECT (model),
+				       rhythmdb_query_model_signals[ENTRY_REMOVED], 0,
+				       entry);
+		}
+		rhythmdb_query_model_filter_out_entry (model, entry);
+	}
+	rhythmdb_query_model_schedule_entry (model, entry);
+}
+
 static gboolean
-rhythmdb_query_model_reapply_query_cb (RhythmDBQueryModel *model)
+rhythmdb_query_model_expiry_cb (RhythmDBQueryModel *model)
 {
+	RhythmDBQueryModelExpiry *expiry;
+	GSequenceIter *ptr;
+	GPtrArray *expired;
+	GTimeVal now;
+	guint i;
+
 	GDK_THREADS_ENTER ();
-	rhythmdb_query_model_reapply_query (model, FALSE);
-	rhythmdb_do_full_query_async_parsed (model->priv->db,
-					     RHYTHMDB_QUERY_RESULTS (model),
-					     model->priv->original_query);
+
+	model->priv->expiry_id = 0;
+	g_get_current_time (&now);
+
+	/* take the entries off the queue first, as re-evaluating them
+	 * puts them back on it.
+	 */
+	expired = g_ptr_array_new ();
+	while (TRUE) {
+		ptr = g_sequence_get_begin_iter (model->priv->expiry_queue);
+		if (g_sequence_iter_is_end (ptr))
+			break;
+
+		expiry = g_sequence_get (ptr);
+		if (expiry->time > now.tv_sec)
+			break;
+
+		g_ptr_array_add (expired, rhythmdb_entry_ref (expiry->entry));
+		rhythmdb_query_model_unschedule_entry (model, expiry->entry);
+	}
+
+	rb_debug ("re-evaluating %d entries in time-relative query model %p", expired->len, model);
+	for (i = 0; i < expired->len; i++) {
+		RhythmDBEntry *entry = g_ptr_array_index (expired, i);
+
+		rhythmdb_query_model_expire_entry (model, entry);
+		rhythmdb_entry_unref (entry);
+	}
+	g_ptr_array_free (expired, TRUE);
+
+	rhythmdb_query_model_update_expiry_timeout (model);
+
 	GDK_THREADS_LEAVE ();
-	return TRUE;
+	return FALSE;
+}
+
+/*
+ * Rewrites a query so it matches everything the original could match
+ * once its 'not within' windows have passed, collecting the windows
+ * into a separate disjunction.
+ */
+static void
+rhythmdb_query_model_rewrite_candidate_query (RhythmDB *db,
+					      GPtrArray *query,
+					      GPtrArray *windows)
+{
+	guint i;
+
+	for (i = 0; i < query->len; i++) {
+		RhythmDBQueryData *data = g_ptr_array_index (query, i);
+
+		if (data->type == RHYTHMDB_QUERY_SUBQUERY) {
+			rhythmdb_query_model_rewrite_candidate_query (db, data->subquery, windows);
+		} else if (data->type == RHYTHMDB_QUERY_PROP_CURRENT_TIME_NOT_WITHIN) {
+			if (windows->len > 0)
+				rhythmdb_query_append (db, windows, RHYTHMDB_QUERY_DISJUNCTION, RHYTHMDB_QUERY_END);
+			rhythmdb_query_append (db, windows,
+					       RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN,
+					       data->propid,
+					       g_value_get_ulong (data->val),
+					       RHYTHMDB_QUERY_END);
+
+			/* always true */
+			data->type = RHYTHMDB_QUERY_PROP_GREATER;
+			g_value_set_ulong (data->val, 0);
+		}
+	}
+}
+
+static void
+rhythmdb_query_model_candidates_complete_cb (RhythmDBQueryModel *candidates,
+					     RhythmDBQueryModel *model)
+{
+	GSequenceIter *ptr;
+
+	if (candidates != model->priv->candidate_model)
+		return;
+
+	rb_debug ("scheduling %d candidate entries for time-relative query model %p",
+		  g_hash_table_size (candidates->priv->reverse_map), model);
+	for (ptr = g_sequence_get_begin_iter (candidates->priv->entries);
+	     !g_sequence_iter_is_end (ptr);
+	     ptr = g_sequence_iter_next (ptr)) {
+		rhythmdb_query_model_schedule_entry (model, g_sequence_get (ptr));
+	}
+
+	rhythmdb_query_model_cancel_candidates (model);
+}
+
+static void
+rhythmdb_query_model_cancel_candidates (RhythmDBQueryModel *model)
+{
+	if (model->priv->candidate_model == NULL)
+		return;
+
+	g_signal_handlers_disconnect_by_func (G_OBJECT (model->priv->candidate_model),
+					      G_CALLBACK (rhythmdb_query_model_candidates_complete_cb),
+					      model);
+	g_object_unref (model->priv->candidate_model);
+	model->priv->candidate_model = NULL;
+}
+
+static void
+rhythmdb_query_model_reset_expiry (RhythmDBQueryModel *model)
+{
+	GSequenceIter *ptr;
+	GPtrArray *candidate;
+	GPtrArray *windows;
+	GPtrArray *query;
+
+	rhythmdb_query_model_cancel_candidates (model);
+	g_hash_table_remove_all (model->priv->expiry_map);
+	g_sequence_remove_range (g_sequence_get_begin_iter (model->priv->expiry_queue),
+				 g_sequence_get_end_iter (model->priv->expiry_queue));
+	rhythmdb_query_model_update_expiry_timeout (model);
+
+	if (model->priv->time_relative == FALSE)
+		return;
+
+	for (ptr = g_sequence_get_begin_iter (model->priv->entries);
+	     !g_sequence_iter_is_end (ptr);
+	     ptr = g_sequence_iter_next (ptr)) {
+		rhythmdb_query_model_schedule_entry (model, g_sequence_get (ptr));
+	}
+	for (ptr = g_sequence_get_begin_iter (model->priv->limited_entries);
+	     !g_sequence_iter_is_end (ptr);
+	     ptr = g_sequence_iter_next (ptr)) {
+		rhythmdb_query_model_schedule_entry (model, g_sequence_get (ptr));
+	}
+
+	/* entries can only move into the results when a 'not within'
+	 * window passes them, so look for entries that are inside one of
+	 * those windows and would otherwise match.
+	 */
+	candidate = rhythmdb_query_copy (model->priv->original_query);
+	windows = g_ptr_array_new ();
+	rhythmdb_query_model_rewrite_candidate_query (model->priv->db, candidate, windows);
+
+	if (windows->len > 0) {
+		query = rhythmdb_query_parse (model->priv->db,
+					      RHYTHMDB_QUERY_SUBQUERY, candidate,
+					      RHYTHMDB_QUERY_SUBQUERY, windows,
+					      RHYTHMDB_QUERY_END);
+
+		model->priv->candidate_model = rhythmdb_query_model_new_empty (model->priv->db);
+		g_signal_connect_object (G_OBJECT (model->priv->candidate_model),
+					 "complete",
+					 G_CALLBACK (rhythmdb_query_model_candidates_complete_cb),
+					 model, 0);
+		rhythmdb_do_full_query_async_parsed (model->priv->db,
+						     RHYTHMDB_QUERY_RESULTS (model->priv->candidate_model),
+						     query);
+		rhythmdb_query_free (query);
+	}
+
+	rhythmdb_query_free (candidate);
+	rhythmdb_query_free (windows);
 }
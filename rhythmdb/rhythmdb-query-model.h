@@ -108,6 +108,10 @@ void			rhythmdb_query_model_chain		(RhythmDBQueryModel *model,
 								 RhythmDBQueryModel *base,
 								 gboolean import_entries);
 
+void			rhythmdb_query_model_freeze		(RhythmDBQueryModel *model);
+
+gboolean		rhythmdb_query_model_thaw		(RhythmDBQueryModel *model);
+
 void			rhythmdb_query_model_add_entry		(RhythmDBQueryModel *model,
 								 RhythmDBEntry *entry,
 								 gint index);
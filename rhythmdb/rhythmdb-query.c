@@ -360,6 +360,10 @@ prop_gvalue_to_string (RhythmDB *db,
 		break;
 	}
 
+	/* search words are split up when the query is preprocessed */
+	if (G_VALUE_HOLDS (val, G_TYPE_STRV))
+		return g_strjoinv (" ", g_value_get_boxed (val));
+
 	/* otherwise just convert numbers to strings */
 	switch (G_VALUE_TYPE (val)) {
 	case G_TYPE_STRING:
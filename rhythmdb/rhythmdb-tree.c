@@ -40,7 +40,10 @@
 #include <errno.h>
 #include <string.h>
 #include <math.h>
+#include <locale.h>
+#include <sys/stat.h>
 #include <glib/gprintf.h>
+#include <glib/gstdio.h>
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
@@ -69,11 +72,22 @@ typedef struct RhythmDBTreeProperty
 G_DEFINE_TYPE(RhythmDBTree, rhythmdb_tree, RHYTHMDB_TYPE)
 
 static void rhythmdb_tree_finalize (GObject *object);
+static void rhythmdb_tree_set_property (GObject *object,
+					guint prop_id,
+					const GValue *value,
+					GParamSpec *pspec);
+static void rhythmdb_tree_get_property (GObject *object,
+					guint prop_id,
+					GValue *value,
+					GParamSpec *pspec);
 
 static gboolean rhythmdb_tree_load (RhythmDB *rdb, GCancellable *cancel, GError **error);
 static void rhythmdb_tree_save (RhythmDB *rdb);
+static gboolean rhythmdb_tree_snapshot_load (RhythmDBTree *db, const char *name, GCancellable *cancel);
+static void rhythmdb_tree_snapshot_save (RhythmDBTree *db, const char *name);
 static void rhythmdb_tree_entry_new (RhythmDB *db, RhythmDBEntry *entry);
 static void rhythmdb_tree_entry_new_internal (RhythmDB *db, RhythmDBEntry *entry);
+static void word_index_prepare_entry (RhythmDBEntry *entry);
 static gboolean rhythmdb_tree_entry_set (RhythmDB *db, RhythmDBEntry *entry,
 					 guint propid, const GValue *value);
 
@@ -118,6 +132,14 @@ static void rhythmdb_hash_tree_foreach (RhythmDB *adb,
 #define RHYTHMDB_TREE_XML_VERSION "1.6"
 #define RHYTHMDB_TREE_XML_VERSION_INT 160
 
+#define RHYTHMDB_TREE_JOURNAL_SUFFIX ".journal"
+#define RHYTHMDB_TREE_GENERATION_START "<generation value=\""
+#define RHYTHMDB_TREE_JOURNAL_END "</rhythmdb-journal>\n"
+/* the journal is compacted into a full save once it grows past this size,
+ * or past a quarter of the size of the database, whichever is larger.
+ */
+#define RHYTHMDB_TREE_JOURNAL_MIN_COMPACT_SIZE (256 * 1024)
+
 static void destroy_tree_property (RhythmDBTreeProperty *prop);
 static RhythmDBTreeProperty *get_or_create_album (RhythmDBTree *db, RhythmDBTreeProperty *artist,
 						  RBRefString *name);
@@ -127,6 +149,9 @@ static RhythmDBTreeProperty *get_or_create_genre (RhythmDBTree *db, RhythmDBEntr
 							 RBRefString *name);
 
 static void remove_entry_from_album (RhythmDBTree *db, RhythmDBEntry *entry);
+static void prop_index_add_entry (RhythmDBTree *db, RhythmDBEntry *entry);
+static void prop_index_remove_entry (RhythmDBTree *db, RhythmDBEntry *entry);
+static void prop_index_set_enabled (RhythmDBTree *db, gboolean enabled);
 static void remove_entry_from_keywords (RhythmDBTree *db, RhythmDBEntry *entry);
 
 static GList *split_query_by_disjunctions (RhythmDBTree *db, GPtrArray *query);
@@ -145,9 +170,30 @@ struct RhythmDBTreePrivate
 	GHashTable *genres;
 	GMutex *genres_lock; /* must be held while using the tree */
 
+	/* title, artist, album and genre strings, for searching */
+	RhythmDBWordIndex *word_index;
+
+	/* entries sorted by numeric properties, see prop_index_props.
+	 * NULL when the indexes are disabled.
+	 */
+	GSequence **prop_indexes;
+	GMutex *prop_indexes_lock;
+
+	/* worker threads for evaluating large queries, created when first
+	 * needed.  only used with the genres lock held.
+	 */
+	GThreadPool *query_pool;
+	guint parallel_query_threshold;
+
 	GHashTable *unknown_entry_types;
 	gboolean finalizing;
 
+	/* TRUE if the saved database and journal match the entries in
+	 * memory, so changes can be appended to the journal.
+	 * protected by entries_lock.
+	 */
+	gboolean journal_valid;
+
 	guint idle_load_id;
 };
 
@@ -168,10 +214,17 @@ typedef struct
 enum
 {
 	PROP_0,
+	PROP_SECONDARY_INDEXES,
+	PROP_PARALLEL_QUERY_THRESHOLD
 };
 
 const int RHYTHMDB_TREE_PARSER_INITIAL_BUFFER_SIZE = 512;
 
+/* by default, queries checking fewer entries than this are evaluated
+ * on the query thread alone
+ */
+#define RHYTHMDB_TREE_PARALLEL_QUERY_MIN_ENTRIES	16384
+
 GQuark
 rhythmdb_tree_error_quark (void)
 {
@@ -189,6 +242,8 @@ rhythmdb_tree_class_init (RhythmDBTreeClass *klass)
 	RhythmDBClass *rhythmdb_class = RHYTHMDB_CLASS (klass);
 
 	object_class->finalize = rhythmdb_tree_finalize;
+	object_class->set_property = rhythmdb_tree_set_property;
+	object_class->get_property = rhythmdb_tree_get_property;
 
 	rhythmdb_class->impl_load = rhythmdb_tree_load;
 	rhythmdb_class->impl_save = rhythmdb_tree_save;
@@ -210,6 +265,37 @@ rhythmdb_tree_class_init (RhythmDBTreeClass *klass)
 	rhythmdb_class->impl_do_full_query = rhythmdb_tree_do_full_query;
 	rhythmdb_class->impl_entry_type_registered = rhythmdb_tree_entry_type_registered;
 
+	/**
+	 * RhythmDBTree:secondary-indexes
+	 *
+	 * If %TRUE, the database keeps entries sorted by last played time,
+	 * first seen time, rating, play count and date, so that queries
+	 * restricting these properties to a range don't need to check
+	 * every entry.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_SECONDARY_INDEXES,
+					 g_param_spec_boolean ("secondary-indexes",
+							       "secondary indexes",
+							       "Whether to maintain indexes on numeric properties",
+							       TRUE,
+							       G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+
+	/**
+	 * RhythmDBTree:parallel-query-threshold
+	 *
+	 * The number of entries a query has to check before they're split
+	 * up and checked on several threads.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_PARALLEL_QUERY_THRESHOLD,
+					 g_param_spec_uint ("parallel-query-threshold",
+							    "parallel query threshold",
+							    "Number of entries to check before evaluating a query on several threads",
+							    1, G_MAXUINT,
+							    RHYTHMDB_TREE_PARALLEL_QUERY_MIN_ENTRIES,
+							    G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+
 	g_type_class_add_private (klass, sizeof (RhythmDBTreePrivate));
 }
 
@@ -231,6 +317,10 @@ rhythmdb_tree_init (RhythmDBTree *db)
 						  NULL, (GDestroyNotify)g_hash_table_destroy);
 
 	db->priv->unknown_entry_types = g_hash_table_new (rb_refstring_hash, rb_refstring_equal);
+
+	db->priv->word_index = rhythmdb_word_index_new ();
+
+	db->priv->prop_indexes_lock = g_mutex_new ();
 }
 
 /* must be called with the genres lock held */
@@ -284,6 +374,9 @@ rhythmdb_tree_finalize (GObject *object)
 
 	db->priv->finalizing = TRUE;
 
+	/* this takes the entries lock, so it has to be done first */
+	prop_index_set_enabled (db, FALSE);
+
 	g_mutex_lock (db->priv->genres_lock);
 	g_hash_table_foreach (db->priv->entries, (GHFunc) unparent_entries, db);
 	g_mutex_unlock (db->priv->genres_lock);
@@ -298,6 +391,13 @@ rhythmdb_tree_finalize (GObject *object)
 	g_hash_table_destroy (db->priv->genres);
 	g_mutex_free (db->priv->genres_lock);
 
+	rhythmdb_word_index_free (db->priv->word_index);
+
+	g_mutex_free (db->priv->prop_indexes_lock);
+
+	if (db->priv->query_pool != NULL)
+		g_thread_pool_free (db->priv->query_pool, FALSE, TRUE);
+
 	g_hash_table_foreach (db->priv->unknown_entry_types,
 			      (GHFunc) free_unknown_entries,
 			      NULL);
@@ -306,6 +406,48 @@ rhythmdb_tree_finalize (GObject *object)
 	G_OBJECT_CLASS (rhythmdb_tree_parent_class)->finalize (object);
 }
 
+static void
+rhythmdb_tree_set_property (GObject *object,
+			    guint prop_id,
+			    const GValue *value,
+			    GParamSpec *pspec)
+{
+	RhythmDBTree *db = RHYTHMDB_TREE (object);
+
+	switch (prop_id) {
+	case PROP_SECONDARY_INDEXES:
+		prop_index_set_enabled (db, g_value_get_boolean (value));
+		break;
+	case PROP_PARALLEL_QUERY_THRESHOLD:
+		db->priv->parallel_query_threshold = g_value_get_uint (value);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+rhythmdb_tree_get_property (GObject *object,
+			    guint prop_id,
+			    GValue *value,
+			    GParamSpec *pspec)
+{
+	RhythmDBTree *db = RHYTHMDB_TREE (object);
+
+	switch (prop_id) {
+	case PROP_SECONDARY_INDEXES:
+		g_value_set_boolean (value, db->priv->prop_indexes != NULL);
+		break;
+	case PROP_PARALLEL_QUERY_THRESHOLD:
+		g_value_set_uint (value, db->priv->parallel_query_threshold);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
 struct RhythmDBTreeLoadContext
 {
 	RhythmDBTree *db;
@@ -334,8 +476,115 @@ struct RhythmDBTreeLoadContext
 	guint canonicalise_uris : 1;
 	guint reload_all_metadata : 1;
 	guint update_podcasts : 1;
+
+	/* journal replay */
+	guint in_journal : 1;
+	guint journal_stale : 1;
+	guint has_generation : 1;
+	guint64 xml_size;
+	guint64 xml_mtime;
+	guint64 generation;
+
+	/* parallel loading */
+	GPtrArray *batch;
 };
 
+static RBRefString *
+unknown_entry_get_location (RhythmDBUnknownEntry *entry)
+{
+	GList *p;
+
+	for (p = entry->properties; p != NULL; p = p->next) {
+		RhythmDBUnknownEntryProperty *prop;
+
+		prop = (RhythmDBUnknownEntryProperty *) p->data;
+		if (strcmp (rb_refstring_get (prop->name), "location") == 0)
+			return prop->value;
+	}
+	return NULL;
+}
+
+/* must be called with the entries lock held */
+static void
+remove_unknown_entry (RhythmDBTree *db,
+		      RBRefString *typename,
+		      const char *location)
+{
+	GList *entries;
+	GList *e;
+
+	/* the entries hold the references on the type name */
+	rb_refstring_ref (typename);
+
+	entries = g_hash_table_lookup (db->priv->unknown_entry_types, typename);
+	for (e = entries; e != NULL; e = e->next) {
+		RBRefString *entry_location;
+
+		entry_location = unknown_entry_get_location ((RhythmDBUnknownEntry *)e->data);
+		if (entry_location != NULL && strcmp (rb_refstring_get (entry_location), location) == 0) {
+			entries = g_list_remove_link (entries, e);
+			free_unknown_entries (typename, e, NULL);
+			break;
+		}
+	}
+
+	if (entries != NULL)
+		g_hash_table_insert (db->priv->unknown_entry_types, typename, entries);
+	else
+		g_hash_table_remove (db->priv->unknown_entry_types, typename);
+
+	rb_refstring_unref (typename);
+}
+
+static void
+remove_unknown_entry_cb (RBRefString *typename,
+			 GList *entries,
+			 gpointer data)
+{
+	GList **typenames = (GList **)data;
+	*typenames = g_list_prepend (*typenames, typename);
+}
+
+/* must be called with the entries lock held */
+static void
+remove_unknown_entry_any_type (RhythmDBTree *db,
+			       const char *location)
+{
+	GList *typenames = NULL;
+	GList *t;
+
+	g_hash_table_foreach (db->priv->unknown_entry_types,
+			      (GHFunc) remove_unknown_entry_cb,
+			      &typenames);
+	for (t = typenames; t != NULL; t = t->next) {
+		remove_unknown_entry (db, (RBRefString *)t->data, location);
+	}
+	g_list_free (typenames);
+}
+
+static gboolean
+journal_matches_database (struct RhythmDBTreeLoadContext *ctx,
+			  const char **attrs)
+{
+	gboolean version_ok = FALSE;
+	gboolean size_ok = FALSE;
+	gboolean mtime_ok = FALSE;
+
+	for (; *attrs; attrs += 2) {
+		const char *value = *(attrs+1);
+
+		if (!strcmp (*attrs, "version")) {
+			version_ok = (strcmp (value, RHYTHMDB_TREE_XML_VERSION) == 0);
+		} else if (!strcmp (*attrs, "xml-size")) {
+			size_ok = (g_ascii_strtoull (value, NULL, 10) == ctx->xml_size);
+		} else if (!strcmp (*attrs, "xml-mtime")) {
+			mtime_ok = (g_ascii_strtoull (value, NULL, 10) == ctx->xml_mtime);
+		}
+	}
+
+	return (version_ok && size_ok && mtime_ok);
+}
+
 /* Returns the version as an int, multiplied by 100,
  * eg. "1.4" becomes 140 */
 static int
@@ -412,6 +661,14 @@ rhythmdb_tree_parser_start_element (struct RhythmDBTreeLoadContext *ctx,
 				}
 			}
 
+		} else if (!strcmp (name, "rhythmdb-journal")) {
+			ctx->state = RHYTHMDB_TREE_PARSER_STATE_RHYTHMDB;
+			ctx->in_journal = TRUE;
+			if (journal_matches_database (ctx, attrs) == FALSE) {
+				rb_debug ("journal doesn't match the saved database, ignoring it");
+				ctx->journal_stale = TRUE;
+				xmlStopParser (ctx->xmlctx);
+			}
 		} else {
 			ctx->in_unknown_elt++;
 		}
@@ -423,6 +680,9 @@ rhythmdb_tree_parser_start_element (struct RhythmDBTreeLoadContext *ctx,
 		if (!strcmp (name, "entry")) {
 			RhythmDBEntryType type = RHYTHMDB_ENTRY_TYPE_INVALID;
 			const char *typename = NULL;
+
+			/* only a generation record after this entry covers it */
+			ctx->has_generation = FALSE;
 			for (; *attrs; attrs +=2) {
 				if (!strcmp (*attrs, "type")) {
 					typename = *(attrs+1);
@@ -443,6 +703,39 @@ rhythmdb_tree_parser_start_element (struct RhythmDBTreeLoadContext *ctx,
 				ctx->unknown_entry = g_new0 (RhythmDBUnknownEntry, 1);
 				ctx->unknown_entry->typename = rb_refstring_new (typename);
 			}
+		} else if (ctx->in_journal && !strcmp (name, "deleted")) {
+			const char *location = NULL;
+			RhythmDBEntry *entry;
+
+			for (; *attrs; attrs +=2) {
+				if (!strcmp (*attrs, "location"))
+					location = *(attrs+1);
+			}
+
+			ctx->has_generation = FALSE;
+			if (location != NULL) {
+				entry = rhythmdb_entry_lookup_by_location (RHYTHMDB (ctx->db), location);
+				if (entry != NULL) {
+					rhythmdb_entry_delete (RHYTHMDB (ctx->db), entry);
+					rhythmdb_commit (RHYTHMDB (ctx->db));
+				} else {
+					g_mutex_lock (ctx->db->priv->entries_lock);
+					remove_unknown_entry_any_type (ctx->db, location);
+					g_mutex_unlock (ctx->db->priv->entries_lock);
+				}
+			}
+
+			/* skip the (empty) element */
+			ctx->in_unknown_elt++;
+		} else if (ctx->in_journal && !strcmp (name, "generation")) {
+			for (; *attrs; attrs +=2) {
+				if (!strcmp (*attrs, "value")) {
+					ctx->generation = g_ascii_strtoull (*(attrs+1), NULL, 10);
+					ctx->has_generation = TRUE;
+				}
+			}
+
+			ctx->in_unknown_elt++;
 		} else {
 			ctx->in_unknown_elt++;
 		}
@@ -483,6 +776,96 @@ rhythmdb_tree_parser_start_element (struct RhythmDBTreeLoadContext *ctx,
 	}
 }
 
+/*
+ * Adds an entry read from the database, merging it with any existing
+ * entry for the same location.
+ */
+static void
+rhythmdb_tree_parser_add_entry (struct RhythmDBTreeLoadContext *ctx,
+				RhythmDBEntry *new_entry)
+{
+	if (new_entry->location != NULL && rb_refstring_get (new_entry->location)[0] != '\0') {
+		RhythmDBEntry *entry;
+
+		g_mutex_lock (ctx->db->priv->entries_lock);
+		entry = g_hash_table_lookup (ctx->db->priv->entries, new_entry->location);
+		if (entry == NULL) {
+			rhythmdb_tree_entry_new_internal (RHYTHMDB (ctx->db), new_entry);
+			rhythmdb_entry_insert (RHYTHMDB (ctx->db), new_entry);
+			if (++ctx->batch_count == RHYTHMDB_QUERY_MODEL_SUGGESTED_UPDATE_CHUNK) {
+				rhythmdb_commit (RHYTHMDB (ctx->db));
+				ctx->batch_count = 0;
+			}
+		} else if (ctx->in_journal == FALSE &&
+			   new_entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_POST &&
+			   entry->type == RHYTHMDB_ENTRY_TYPE_SONG) {
+			rb_debug ("found song entry with duplicate location for Podcast post %s. merging metadata",
+				  rb_refstring_get (new_entry->location));
+
+			new_entry->play_count += entry->play_count;
+			if (new_entry->last_played < entry->last_played)
+				new_entry->last_played = entry->last_played;
+
+			/* Remove the song entry,
+			 * deleting requires relinquishing the locks */
+			g_mutex_unlock (ctx->db->priv->entries_lock);
+			rhythmdb_entry_delete (RHYTHMDB(ctx->db), entry);
+			g_mutex_lock (ctx->db->priv->entries_lock);
+			rhythmdb_commit (RHYTHMDB (ctx->db));
+
+			/* And add the Podcast entry to the database */
+			rhythmdb_tree_entry_new_internal (RHYTHMDB (ctx->db), new_entry);
+			rhythmdb_entry_insert (RHYTHMDB (ctx->db), new_entry);
+			if (++ctx->batch_count == RHYTHMDB_QUERY_MODEL_SUGGESTED_UPDATE_CHUNK) {
+				rhythmdb_commit (RHYTHMDB (ctx->db));
+				ctx->batch_count = 0;
+			}
+		} else if (ctx->in_journal) {
+			/* the journal holds the most recent version of the entry */
+			g_mutex_unlock (ctx->db->priv->entries_lock);
+			rhythmdb_entry_delete (RHYTHMDB(ctx->db), entry);
+			g_mutex_lock (ctx->db->priv->entries_lock);
+			rhythmdb_commit (RHYTHMDB (ctx->db));
+
+			rhythmdb_tree_entry_new_internal (RHYTHMDB (ctx->db), new_entry);
+			rhythmdb_entry_insert (RHYTHMDB (ctx->db), new_entry);
+			if (++ctx->batch_count == RHYTHMDB_QUERY_MODEL_SUGGESTED_UPDATE_CHUNK) {
+				rhythmdb_commit (RHYTHMDB (ctx->db));
+				ctx->batch_count = 0;
+			}
+		} else {
+			rb_debug ("found entry with duplicate location %s. merging metadata",
+				  rb_refstring_get (new_entry->location));
+
+			prop_index_remove_entry (ctx->db, entry);
+
+			entry->play_count += new_entry->play_count;
+
+			if (entry->rating < 0.01)
+				entry->rating = new_entry->rating;
+			else if (new_entry->rating > 0.01)
+				entry->rating = (entry->rating + new_entry->rating) / 2;
+
+			if (new_entry->last_played > entry->last_played)
+				entry->last_played = new_entry->last_played;
+
+			if (new_entry->first_seen < entry->first_seen)
+				entry->first_seen = new_entry->first_seen;
+
+			if (new_entry->last_seen > entry->last_seen)
+				entry->last_seen = new_entry->last_seen;
+
+			prop_index_add_entry (ctx->db, entry);
+
+			rhythmdb_entry_unref (new_entry);
+		}
+		g_mutex_unlock (ctx->db->priv->entries_lock);
+	} else {
+		rb_debug ("found entry without location");
+		rhythmdb_entry_unref (new_entry);
+	}
+}
+
 static void
 rhythmdb_tree_parser_end_element (struct RhythmDBTreeLoadContext *ctx,
 				  const char *name)
@@ -536,67 +919,12 @@ rhythmdb_tree_parser_end_element (struct RhythmDBTreeLoadContext *ctx,
 			}
 		}
 
-		if (ctx->entry->location != NULL && rb_refstring_get (ctx->entry->location)[0] != '\0') {
-			RhythmDBEntry *entry;
-
-			g_mutex_lock (ctx->db->priv->entries_lock);
-			entry = g_hash_table_lookup (ctx->db->priv->entries, ctx->entry->location);
-			if (entry == NULL) {
-				rhythmdb_tree_entry_new_internal (RHYTHMDB (ctx->db), ctx->entry);
-				rhythmdb_entry_insert (RHYTHMDB (ctx->db), ctx->entry);
-				if (++ctx->batch_count == RHYTHMDB_QUERY_MODEL_SUGGESTED_UPDATE_CHUNK) {
-					rhythmdb_commit (RHYTHMDB (ctx->db));
-					ctx->batch_count = 0;
-				}
-			} else if (ctx->entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_POST &&
-				   entry->type == RHYTHMDB_ENTRY_TYPE_SONG) {
-				rb_debug ("found song entry with duplicate location for Podcast post %s. merging metadata",
-					  rb_refstring_get (ctx->entry->location));
-
-				ctx->entry->play_count += entry->play_count;
-				if (ctx->entry->last_played < entry->last_played)
-					ctx->entry->last_played = entry->last_played;
-
-				/* Remove the song entry,
-				 * deleting requires relinquishing the locks */
-				g_mutex_unlock (ctx->db->priv->entries_lock);
-				rhythmdb_entry_delete (RHYTHMDB(ctx->db), entry);
-				g_mutex_lock (ctx->db->priv->entries_lock);
-				rhythmdb_commit (RHYTHMDB (ctx->db));
-
-				/* And add the Podcast entry to the database */
-				rhythmdb_tree_entry_new_internal (RHYTHMDB (ctx->db), ctx->entry);
-				rhythmdb_entry_insert (RHYTHMDB (ctx->db), ctx->entry);
-				if (++ctx->batch_count == RHYTHMDB_QUERY_MODEL_SUGGESTED_UPDATE_CHUNK) {
-					rhythmdb_commit (RHYTHMDB (ctx->db));
-					ctx->batch_count = 0;
-				}
-			} else {
-				rb_debug ("found entry with duplicate location %s. merging metadata",
-					  rb_refstring_get (ctx->entry->location));
-
-				entry->play_count += ctx->entry->play_count;
-
-				if (entry->rating < 0.01)
-					entry->rating = ctx->entry->rating;
-				else if (ctx->entry->rating > 0.01)
-					entry->rating = (entry->rating + ctx->entry->rating) / 2;
-
-				if (ctx->entry->last_played > entry->last_played)
-					entry->last_played = ctx->entry->last_played;
-
-				if (ctx->entry->first_seen < entry->first_seen)
-					entry->first_seen = ctx->entry->first_seen;
-
-				if (ctx->entry->last_seen > entry->last_seen)
-					entry->last_seen = ctx->entry->last_seen;
-
-				rhythmdb_entry_unref (ctx->entry);
-			}
-			g_mutex_unlock (ctx->db->priv->entries_lock);
+		word_index_prepare_entry (ctx->entry);
+		if (ctx->batch != NULL) {
+			/* parallel load: added to the database when the chunks are merged */
+			g_ptr_array_add (ctx->batch, ctx->entry);
 		} else {
-			rb_debug ("found entry without location");
-			rhythmdb_entry_unref (ctx->entry);
+			rhythmdb_tree_parser_add_entry (ctx, ctx->entry);
 		}
 		ctx->state = RHYTHMDB_TREE_PARSER_STATE_RHYTHMDB;
 		ctx->entry = NULL;
@@ -610,6 +938,13 @@ rhythmdb_tree_parser_end_element (struct RhythmDBTreeLoadContext *ctx,
 		ctx->unknown_entry->properties = g_list_reverse (ctx->unknown_entry->properties);
 
 		g_mutex_lock (ctx->db->priv->entries_lock);
+		if (ctx->in_journal) {
+			RBRefString *location;
+
+			location = unknown_entry_get_location (ctx->unknown_entry);
+			if (location != NULL)
+				remove_unknown_entry (ctx->db, ctx->unknown_entry->typename, rb_refstring_get (location));
+		}
 		entry_list = g_hash_table_lookup (ctx->db->priv->unknown_entry_types, ctx->unknown_entry->typename);
 		entry_list = g_list_prepend (entry_list, ctx->unknown_entry);
 		g_hash_table_insert (ctx->db->priv->unknown_entry_types, ctx->unknown_entry->typename, entry_list);
@@ -718,98 +1053,476 @@ rhythmdb_tree_parser_characters (struct RhythmDBTreeLoadContext *ctx,
 	}
 }
 
-static gboolean
-rhythmdb_tree_load (RhythmDB *rdb,
-		    GCancellable *cancel,
-		    GError **error)
+/*
+ * Parallel loading.
+ *
+ * Large databases in the current format are split into chunks at entry
+ * boundaries.  Each chunk is parsed on a worker thread, prefixed with the
+ * document's root element, into a batch of entries that are not yet part
+ * of the database.  The batches are then merged in file order on the
+ * load thread, linking each entry into the genre/artist/album tree.
+ */
+
+/* databases smaller than this are parsed on the load thread alone */
+#define RHYTHMDB_TREE_PARALLEL_LOAD_MIN_SIZE		(1024 * 1024)
+#define RHYTHMDB_TREE_PARALLEL_LOAD_CHUNKS_PER_THREAD	4
+
+#define RHYTHMDB_TREE_ENTRY_START "\n  <entry "
+#define RHYTHMDB_TREE_XML_END "</rhythmdb>\n"
+
+typedef struct
 {
-	RhythmDBTree *db = RHYTHMDB_TREE (rdb);
-	xmlParserCtxtPtr ctxt;
+	struct RhythmDBTreeLoadContext ctx;
 	xmlSAXHandlerPtr sax_handler;
-	struct RhythmDBTreeLoadContext *ctx;
-	char *name;
-	GError *local_error;
-	gboolean ret;
+	const char *header;
+	gsize header_len;
+	const char *data;
+	gsize len;
+	gboolean last;
+	GError *error;
+	gboolean well_formed;
+} RhythmDBTreeLoadChunk;
 
-	local_error = NULL;
+static void
+load_chunk_thread (RhythmDBTreeLoadChunk *chunk,
+		   gpointer data)
+{
+	xmlParserCtxtPtr ctxt;
 
-	sax_handler = g_new0 (xmlSAXHandler, 1);
-	ctx = g_new0 (struct RhythmDBTreeLoadContext, 1);
+	ctxt = xmlCreatePushParserCtxt (chunk->sax_handler, &chunk->ctx, NULL, 0, NULL);
+	chunk->ctx.xmlctx = ctxt;
 
-	sax_handler->startElement = (startElementSAXFunc) rhythmdb_tree_parser_start_element;
-	sax_handler->endElement = (endElementSAXFunc) rhythmdb_tree_parser_end_element;
-	sax_handler->characters = (charactersSAXFunc) rhythmdb_tree_parser_characters;
+	xmlParseChunk (ctxt, chunk->header, chunk->header_len, 0);
+	if (chunk->last) {
+		xmlParseChunk (ctxt, chunk->data, chunk->len, 1);
+	} else {
+		xmlParseChunk (ctxt, chunk->data, chunk->len, 0);
+		xmlParseChunk (ctxt, RHYTHMDB_TREE_XML_END, strlen (RHYTHMDB_TREE_XML_END), 1);
+	}
 
-	ctx->state = RHYTHMDB_TREE_PARSER_STATE_START;
-	ctx->db = db;
-	ctx->cancel = cancel;
-	ctx->buf = g_string_sized_new (RHYTHMDB_TREE_PARSER_INITIAL_BUFFER_SIZE);
-	ctx->error = &local_error;
+	chunk->well_formed = ctxt->wellFormed;
+	xmlFreeParserCtxt (ctxt);
 
-	g_object_get (G_OBJECT (db), "name", &name, NULL);
+	/* clean up after an incomplete entry */
+	if (chunk->ctx.entry != NULL) {
+		rhythmdb_entry_unref (chunk->ctx.entry);
+		chunk->ctx.entry = NULL;
+	}
+	if (chunk->ctx.unknown_entry != NULL) {
+		free_unknown_entries (chunk->ctx.unknown_entry->typename,
+				      g_list_prepend (NULL, chunk->ctx.unknown_entry),
+				      NULL);
+		chunk->ctx.unknown_entry = NULL;
+	}
+}
 
-	if (g_file_test (name, G_FILE_TEST_EXISTS)) {
-		ctxt = xmlCreateFileParserCtxt (name);
-		ctx->xmlctx = ctxt;
-		xmlFree (ctxt->sax);
-		ctxt->userData = ctx;
-		ctxt->sax = sax_handler;
-		xmlParseDocument (ctxt);
-		ctxt->sax = NULL;
-		xmlFreeParserCtxt (ctxt);
+/*
+ * Returns FALSE without loading anything if the database isn't suitable
+ * for parallel loading, in which case the caller parses it serially.
+ */
+static gboolean
+rhythmdb_tree_parallel_load (RhythmDBTree *db,
+			     const char *name,
+			     xmlSAXHandlerPtr sax_handler,
+			     GCancellable *cancel)
+{
+	RhythmDBTreeLoadChunk *chunks;
+	struct RhythmDBTreeLoadContext merge;
+	GMappedFile *mapped;
+	GThreadPool *pool;
+	const char *data;
+	const char *body;
+	const char *root;
+	const char *root_end;
+	const char *pos;
+	gsize length;
+	int n_threads;
+	int n_chunks;
+	int i;
+	guint j;
 
-		if (ctx->batch_count)
-			rhythmdb_commit (RHYTHMDB (ctx->db));
+	n_threads = rb_get_num_processors ();
+	if (n_threads < 2)
+		return FALSE;
+
+	mapped = g_mapped_file_new (name, FALSE, NULL);
+	if (mapped == NULL)
+		return FALSE;
+
+	data = g_mapped_file_get_contents (mapped);
+	length = g_mapped_file_get_length (mapped);
+	if (length < RHYTHMDB_TREE_PARALLEL_LOAD_MIN_SIZE) {
+		rb_debug ("database is small enough to load serially");
+		goto fallback;
 	}
 
-	ret = TRUE;
-	if (local_error != NULL) {
-		g_propagate_error (error, local_error);
-		ret = FALSE;
+	/* the root element must be in the current format, as upgrading
+	 * older databases relies on seeing entries in order.
+	 */
+	root = g_strstr_len (data, MIN (length, 1024), "<rhythmdb ");
+	root_end = root ? memchr (root, '>', length - (root - data)) : NULL;
+	if (root_end == NULL ||
+	    g_strstr_len (root, root_end - root, "version=\"" RHYTHMDB_TREE_XML_VERSION "\"") == NULL) {
+		rb_debug ("database is not in the current format, loading serially");
+		goto fallback;
 	}
+	body = root_end + 1;
 
-	g_string_free (ctx->buf, TRUE);
-	g_free (name);
-	g_free (sax_handler);
-	g_free (ctx);
+	rb_profile_start ("parallel database load");
 
-	return ret;
-}
+	n_chunks = n_threads * RHYTHMDB_TREE_PARALLEL_LOAD_CHUNKS_PER_THREAD;
+	chunks = g_new0 (RhythmDBTreeLoadChunk, n_chunks);
 
-struct RhythmDBTreeSaveContext
-{
-	RhythmDBTree *db;
-	FILE *handle;
-	char *error;
-};
+	/* find entry-aligned chunk boundaries */
+	pos = body;
+	for (i = 0; i < n_chunks; i++) {
+		RhythmDBTreeLoadChunk *chunk = &chunks[i];
+		const char *target;
+		const char *next = NULL;
 
-#ifdef HAVE_GNU_FWRITE_UNLOCKED
-#define RHYTHMDB_FWRITE_REAL fwrite_unlocked
-#define RHYTHMDB_FPUTC_REAL fputc_unlocked
-#else
-#define RHYTHMDB_FWRITE_REAL fwrite
-#define RHYTHMDB_FPUTC_REAL fputc
-#endif
+		if (i < n_chunks - 1) {
+			target = body + ((data + length - body) / n_chunks) * (i + 1);
+			target = MAX (target, pos);
+			next = g_strstr_len (target, data + length - target, RHYTHMDB_TREE_ENTRY_START);
+		}
 
-#define RHYTHMDB_FWRITE(w,x,len,handle,error) do {			\
-	if (error == NULL) {						\
-		if (RHYTHMDB_FWRITE_REAL (w,x,len,handle) != len) {	\
-			error = g_strdup (g_strerror (errno));		\
-		}							\
-	}								\
-} while (0)
+		chunk->sax_handler = sax_handler;
+		chunk->header = data;
+		chunk->header_len = body - data;
+		chunk->data = pos;
+
+		chunk->ctx.state = RHYTHMDB_TREE_PARSER_STATE_START;
+		chunk->ctx.db = db;
+		chunk->ctx.cancel = cancel;
+		chunk->ctx.buf = g_string_sized_new (RHYTHMDB_TREE_PARSER_INITIAL_BUFFER_SIZE);
+		chunk->ctx.error = &chunk->error;
+		chunk->ctx.batch = g_ptr_array_new ();
+
+		if (next == NULL) {
+			chunk->len = data + length - pos;
+			chunk->last = TRUE;
+			n_chunks = i + 1;
+			break;
+		}
 
-#define RHYTHMDB_FPUTC(x,handle,error) do {				\
-	if (error == NULL) {						\
-		if (RHYTHMDB_FPUTC_REAL (x,handle) == EOF) {		\
-			error = g_strdup (g_strerror (errno));		\
-		}							\
-	}								\
-} while (0)
+		/* include the newline in this chunk */
+		next++;
+		chunk->len = next - pos;
+		pos = next;
+	}
 
-#define RHYTHMDB_FWRITE_STATICSTR(STR, HANDLE, ERROR) RHYTHMDB_FWRITE(STR, 1, sizeof(STR)-1, HANDLE, ERROR)
+	rb_debug ("loading database in %d chunks on %d threads", n_chunks, n_threads);
 
-static void
+	/* libxml2 must be initialised before parsing on multiple threads */
+	xmlInitParser ();
+
+	pool = g_thread_pool_new ((GFunc) load_chunk_thread, NULL, MIN (n_threads, n_chunks), TRUE, NULL);
+	for (i = 0; i < n_chunks; i++) {
+		g_thread_pool_push (pool, &chunks[i], NULL);
+	}
+	g_thread_pool_free (pool, FALSE, TRUE);
+
+	/* merge the batches into the database in file order */
+	memset (&merge, 0, sizeof (merge));
+	merge.db = db;
+	merge.cancel = cancel;
+	for (i = 0; i < n_chunks; i++) {
+		RhythmDBTreeLoadChunk *chunk = &chunks[i];
+
+		if (chunk->well_formed == FALSE)
+			rb_debug ("chunk %d of the database is not well formed", i);
+
+		for (j = 0; j < chunk->ctx.batch->len; j++) {
+			RhythmDBEntry *entry = g_ptr_array_index (chunk->ctx.batch, j);
+
+			if (g_cancellable_is_cancelled (cancel))
+				rhythmdb_entry_unref (entry);
+			else
+				rhythmdb_tree_parser_add_entry (&merge, entry);
+		}
+
+		g_ptr_array_free (chunk->ctx.batch, TRUE);
+		g_string_free (chunk->ctx.buf, TRUE);
+		if (chunk->error != NULL)
+			g_error_free (chunk->error);
+	}
+
+	if (merge.batch_count)
+		rhythmdb_commit (RHYTHMDB (db));
+
+	g_free (chunks);
+#if GLIB_CHECK_VERSION (2,22,0)
+	g_mapped_file_unref (mapped);
+#else
+	g_mapped_file_free (mapped);
+#endif
+
+	rb_profile_end ("parallel database load");
+	return TRUE;
+
+fallback:
+#if GLIB_CHECK_VERSION (2,22,0)
+	g_mapped_file_unref (mapped);
+#else
+	g_mapped_file_free (mapped);
+#endif
+	return FALSE;
+}
+
+static char *
+journal_filename (const char *name)
+{
+	return g_strconcat (name, RHYTHMDB_TREE_JOURNAL_SUFFIX, NULL);
+}
+
+/*
+ * Reads the generation saved at the start of the full database, which is
+ * written before any entries so it can be found without parsing the file.
+ */
+static gboolean
+rhythmdb_tree_read_generation (const char *name,
+			       guint64 *generation)
+{
+	char head[1024];
+	const char *start;
+	const char *entry;
+	size_t length;
+	FILE *f;
+
+	f = fopen (name, "r");
+	if (f == NULL)
+		return FALSE;
+	length = fread (head, 1, sizeof (head) - 1, f);
+	fclose (f);
+	head[length] = '\0';
+
+	start = strstr (head, RHYTHMDB_TREE_GENERATION_START);
+	entry = strstr (head, RHYTHMDB_TREE_ENTRY_START);
+	if (start == NULL || (entry != NULL && entry < start))
+		return FALSE;
+
+	*generation = g_ascii_strtoull (start + strlen (RHYTHMDB_TREE_GENERATION_START), NULL, 10);
+	return TRUE;
+}
+
+/*
+ * Replays changes appended to the journal since the database was last
+ * saved in full.  Returns TRUE if the entries in memory now match the
+ * database and journal on disk, so further changes can be appended to
+ * the journal.  If the journal records the generation its last changes
+ * bring the database up to, that is returned in @generation; if it
+ * contains changes that no generation was recorded for, @has_generation
+ * is cleared.
+ */
+static gboolean
+rhythmdb_tree_journal_load (RhythmDBTree *db,
+			    const char *name,
+			    xmlSAXHandlerPtr sax_handler,
+			    GCancellable *cancel,
+			    gboolean *has_generation,
+			    guint64 *generation)
+{
+	struct RhythmDBTreeLoadContext *ctx;
+	xmlParserCtxtPtr ctxt;
+	GError *local_error = NULL;
+	struct stat xml_stat;
+	char *filename;
+	char *contents;
+	gsize length;
+	gboolean ret;
+
+	if (g_stat (name, &xml_stat) < 0)
+		return FALSE;
+
+	filename = journal_filename (name);
+	if (g_file_get_contents (filename, &contents, &length, NULL) == FALSE) {
+		g_free (filename);
+		return TRUE;
+	}
+
+	rb_profile_start ("replaying database journal");
+
+	ctx = g_new0 (struct RhythmDBTreeLoadContext, 1);
+	ctx->state = RHYTHMDB_TREE_PARSER_STATE_START;
+	ctx->db = db;
+	ctx->cancel = cancel;
+	ctx->buf = g_string_sized_new (RHYTHMDB_TREE_PARSER_INITIAL_BUFFER_SIZE);
+	ctx->error = &local_error;
+	ctx->xml_size = xml_stat.st_size;
+	ctx->xml_mtime = xml_stat.st_mtime;
+	ctx->has_generation = *has_generation;
+	ctx->generation = *generation;
+
+	/* the journal is only ever appended to, so it has no closing tag */
+	ctxt = xmlCreatePushParserCtxt (sax_handler, ctx, NULL, 0, filename);
+	ctx->xmlctx = ctxt;
+	xmlParseChunk (ctxt, contents, length, 0);
+	xmlParseChunk (ctxt, RHYTHMDB_TREE_JOURNAL_END, strlen (RHYTHMDB_TREE_JOURNAL_END), 1);
+
+	if (ctx->batch_count)
+		rhythmdb_commit (RHYTHMDB (ctx->db));
+
+	if (ctx->journal_stale) {
+		g_unlink (filename);
+		ret = FALSE;
+	} else {
+		/* a partially written record at the end of the journal
+		 * means it needs to be compacted before appending to it.
+		 */
+		ret = (ctxt->wellFormed && local_error == NULL);
+	}
+	*has_generation = ctx->has_generation;
+	*generation = ctx->generation;
+
+	/* clean up after a truncated record */
+	if (ctx->entry != NULL)
+		rhythmdb_entry_unref (ctx->entry);
+	if (ctx->unknown_entry != NULL) {
+		free_unknown_entries (ctx->unknown_entry->typename,
+				      g_list_prepend (NULL, ctx->unknown_entry),
+				      NULL);
+	}
+
+	xmlFreeParserCtxt (ctxt);
+	if (local_error != NULL)
+		g_error_free (local_error);
+	g_string_free (ctx->buf, TRUE);
+	g_free (ctx);
+	g_free (contents);
+	g_free (filename);
+
+	rb_profile_end ("replaying database journal");
+	return ret;
+}
+
+static gboolean
+rhythmdb_tree_load (RhythmDB *rdb,
+		    GCancellable *cancel,
+		    GError **error)
+{
+	RhythmDBTree *db = RHYTHMDB_TREE (rdb);
+	xmlParserCtxtPtr ctxt;
+	xmlSAXHandlerPtr sax_handler;
+	struct RhythmDBTreeLoadContext *ctx;
+	char *name;
+	GError *local_error;
+	gboolean has_generation = FALSE;
+	guint64 generation = 0;
+	gboolean ret;
+
+	local_error = NULL;
+
+	sax_handler = g_new0 (xmlSAXHandler, 1);
+	ctx = g_new0 (struct RhythmDBTreeLoadContext, 1);
+
+	sax_handler->startElement = (startElementSAXFunc) rhythmdb_tree_parser_start_element;
+	sax_handler->endElement = (endElementSAXFunc) rhythmdb_tree_parser_end_element;
+	sax_handler->characters = (charactersSAXFunc) rhythmdb_tree_parser_characters;
+
+	ctx->state = RHYTHMDB_TREE_PARSER_STATE_START;
+	ctx->db = db;
+	ctx->cancel = cancel;
+	ctx->buf = g_string_sized_new (RHYTHMDB_TREE_PARSER_INITIAL_BUFFER_SIZE);
+	ctx->error = &local_error;
+
+	g_object_get (G_OBJECT (db), "name", &name, NULL);
+
+	if (rhythmdb_tree_snapshot_load (db, name, cancel)) {
+		rb_debug ("loaded database from binary snapshot");
+	} else if (rhythmdb_tree_parallel_load (db, name, sax_handler, cancel)) {
+		rb_debug ("loaded database using parallel parser");
+	} else if (g_file_test (name, G_FILE_TEST_EXISTS)) {
+		ctxt = xmlCreateFileParserCtxt (name);
+		ctx->xmlctx = ctxt;
+		xmlFree (ctxt->sax);
+		ctxt->userData = ctx;
+		ctxt->sax = sax_handler;
+		xmlParseDocument (ctxt);
+		ctxt->sax = NULL;
+		xmlFreeParserCtxt (ctxt);
+
+		if (ctx->batch_count)
+			rhythmdb_commit (RHYTHMDB (ctx->db));
+	}
+
+	if (local_error == NULL && !g_cancellable_is_cancelled (cancel)) {
+		gboolean journal_valid;
+
+		has_generation = rhythmdb_tree_read_generation (name, &generation);
+		journal_valid = rhythmdb_tree_journal_load (db, name, sax_handler, cancel,
+							    &has_generation, &generation);
+
+		/* upgraded entries differ from what's on disk */
+		if (ctx->canonicalise_uris || ctx->reload_all_metadata || ctx->update_podcasts)
+			journal_valid = FALSE;
+
+		g_mutex_lock (db->priv->entries_lock);
+		db->priv->journal_valid = journal_valid;
+		g_mutex_unlock (db->priv->entries_lock);
+
+		if (journal_valid == FALSE)
+			has_generation = FALSE;
+	}
+
+	/* everything added while loading is already on disk */
+	rhythmdb_journal_clear (rdb);
+
+	/* if the contents of the database don't match a saved generation,
+	 * start from one that nothing saved elsewhere can match.
+	 */
+	if (has_generation == FALSE)
+		generation = ((guint64) g_random_int () << 32) | g_random_int ();
+	rb_debug ("database generation is %" G_GUINT64_FORMAT, generation);
+	rhythmdb_set_generation (rdb, generation);
+
+	ret = TRUE;
+	if (local_error != NULL) {
+		g_propagate_error (error, local_error);
+		ret = FALSE;
+	}
+
+	g_string_free (ctx->buf, TRUE);
+	g_free (name);
+	g_free (sax_handler);
+	g_free (ctx);
+
+	return ret;
+}
+
+struct RhythmDBTreeSaveContext
+{
+	RhythmDBTree *db;
+	FILE *handle;
+	char *error;
+};
+
+#ifdef HAVE_GNU_FWRITE_UNLOCKED
+#define RHYTHMDB_FWRITE_REAL fwrite_unlocked
+#define RHYTHMDB_FPUTC_REAL fputc_unlocked
+#else
+#define RHYTHMDB_FWRITE_REAL fwrite
+#define RHYTHMDB_FPUTC_REAL fputc
+#endif
+
+#define RHYTHMDB_FWRITE(w,x,len,handle,error) do {			\
+	if (error == NULL) {						\
+		if (RHYTHMDB_FWRITE_REAL (w,x,len,handle) != len) {	\
+			error = g_strdup (g_strerror (errno));		\
+		}							\
+	}								\
+} while (0)
+
+#define RHYTHMDB_FPUTC(x,handle,error) do {				\
+	if (error == NULL) {						\
+		if (RHYTHMDB_FPUTC_REAL (x,handle) == EOF) {		\
+			error = g_strdup (g_strerror (errno));		\
+		}							\
+	}								\
+} while (0)
+
+#define RHYTHMDB_FWRITE_STATICSTR(STR, HANDLE, ERROR) RHYTHMDB_FWRITE(STR, 1, sizeof(STR)-1, HANDLE, ERROR)
+
+static void
 write_elt_name_open (struct RhythmDBTreeSaveContext *ctx,
 		     const xmlChar *elt_name)
 {
@@ -976,16 +1689,16 @@ save_entry (RhythmDBTree *db,
 			save_entry_string(ctx, elt_name, rb_refstring_get (entry->genre));
 			break;
 		case RHYTHMDB_PROP_MUSICBRAINZ_TRACKID:
-			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->musicbrainz_trackid));
+			save_entry_string_if_set (ctx, elt_name, rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_MUSICBRAINZ_TRACKID));
 			break;
 		case RHYTHMDB_PROP_MUSICBRAINZ_ARTISTID:
-			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->musicbrainz_artistid));
+			save_entry_string_if_set (ctx, elt_name, rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_MUSICBRAINZ_ARTISTID));
 			break;
 		case RHYTHMDB_PROP_MUSICBRAINZ_ALBUMID:
-			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->musicbrainz_albumid));
+			save_entry_string_if_set (ctx, elt_name, rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_MUSICBRAINZ_ALBUMID));
 			break;
 		case RHYTHMDB_PROP_MUSICBRAINZ_ALBUMARTISTID:
-			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->musicbrainz_albumartistid));
+			save_entry_string_if_set (ctx, elt_name, rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_MUSICBRAINZ_ALBUMARTISTID));
 			break;
 		case RHYTHMDB_PROP_ARTIST_SORTNAME:
 			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->artist_sortname));
@@ -1175,17 +1888,158 @@ save_unknown_entry_type (RBRefString *typename,
 	}
 }
 
+static void
+journal_save_deleted_entry (RhythmDBEntry *entry,
+			    gpointer op,
+			    struct RhythmDBTreeSaveContext *ctx)
+{
+	xmlChar *encoded;
+
+	if (ctx->error || entry->type->save_to_disk == FALSE ||
+	    GPOINTER_TO_INT (op) != RHYTHMDB_JOURNAL_ENTRY_DELETED)
+		return;
+
+	RHYTHMDB_FWRITE_STATICSTR ("  <deleted location=\"", ctx->handle, ctx->error);
+	encoded = xmlEncodeSpecialChars (NULL, BAD_CAST rb_refstring_get (entry->location));
+	RHYTHMDB_FWRITE (encoded, 1, xmlStrlen (encoded), ctx->handle, ctx->error);
+	g_free (encoded);
+	RHYTHMDB_FWRITE_STATICSTR ("\"/>\n", ctx->handle, ctx->error);
+}
+
+static void
+journal_save_changed_entry (RhythmDBEntry *entry,
+			    gpointer op,
+			    struct RhythmDBTreeSaveContext *ctx)
+{
+	if (ctx->error || entry->type->save_to_disk == FALSE ||
+	    GPOINTER_TO_INT (op) != RHYTHMDB_JOURNAL_ENTRY_CHANGED)
+		return;
+
+	save_entry (ctx->db, entry, ctx);
+}
+
+/*
+ * Records the database generation the saved entries correspond to.  Older
+ * versions skip this as an unknown element.
+ */
+static void
+rhythmdb_tree_write_generation (struct RhythmDBTreeSaveContext *ctx,
+				guint64 generation)
+{
+	char *str;
+
+	str = g_strdup_printf ("  " RHYTHMDB_TREE_GENERATION_START "%" G_GUINT64_FORMAT "\"/>\n", generation);
+	RHYTHMDB_FWRITE (str, 1, strlen (str), ctx->handle, ctx->error);
+	g_free (str);
+}
+
+/*
+ * Appends the entries changed since the last save to the journal.
+ * Returns FALSE if the database needs to be saved in full instead, either
+ * because the journal can't be used or has grown too large.
+ */
+static gboolean
+rhythmdb_tree_journal_append (RhythmDBTree *db,
+			      const char *name,
+			      GHashTable *journal,
+			      guint64 generation)
+{
+	struct RhythmDBTreeSaveContext ctx;
+	struct stat xml_stat;
+	struct stat journal_stat;
+	gboolean journal_valid;
+	gboolean ret = FALSE;
+	char *filename;
+	FILE *f;
+
+	g_mutex_lock (db->priv->entries_lock);
+	journal_valid = db->priv->journal_valid;
+	g_mutex_unlock (db->priv->entries_lock);
+
+	if (journal_valid == FALSE || g_stat (name, &xml_stat) < 0)
+		return FALSE;
+
+	filename = journal_filename (name);
+	if (g_stat (filename, &journal_stat) < 0) {
+		journal_stat.st_size = 0;
+	} else if (journal_stat.st_size > MAX (RHYTHMDB_TREE_JOURNAL_MIN_COMPACT_SIZE, xml_stat.st_size / 4)) {
+		rb_debug ("journal has grown to %" G_GINT64_FORMAT " bytes, compacting",
+			  (gint64) journal_stat.st_size);
+		g_free (filename);
+		return FALSE;
+	}
+
+	f = fopen (filename, "a");
+	if (f == NULL) {
+		rb_debug ("couldn't open journal %s: %s", filename, g_strerror (errno));
+		g_free (filename);
+		return FALSE;
+	}
+
+	ctx.db = db;
+	ctx.handle = f;
+	ctx.error = NULL;
+
+	if (journal_stat.st_size == 0) {
+		char *header;
+
+		/* identifies the saved database the journal applies to */
+		header = g_strdup_printf ("<?xml version=\"1.0\" standalone=\"yes\"?>\n"
+					  "<rhythmdb-journal version=\"" RHYTHMDB_TREE_XML_VERSION "\""
+					  " xml-size=\"%" G_GUINT64_FORMAT "\""
+					  " xml-mtime=\"%" G_GUINT64_FORMAT "\">\n",
+					  (guint64) xml_stat.st_size,
+					  (guint64) xml_stat.st_mtime);
+		RHYTHMDB_FWRITE (header, 1, strlen (header), ctx.handle, ctx.error);
+		g_free (header);
+	}
+
+	/* a location can be deleted and then used by a new entry between
+	 * saves, so the deletions are written first, to be replayed before
+	 * the new entry.
+	 */
+	g_hash_table_foreach (journal, (GHFunc) journal_save_deleted_entry, &ctx);
+	g_hash_table_foreach (journal, (GHFunc) journal_save_changed_entry, &ctx);
+	rhythmdb_tree_write_generation (&ctx, generation);
+
+	if (fclose (f) < 0 && ctx.error == NULL)
+		ctx.error = g_strdup (g_strerror (errno));
+
+	if (ctx.error != NULL) {
+		rb_debug ("writing to the journal failed: %s", ctx.error);
+		g_free (ctx.error);
+	} else {
+		rb_debug ("appended %u changed entries to the journal", g_hash_table_size (journal));
+		ret = TRUE;
+	}
+
+	g_free (filename);
+	return ret;
+}
+
 static void
 rhythmdb_tree_save (RhythmDB *rdb)
 {
 	RhythmDBTree *db = RHYTHMDB_TREE (rdb);
 	char *name;
+	char *journal_name;
 	GString *savepath;
+	GHashTable *journal;
+	guint64 generation;
+	gboolean saved = FALSE;
 	FILE *f;
 	struct RhythmDBTreeSaveContext ctx;
 
 	g_object_get (G_OBJECT (db), "name", &name, NULL);
 
+	journal = rhythmdb_journal_take (rdb, &generation);
+	if (rhythmdb_tree_journal_append (db, name, journal, generation)) {
+		g_hash_table_destroy (journal);
+		g_free (name);
+		return;
+	}
+	g_hash_table_destroy (journal);
+
 	savepath = g_string_new (name);
 	g_string_append (savepath, ".tmp");
 
@@ -1202,6 +2056,7 @@ rhythmdb_tree_save (RhythmDB *rdb)
 	RHYTHMDB_FWRITE_STATICSTR ("<?xml version=\"1.0\" standalone=\"yes\"?>\n"
 				   "<rhythmdb version=\"" RHYTHMDB_TREE_XML_VERSION "\">\n",
 				   ctx.handle, ctx.error);
+	rhythmdb_tree_write_generation (&ctx, generation);
 
 	rhythmdb_entry_type_foreach (rdb, (GHFunc) save_entry_type, &ctx);
 	g_mutex_lock (RHYTHMDB_TREE(rdb)->priv->entries_lock);
@@ -1230,10 +2085,26 @@ rhythmdb_tree_save (RhythmDB *rdb)
 				   name, savepath->str,
 				   g_strerror (errno));
 			unlink (savepath->str);
+		} else {
+			rhythmdb_tree_snapshot_save (db, name);
+			saved = TRUE;
 		}
 	}
 
 out:
+	/* a full save replaces the journal; if the save failed, the
+	 * changes taken from the journal are only in memory, so the next
+	 * save must be a full one too.
+	 */
+	if (saved) {
+		journal_name = journal_filename (name);
+		g_unlink (journal_name);
+		g_free (journal_name);
+	}
+	g_mutex_lock (db->priv->entries_lock);
+	db->priv->journal_valid = saved;
+	g_mutex_unlock (db->priv->entries_lock);
+
 	g_string_free (savepath, TRUE);
 	g_free (name);
 	return;
@@ -1244,34 +2115,1051 @@ out:
 #undef RHYTHMDB_FPUTC
 #undef RHYTHMDB_FWRITE
 
-RhythmDB *
-rhythmdb_tree_new (const char *name)
-{
-	RhythmDBTree *db = g_object_new (RHYTHMDB_TYPE_TREE, "name", name, NULL);
+/*
+ * Binary snapshot of the database.
+ *
+ * Each time the XML database is saved, a snapshot of the same entries is
+ * written next to it (rhythmdb.xml.snapshot).  On startup, if the snapshot
+ * matches the size and modification time of the XML file, entries are
+ * created straight from the mapped snapshot rather than by running the
+ * SAX parser over the XML.  The XML file remains the authoritative copy;
+ * the snapshot is discarded whenever anything about it looks wrong.
+ *
+ * The folded strings and sort keys of strings used for searching and
+ * sorting are stored too, if they had been computed by the time of the
+ * save, so they don't have to be computed again after loading.  Sort keys
+ * depend on the collation locale, so they are ignored if it has changed.
+ *
+ * Layout (native byte order):
+ *   RhythmDBTreeSnapshotHeader
+ *   n_entries x RhythmDBTreeSnapshotEntry
+ *   n_keywords x guint32 string index
+ *   n_strings x guint32 offset into the string data
+ *   n_strings x 2 guint32 string index of the folded string and sort key
+ *   strings_size bytes of nul-terminated string data
+ */
 
-	g_return_val_if_fail (db->priv != NULL, NULL);
+#define RHYTHMDB_TREE_SNAPSHOT_SUFFIX		".snapshot"
+#define RHYTHMDB_TREE_SNAPSHOT_MAGIC		"RBDBSNAP"
+#define RHYTHMDB_TREE_SNAPSHOT_VERSION		2
+#define RHYTHMDB_TREE_SNAPSHOT_BYTE_ORDER	0x01020304
+#define RHYTHMDB_TREE_SNAPSHOT_NO_STRING	G_MAXUINT32
+
+#define RHYTHMDB_TREE_SNAPSHOT_N_STRINGS	19
+#define RHYTHMDB_TREE_SNAPSHOT_N_ULONGS		12
+
+static const RhythmDBPropType snapshot_string_props[RHYTHMDB_TREE_SNAPSHOT_N_STRINGS] = {
+	RHYTHMDB_PROP_LOCATION,
+	RHYTHMDB_PROP_TITLE,
+	RHYTHMDB_PROP_ARTIST,
+	RHYTHMDB_PROP_ALBUM,
+	RHYTHMDB_PROP_GENRE,
+	RHYTHMDB_PROP_MUSICBRAINZ_TRACKID,
+	RHYTHMDB_PROP_MUSICBRAINZ_ARTISTID,
+	RHYTHMDB_PROP_MUSICBRAINZ_ALBUMID,
+	RHYTHMDB_PROP_MUSICBRAINZ_ALBUMARTISTID,
+	RHYTHMDB_PROP_ARTIST_SORTNAME,
+	RHYTHMDB_PROP_ALBUM_SORTNAME,
+	RHYTHMDB_PROP_MOUNTPOINT,
+	RHYTHMDB_PROP_MIMETYPE,
+	RHYTHMDB_PROP_DESCRIPTION,
+	RHYTHMDB_PROP_SUBTITLE,
+	RHYTHMDB_PROP_SUMMARY,
+	RHYTHMDB_PROP_LANG,
+	RHYTHMDB_PROP_COPYRIGHT,
+	RHYTHMDB_PROP_IMAGE
+};
 
-	return RHYTHMDB (db);
-}
+static const RhythmDBPropType snapshot_ulong_props[RHYTHMDB_TREE_SNAPSHOT_N_ULONGS] = {
+	RHYTHMDB_PROP_TRACK_NUMBER,
+	RHYTHMDB_PROP_DISC_NUMBER,
+	RHYTHMDB_PROP_DATE,
+	RHYTHMDB_PROP_DURATION,
+	RHYTHMDB_PROP_BITRATE,
+	RHYTHMDB_PROP_MTIME,
+	RHYTHMDB_PROP_FIRST_SEEN,
+	RHYTHMDB_PROP_LAST_SEEN,
+	RHYTHMDB_PROP_PLAY_COUNT,
+	RHYTHMDB_PROP_LAST_PLAYED,
+	RHYTHMDB_PROP_STATUS,
+	RHYTHMDB_PROP_POST_TIME
+};
 
-/* must be called with the genres_lock held */
-static void
-set_entry_album (RhythmDBTree *db,
-		 RhythmDBEntry *entry,
-		 RhythmDBTreeProperty *artist,
-		 RBRefString *name)
+typedef struct
 {
-	struct RhythmDBTreeProperty *prop;
+	char magic[8];
+	guint32 version;
+	guint32 byte_order;
+	guint32 record_size;
+	guint32 n_entries;
+	guint32 n_keywords;
+	guint32 n_strings;
+	guint64 xml_size;
+	guint64 xml_mtime;
+	guint64 strings_size;
+	guint32 collate_locale;
+	guint32 padding;
+} RhythmDBTreeSnapshotHeader;
+
+typedef struct
+{
+	guint64 file_size;
+	gdouble rating;
+	guint64 ulongs[RHYTHMDB_TREE_SNAPSHOT_N_ULONGS];
+	guint32 type;
+	guint32 hidden;
+	guint32 first_keyword;
+	guint32 n_keywords;
+	guint32 strings[RHYTHMDB_TREE_SNAPSHOT_N_STRINGS];
+	guint32 padding;
+} RhythmDBTreeSnapshotEntry;
+
+struct RhythmDBTreeSnapshotSaveContext
+{
+	RhythmDBTree *db;
+	GArray *entries;
+	GArray *keywords;
+	GArray *string_offsets;
+	GArray *string_keys;
+	GString *strings;
+	GHashTable *string_ids;
+};
+
+static RBRefString **
+snapshot_string_slot (RhythmDBEntry *entry,
+		      RhythmDBPodcastFields *podcast,
+		      RhythmDBPropType propid,
+		      gboolean create)
+{
+	RhythmDBEntryColdFields *cold;
+
+	switch (propid) {
+	case RHYTHMDB_PROP_LOCATION:
+		return &entry->location;
+	case RHYTHMDB_PROP_TITLE:
+		return &entry->title;
+	case RHYTHMDB_PROP_ARTIST:
+		return &entry->artist;
+	case RHYTHMDB_PROP_ALBUM:
+		return &entry->album;
+	case RHYTHMDB_PROP_GENRE:
+		return &entry->genre;
+	case RHYTHMDB_PROP_MUSICBRAINZ_TRACKID:
+		cold = rhythmdb_entry_get_cold_fields (entry, create);
+		return cold ? &cold->musicbrainz_trackid : NULL;
+	case RHYTHMDB_PROP_MUSICBRAINZ_ARTISTID:
+		cold = rhythmdb_entry_get_cold_fields (entry, create);
+		return cold ? &cold->musicbrainz_artistid : NULL;
+	case RHYTHMDB_PROP_MUSICBRAINZ_ALBUMID:
+		cold = rhythmdb_entry_get_cold_fields (entry, create);
+		return cold ? &cold->musicbrainz_albumid : NULL;
+	case RHYTHMDB_PROP_MUSICBRAINZ_ALBUMARTISTID:
+		cold = rhythmdb_entry_get_cold_fields (entry, create);
+		return cold ? &cold->musicbrainz_albumartistid : NULL;
+	case RHYTHMDB_PROP_ARTIST_SORTNAME:
+		return &entry->artist_sortname;
+	case RHYTHMDB_PROP_ALBUM_SORTNAME:
+		return &entry->album_sortname;
+	case RHYTHMDB_PROP_MOUNTPOINT:
+		return &entry->mountpoint;
+	case RHYTHMDB_PROP_MIMETYPE:
+		return &entry->mimetype;
+	case RHYTHMDB_PROP_DESCRIPTION:
+		return podcast ? &podcast->description : NULL;
+	case RHYTHMDB_PROP_SUBTITLE:
+		return podcast ? &podcast->subtitle : NULL;
+	case RHYTHMDB_PROP_SUMMARY:
+		return podcast ? &podcast->summary : NULL;
+	case RHYTHMDB_PROP_LANG:
+		return podcast ? &podcast->lang : NULL;
+	case RHYTHMDB_PROP_COPYRIGHT:
+		return podcast ? &podcast->copyright : NULL;
+	case RHYTHMDB_PROP_IMAGE:
+		return podcast ? &podcast->image : NULL;
+	default:
+		g_assert_not_reached ();
+		return NULL;
+	}
+}
+
+static void
+snapshot_set_ulong (RhythmDBEntry *entry,
+		    RhythmDBPodcastFields *podcast,
+		    RhythmDBPropType propid,
+		    gulong value)
+{
+	switch (propid) {
+	case RHYTHMDB_PROP_TRACK_NUMBER:
+		entry->tracknum = value;
+		break;
+	case RHYTHMDB_PROP_DISC_NUMBER:
+		entry->discnum = value;
+		break;
+	case RHYTHMDB_PROP_DATE:
+		if (value > 0)
+			g_date_set_julian (&entry->date, value);
+		else
+			g_date_clear (&entry->date, 1);
+		break;
+	case RHYTHMDB_PROP_DURATION:
+		entry->duration = value;
+		break;
+	case RHYTHMDB_PROP_BITRATE:
+		entry->bitrate = value;
+		break;
+	case RHYTHMDB_PROP_MTIME:
+		entry->mtime = value;
+		break;
+	case RHYTHMDB_PROP_FIRST_SEEN:
+		entry->first_seen = value;
+		break;
+	case RHYTHMDB_PROP_LAST_SEEN:
+		entry->last_seen = value;
+		break;
+	case RHYTHMDB_PROP_PLAY_COUNT:
+		entry->play_count = value;
+		break;
+	case RHYTHMDB_PROP_LAST_PLAYED:
+		entry->last_played = value;
+		break;
+	case RHYTHMDB_PROP_STATUS:
+		if (podcast)
+			podcast->status = value;
+		break;
+	case RHYTHMDB_PROP_POST_TIME:
+		if (podcast)
+			podcast->post_time = value;
+		break;
+	default:
+		g_assert_not_reached ();
+		break;
+	}
+}
+
+static guint32
+snapshot_string_index (struct RhythmDBTreeSnapshotSaveContext *ctx,
+		       const char *str)
+{
+	gpointer id;
+	guint32 offset;
+
+	if (str == NULL)
+		return RHYTHMDB_TREE_SNAPSHOT_NO_STRING;
+
+	/* strings are either refstrings or entry type names, so the same
+	 * string always has the same address for the duration of the save.
+	 */
+	if (g_hash_table_lookup_extended (ctx->string_ids, str, NULL, &id))
+		return GPOINTER_TO_UINT (id);
+
+	offset = ctx->strings->len;
+	g_string_append_len (ctx->strings, str, strlen (str) + 1);
+	g_array_append_val (ctx->string_offsets, offset);
+
+	id = GUINT_TO_POINTER (ctx->string_offsets->len - 1);
+	g_hash_table_insert (ctx->string_ids, (gpointer) str, id);
+	return GPOINTER_TO_UINT (id);
+}
+
+static gboolean
+snapshot_prop_has_keys (RhythmDBPropType propid)
+{
+	switch (propid) {
+	case RHYTHMDB_PROP_TITLE:
+	case RHYTHMDB_PROP_ARTIST:
+	case RHYTHMDB_PROP_ALBUM:
+	case RHYTHMDB_PROP_GENRE:
+	case RHYTHMDB_PROP_ARTIST_SORTNAME:
+	case RHYTHMDB_PROP_ALBUM_SORTNAME:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+static void
+snapshot_save_string_keys (struct RhythmDBTreeSnapshotSaveContext *ctx,
+			   guint32 id,
+			   RBRefString *str)
+{
+	guint32 folded;
+	guint32 sortkey;
+	guint32 none = RHYTHMDB_TREE_SNAPSHOT_NO_STRING;
+
+	if (id == RHYTHMDB_TREE_SNAPSHOT_NO_STRING)
+		return;
+
+	/* only save keys that have already been computed */
+	folded = snapshot_string_index (ctx, rb_refstring_peek_folded (str));
+	sortkey = snapshot_string_index (ctx, rb_refstring_peek_sort_key (str));
+
+	while (ctx->string_keys->len < (id + 1) * 2)
+		g_array_append_val (ctx->string_keys, none);
+
+	g_array_index (ctx->string_keys, guint32, id * 2) = folded;
+	g_array_index (ctx->string_keys, guint32, id * 2 + 1) = sortkey;
+}
+
+static void
+snapshot_save_entry (RhythmDBTree *db,
+		     RhythmDBEntry *entry,
+		     struct RhythmDBTreeSnapshotSaveContext *ctx)
+{
+	RhythmDBTreeSnapshotEntry record;
+	RhythmDBPodcastFields *podcast = NULL;
+	GList *keywords, *l;
+	int i;
+
+	if (entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_FEED ||
+	    entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_POST)
+		podcast = RHYTHMDB_ENTRY_GET_TYPE_DATA (entry, RhythmDBPodcastFields);
+
+	memset (&record, 0, sizeof (record));
+	record.type = snapshot_string_index (ctx, entry->type->name);
+	record.hidden = ((entry->flags & RHYTHMDB_ENTRY_HIDDEN) != 0);
+	record.file_size = entry->file_size;
+	record.rating = entry->rating;
+
+	for (i = 0; i < RHYTHMDB_TREE_SNAPSHOT_N_STRINGS; i++) {
+		RBRefString **slot;
+
+		slot = snapshot_string_slot (entry, podcast, snapshot_string_props[i], FALSE);
+		if (slot != NULL)
+			record.strings[i] = snapshot_string_index (ctx, rb_refstring_get (*slot));
+		else
+			record.strings[i] = RHYTHMDB_TREE_SNAPSHOT_NO_STRING;
+
+		if (slot != NULL && snapshot_prop_has_keys (snapshot_string_props[i]))
+			snapshot_save_string_keys (ctx, record.strings[i], *slot);
+	}
+
+	for (i = 0; i < RHYTHMDB_TREE_SNAPSHOT_N_ULONGS; i++) {
+		record.ulongs[i] = rhythmdb_entry_get_ulong (entry, snapshot_ulong_props[i]);
+	}
+
+	record.first_keyword = ctx->keywords->len;
+	keywords = rhythmdb_entry_keywords_get (RHYTHMDB (db), entry);
+	for (l = keywords; l != NULL; l = l->next) {
+		RBRefString *keyword = (RBRefString *)l->data;
+		guint32 id;
+
+		id = snapshot_string_index (ctx, rb_refstring_get (keyword));
+		g_array_append_val (ctx->keywords, id);
+		rb_refstring_unref (keyword);
+		record.n_keywords++;
+	}
+	g_list_free (keywords);
+
+	g_array_append_val (ctx->entries, record);
+}
+
+static void
+snapshot_save_entry_type (const char *name,
+			  RhythmDBEntryType entry_type,
+			  struct RhythmDBTreeSnapshotSaveContext *ctx)
+{
+	if (entry_type->save_to_disk == FALSE)
+		return;
+
+	rhythmdb_hash_tree_foreach (RHYTHMDB (ctx->db), entry_type,
+				    (RBTreeEntryItFunc) snapshot_save_entry,
+				    NULL, NULL, NULL, ctx);
+}
+
+static char *
+snapshot_filename (const char *name)
+{
+	return g_strconcat (name, RHYTHMDB_TREE_SNAPSHOT_SUFFIX, NULL);
+}
+
+static void
+rhythmdb_tree_snapshot_save (RhythmDBTree *db,
+			     const char *name)
+{
+	struct RhythmDBTreeSnapshotSaveContext ctx;
+	RhythmDBTreeSnapshotHeader header;
+	struct stat xml_stat;
+	char *filename;
+	char *tmpname;
+	gboolean has_unknown;
+	guint32 none = RHYTHMDB_TREE_SNAPSHOT_NO_STRING;
+	FILE *f;
+	gboolean ok;
+
+	filename = snapshot_filename (name);
+
+	/* entries of types that aren't registered can only be preserved
+	 * by the XML file, so don't bother with a snapshot in that case.
+	 */
+	g_mutex_lock (db->priv->entries_lock);
+	has_unknown = (g_hash_table_size (db->priv->unknown_entry_types) > 0);
+	g_mutex_unlock (db->priv->entries_lock);
+
+	if (has_unknown || g_stat (name, &xml_stat) < 0) {
+		rb_debug ("not writing database snapshot");
+		g_unlink (filename);
+		g_free (filename);
+		return;
+	}
+
+	rb_profile_start ("writing database snapshot");
+
+	ctx.db = db;
+	ctx.entries = g_array_new (FALSE, FALSE, sizeof (RhythmDBTreeSnapshotEntry));
+	ctx.keywords = g_array_new (FALSE, FALSE, sizeof (guint32));
+	ctx.string_offsets = g_array_new (FALSE, FALSE, sizeof (guint32));
+	ctx.string_keys = g_array_new (FALSE, FALSE, sizeof (guint32));
+	ctx.strings = g_string_sized_new (RHYTHMDB_TREE_PARSER_INITIAL_BUFFER_SIZE);
+	ctx.string_ids = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+	rhythmdb_entry_type_foreach (RHYTHMDB (db), (GHFunc) snapshot_save_entry_type, &ctx);
+
+	memset (&header, 0, sizeof (header));
+	header.collate_locale = snapshot_string_index (&ctx, setlocale (LC_COLLATE, NULL));
+	while (ctx.string_keys->len < ctx.string_offsets->len * 2)
+		g_array_append_val (ctx.string_keys, none);
+
+	memcpy (header.magic, RHYTHMDB_TREE_SNAPSHOT_MAGIC, sizeof (header.magic));
+	header.version = RHYTHMDB_TREE_SNAPSHOT_VERSION;
+	header.byte_order = RHYTHMDB_TREE_SNAPSHOT_BYTE_ORDER;
+	header.record_size = sizeof (RhythmDBTreeSnapshotEntry);
+	header.n_entries = ctx.entries->len;
+	header.n_keywords = ctx.keywords->len;
+	header.n_strings = ctx.string_offsets->len;
+	header.xml_size = xml_stat.st_size;
+	header.xml_mtime = xml_stat.st_mtime;
+	header.strings_size = ctx.strings->len;
+
+	tmpname = g_strconcat (filename, ".tmp", NULL);
+	f = fopen (tmpname, "w");
+	ok = (f != NULL);
+	if (ok) {
+		ok = (fwrite (&header, sizeof (header), 1, f) == 1);
+		ok = ok && (fwrite (ctx.entries->data, sizeof (RhythmDBTreeSnapshotEntry), ctx.entries->len, f) == ctx.entries->len);
+		ok = ok && (fwrite (ctx.keywords->data, sizeof (guint32), ctx.keywords->len, f) == ctx.keywords->len);
+		ok = ok && (fwrite (ctx.string_offsets->data, sizeof (guint32), ctx.string_offsets->len, f) == ctx.string_offsets->len);
+		ok = ok && (fwrite (ctx.string_keys->data, sizeof (guint32), ctx.string_keys->len, f) == ctx.string_keys->len);
+		ok = ok && (fwrite (ctx.strings->str, 1, ctx.strings->len, f) == ctx.strings->len);
+		if (fclose (f) < 0)
+			ok = FALSE;
+	}
+
+	if (ok && rename (tmpname, filename) == 0) {
+		rb_debug ("wrote snapshot of %u entries, %u strings", header.n_entries, header.n_strings);
+	} else {
+		rb_debug ("couldn't write database snapshot %s: %s", filename, g_strerror (errno));
+		g_unlink (tmpname);
+		g_unlink (filename);
+	}
+
+	g_array_free (ctx.entries, TRUE);
+	g_array_free (ctx.keywords, TRUE);
+	g_array_free (ctx.string_offsets, TRUE);
+	g_array_free (ctx.string_keys, TRUE);
+	g_string_free (ctx.strings, TRUE);
+	g_hash_table_destroy (ctx.string_ids);
+	g_free (tmpname);
+	g_free (filename);
+
+	rb_profile_end ("writing database snapshot");
+}
+
+struct RhythmDBTreeSnapshotLoadContext
+{
+	const RhythmDBTreeSnapshotHeader *header;
+	const RhythmDBTreeSnapshotEntry *entries;
+	const guint32 *keywords;
+	const guint32 *string_offsets;
+	const guint32 *string_keys;
+	const char *strings;
+	gboolean use_sort_keys;
+	RBRefString **refstrings;
+};
+
+static const char *
+snapshot_get_string (struct RhythmDBTreeSnapshotLoadContext *ctx,
+		     guint32 id)
+{
+	if (id == RHYTHMDB_TREE_SNAPSHOT_NO_STRING)
+		return NULL;
+	return ctx->strings + ctx->string_offsets[id];
+}
+
+static RBRefString *
+snapshot_get_refstring (struct RhythmDBTreeSnapshotLoadContext *ctx,
+			guint32 id)
+{
+	if (id == RHYTHMDB_TREE_SNAPSHOT_NO_STRING)
+		return NULL;
+
+	/* each distinct string is only interned once per load */
+	if (ctx->refstrings[id] == NULL) {
+		RBRefString *str;
+		guint32 folded, sortkey;
+
+		str = rb_refstring_new (snapshot_get_string (ctx, id));
+		folded = ctx->string_keys[id * 2];
+		sortkey = ctx->string_keys[id * 2 + 1];
+		if (folded != RHYTHMDB_TREE_SNAPSHOT_NO_STRING)
+			rb_refstring_set_folded (str, snapshot_get_string (ctx, folded));
+		if (sortkey != RHYTHMDB_TREE_SNAPSHOT_NO_STRING && ctx->use_sort_keys)
+			rb_refstring_set_sort_key (str, snapshot_get_string (ctx, sortkey));
+
+		ctx->refstrings[id] = str;
+	}
+	return rb_refstring_ref (ctx->refstrings[id]);
+}
+
+static gboolean
+snapshot_check_string_id (struct RhythmDBTreeSnapshotLoadContext *ctx,
+			  guint32 id)
+{
+	return (id == RHYTHMDB_TREE_SNAPSHOT_NO_STRING || id < ctx->header->n_strings);
+}
+
+/* checks that everything referenced from the snapshot is in bounds, and that
+ * all entry types are known, before anything is added to the database.
+ */
+static gboolean
+snapshot_validate (RhythmDBTree *db,
+		   struct RhythmDBTreeSnapshotLoadContext *ctx,
+		   RhythmDBEntryType *types)
+{
+	const RhythmDBTreeSnapshotHeader *header = ctx->header;
+	guint32 i, j;
+
+	for (i = 0; i < header->n_strings; i++) {
+		if (ctx->string_offsets[i] >= header->strings_size)
+			return FALSE;
+		if (!snapshot_check_string_id (ctx, ctx->string_keys[i * 2]) ||
+		    !snapshot_check_string_id (ctx, ctx->string_keys[i * 2 + 1]))
+			return FALSE;
+	}
+
+	if (header->collate_locale >= header->n_strings)
+		return FALSE;
+
+	for (i = 0; i < header->n_keywords; i++) {
+		if (ctx->keywords[i] >= header->n_strings)
+			return FALSE;
+	}
+
+	for (i = 0; i < header->n_entries; i++) {
+		const RhythmDBTreeSnapshotEntry *record = &ctx->entries[i];
+
+		if (record->type >= header->n_strings)
+			return FALSE;
+		if (record->first_keyword > header->n_keywords ||
+		    record->n_keywords > header->n_keywords - record->first_keyword)
+			return FALSE;
+		for (j = 0; j < RHYTHMDB_TREE_SNAPSHOT_N_STRINGS; j++) {
+			if (!snapshot_check_string_id (ctx, record->strings[j]))
+				return FALSE;
+		}
+		if (record->strings[0] == RHYTHMDB_TREE_SNAPSHOT_NO_STRING)
+			return FALSE;
+
+		if (types[record->type] == NULL) {
+			types[record->type] = rhythmdb_entry_type_get_by_name (RHYTHMDB (db),
+									       snapshot_get_string (ctx, record->type));
+			if (types[record->type] == RHYTHMDB_ENTRY_TYPE_INVALID) {
+				rb_debug ("snapshot contains entries of unknown type %s",
+					  snapshot_get_string (ctx, record->type));
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+static RhythmDBEntry *
+snapshot_create_entry (RhythmDBTree *db,
+		       struct RhythmDBTreeSnapshotLoadContext *ctx,
+		       const RhythmDBTreeSnapshotEntry *record,
+		       RhythmDBEntryType type)
+{
+	RhythmDBEntry *entry;
+	RhythmDBPodcastFields *podcast = NULL;
+	guint32 i;
+
+	entry = rhythmdb_entry_allocate (RHYTHMDB (db), type);
+	entry->flags |= RHYTHMDB_ENTRY_TREE_LOADING;
+
+	if (type == RHYTHMDB_ENTRY_TYPE_PODCAST_FEED ||
+	    type == RHYTHMDB_ENTRY_TYPE_PODCAST_POST)
+		podcast = RHYTHMDB_ENTRY_GET_TYPE_DATA (entry, RhythmDBPodcastFields);
+
+	for (i = 0; i < RHYTHMDB_TREE_SNAPSHOT_N_STRINGS; i++) {
+		RBRefString **slot;
+
+		if (record->strings[i] == RHYTHMDB_TREE_SNAPSHOT_NO_STRING)
+			continue;
+
+		slot = snapshot_string_slot (entry, podcast, snapshot_string_props[i], TRUE);
+		if (slot == NULL)
+			continue;
+
+		rb_refstring_unref (*slot);
+		*slot = snapshot_get_refstring (ctx, record->strings[i]);
+	}
+
+	for (i = 0; i < RHYTHMDB_TREE_SNAPSHOT_N_ULONGS; i++) {
+		snapshot_set_ulong (entry, podcast, snapshot_ulong_props[i], record->ulongs[i]);
+	}
+
+	entry->file_size = record->file_size;
+	entry->rating = record->rating;
+	if (record->hidden)
+		entry->flags |= RHYTHMDB_ENTRY_HIDDEN;
+
+	for (i = 0; i < record->n_keywords; i++) {
+		RBRefString *keyword;
+
+		keyword = snapshot_get_refstring (ctx, ctx->keywords[record->first_keyword + i]);
+		rhythmdb_entry_keyword_add (RHYTHMDB (db), entry, keyword);
+		rb_refstring_unref (keyword);
+	}
+
+	return entry;
+}
+
+static gboolean
+rhythmdb_tree_snapshot_load (RhythmDBTree *db,
+			     const char *name,
+			     GCancellable *cancel)
+{
+	struct RhythmDBTreeSnapshotLoadContext ctx;
+	const RhythmDBTreeSnapshotHeader *header;
+	RhythmDBEntryType *types = NULL;
+	struct stat xml_stat;
+	GMappedFile *mapped;
+	GError *error = NULL;
+	char *filename;
+	const char *data;
+	gsize length;
+	guint64 expected;
+	gboolean ret = FALSE;
+	int batch_count = 0;
+	guint32 i;
+
+	if (g_stat (name, &xml_stat) < 0)
+		return FALSE;
+
+	filename = snapshot_filename (name);
+	mapped = g_mapped_file_new (filename, FALSE, &error);
+	if (mapped == NULL) {
+		rb_debug ("unable to map database snapshot: %s", error->message);
+		g_error_free (error);
+		g_free (filename);
+		return FALSE;
+	}
+
+	data = g_mapped_file_get_contents (mapped);
+	length = g_mapped_file_get_length (mapped);
+	header = (const RhythmDBTreeSnapshotHeader *) data;
+	memset (&ctx, 0, sizeof (ctx));
+
+	if (length < sizeof (RhythmDBTreeSnapshotHeader) ||
+	    memcmp (header->magic, RHYTHMDB_TREE_SNAPSHOT_MAGIC, sizeof (header->magic)) != 0 ||
+	    header->version != RHYTHMDB_TREE_SNAPSHOT_VERSION ||
+	    header->byte_order != RHYTHMDB_TREE_SNAPSHOT_BYTE_ORDER ||
+	    header->record_size != sizeof (RhythmDBTreeSnapshotEntry)) {
+		rb_debug ("database snapshot %s is not usable", filename);
+		goto out;
+	}
+
+	if (header->xml_size != (guint64) xml_stat.st_size ||
+	    header->xml_mtime != (guint64) xml_stat.st_mtime) {
+		rb_debug ("database snapshot %s is out of date", filename);
+		goto out;
+	}
+
+	expected = sizeof (RhythmDBTreeSnapshotHeader) +
+		   (guint64) header->n_entries * sizeof (RhythmDBTreeSnapshotEntry) +
+		   (guint64) header->n_keywords * sizeof (guint32) +
+		   (guint64) header->n_strings * sizeof (guint32) * 3 +
+		   header->strings_size;
+	if (expected != length ||
+	    (header->strings_size > 0 && data[length - 1] != '\0')) {
+		rb_debug ("database snapshot %s is truncated", filename);
+		goto out;
+	}
+
+	ctx.header = header;
+	ctx.entries = (const RhythmDBTreeSnapshotEntry *) (data + sizeof (RhythmDBTreeSnapshotHeader));
+	ctx.keywords = (const guint32 *) (ctx.entries + header->n_entries);
+	ctx.string_offsets = ctx.keywords + header->n_keywords;
+	ctx.string_keys = ctx.string_offsets + header->n_strings;
+	ctx.strings = (const char *) (ctx.string_keys + header->n_strings * 2);
+
+	types = g_new0 (RhythmDBEntryType, header->n_strings);
+	if (snapshot_validate (db, &ctx, types) == FALSE) {
+		rb_debug ("database snapshot %s failed validation", filename);
+		goto out;
+	}
+
+	ctx.use_sort_keys = (strcmp (snapshot_get_string (&ctx, header->collate_locale),
+				     setlocale (LC_COLLATE, NULL)) == 0);
+	if (ctx.use_sort_keys == FALSE)
+		rb_debug ("collation locale has changed, not using sort keys from snapshot");
+
+	rb_profile_start ("loading database snapshot");
+	ctx.refstrings = g_new0 (RBRefString *, header->n_strings);
+
+	g_mutex_lock (db->priv->entries_lock);
+	for (i = 0; i < header->n_entries; i++) {
+		const RhythmDBTreeSnapshotEntry *record = &ctx.entries[i];
+		RhythmDBEntry *entry;
+
+		if (g_cancellable_is_cancelled (cancel))
+			break;
+
+		entry = snapshot_create_entry (db, &ctx, record, types[record->type]);
+		if (g_hash_table_lookup (db->priv->entries, entry->location) != NULL) {
+			rb_debug ("found entry with duplicate location %s in snapshot",
+				  rb_refstring_get (entry->location));
+			rhythmdb_entry_unref (entry);
+			continue;
+		}
+
+		rhythmdb_tree_entry_new_internal (RHYTHMDB (db), entry);
+		rhythmdb_entry_insert (RHYTHMDB (db), entry);
+		if (++batch_count == RHYTHMDB_QUERY_MODEL_SUGGESTED_UPDATE_CHUNK) {
+			rhythmdb_commit (RHYTHMDB (db));
+			batch_count = 0;
+		}
+	}
+	g_mutex_unlock (db->priv->entries_lock);
+
+	if (batch_count)
+		rhythmdb_commit (RHYTHMDB (db));
+
+	for (i = 0; i < header->n_strings; i++) {
+		rb_refstring_unref (ctx.refstrings[i]);
+	}
+	g_free (ctx.refstrings);
+
+	rb_profile_end ("loading database snapshot");
+	ret = TRUE;
+out:
+	g_free (types);
+#if GLIB_CHECK_VERSION (2,22,0)
+	g_mapped_file_unref (mapped);
+#else
+	g_mapped_file_free (mapped);
+#endif
+	g_free (filename);
+	return ret;
+}
+
+RhythmDB *
+rhythmdb_tree_new (const char *name)
+{
+	RhythmDBTree *db = g_object_new (RHYTHMDB_TYPE_TREE, "name", name, NULL);
+
+	g_return_val_if_fail (db->priv != NULL, NULL);
+
+	return RHYTHMDB (db);
+}
+
+/* must be called with the genres_lock held */
+static void
+set_entry_album (RhythmDBTree *db,
+		 RhythmDBEntry *entry,
+		 RhythmDBTreeProperty *artist,
+		 RBRefString *name)
+{
+	struct RhythmDBTreeProperty *prop;
 
 	prop = get_or_create_album (db, artist, name);
 	g_hash_table_insert (prop->children, entry, NULL);
 	entry->data = prop;
 }
 
+/*
+ * Case-folds the strings the word index uses for an entry, before it's
+ * added.  The folded strings are cached in the refstrings, so this keeps
+ * the folding out of the entries lock, and on the parser threads when
+ * loading the database in parallel.
+ */
+static void
+word_index_prepare_entry (RhythmDBEntry *entry)
+{
+	rb_refstring_get_folded (entry->title);
+	rb_refstring_get_folded (entry->artist);
+	rb_refstring_get_folded (entry->album);
+	rb_refstring_get_folded (entry->genre);
+}
+
+static void
+word_index_add_entry (RhythmDBTree *db,
+		      RhythmDBEntry *entry)
+{
+	rhythmdb_word_index_add (db->priv->word_index, entry->title, entry);
+	rhythmdb_word_index_add (db->priv->word_index, entry->artist, entry);
+	rhythmdb_word_index_add (db->priv->word_index, entry->album, entry);
+	rhythmdb_word_index_add (db->priv->word_index, entry->genre, entry);
+}
+
+static void
+word_index_remove_entry (RhythmDBTree *db,
+			 RhythmDBEntry *entry)
+{
+	rhythmdb_word_index_remove (db->priv->word_index, entry->title, entry);
+	rhythmdb_word_index_remove (db->priv->word_index, entry->artist, entry);
+	rhythmdb_word_index_remove (db->priv->word_index, entry->album, entry);
+	rhythmdb_word_index_remove (db->priv->word_index, entry->genre, entry);
+}
+
+static void
+word_index_replace (RhythmDBTree *db,
+		    RhythmDBEntry *entry,
+		    RBRefString *old,
+		    const char *value)
+{
+	RBRefString *s;
+
+	s = rb_refstring_new (value);
+	rhythmdb_word_index_add (db->priv->word_index, s, entry);
+	rhythmdb_word_index_remove (db->priv->word_index, old, entry);
+	rb_refstring_unref (s);
+}
+
+/*
+ * Sorted indexes on numeric properties.
+ *
+ * For each property in prop_index_props, a GSequence holds an item for
+ * each entry, ordered by the value of the property and then by entry ID.
+ * Queries that restrict one of these properties to a range can then find
+ * the matching entries without looking at the rest.  Items hold the value
+ * they were inserted with, so entries must be removed from the indexes
+ * before any of these properties are changed, and added back afterwards.
+ */
+
+static const RhythmDBPropType prop_index_props[] = {
+	RHYTHMDB_PROP_LAST_PLAYED,
+	RHYTHMDB_PROP_FIRST_SEEN,
+	RHYTHMDB_PROP_RATING,
+	RHYTHMDB_PROP_PLAY_COUNT,
+	RHYTHMDB_PROP_DATE
+};
+
+#define RHYTHMDB_TREE_N_PROP_INDEXES	G_N_ELEMENTS (prop_index_props)
+
+/* how long a query may take before entries that were not within the
+ * specified time at the start of the query could become so.
+ */
+#define RHYTHMDB_TREE_PROP_INDEX_TIME_SLACK	60
+
+typedef struct
+{
+	gdouble value;
+	guint id;
+	RhythmDBEntry *entry;
+} RhythmDBTreePropIndexItem;
+
+static int
+prop_index_for_prop (RhythmDBPropType propid)
+{
+	guint i;
+
+	for (i = 0; i < RHYTHMDB_TREE_N_PROP_INDEXES; i++) {
+		if (prop_index_props[i] == propid)
+			return i;
+	}
+	return -1;
+}
+
+/* returns the value in the same form the query evaluation compares it */
+static gdouble
+prop_index_entry_value (RhythmDBEntry *entry,
+			RhythmDBPropType propid)
+{
+	if (propid == RHYTHMDB_PROP_RATING)
+		return entry->rating;
+	return (gdouble) rhythmdb_entry_get_ulong (entry, propid);
+}
+
+static gdouble
+prop_index_gvalue (const GValue *value)
+{
+	if (G_VALUE_HOLDS_DOUBLE (value))
+		return g_value_get_double (value);
+	return (gdouble) g_value_get_ulong (value);
+}
+
+static gint
+prop_index_compare (const RhythmDBTreePropIndexItem *a,
+		    const RhythmDBTreePropIndexItem *b,
+		    gpointer data)
+{
+	if (a->value < b->value)
+		return -1;
+	if (a->value > b->value)
+		return 1;
+	if (a->id < b->id)
+		return -1;
+	if (a->id > b->id)
+		return 1;
+	return 0;
+}
+
+static void
+prop_index_item_free (RhythmDBTreePropIndexItem *item)
+{
+	g_slice_free (RhythmDBTreePropIndexItem, item);
+}
+
+/* must be called with the prop index lock held */
+static void
+prop_index_insert (GSequence *index,
+		   RhythmDBEntry *entry,
+		   gdouble value)
+{
+	RhythmDBTreePropIndexItem *item;
+
+	item = g_slice_new (RhythmDBTreePropIndexItem);
+	item->value = value;
+	item->id = entry->id;
+	item->entry = entry;
+	g_sequence_insert_sorted (index, item, (GCompareDataFunc) prop_index_compare, NULL);
+}
+
+/* must be called with the prop index lock held */
+static void
+prop_index_remove (GSequence *index,
+		   RhythmDBEntry *entry,
+		   gdouble value)
+{
+	RhythmDBTreePropIndexItem probe;
+	GSequenceIter *iter;
+
+	probe.value = value;
+	probe.id = entry->id;
+	probe.entry = entry;
+
+	/* the search returns the position after the item, if it's there */
+	iter = g_sequence_search (index, &probe, (GCompareDataFunc) prop_index_compare, NULL);
+	if (!g_sequence_iter_is_begin (iter)) {
+		iter = g_sequence_iter_prev (iter);
+		if (((RhythmDBTreePropIndexItem *) g_sequence_get (iter))->entry == entry) {
+			g_sequence_remove (iter);
+			return;
+		}
+	}
+
+	/* the property was changed without updating the index */
+	g_warning ("entry %s not found in property index", rb_refstring_get (entry->location));
+	for (iter = g_sequence_get_begin_iter (index);
+	     !g_sequence_iter_is_end (iter);
+	     iter = g_sequence_iter_next (iter)) {
+		if (((RhythmDBTreePropIndexItem *) g_sequence_get (iter))->entry == entry) {
+			g_sequence_remove (iter);
+			return;
+		}
+	}
+}
+
+static void
+prop_index_add_entry (RhythmDBTree *db,
+		      RhythmDBEntry *entry)
+{
+	guint i;
+
+	g_mutex_lock (db->priv->prop_indexes_lock);
+	if (db->priv->prop_indexes != NULL) {
+		for (i = 0; i < RHYTHMDB_TREE_N_PROP_INDEXES; i++) {
+			prop_index_insert (db->priv->prop_indexes[i], entry,
+					   prop_index_entry_value (entry, prop_index_props[i]));
+		}
+	}
+	g_mutex_unlock (db->priv->prop_indexes_lock);
+}
+
+static void
+prop_index_remove_entry (RhythmDBTree *db,
+			 RhythmDBEntry *entry)
+{
+	guint i;
+
+	g_mutex_lock (db->priv->prop_indexes_lock);
+	if (db->priv->prop_indexes != NULL) {
+		for (i = 0; i < RHYTHMDB_TREE_N_PROP_INDEXES; i++) {
+			prop_index_remove (db->priv->prop_indexes[i], entry,
+					   prop_index_entry_value (entry, prop_index_props[i]));
+		}
+	}
+	g_mutex_unlock (db->priv->prop_indexes_lock);
+}
+
+/* called before the property is changed */
+static void
+prop_index_update (RhythmDBTree *db,
+		   RhythmDBEntry *entry,
+		   RhythmDBPropType propid,
+		   const GValue *value)
+{
+	int i;
+
+	i = prop_index_for_prop (propid);
+	g_assert (i >= 0);
+
+	g_mutex_lock (db->priv->prop_indexes_lock);
+	if (db->priv->prop_indexes != NULL) {
+		prop_index_remove (db->priv->prop_indexes[i], entry,
+				   prop_index_entry_value (entry, propid));
+		prop_index_insert (db->priv->prop_indexes[i], entry,
+				   prop_index_gvalue (value));
+	}
+	g_mutex_unlock (db->priv->prop_indexes_lock);
+}
+
+static void
+prop_index_add_foreach (RBRefString *location,
+			RhythmDBEntry *entry,
+			RhythmDBTree *db)
+{
+	guint i;
+
+	for (i = 0; i < RHYTHMDB_TREE_N_PROP_INDEXES; i++) {
+		prop_index_insert (db->priv->prop_indexes[i], entry,
+				   prop_index_entry_value (entry, prop_index_props[i]));
+	}
+}
+
+static void
+prop_index_set_enabled (RhythmDBTree *db,
+			gboolean enabled)
+{
+	guint i;
+
+	g_mutex_lock (db->priv->entries_lock);
+	g_mutex_lock (db->priv->prop_indexes_lock);
+
+	if (enabled && db->priv->prop_indexes == NULL) {
+		db->priv->prop_indexes = g_new0 (GSequence *, RHYTHMDB_TREE_N_PROP_INDEXES);
+		for (i = 0; i < RHYTHMDB_TREE_N_PROP_INDEXES; i++) {
+			db->priv->prop_indexes[i] = g_sequence_new ((GDestroyNotify) prop_index_item_free);
+		}
+		g_hash_table_foreach (db->priv->entries, (GHFunc) prop_index_add_foreach, db);
+	} else if (!enabled && db->priv->prop_indexes != NULL) {
+		for (i = 0; i < RHYTHMDB_TREE_N_PROP_INDEXES; i++) {
+			g_sequence_free (db->priv->prop_indexes[i]);
+		}
+		g_free (db->priv->prop_indexes);
+		db->priv->prop_indexes = NULL;
+	}
+
+	g_mutex_unlock (db->priv->prop_indexes_lock);
+	g_mutex_unlock (db->priv->entries_lock);
+}
+
 static void
 rhythmdb_tree_entry_new (RhythmDB *rdb,
 			 RhythmDBEntry *entry)
 {
+	word_index_prepare_entry (entry);
 	g_mutex_lock (RHYTHMDB_TREE(rdb)->priv->entries_lock);
 	rhythmdb_tree_entry_new_internal (rdb, entry);
 	g_mutex_unlock (RHYTHMDB_TREE(rdb)->priv->entries_lock);
@@ -1318,6 +3206,9 @@ rhythmdb_tree_entry_new_internal (RhythmDB *rdb, RhythmDBEntry *entry)
 	set_entry_album (db, entry, artist, entry->album);
 	g_mutex_unlock (db->priv->genres_lock);
 
+	word_index_add_entry (db, entry);
+	prop_index_add_entry (db, entry);
+
 	/* this accounts for the initial reference on the entry */
 	g_hash_table_insert (db->priv->entries, entry->location, entry);
 	g_hash_table_insert (db->priv->entry_ids, GINT_TO_POINTER (entry->id), entry);
@@ -1542,10 +3433,30 @@ rhythmdb_tree_entry_set (RhythmDB *adb,
 		rb_refstring_unref (entry->location);
 		entry->location = s;
 		g_hash_table_insert (db->priv->entries, entry->location, entry);
+
+		/* the journal only records entries by their current location,
+		 * so it can't remove the entry saved under the old one.
+		 */
+		db->priv->journal_valid = FALSE;
 		g_mutex_unlock (db->priv->entries_lock);
 
 		return TRUE;
 	}
+	case RHYTHMDB_PROP_TITLE:
+	{
+		const char *title = g_value_get_string (value);
+
+		if (strcmp (rb_refstring_get (entry->title), title))
+			word_index_replace (db, entry, entry->title, title);
+		break;
+	}
+	case RHYTHMDB_PROP_LAST_PLAYED:
+	case RHYTHMDB_PROP_FIRST_SEEN:
+	case RHYTHMDB_PROP_RATING:
+	case RHYTHMDB_PROP_PLAY_COUNT:
+	case RHYTHMDB_PROP_DATE:
+		prop_index_update (db, entry, propid, value);
+		break;
 	case RHYTHMDB_PROP_ALBUM:
 	{
 		const char *albumname = g_value_get_string (value);
@@ -1554,6 +3465,8 @@ rhythmdb_tree_entry_set (RhythmDB *adb,
 			RhythmDBTreeProperty *artist;
 			RhythmDBTreeProperty *genre;
 
+			word_index_replace (db, entry, entry->album, albumname);
+
 			rb_refstring_ref (entry->genre);
 			rb_refstring_ref (entry->artist);
 			rb_refstring_ref (entry->album);
@@ -1579,6 +3492,8 @@ rhythmdb_tree_entry_set (RhythmDB *adb,
 			RhythmDBTreeProperty *new_artist;
 			RhythmDBTreeProperty *genre;
 
+			word_index_replace (db, entry, entry->artist, artistname);
+
 			rb_refstring_ref (entry->genre);
 			rb_refstring_ref (entry->artist);
 			rb_refstring_ref (entry->album);
@@ -1605,6 +3520,8 @@ rhythmdb_tree_entry_set (RhythmDB *adb,
 			RhythmDBTreeProperty *new_genre;
 			RhythmDBTreeProperty *new_artist;
 
+			word_index_replace (db, entry, entry->genre, genrename);
+
 			rb_refstring_ref (entry->genre);
 			rb_refstring_ref (entry->artist);
 			rb_refstring_ref (entry->album);
@@ -1640,6 +3557,9 @@ rhythmdb_tree_entry_delete (RhythmDB *adb,
 	remove_entry_from_album (db, entry);
 	g_mutex_unlock (db->priv->genres_lock);
 
+	word_index_remove_entry (db, entry);
+	prop_index_remove_entry (db, entry);
+
 	/* remove all keywords */
 	g_mutex_lock (db->priv->keywords_lock);
 	remove_entry_from_keywords (db, entry);
@@ -1678,6 +3598,8 @@ remove_one_song (gpointer key,
 		remove_entry_from_keywords (db, entry);
 		g_mutex_unlock (db->priv->keywords_lock);
 		remove_entry_from_album (db, entry);
+		word_index_remove_entry (db, entry);
+		prop_index_remove_entry (db, entry);
 		g_hash_table_remove (db->priv->entry_ids, GINT_TO_POINTER (entry->id));
 		rhythmdb_entry_unref (entry);
 		return TRUE;
@@ -1699,6 +3621,9 @@ rhythmdb_tree_entry_delete_by_type (RhythmDB *adb,
 	g_hash_table_foreach_remove (db->priv->entries,
 				     (GHRFunc) remove_one_song, &ctxt);
 	g_mutex_unlock (db->priv->genres_lock);
+
+	/* these deletions bypass the journal */
+	db->priv->journal_valid = FALSE;
 	g_mutex_unlock (db->priv->entries_lock);
 }
 
@@ -1715,13 +3640,62 @@ destroy_tree_property (RhythmDBTreeProperty *prop)
 typedef void (*RhythmDBTreeTraversalFunc) (RhythmDBTree *db, RhythmDBEntry *entry, gpointer data);
 typedef void (*RhythmDBTreeAlbumTraversalFunc) (RhythmDBTree *db, RhythmDBTreeProperty *album, gpointer data);
 
+/*
+ * Query profiling.
+ *
+ * When the database's profile-queries property is set, full queries record
+ * how the entries to check were found for each conjunction, how many were
+ * checked and how many matched, and how long each criteria took, and print
+ * it all along with a description of the query once the query is done.
+ * Each criteria is compiled and evaluated separately in this mode, so the
+ * measurements only make sense relative to each other.
+ */
+
+typedef struct
+{
+	GPtrArray *query;		/* just this criteria */
+	RhythmDBCompiledQuery *compiled;
+	char *description;
+	guint evaluated;
+	guint matched;
+	gdouble time;
+} RhythmDBTreePredicateProfile;
+
+typedef struct
+{
+	char *plan;
+	gboolean impossible;
+	gboolean word_index;
+	gboolean prop_index;
+	gboolean type_lookup;
+	gboolean genre_lookup;
+	gboolean artist_lookup;
+	gboolean album_lookup;
+	guint candidates;
+	guint matched;
+	gdouble time;
+	GPtrArray *predicates;
+	GTimer *timer;
+} RhythmDBTreeConjunctionProfile;
+
+typedef struct
+{
+	char *plan;
+	GPtrArray *conjunctions;
+	guint results;
+	GTimer *timer;
+} RhythmDBTreeQueryProfile;
+
 struct RhythmDBTreeTraversalData
 {
 	RhythmDBTree *db;
 	GPtrArray *query;
+	RhythmDBCompiledQuery *compiled;
 	RhythmDBTreeTraversalFunc func;
 	gpointer data;
 	gboolean *cancel;
+	GPtrArray *collected;
+	RhythmDBTreeConjunctionProfile *profile;
 };
 
 static gboolean
@@ -1967,16 +3941,192 @@ evaluate_conjunctive_subquery (RhythmDBTree *dbtree,
 	return TRUE;
 }
 
+static RhythmDBTreeConjunctionProfile *
+conjunction_profile_new (RhythmDBTree *db,
+			 GPtrArray *query)
+{
+	RhythmDBTreeConjunctionProfile *profile;
+	guint i;
+
+	profile = g_new0 (RhythmDBTreeConjunctionProfile, 1);
+	profile->plan = rhythmdb_query_to_string (RHYTHMDB (db), query);
+	profile->predicates = g_ptr_array_new ();
+	profile->timer = g_timer_new ();
+
+	for (i = 0; i < query->len; i++) {
+		RhythmDBTreePredicateProfile *predicate;
+
+		predicate = g_new0 (RhythmDBTreePredicateProfile, 1);
+		predicate->query = g_ptr_array_new ();
+		g_ptr_array_add (predicate->query, g_ptr_array_index (query, i));
+		predicate->compiled = rhythmdb_query_compile (RHYTHMDB (db), predicate->query);
+		predicate->description = rhythmdb_query_to_string (RHYTHMDB (db), predicate->query);
+		g_ptr_array_add (profile->predicates, predicate);
+	}
+
+	return profile;
+}
+
+static void
+conjunction_profile_free (RhythmDBTreeConjunctionProfile *profile)
+{
+	guint i;
+
+	for (i = 0; i < profile->predicates->len; i++) {
+		RhythmDBTreePredicateProfile *predicate = g_ptr_array_index (profile->predicates, i);
+
+		rhythmdb_compiled_query_free (predicate->compiled);
+		g_ptr_array_free (predicate->query, TRUE);
+		g_free (predicate->description);
+		g_free (predicate);
+	}
+	g_ptr_array_free (profile->predicates, TRUE);
+	g_timer_destroy (profile->timer);
+	g_free (profile->plan);
+	g_free (profile);
+}
+
+/* evaluates each criteria in turn, as the compiled query would */
+static gboolean
+conjunction_profile_evaluate (RhythmDBTreeConjunctionProfile *profile,
+			      RhythmDBEntry *entry)
+{
+	guint i;
+
+	profile->candidates++;
+	for (i = 0; i < profile->predicates->len; i++) {
+		RhythmDBTreePredicateProfile *predicate = g_ptr_array_index (profile->predicates, i);
+		gboolean matched;
+		gdouble start;
+
+		start = g_timer_elapsed (profile->timer, NULL);
+		matched = rhythmdb_compiled_query_evaluate (predicate->compiled, entry);
+		predicate->time += g_timer_elapsed (profile->timer, NULL) - start;
+
+		predicate->evaluated++;
+		if (!matched)
+			return FALSE;
+		predicate->matched++;
+	}
+
+	profile->matched++;
+	return TRUE;
+}
+
+static void
+conjunction_profile_describe_path (RhythmDBTreeConjunctionProfile *profile,
+				   GString *buf)
+{
+	if (profile->impossible) {
+		g_string_append (buf, "none, conflicting entry type criteria");
+		return;
+	}
+
+	if (profile->word_index || profile->prop_index) {
+		g_string_append (buf, "candidates from the ");
+		if (profile->word_index && profile->prop_index)
+			g_string_append (buf, "word and property indexes");
+		else if (profile->word_index)
+			g_string_append (buf, "word index");
+		else
+			g_string_append (buf, "property indexes");
+		return;
+	}
+
+	if (profile->type_lookup)
+		g_string_append (buf, "tree walk of one entry type");
+	else
+		g_string_append (buf, "tree walk of all entry types");
+
+	if (profile->genre_lookup)
+		g_string_append (buf, ", genre lookup");
+	if (profile->artist_lookup)
+		g_string_append (buf, ", artist lookup");
+	if (profile->album_lookup)
+		g_string_append (buf, ", album lookup");
+}
+
+static RhythmDBTreeQueryProfile *
+query_profile_new (RhythmDBTree *db,
+		   GPtrArray *query)
+{
+	RhythmDBTreeQueryProfile *profile;
+
+	profile = g_new0 (RhythmDBTreeQueryProfile, 1);
+	profile->plan = rhythmdb_query_to_string (RHYTHMDB (db), query);
+	profile->conjunctions = g_ptr_array_new ();
+	profile->timer = g_timer_new ();
+	return profile;
+}
+
+static void
+query_profile_dump (RhythmDBTreeQueryProfile *profile)
+{
+	GString *buf;
+	guint i, j;
+
+	buf = g_string_new (NULL);
+	g_string_append_printf (buf, "query profile: %s\n", profile->plan);
+	g_string_append_printf (buf, "  %u conjunctions, %u results, %.3f ms\n",
+				profile->conjunctions->len,
+				profile->results,
+				g_timer_elapsed (profile->timer, NULL) * 1000.0);
+
+	for (i = 0; i < profile->conjunctions->len; i++) {
+		RhythmDBTreeConjunctionProfile *conj = g_ptr_array_index (profile->conjunctions, i);
+
+		g_string_append_printf (buf, "  conjunction %u: %s\n", i + 1, conj->plan);
+		g_string_append (buf, "    path: ");
+		conjunction_profile_describe_path (conj, buf);
+		g_string_append_printf (buf, "\n    %u candidates, %u matched, %.3f ms\n",
+					conj->candidates, conj->matched, conj->time * 1000.0);
+
+		for (j = 0; j < conj->predicates->len; j++) {
+			RhythmDBTreePredicateProfile *predicate = g_ptr_array_index (conj->predicates, j);
+
+			g_string_append_printf (buf, "    %s: %u evaluated, %u matched, %.3f ms\n",
+						predicate->description,
+						predicate->evaluated,
+						predicate->matched,
+						predicate->time * 1000.0);
+		}
+	}
+
+	g_message ("%s", buf->str);
+	g_string_free (buf, TRUE);
+}
+
+static void
+query_profile_free (RhythmDBTreeQueryProfile *profile)
+{
+	g_ptr_array_foreach (profile->conjunctions, (GFunc) conjunction_profile_free, NULL);
+	g_ptr_array_free (profile->conjunctions, TRUE);
+	g_timer_destroy (profile->timer);
+	g_free (profile->plan);
+	g_free (profile);
+}
+
 static void
 do_conjunction (RhythmDBEntry *entry,
 		gpointer unused,
 		struct RhythmDBTreeTraversalData *data)
 {
+	gboolean matched;
+
 	if (G_UNLIKELY (*data->cancel))
 		return;
+	/* for parallel evaluation, just gather the entries to check */
+	if (data->collected != NULL) {
+		g_ptr_array_add (data->collected, entry);
+		return;
+	}
 	/* Finally, we actually evaluate the query! */
-	if (evaluate_conjunctive_subquery (data->db, data->query, 0, data->query->len,
-					   entry)) {
+	if (G_UNLIKELY (data->profile != NULL))
+		matched = conjunction_profile_evaluate (data->profile, entry);
+	else
+		matched = rhythmdb_compiled_query_evaluate (data->compiled, entry);
+
+	if (matched) {
 		data->func (data->db, entry, data->data);
 	}
 }
@@ -2033,6 +4183,8 @@ conjunctive_query_albums (const char *name,
 		GPtrArray *oldquery = data->query;
 
 		data->query = clone_remove_ptr_array_index (data->query, album_query_idx);
+		if (data->profile != NULL)
+			data->profile->album_lookup = TRUE;
 
 		album = g_hash_table_lookup (artist->children, albumname);
 
@@ -2076,6 +4228,8 @@ conjunctive_query_artists (const char *name,
 		GPtrArray *oldquery = data->query;
 
 		data->query = clone_remove_ptr_array_index (data->query, artist_query_idx);
+		if (data->profile != NULL)
+			data->profile->artist_lookup = TRUE;
 
 		artist = g_hash_table_lookup (genre->children, artistname);
 		if (artist != NULL) {
@@ -2121,6 +4275,8 @@ conjunctive_query_genre (RhythmDBTree *db,
 		GPtrArray *oldquery = data->query;
 
 		data->query = clone_remove_ptr_array_index (data->query, genre_query_idx);
+		if (data->profile != NULL)
+			data->profile->genre_lookup = TRUE;
 
 		genre = g_hash_table_lookup (genres, genrename);
 		if (genre != NULL) {
@@ -2134,24 +4290,450 @@ conjunctive_query_genre (RhythmDBTree *db,
 	g_hash_table_foreach (genres, (GHFunc) conjunctive_query_artists, data);
 }
 
+static gboolean
+query_has_disjunction (GPtrArray *query)
+{
+	guint i;
+
+	for (i = 0; i < query->len; i++) {
+		RhythmDBQueryData *data = g_ptr_array_index (query, i);
+		if (data->type == RHYTHMDB_QUERY_DISJUNCTION)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static gboolean
+entry_not_in_set (RhythmDBEntry *entry,
+		  gpointer value,
+		  GHashTable *set)
+{
+	return (g_hash_table_lookup (set, entry) == NULL);
+}
+
+/* combines two candidate sets, either of which may be NULL (meaning all entries) */
+static GHashTable *
+intersect_candidates (GHashTable *candidates,
+		      GHashTable *matches)
+{
+	if (matches == NULL)
+		return candidates;
+	if (candidates == NULL)
+		return matches;
+
+	if (g_hash_table_size (matches) < g_hash_table_size (candidates)) {
+		GHashTable *t = candidates;
+		candidates = matches;
+		matches = t;
+	}
+
+	g_hash_table_foreach_remove (candidates, (GHRFunc) entry_not_in_set, matches);
+	g_hash_table_destroy (matches);
+	return candidates;
+}
+
+/*
+ * Uses the word index to find the entries that can possibly match a
+ * conjunctive query containing substring matches on the title, artist,
+ * album or genre, or a search match.  Returns NULL if the query has no
+ * criteria the index can be used for.
+ */
+static GHashTable *
+word_index_candidates (RhythmDBTree *db,
+		       GPtrArray *query,
+		       GHashTable *candidates)
+{
+	guint i;
+
+	for (i = 0; i < query->len; i++) {
+		RhythmDBQueryData *data = g_ptr_array_index (query, i);
+
+		if (data->type == RHYTHMDB_QUERY_SUBQUERY) {
+			if (data->subquery != NULL && !query_has_disjunction (data->subquery))
+				candidates = word_index_candidates (db, data->subquery, candidates);
+			continue;
+		}
+
+		if (data->type != RHYTHMDB_QUERY_PROP_LIKE)
+			continue;
+
+		switch (data->propid) {
+		case RHYTHMDB_PROP_SEARCH_MATCH:
+		{
+			char **words;
+
+			/* search words are split up when the query is preprocessed */
+			if (!G_VALUE_HOLDS (data->val, G_TYPE_STRV))
+				break;
+
+			for (words = g_value_get_boxed (data->val); words != NULL && *words != NULL; words++) {
+				candidates = intersect_candidates (candidates,
+								   rhythmdb_word_index_lookup (db->priv->word_index, *words));
+			}
+			break;
+		}
+		case RHYTHMDB_PROP_TITLE_FOLDED:
+		case RHYTHMDB_PROP_ARTIST_FOLDED:
+		case RHYTHMDB_PROP_ALBUM_FOLDED:
+		case RHYTHMDB_PROP_GENRE_FOLDED:
+			candidates = intersect_candidates (candidates,
+							   rhythmdb_word_index_lookup (db->priv->word_index,
+										       g_value_get_string (data->val)));
+			break;
+		default:
+			break;
+		}
+	}
+
+	return candidates;
+}
+
+typedef struct
+{
+	gdouble min;
+	gdouble max;
+	gboolean used;
+} RhythmDBTreePropRange;
+
+static void
+restrict_range (RhythmDBTreePropRange *range,
+		gdouble min,
+		gdouble max)
+{
+	range->min = MAX (range->min, min);
+	range->max = MIN (range->max, max);
+	range->used = TRUE;
+}
+
+/* works out the range of values each indexed property can have in
+ * entries matching a conjunctive query.
+ */
+static void
+prop_index_collect_ranges (GPtrArray *query,
+			   RhythmDBTreePropRange *ranges)
+{
+	guint i;
+
+	for (i = 0; i < query->len; i++) {
+		RhythmDBQueryData *data = g_ptr_array_index (query, i);
+		RhythmDBTreePropRange *range;
+		GTimeVal current_time;
+		gulong threshold;
+		gdouble value;
+		int index;
+
+		if (data->type == RHYTHMDB_QUERY_SUBQUERY) {
+			if (data->subquery != NULL && !query_has_disjunction (data->subquery))
+				prop_index_collect_ranges (data->subquery, ranges);
+			continue;
+		}
+
+		if (data->val == NULL)
+			continue;
+		index = prop_index_for_prop (data->propid);
+		if (index < 0)
+			continue;
+		range = &ranges[index];
+
+		switch (data->type) {
+		case RHYTHMDB_QUERY_PROP_EQUALS:
+			value = prop_index_gvalue (data->val);
+			restrict_range (range, value, value);
+			break;
+		case RHYTHMDB_QUERY_PROP_GREATER:
+			restrict_range (range, prop_index_gvalue (data->val), G_MAXDOUBLE);
+			break;
+		case RHYTHMDB_QUERY_PROP_LESS:
+			restrict_range (range, -G_MAXDOUBLE, prop_index_gvalue (data->val));
+			break;
+		case RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN:
+		case RHYTHMDB_QUERY_PROP_CURRENT_TIME_NOT_WITHIN:
+			/* same arithmetic as evaluate_conjunctive_subquery */
+			g_get_current_time (&current_time);
+			threshold = current_time.tv_sec - g_value_get_ulong (data->val);
+			if (data->type == RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN) {
+				restrict_range (range, (gdouble) threshold, G_MAXDOUBLE);
+			} else {
+				restrict_range (range, -G_MAXDOUBLE,
+						(gdouble) threshold + RHYTHMDB_TREE_PROP_INDEX_TIME_SLACK);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* must be called with the prop index lock held */
+static void
+prop_index_range_iters (GSequence *index,
+			RhythmDBTreePropRange *range,
+			GSequenceIter **begin,
+			GSequenceIter **end)
+{
+	RhythmDBTreePropIndexItem probe;
+
+	/* entry IDs start at 1, so these sort before and after all
+	 * items with the same value.
+	 */
+	probe.entry = NULL;
+	probe.value = range->min;
+	probe.id = 0;
+	*begin = g_sequence_search (index, &probe, (GCompareDataFunc) prop_index_compare, NULL);
+
+	probe.value = range->max;
+	probe.id = G_MAXUINT;
+	*end = g_sequence_search (index, &probe, (GCompareDataFunc) prop_index_compare, NULL);
+}
+
+/*
+ * Uses the most selective of the property indexes to narrow down the
+ * entries that can match a conjunctive query, if the query restricts any
+ * of the indexed properties to a range and that excludes enough entries
+ * to be worth it.  @candidates is the candidate set found so far, if any.
+ * @used is set to %TRUE if an index was used.
+ */
+static GHashTable *
+prop_index_candidates (RhythmDBTree *db,
+		       GPtrArray *query,
+		       GHashTable *candidates,
+		       gboolean *used)
+{
+	RhythmDBTreePropRange ranges[RHYTHMDB_TREE_N_PROP_INDEXES];
+	GSequenceIter *best_begin = NULL;
+	GSequenceIter *best_end = NULL;
+	GSequenceIter *iter;
+	GHashTable *matches;
+	gint best_count = -1;
+	gint limit;
+	guint i;
+
+	*used = FALSE;
+	for (i = 0; i < RHYTHMDB_TREE_N_PROP_INDEXES; i++) {
+		ranges[i].min = -G_MAXDOUBLE;
+		ranges[i].max = G_MAXDOUBLE;
+		ranges[i].used = FALSE;
+	}
+	prop_index_collect_ranges (query, ranges);
+
+	g_mutex_lock (db->priv->prop_indexes_lock);
+	if (db->priv->prop_indexes == NULL) {
+		g_mutex_unlock (db->priv->prop_indexes_lock);
+		return candidates;
+	}
+
+	for (i = 0; i < RHYTHMDB_TREE_N_PROP_INDEXES; i++) {
+		GSequenceIter *begin, *end;
+		gint count;
+
+		if (ranges[i].used == FALSE)
+			continue;
+
+		if (ranges[i].min > ranges[i].max) {
+			count = 0;
+			begin = end = NULL;
+		} else {
+			prop_index_range_iters (db->priv->prop_indexes[i], &ranges[i], &begin, &end);
+			count = g_sequence_iter_get_position (end) - g_sequence_iter_get_position (begin);
+		}
+
+		if (best_count < 0 || count < best_count) {
+			best_count = count;
+			best_begin = begin;
+			best_end = end;
+		}
+	}
+
+	/* walking the tree is cheaper than collecting a large candidate set */
+	if (candidates != NULL)
+		limit = g_hash_table_size (candidates);
+	else
+		limit = g_sequence_get_length (db->priv->prop_indexes[0]) / 2;
+
+	if (best_count < 0 || best_count >= limit) {
+		g_mutex_unlock (db->priv->prop_indexes_lock);
+		return candidates;
+	}
+
+	matches = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+					 (GDestroyNotify) rhythmdb_entry_unref, NULL);
+	for (iter = best_begin; iter != best_end; iter = g_sequence_iter_next (iter)) {
+		RhythmDBTreePropIndexItem *item = g_sequence_get (iter);
+		g_hash_table_insert (matches, rhythmdb_entry_ref (item->entry), item->entry);
+	}
+	g_mutex_unlock (db->priv->prop_indexes_lock);
+
+	*used = TRUE;
+	return intersect_candidates (candidates, matches);
+}
+
+static void
+conjunctive_query_candidate (RhythmDBEntry *entry,
+			     gpointer value,
+			     struct RhythmDBTreeTraversalData *data)
+{
+	/* entries deleted since the lookup are no longer in the tree */
+	if (entry->flags & RHYTHMDB_ENTRY_TREE_REMOVED)
+		return;
+
+	do_conjunction (entry, NULL, data);
+}
+
+/*
+ * Parallel query evaluation.
+ *
+ * On machines with more than one processor, the tree walk only gathers
+ * the entries that need to be checked.  If there are enough of them,
+ * they're split into chunks that are evaluated against the compiled
+ * query on the database's worker threads.  The query thread passes on the
+ * matches from each chunk as soon as that chunk and all the ones before
+ * it have been evaluated, so results keep the order they were gathered
+ * in and reach the query results while later chunks are still being
+ * evaluated.
+ */
+
+#define RHYTHMDB_TREE_PARALLEL_QUERY_CHUNKS_PER_THREAD	4
+
+typedef struct
+{
+	RhythmDBCompiledQuery *compiled;
+	RhythmDBEntry **entries;
+	guint n_entries;
+	GPtrArray *matches;
+	gboolean *cancel;
+
+	/* protects done */
+	GMutex *lock;
+	GCond *cond;
+	gboolean done;
+} RhythmDBTreeQueryChunk;
+
+static void
+query_chunk_thread (RhythmDBTreeQueryChunk *chunk, gpointer unused)
+{
+	guint i;
+
+	for (i = 0; i < chunk->n_entries; i++) {
+		RhythmDBEntry *entry = chunk->entries[i];
+
+		if (G_UNLIKELY (*chunk->cancel))
+			break;
+
+		if (rhythmdb_compiled_query_evaluate (chunk->compiled, entry))
+			g_ptr_array_add (chunk->matches, entry);
+	}
+
+	g_mutex_lock (chunk->lock);
+	chunk->done = TRUE;
+	g_cond_broadcast (chunk->cond);
+	g_mutex_unlock (chunk->lock);
+}
+
+/* must be called with the genres lock held, so the gathered entries
+ * stay in the tree until they've been evaluated.
+ */
+static void
+conjunctive_query_evaluate_collected (struct RhythmDBTreeTraversalData *data,
+				      int n_threads)
+{
+	RhythmDBTreeQueryChunk *chunks;
+	GPtrArray *entries = data->collected;
+	RhythmDBTree *db = data->db;
+	GMutex *lock;
+	GCond *cond;
+	guint chunk_size;
+	guint n_chunks;
+	guint i, j;
+
+	data->collected = NULL;
+
+	if (entries->len < db->priv->parallel_query_threshold) {
+		for (i = 0; i < entries->len; i++) {
+			do_conjunction (g_ptr_array_index (entries, i), NULL, data);
+		}
+		g_ptr_array_free (entries, TRUE);
+		return;
+	}
+
+	n_chunks = n_threads * RHYTHMDB_TREE_PARALLEL_QUERY_CHUNKS_PER_THREAD;
+	chunk_size = (entries->len + n_chunks - 1) / n_chunks;
+	n_chunks = (entries->len + chunk_size - 1) / chunk_size;
+	rb_debug ("evaluating query against %u entries in %u chunks on %d threads",
+		  entries->len, n_chunks, n_threads);
+
+	chunks = g_new0 (RhythmDBTreeQueryChunk, n_chunks);
+	lock = g_mutex_new ();
+	cond = g_cond_new ();
+	if (db->priv->query_pool == NULL)
+		db->priv->query_pool = g_thread_pool_new ((GFunc) query_chunk_thread, NULL, n_threads, FALSE, NULL);
+	for (i = 0; i < n_chunks; i++) {
+		RhythmDBTreeQueryChunk *chunk = &chunks[i];
+
+		chunk->compiled = data->compiled;
+		chunk->entries = (RhythmDBEntry **) entries->pdata + (i * chunk_size);
+		chunk->n_entries = MIN (chunk_size, entries->len - (i * chunk_size));
+		chunk->matches = g_ptr_array_new ();
+		chunk->cancel = data->cancel;
+		chunk->lock = lock;
+		chunk->cond = cond;
+
+		g_thread_pool_push (db->priv->query_pool, chunk, NULL);
+	}
+
+	/* pass the matches on in the order the entries were gathered,
+	 * without waiting for the chunks after the current one.
+	 */
+	for (i = 0; i < n_chunks; i++) {
+		GPtrArray *matches = chunks[i].matches;
+
+		g_mutex_lock (lock);
+		while (chunks[i].done == FALSE)
+			g_cond_wait (cond, lock);
+		g_mutex_unlock (lock);
+
+		for (j = 0; j < matches->len && !*data->cancel; j++) {
+			data->func (data->db, g_ptr_array_index (matches, j), data->data);
+		}
+		g_ptr_array_free (matches, TRUE);
+	}
+
+	g_cond_free (cond);
+	g_mutex_free (lock);
+	g_free (chunks);
+	g_ptr_array_free (entries, TRUE);
+}
+
 static void
 conjunctive_query (RhythmDBTree *db,
 		   GPtrArray *query,
 		   RhythmDBTreeTraversalFunc func,
 		   gpointer data,
-		   gboolean *cancel)
+		   gboolean *cancel,
+		   RhythmDBTreeQueryProfile *query_profile)
 {
 	int type_query_idx = -1;
 	guint i;
 	struct RhythmDBTreeTraversalData *traversal_data;
+	RhythmDBTreeConjunctionProfile *profile = NULL;
+	GHashTable *candidates;
+	gboolean used_prop_index;
+	int n_threads;
+
+	if (query_profile != NULL) {
+		profile = conjunction_profile_new (db, query);
+		g_ptr_array_add (query_profile->conjunctions, profile);
+	}
 
 	for (i = 0; i < query->len; i++) {
 		RhythmDBQueryData *qdata = g_ptr_array_index (query, i);
 		if (qdata->type == RHYTHMDB_QUERY_PROP_EQUALS
 		    && qdata->propid == RHYTHMDB_PROP_TYPE) {
 			/* A song can't have two types. */
-			if (type_query_idx > 0)
+			if (type_query_idx > 0) {
+				if (profile != NULL)
+					profile->impossible = TRUE;
 				return;
+			}
 			type_query_idx = i;
 		}
 	}
@@ -2162,14 +4744,46 @@ conjunctive_query (RhythmDBTree *db,
 	traversal_data->func = func;
 	traversal_data->data = data;
 	traversal_data->cancel = cancel;
+	traversal_data->collected = NULL;
+	traversal_data->profile = profile;
+
+	/* the profile is recorded on the query thread */
+	n_threads = rb_get_num_processors ();
+	if (n_threads > 1 && profile == NULL)
+		traversal_data->collected = g_ptr_array_new ();
+	else if (n_threads > 1)
+		rb_debug ("profiling query, so evaluating it on the query thread");
+
+	/* the full query is compiled, so the criteria used to select
+	 * the genre, artist and album are checked again for each entry,
+	 * but that's cheap compared to compiling the query for each album.
+	 */
+	traversal_data->compiled = rhythmdb_query_compile (RHYTHMDB (db), query);
+
+	/* if the word index or the property indexes can narrow down the
+	 * entries to check, only evaluate the query against those, rather
+	 * than walking the tree.  the type criteria stays in the query in
+	 * this case.
+	 */
+	candidates = word_index_candidates (db, query, NULL);
+	if (profile != NULL)
+		profile->word_index = (candidates != NULL);
+	candidates = prop_index_candidates (db, query, candidates, &used_prop_index);
+	if (profile != NULL)
+		profile->prop_index = used_prop_index;
 
 	g_mutex_lock (db->priv->genres_lock);
-	if (type_query_idx >= 0) {
+	if (candidates != NULL) {
+		g_hash_table_foreach (candidates, (GHFunc) conjunctive_query_candidate, traversal_data);
+		g_hash_table_destroy (candidates);
+	} else if (type_query_idx >= 0) {
 		GHashTable *genres;
 		RhythmDBEntryType etype;
 		RhythmDBQueryData *qdata = g_ptr_array_index (query, type_query_idx);
 
 		g_ptr_array_remove_index_fast (query, type_query_idx);
+		if (profile != NULL)
+			profile->type_lookup = TRUE;
 
 		etype = g_value_get_pointer (qdata->val);
 		genres = get_genres_hash_for_type (db, etype);
@@ -2184,8 +4798,15 @@ conjunctive_query (RhythmDBTree *db,
 		genres_hash_foreach (db, (RBHFunc)conjunctive_query_genre,
 				     traversal_data);
 	}
+
+	if (traversal_data->collected != NULL)
+		conjunctive_query_evaluate_collected (traversal_data, n_threads);
 	g_mutex_unlock (db->priv->genres_lock);
 
+	if (profile != NULL)
+		profile->time = g_timer_elapsed (profile->timer, NULL);
+
+	rhythmdb_compiled_query_free (traversal_data->compiled);
 	g_free (traversal_data);
 }
 
@@ -2233,6 +4854,7 @@ struct RhythmDBTreeQueryGatheringData
 	GPtrArray *queue;
 	GHashTable *entries;
 	RhythmDBQueryResults *results;
+	RhythmDBTreeQueryProfile *profile;
 };
 
 static void
@@ -2262,7 +4884,7 @@ do_query_recurse (RhythmDBTree *db,
 	for (tem = conjunctions; tem; tem = tem->next) {
 		if (G_UNLIKELY (*cancel))
 			break;
-		conjunctive_query (db, tem->data, func, data, cancel);
+		conjunctive_query (db, tem->data, func, data, cancel, data->profile);
 		g_ptr_array_free (tem->data, TRUE);
 	}
 
@@ -2282,6 +4904,9 @@ handle_entry_match (RhythmDB *db,
 	    && g_hash_table_lookup (data->entries, entry))
 		return;
 
+	if (data->profile != NULL)
+		data->profile->results++;
+
 	g_ptr_array_add (data->queue, entry);
 	if (data->queue->len > RHYTHMDB_QUERY_MODEL_SUGGESTED_UPDATE_CHUNK) {
 		rhythmdb_query_results_add_results (data->results, data->queue);
@@ -2300,11 +4925,17 @@ rhythmdb_tree_do_full_query (RhythmDB *adb,
 
 	data->results = results;
 	data->queue = g_ptr_array_new ();
+	if (adb->priv->profile_queries && query != NULL)
+		data->profile = query_profile_new (db, query);
 
 	do_query_recurse (db, query, (RhythmDBTreeTraversalFunc) handle_entry_match, data, cancel);
 
 	rhythmdb_query_results_add_results (data->results, data->queue);
 
+	if (data->profile != NULL) {
+		query_profile_dump (data->profile);
+		query_profile_free (data->profile);
+	}
 	g_free (data);
 }
 
@@ -2718,6 +5349,9 @@ rhythmdb_tree_entry_type_registered (RhythmDB *db,
 	rb_debug ("handled %d entries of newly registered type %s", count, name);
 	rhythmdb_commit (db);
 
+	/* the saved copies of these entries are still unknown entries */
+	rdb->priv->journal_valid = FALSE;
+
 	g_hash_table_remove (rdb->priv->unknown_entry_types, rs_name);
 	g_mutex_unlock (RHYTHMDB_TREE(rdb)->priv->entries_lock);
 	free_unknown_entries (rs_name, entries, NULL);
@@ -0,0 +1,413 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+/*
+ * Trigram index over the case-folded strings used for searching.
+ *
+ * The index records which entries use each distinct string, and for each
+ * three byte sequence occurring in the case-folded version of a string,
+ * which strings contain it.  A substring of a folded string contains only
+ * trigrams that also occur in that string, so the strings containing a
+ * search word can be found by checking only the strings listed for the
+ * least common trigram of the word, rather than every entry.
+ *
+ * The entry sets returned by lookups are candidates: they include every
+ * entry that has an indexed string containing the word, and callers still
+ * evaluate the full query against each of them.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "rb-debug.h"
+#include "rhythmdb-private.h"
+
+#define RHYTHMDB_WORD_INDEX_GRAM_LENGTH	3
+
+typedef struct
+{
+	RBRefString *string;
+	guint32 id;
+
+	/* most strings are only used by one entry, so the entry table
+	 * is only created when a second entry is added.
+	 */
+	RhythmDBEntry *entry;
+	guint entry_refs;
+	GHashTable *entries;		/* RhythmDBEntry -> number of references */
+} RhythmDBWordIndexString;
+
+struct _RhythmDBWordIndex
+{
+	GMutex *lock;
+
+	GHashTable *strings;		/* RBRefString -> RhythmDBWordIndexString */
+	GPtrArray *strings_by_id;
+	GArray *free_ids;
+	GHashTable *trigrams;		/* trigram -> GArray of string ids */
+};
+
+static inline guint32
+trigram_at (const char *s)
+{
+	return ((guint32) (guchar) s[0] << 16) |
+	       ((guint32) (guchar) s[1] << 8) |
+	       (guint32) (guchar) s[2];
+}
+
+static void
+free_posting (GArray *ids)
+{
+	g_array_free (ids, TRUE);
+}
+
+/**
+ * rhythmdb_word_index_new:
+ *
+ * Creates a new, empty word index.
+ *
+ * Return value: the new #RhythmDBWordIndex
+ */
+RhythmDBWordIndex *
+rhythmdb_word_index_new (void)
+{
+	RhythmDBWordIndex *index;
+
+	index = g_new0 (RhythmDBWordIndex, 1);
+	index->lock = g_mutex_new ();
+	index->strings = g_hash_table_new (rb_refstring_hash, rb_refstring_equal);
+	index->strings_by_id = g_ptr_array_new ();
+	index->free_ids = g_array_new (FALSE, FALSE, sizeof (guint32));
+	index->trigrams = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						 NULL, (GDestroyNotify) free_posting);
+	return index;
+}
+
+static void
+free_index_string (RhythmDBWordIndexString *istr)
+{
+	if (istr->entries != NULL)
+		g_hash_table_destroy (istr->entries);
+	rb_refstring_unref (istr->string);
+	g_free (istr);
+}
+
+/**
+ * rhythmdb_word_index_free:
+ * @index: a #RhythmDBWordIndex
+ *
+ * Frees the index.  Entries in the index are not referenced by it.
+ */
+void
+rhythmdb_word_index_free (RhythmDBWordIndex *index)
+{
+	guint i;
+
+	for (i = 0; i < index->strings_by_id->len; i++) {
+		RhythmDBWordIndexString *istr = g_ptr_array_index (index->strings_by_id, i);
+		if (istr != NULL)
+			free_index_string (istr);
+	}
+
+	g_hash_table_destroy (index->trigrams);
+	g_hash_table_destroy (index->strings);
+	g_ptr_array_free (index->strings_by_id, TRUE);
+	g_array_free (index->free_ids, TRUE);
+	g_mutex_free (index->lock);
+	g_free (index);
+}
+
+/* calls func for each distinct trigram of the string */
+static void
+foreach_trigram (const char *folded,
+		 void (*func) (RhythmDBWordIndex *index, guint32 trigram, guint32 id),
+		 RhythmDBWordIndex *index,
+		 guint32 id)
+{
+	GHashTable *seen;
+	gsize len;
+	gsize i;
+
+	len = strlen (folded);
+	if (len < RHYTHMDB_WORD_INDEX_GRAM_LENGTH)
+		return;
+
+	seen = g_hash_table_new (g_direct_hash, g_direct_equal);
+	for (i = 0; i + RHYTHMDB_WORD_INDEX_GRAM_LENGTH <= len; i++) {
+		guint32 trigram = trigram_at (folded + i);
+
+		if (g_hash_table_lookup (seen, GUINT_TO_POINTER (trigram)) != NULL)
+			continue;
+		g_hash_table_insert (seen, GUINT_TO_POINTER (trigram), GUINT_TO_POINTER (1));
+
+		func (index, trigram, id);
+	}
+	g_hash_table_destroy (seen);
+}
+
+/* must be called with the index lock held */
+static void
+posting_add (RhythmDBWordIndex *index,
+	     guint32 trigram,
+	     guint32 id)
+{
+	GArray *ids;
+
+	ids = g_hash_table_lookup (index->trigrams, GUINT_TO_POINTER (trigram));
+	if (ids == NULL) {
+		ids = g_array_new (FALSE, FALSE, sizeof (guint32));
+		g_hash_table_insert (index->trigrams, GUINT_TO_POINTER (trigram), ids);
+	}
+	g_array_append_val (ids, id);
+}
+
+/* must be called with the index lock held */
+static void
+posting_remove (RhythmDBWordIndex *index,
+		guint32 trigram,
+		guint32 id)
+{
+	GArray *ids;
+	guint i;
+
+	ids = g_hash_table_lookup (index->trigrams, GUINT_TO_POINTER (trigram));
+	g_return_if_fail (ids != NULL);
+
+	for (i = 0; i < ids->len; i++) {
+		if (g_array_index (ids, guint32, i) == id) {
+			g_array_remove_index_fast (ids, i);
+			break;
+		}
+	}
+
+	if (ids->len == 0)
+		g_hash_table_remove (index->trigrams, GUINT_TO_POINTER (trigram));
+}
+
+/* must be called with the index lock held */
+static RhythmDBWordIndexString *
+get_or_create_string (RhythmDBWordIndex *index,
+		      RBRefString *string)
+{
+	RhythmDBWordIndexString *istr;
+
+	istr = g_hash_table_lookup (index->strings, string);
+	if (istr != NULL)
+		return istr;
+
+	istr = g_new0 (RhythmDBWordIndexString, 1);
+	istr->string = rb_refstring_ref (string);
+
+	if (index->free_ids->len > 0) {
+		istr->id = g_array_index (index->free_ids, guint32, index->free_ids->len - 1);
+		g_array_set_size (index->free_ids, index->free_ids->len - 1);
+		g_ptr_array_index (index->strings_by_id, istr->id) = istr;
+	} else {
+		istr->id = index->strings_by_id->len;
+		g_ptr_array_add (index->strings_by_id, istr);
+	}
+
+	g_hash_table_insert (index->strings, istr->string, istr);
+	foreach_trigram (rb_refstring_get_folded (string), posting_add, index, istr->id);
+	return istr;
+}
+
+/* must be called with the index lock held */
+static void
+destroy_string (RhythmDBWordIndex *index,
+		RhythmDBWordIndexString *istr)
+{
+	foreach_trigram (rb_refstring_get_folded (istr->string), posting_remove, index, istr->id);
+
+	g_hash_table_remove (index->strings, istr->string);
+	g_ptr_array_index (index->strings_by_id, istr->id) = NULL;
+	g_array_append_val (index->free_ids, istr->id);
+	free_index_string (istr);
+}
+
+/**
+ * rhythmdb_word_index_add:
+ * @index: a #RhythmDBWordIndex
+ * @string: a string property value of @entry
+ * @entry: a #RhythmDBEntry
+ *
+ * Records that @entry has a property with the value @string.  An entry
+ * may add the same string more than once, for different properties, and
+ * must remove it the same number of times.
+ */
+void
+rhythmdb_word_index_add (RhythmDBWordIndex *index,
+			 RBRefString *string,
+			 RhythmDBEntry *entry)
+{
+	RhythmDBWordIndexString *istr;
+
+	if (string == NULL)
+		return;
+
+	g_mutex_lock (index->lock);
+	istr = get_or_create_string (index, string);
+
+	if (istr->entries == NULL && (istr->entry == NULL || istr->entry == entry)) {
+		istr->entry = entry;
+		istr->entry_refs++;
+	} else {
+		guint refs;
+
+		if (istr->entries == NULL) {
+			istr->entries = g_hash_table_new (g_direct_hash, g_direct_equal);
+			g_hash_table_insert (istr->entries, istr->entry, GUINT_TO_POINTER (istr->entry_refs));
+			istr->entry = NULL;
+			istr->entry_refs = 0;
+		}
+
+		refs = GPOINTER_TO_UINT (g_hash_table_lookup (istr->entries, entry));
+		g_hash_table_insert (istr->entries, entry, GUINT_TO_POINTER (refs + 1));
+	}
+	g_mutex_unlock (index->lock);
+}
+
+/**
+ * rhythmdb_word_index_remove:
+ * @index: a #RhythmDBWordIndex
+ * @string: a string property value of @entry
+ * @entry: a #RhythmDBEntry
+ *
+ * Removes one reference to @string for @entry, previously added using
+ * #rhythmdb_word_index_add.
+ */
+void
+rhythmdb_word_index_remove (RhythmDBWordIndex *index,
+			    RBRefString *string,
+			    RhythmDBEntry *entry)
+{
+	RhythmDBWordIndexString *istr;
+	gboolean unused = FALSE;
+
+	if (string == NULL)
+		return;
+
+	g_mutex_lock (index->lock);
+	istr = g_hash_table_lookup (index->strings, string);
+	if (istr == NULL) {
+		g_mutex_unlock (index->lock);
+		g_warning ("removing unindexed string %s", rb_refstring_get (string));
+		return;
+	}
+
+	if (istr->entries == NULL) {
+		if (istr->entry == entry && --istr->entry_refs == 0) {
+			istr->entry = NULL;
+			unused = TRUE;
+		}
+	} else {
+		guint refs;
+
+		refs = GPOINTER_TO_UINT (g_hash_table_lookup (istr->entries, entry));
+		if (refs > 1)
+			g_hash_table_insert (istr->entries, entry, GUINT_TO_POINTER (refs - 1));
+		else if (refs == 1)
+			g_hash_table_remove (istr->entries, entry);
+
+		unused = (g_hash_table_size (istr->entries) == 0);
+	}
+
+	if (unused)
+		destroy_string (index, istr);
+	g_mutex_unlock (index->lock);
+}
+
+static void
+add_candidate (RhythmDBEntry *entry,
+	       gpointer refs,
+	       GHashTable *candidates)
+{
+	if (g_hash_table_lookup (candidates, entry) == NULL)
+		g_hash_table_insert (candidates, rhythmdb_entry_ref (entry), entry);
+}
+
+/**
+ * rhythmdb_word_index_lookup:
+ * @index: a #RhythmDBWordIndex
+ * @word: a case-folded word
+ *
+ * Finds the entries that have an indexed string whose case-folded version
+ * contains @word.  Words shorter than a trigram can't be looked up, as
+ * nearly every string would match them anyway.
+ *
+ * Return value: a #GHashTable holding a reference to each matching entry,
+ * or NULL if the index can't be used for @word.
+ */
+GHashTable *
+rhythmdb_word_index_lookup (RhythmDBWordIndex *index,
+			    const char *word)
+{
+	GHashTable *candidates;
+	GArray *shortest = NULL;
+	gsize len;
+	gsize i;
+
+	len = strlen (word);
+	if (len < RHYTHMDB_WORD_INDEX_GRAM_LENGTH)
+		return NULL;
+
+	candidates = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+					    (GDestroyNotify) rhythmdb_entry_unref, NULL);
+
+	g_mutex_lock (index->lock);
+	for (i = 0; i + RHYTHMDB_WORD_INDEX_GRAM_LENGTH <= len; i++) {
+		GArray *ids;
+
+		ids = g_hash_table_lookup (index->trigrams, GUINT_TO_POINTER (trigram_at (word + i)));
+		if (ids == NULL) {
+			/* no string contains this trigram, so nothing can match */
+			g_mutex_unlock (index->lock);
+			return candidates;
+		}
+
+		if (shortest == NULL || ids->len < shortest->len)
+			shortest = ids;
+	}
+
+	for (i = 0; i < shortest->len; i++) {
+		RhythmDBWordIndexString *istr;
+
+		istr = g_ptr_array_index (index->strings_by_id, g_array_index (shortest, guint32, i));
+		if (strstr (rb_refstring_get_folded (istr->string), word) == NULL)
+			continue;
+
+		if (istr->entries != NULL)
+			g_hash_table_foreach (istr->entries, (GHFunc) add_candidate, candidates);
+		else
+			add_candidate (istr->entry, NULL, candidates);
+	}
+	g_mutex_unlock (index->lock);
+
+	return candidates;
+}
@@ -127,6 +127,8 @@ typedef struct
 	guint propid;
 	RhythmDBQueryResults *results;
 	gboolean cancel;
+	GCancellable *cancellable;
+	gulong cancelled_id;
 } RhythmDBQueryThreadData;
 
 typedef struct
@@ -175,7 +177,11 @@ static void rhythmdb_read_enter (RhythmDB *db);
 static void rhythmdb_read_leave (RhythmDB *db);
 static void rhythmdb_process_one_event (RhythmDBEvent *event, RhythmDB *db);
 static gpointer action_thread_main (RhythmDB *db);
+static void load_thread_main (GPtrArray *batch, RhythmDB *db);
+static guint rhythmdb_get_metadata_workers (RhythmDB *db);
+static void rhythmdb_update_metadata_workers (RhythmDB *db);
 static gpointer query_thread_main (RhythmDBQueryThreadData *data);
+static void rhythmdb_query_thread_data_free (RhythmDBQueryThreadData *data);
 static void rhythmdb_entry_set_mount_point (RhythmDB *db,
  					    RhythmDBEntry *entry,
  					    const gchar *realuri);
@@ -186,8 +192,6 @@ static void library_location_changed_cb (GConfClient *client,
 					  GConfEntry *entry,
 					  RhythmDB *db);
 static void rhythmdb_sync_library_location (RhythmDB *db);
-static void rhythmdb_entry_sync_mirrored (RhythmDBEntry *entry,
-					  guint propid);
 static void rhythmdb_register_core_entry_types (RhythmDB *db);
 static gboolean rhythmdb_entry_extra_metadata_accumulator (GSignalInvocationHint *ihint,
 							   GValue *return_accu,
@@ -213,6 +217,9 @@ enum
 	PROP_NAME,
 	PROP_DRY_RUN,
 	PROP_NO_UPDATE,
+	PROP_PRECOMPUTE_KEYS,
+	PROP_PROFILE_QUERIES,
+	PROP_METADATA_WORKERS,
 };
 
 enum
@@ -220,6 +227,9 @@ enum
 	ENTRY_ADDED,
 	ENTRY_CHANGED,
 	ENTRY_DELETED,
+	ENTRIES_ADDED,
+	ENTRIES_CHANGED,
+	ENTRIES_DELETED,
 	ENTRY_KEYWORD_ADDED,
 	ENTRY_KEYWORD_REMOVED,
 	ENTRY_EXTRA_METADATA_REQUEST,
@@ -283,6 +293,49 @@ rhythmdb_class_init (RhythmDBClass *klass)
 							       "Whether or not to update the database",
 							       FALSE,
 							       G_PARAM_READWRITE));
+	/**
+	 * RhythmDB:precompute-keys
+	 *
+	 * If %TRUE, case-folded strings and sort keys for the properties used
+	 * for searching and sorting are computed on worker threads once the
+	 * database has been loaded, rather than when they are first needed.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_PRECOMPUTE_KEYS,
+					 g_param_spec_boolean ("precompute-keys",
+							       "precompute keys",
+							       "Whether to compute search and sort keys after loading",
+							       TRUE,
+							       G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+	/**
+	 * RhythmDB:profile-queries
+	 *
+	 * If %TRUE, the database backend records how each full query is
+	 * evaluated and how long each part of it takes, and prints a
+	 * description of the query plan along with the measurements once
+	 * the query is complete.  This is initially set if the
+	 * RHYTHMDB_QUERY_PROFILE environment variable is set.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_PROFILE_QUERIES,
+					 g_param_spec_boolean ("profile-queries",
+							       "profile queries",
+							       "Whether to print query plans and timings",
+							       FALSE,
+							       G_PARAM_READWRITE));
+	/**
+	 * RhythmDB:metadata-workers
+	 *
+	 * The number of files to read metadata from at the same time when
+	 * importing.  If 0, this is chosen based on the number of processors.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_METADATA_WORKERS,
+					 g_param_spec_uint ("metadata-workers",
+							    "metadata workers",
+							    "Number of files to read metadata from at once",
+							    0, G_MAXUINT, 0,
+							    G_PARAM_READWRITE));
 	/**
 	 * RhythmDB::entry-added:
 	 * @db: the #RhythmDB
@@ -336,6 +389,64 @@ rhythmdb_class_init (RhythmDBClass *klass)
 			      G_TYPE_NONE, 2,
 			      RHYTHMDB_TYPE_ENTRY, G_TYPE_VALUE_ARRAY);
 
+	/**
+	 * RhythmDB::entries-added:
+	 * @db: the #RhythmDB
+	 * @entries: a #GPtrArray of the newly added #RhythmDBEntry structures
+	 *
+	 * Emitted once for each batch of entries added to the database,
+	 * before #RhythmDB::entry-added is emitted for each entry.  Handling
+	 * this instead of #RhythmDB::entry-added avoids a signal emission
+	 * for each entry when many entries are added at once.
+	 */
+	rhythmdb_signals[ENTRIES_ADDED] =
+		g_signal_new ("entries_added",
+			      RHYTHMDB_TYPE,
+			      G_SIGNAL_RUN_LAST,
+			      G_STRUCT_OFFSET (RhythmDBClass, entries_added),
+			      NULL, NULL,
+			      g_cclosure_marshal_VOID__POINTER,
+			      G_TYPE_NONE,
+			      1, G_TYPE_POINTER);
+
+	/**
+	 * RhythmDB::entries-changed:
+	 * @db: the #RhythmDB
+	 * @entries: a #GPtrArray of the changed #RhythmDBEntry structures
+	 * @changes: a #GPtrArray holding a #GValueArray of #RhythmDBEntryChange
+	 *   structures for each entry in @entries
+	 *
+	 * Emitted once for each batch of modified entries, before
+	 * #RhythmDB::entry-changed is emitted for each entry.
+	 */
+	rhythmdb_signals[ENTRIES_CHANGED] =
+		g_signal_new ("entries_changed",
+			      RHYTHMDB_TYPE,
+			      G_SIGNAL_RUN_LAST,
+			      G_STRUCT_OFFSET (RhythmDBClass, entries_changed),
+			      NULL, NULL,
+			      rb_marshal_VOID__POINTER_POINTER,
+			      G_TYPE_NONE,
+			      2, G_TYPE_POINTER, G_TYPE_POINTER);
+
+	/**
+	 * RhythmDB::entries-deleted:
+	 * @db: the #RhythmDB
+	 * @entries: a #GPtrArray of the deleted #RhythmDBEntry structures
+	 *
+	 * Emitted once for each batch of entries deleted from the database,
+	 * before #RhythmDB::entry-deleted is emitted for each entry.
+	 */
+	rhythmdb_signals[ENTRIES_DELETED] =
+		g_signal_new ("entries_deleted",
+			      RHYTHMDB_TYPE,
+			      G_SIGNAL_RUN_LAST,
+			      G_STRUCT_OFFSET (RhythmDBClass, entries_deleted),
+			      NULL, NULL,
+			      g_cclosure_marshal_VOID__POINTER,
+			      G_TYPE_NONE,
+			      1, G_TYPE_POINTER);
+
 	/**
 	 * RhythmDB::entry-keyword-added:
 	 * @db: the #RhythmDB
@@ -689,6 +800,20 @@ rhythmdb_init (RhythmDB *db)
 	db->priv->metadata_cond = g_cond_new ();
 	db->priv->metadata_lock = g_mutex_new ();
 
+	db->priv->load_mutex = g_mutex_new ();
+	db->priv->load_cond = g_cond_new ();
+	db->priv->loading_uris = g_hash_table_new_full (rb_refstring_hash,
+							rb_refstring_equal,
+							(GDestroyNotify) rb_refstring_unref,
+							NULL);
+	db->priv->load_thread_pool = g_thread_pool_new ((GFunc) load_thread_main,
+							db,
+							rhythmdb_get_metadata_workers (db),
+							FALSE, NULL);
+	rb_metadata_set_max_helpers (rhythmdb_get_metadata_workers (db));
+
+	db->priv->profile_queries = (g_getenv ("RHYTHMDB_QUERY_PROFILE") != NULL);
+
 	prop_class = g_type_class_ref (RHYTHMDB_TYPE_PROP_TYPE);
 
 	g_assert (prop_class->n_values == RHYTHMDB_NUM_PROPERTIES);
@@ -734,6 +859,10 @@ rhythmdb_init (RhythmDB *db)
 							   NULL,
 							   (GDestroyNotify) rhythmdb_entry_unref,
 							   NULL);
+	db->priv->journal_entries = g_hash_table_new_full (NULL,
+							   NULL,
+							   (GDestroyNotify) rhythmdb_entry_unref,
+							   NULL);
 
 	db->priv->saving_condition = g_cond_new ();
 	db->priv->saving_mutex = g_mutex_new ();
@@ -749,6 +878,7 @@ rhythmdb_init (RhythmDB *db)
 	db->priv->next_entry_id = 1;
 
 	rhythmdb_init_monitoring (db);
+	rhythmdb_init_dir_cache (db);
 
 	db->priv->monitor_notify_id = 
 		eel_gconf_notification_add (CONF_MONITOR_LIBRARY,
@@ -808,114 +938,309 @@ stat_thread_mount_done_cb (GObject *source, GAsyncResult *result, RhythmDBStatTh
 	g_mutex_unlock (data->mutex);
 }
 
+/* stats are mostly latency, so more of them can be in flight than there are CPUs */
+#define RHYTHMDB_STAT_WORKERS		8
+
+/* number of stat results passed to the main thread at once */
+#define RHYTHMDB_STAT_BATCH_SIZE	64
+
 typedef struct {
 	RhythmDB *db;
 	GList *stat_list;
+	GMutex *stat_list_mutex;
+	GMutex *mount_mutex;
 } RhythmDBStatThreadData;
 
-static gpointer
-stat_thread_main (RhythmDBStatThreadData *data)
+typedef struct {
+	char *uri;
+	GList *events;
+} RhythmDBStatDirectory;
+
+static GFileInfo *
+stat_thread_query_info (RhythmDB *db, GFile *file, GError **error)
+{
+	return g_file_query_info (file,
+				  G_FILE_ATTRIBUTE_TIME_MODIFIED,	/* anything else? */
+				  G_FILE_QUERY_INFO_NONE,
+				  db->priv->exiting,
+				  error);
+}
+
+static void
+stat_thread_mount (RhythmDBStatThreadData *data, RhythmDBEvent *event, GFile *file, GError **error)
+{
+	GMountOperation *mount_op = NULL;
+
+	/* only one worker tries to mount at a time.  others waiting for the
+	 * same volume will find it mounted once they get the lock.
+	 */
+	g_mutex_lock (data->mount_mutex);
+
+	event->file_info = stat_thread_query_info (data->db, file, NULL);
+	if (event->file_info != NULL) {
+		rb_debug ("%s was mounted while we were waiting", rb_refstring_get (event->uri));
+		g_mutex_unlock (data->mount_mutex);
+		g_clear_error (error);
+		return;
+	}
+
+	/* check if we've tried and failed to mount this location before */
+
+	g_signal_emit (event->db, rhythmdb_signals[CREATE_MOUNT_OP], 0, &mount_op);
+	if (mount_op != NULL) {
+		RhythmDBStatThreadMountData mount_data;
+
+		mount_data.event = event;
+		mount_data.cond = g_cond_new ();
+		mount_data.mutex = g_mutex_new ();
+		mount_data.error = error;
+
+		g_mutex_lock (mount_data.mutex);
+
+		g_clear_error (error);
+		g_file_mount_enclosing_volume (file,
+					       G_MOUNT_MOUNT_NONE,
+					       mount_op,
+					       data->db->priv->exiting,
+					       (GAsyncReadyCallback) stat_thread_mount_done_cb,
+					       &mount_data);
+
+		/* wait for the mount to complete.  the callback occurs on the main
+		 * thread (not this thread), so we can just block until it is called.
+		 */
+		g_cond_wait (mount_data.cond, mount_data.mutex);
+		g_mutex_unlock (mount_data.mutex);
+
+		g_mutex_free (mount_data.mutex);
+		g_cond_free (mount_data.cond);
+
+		if (*error == NULL) {
+			rb_debug ("mount op successful, retrying stat");
+			event->file_info = stat_thread_query_info (data->db, file, error);
+		}
+	} else {
+		rb_debug ("but couldn't create a mount op.");
+	}
+
+	g_mutex_unlock (data->mount_mutex);
+}
+
+static void
+stat_thread_stat_event (RhythmDBStatThreadData *data, RhythmDBEvent *event)
 {
-	GList *i;
 	GError *error = NULL;
-	RhythmDBEvent *result;
-	int count = 0;
+	GFile *file;
 
-	rb_debug ("entering stat thread: %d to process", g_list_length (data->stat_list));
-	for (i = data->stat_list; i != NULL; i = i->next) {
+	file = g_file_new_for_uri (rb_refstring_get (event->uri));
+	event->real_uri = rb_refstring_ref (event->uri);		/* what? */
+	event->file_info = stat_thread_query_info (data->db, file, &error);
+	if (error != NULL) {
+		if (g_error_matches (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_NOT_MOUNTED)) {
+			rb_debug ("got not-mounted error for %s", rb_refstring_get (event->uri));
+			stat_thread_mount (data, event, file, &error);
+		}
+
+		if (error != NULL) {
+			event->error = make_access_failed_error (rb_refstring_get (event->uri), error);
+			g_clear_error (&error);
+		}
+	}
+
+	if (event->error != NULL) {
+		if (event->file_info != NULL) {
+			g_object_unref (event->file_info);
+			event->file_info = NULL;
+		}
+	}
+
+	g_object_unref (file);
+}
+
+static void
+stat_thread_worker (GList *batch, RhythmDBStatThreadData *data)
+{
+	RhythmDB *db = data->db;
+	GList *i;
+	int done;
+	int n = 0;
+
+	for (i = batch; i != NULL; i = i->next) {
 		RhythmDBEvent *event = (RhythmDBEvent *)i->data;
-		GFile *file;
 
-		/* if we've been cancelled, just free the event.  this will
-		 * clean up the list and then we'll exit the thread.
+		/* if we've been cancelled, just free the events.  the
+		 * stat thread exits once all the workers are finished.
 		 */
-		if (g_cancellable_is_cancelled (data->db->priv->exiting)) {
-			rhythmdb_event_free (data->db, event);
-			count = 0;
+		if (g_cancellable_is_cancelled (db->priv->exiting)) {
+			rhythmdb_event_free (db, event);
+			i->data = NULL;
 			continue;
 		}
 
-		if (count > 0 && count % 1000 == 0) {
-			rb_debug ("%d file info queries done", count);
+		stat_thread_stat_event (data, event);
+		n++;
+	}
+
+	/* hand the whole batch over to the main thread at once */
+	g_async_queue_lock (db->priv->event_queue);
+	for (i = batch; i != NULL; i = i->next) {
+		if (i->data != NULL)
+			g_async_queue_push_unlocked (db->priv->event_queue, i->data);
+	}
+	g_async_queue_unlock (db->priv->event_queue);
+	g_main_context_wakeup (g_main_context_default ());
+
+	done = g_atomic_int_exchange_and_add (&db->priv->stat_done, n) + n;
+	if (done / 1000 != (done - n) / 1000) {
+		rb_debug ("%d of %d file info queries done", done, g_atomic_int_get (&db->priv->stat_total));
+	}
+
+	g_list_free (batch);
+}
+
+static void
+stat_thread_check_directory (RhythmDBStatDirectory *dir, RhythmDBStatThreadData *data)
+{
+	RhythmDB *db = data->db;
+
+	if (g_cancellable_is_cancelled (db->priv->exiting) == FALSE &&
+	    rhythmdb_dir_cache_check (db, dir->uri, db->priv->exiting)) {
+		GList *i;
+		int n = 0;
+
+		/* the main thread still marks the entries as seen */
+		g_async_queue_lock (db->priv->event_queue);
+		for (i = dir->events; i != NULL; i = i->next) {
+			RhythmDBEvent *event = (RhythmDBEvent *)i->data;
+
+			event->real_uri = rb_refstring_ref (event->uri);
+			event->unchanged = TRUE;
+			g_async_queue_push_unlocked (db->priv->event_queue, event);
+			n++;
 		}
+		g_async_queue_unlock (db->priv->event_queue);
+		g_main_context_wakeup (g_main_context_default ());
+		g_list_free (dir->events);
 
-		file = g_file_new_for_uri (rb_refstring_get (event->uri));
-		event->real_uri = rb_refstring_ref (event->uri);		/* what? */
-		event->file_info = g_file_query_info (file,
-						      G_FILE_ATTRIBUTE_TIME_MODIFIED,	/* anything else? */
-						      G_FILE_QUERY_INFO_NONE,
-						      data->db->priv->exiting,
-						      &error);
-		if (error != NULL) {
-			if (g_error_matches (error,
-					     G_IO_ERROR,
-					     G_IO_ERROR_NOT_MOUNTED)) {
-				GMountOperation *mount_op = NULL;
-
-				rb_debug ("got not-mounted error for %s", rb_refstring_get (event->uri));
-
-				/* check if we've tried and failed to mount this location before */
-
-				g_signal_emit (event->db, rhythmdb_signals[CREATE_MOUNT_OP], 0, &mount_op);
-				if (mount_op != NULL) {
-					RhythmDBStatThreadMountData mount_data;
-
-					mount_data.event = event;
-					mount_data.cond = g_cond_new ();
-					mount_data.mutex = g_mutex_new ();
-					mount_data.error = &error;
-
-					g_mutex_lock (mount_data.mutex);
-
-					g_file_mount_enclosing_volume (file,
-								       G_MOUNT_MOUNT_NONE,
-								       mount_op,
-								       data->db->priv->exiting,
-								       (GAsyncReadyCallback) stat_thread_mount_done_cb,
-								       &mount_data);
-					g_clear_error (&error);
-
-					/* wait for the mount to complete.  the callback occurs on the main
-					 * thread (not this thread), so we can just block until it is called.
-					 */
-					g_cond_wait (mount_data.cond, mount_data.mutex);
-					g_mutex_unlock (mount_data.mutex);
-
-					g_mutex_free (mount_data.mutex);
-					g_cond_free (mount_data.cond);
-
-					if (error == NULL) {
-						rb_debug ("mount op successful, retrying stat");
-						event->file_info = g_file_query_info (file,
-										      G_FILE_ATTRIBUTE_TIME_MODIFIED,
-										      G_FILE_QUERY_INFO_NONE,
-										      data->db->priv->exiting,
-										      &error);
-					}
-				} else {
-					rb_debug ("but couldn't create a mount op.");
-				}
-			}
+		rb_debug ("%s is unchanged, not checking %d files in it", dir->uri, n);
+		g_atomic_int_exchange_and_add (&db->priv->stat_done, n);
+	} else {
+		if (g_cancellable_is_cancelled (db->priv->exiting) == FALSE)
+			rhythmdb_dir_cache_scan (db, dir->uri, db->priv->exiting);
 
-			if (error != NULL) {
-				event->error = make_access_failed_error (rb_refstring_get (event->uri), error);
-				g_clear_error (&error);
-			}
+		g_mutex_lock (data->stat_list_mutex);
+		data->stat_list = g_list_concat (dir->events, data->stat_list);
+		g_mutex_unlock (data->stat_list_mutex);
+	}
+
+	g_free (dir->uri);
+	g_slice_free (RhythmDBStatDirectory, dir);
+}
+
+/* checks the directories holding files loaded from the database, leaving
+ * only the files in changed directories on the stat list.
+ */
+static void
+stat_thread_check_directories (RhythmDBStatThreadData *data)
+{
+	RhythmDB *db = data->db;
+	GHashTable *dirs;
+	GHashTableIter iter;
+	GThreadPool *pool;
+	GList *i;
+	GList *unsorted = NULL;
+	gpointer dir;
+
+	/* group entries by directory.  anything else (new files and directories,
+	 * or hidden entries) is checked individually.
+	 */
+	dirs = g_hash_table_new (g_str_hash, g_str_equal);
+	for (i = data->stat_list; i != NULL; i = i->next) {
+		RhythmDBEvent *event = (RhythmDBEvent *)i->data;
+		RhythmDBStatDirectory *d;
+		char *uri = NULL;
+
+		if (event->entry != NULL &&
+		    rhythmdb_entry_get_boolean (event->entry, RHYTHMDB_PROP_HIDDEN) == FALSE)
+			uri = rhythmdb_dir_cache_parent (rb_refstring_get (event->uri));
+
+		if (uri == NULL) {
+			unsorted = g_list_prepend (unsorted, event);
+			continue;
 		}
 
-		if (event->error != NULL) {
-			if (event->file_info != NULL) {
-				g_object_unref (event->file_info);
-				event->file_info = NULL;
-			}
+		d = g_hash_table_lookup (dirs, uri);
+		if (d == NULL) {
+			d = g_slice_new0 (RhythmDBStatDirectory);
+			d->uri = uri;
+			g_hash_table_insert (dirs, d->uri, d);
+		} else {
+			g_free (uri);
 		}
+		d->events = g_list_prepend (d->events, event);
+	}
+	g_list_free (data->stat_list);
+	data->stat_list = unsorted;
+
+	rb_debug ("checking %d directories", g_hash_table_size (dirs));
+	pool = g_thread_pool_new ((GFunc) stat_thread_check_directory,
+				  data,
+				  RHYTHMDB_STAT_WORKERS,
+				  FALSE,
+				  NULL);
+	g_hash_table_iter_init (&iter, dirs);
+	while (g_hash_table_iter_next (&iter, NULL, &dir)) {
+		g_thread_pool_push (pool, dir, NULL);
+	}
+	g_hash_table_destroy (dirs);
 
-		g_async_queue_push (data->db->priv->event_queue, event);
-		g_object_unref (file);
-		count++;
+	g_thread_pool_free (pool, FALSE, TRUE);
+
+	if (g_cancellable_is_cancelled (db->priv->exiting) == FALSE)
+		rhythmdb_dir_cache_prune (db);
+
+	rb_debug ("%d files left to check", g_list_length (data->stat_list));
+}
+
+static gpointer
+stat_thread_main (RhythmDBStatThreadData *data)
+{
+	GThreadPool *pool;
+	RhythmDBEvent *result;
+	GList *batch;
+
+	rb_debug ("entering stat thread: %d to process", g_atomic_int_get (&data->db->priv->stat_total));
+	data->mount_mutex = g_mutex_new ();
+	data->stat_list_mutex = g_mutex_new ();
+
+	stat_thread_check_directories (data);
+
+	pool = g_thread_pool_new ((GFunc) stat_thread_worker,
+				  data,
+				  RHYTHMDB_STAT_WORKERS,
+				  FALSE,
+				  NULL);
+
+	/* break the list up into batches and queue them for the workers */
+	batch = data->stat_list;
+	while (batch != NULL) {
+		GList *next;
+
+		next = g_list_nth (batch, RHYTHMDB_STAT_BATCH_SIZE);
+		if (next != NULL) {
+			next->prev->next = NULL;
+			next->prev = NULL;
+		}
+		g_thread_pool_push (pool, batch, NULL);
+		batch = next;
 	}
+	data->stat_list = NULL;
 
-	g_list_free (data->stat_list);
+	/* wait for all the batches to be processed */
+	g_thread_pool_free (pool, FALSE, TRUE);
+	g_mutex_free (data->mount_mutex);
+	g_mutex_free (data->stat_list_mutex);
 
 	data->db->priv->stat_thread_running = FALSE;
 	
@@ -949,6 +1274,8 @@ rhythmdb_start_action_thread (RhythmDB *db)
 		data->stat_list = db->priv->stat_list;
 		db->priv->stat_list = NULL;
 
+		db->priv->stat_total = g_list_length (data->stat_list);
+		db->priv->stat_done = 0;
 		db->priv->stat_thread_running = TRUE;
 		rhythmdb_thread_create (db, NULL, (GThreadFunc) stat_thread_main, data);
 	}
@@ -982,10 +1309,12 @@ rhythmdb_event_free (RhythmDB *db,
 	case RHYTHMDB_EVENT_METADATA_LOAD:
 	case RHYTHMDB_EVENT_DB_LOAD:
 	case RHYTHMDB_EVENT_DB_SAVED:
-	case RHYTHMDB_EVENT_QUERY_COMPLETE:
 	case RHYTHMDB_EVENT_FILE_CREATED_OR_MODIFIED:
 	case RHYTHMDB_EVENT_FILE_DELETED:
 		break;
+	case RHYTHMDB_EVENT_QUERY_COMPLETE:
+		rhythmdb_query_thread_data_free (result->query_data);
+		break;
 	case RHYTHMDB_EVENT_ENTRY_SET:
 		g_value_unset (&result->change.new);
 		break;
@@ -1132,8 +1461,14 @@ rhythmdb_finalize (GObject *object)
 	g_return_if_fail (db->priv != NULL);
 
 	rhythmdb_finalize_monitoring (db);
+	rhythmdb_finalize_dir_cache (db);
 
 	g_thread_pool_free (db->priv->query_thread_pool, FALSE, TRUE);
+	if (db->priv->load_thread_pool != NULL)
+		g_thread_pool_free (db->priv->load_thread_pool, FALSE, TRUE);
+	g_hash_table_destroy (db->priv->loading_uris);
+	g_mutex_free (db->priv->load_mutex);
+	g_cond_free (db->priv->load_cond);
 	g_async_queue_unref (db->priv->action_queue);
 	g_async_queue_unref (db->priv->event_queue);
 	g_async_queue_unref (db->priv->restored_queue);
@@ -1152,6 +1487,7 @@ rhythmdb_finalize (GObject *object)
 	g_hash_table_destroy (db->priv->added_entries);
 	g_hash_table_destroy (db->priv->deleted_entries);
 	g_hash_table_destroy (db->priv->changed_entries);
+	g_hash_table_destroy (db->priv->journal_entries);
 
 	rb_refstring_unref (db->priv->empty_string);
 	rb_refstring_unref (db->priv->octet_stream_str);
@@ -1189,6 +1525,16 @@ rhythmdb_set_property (GObject *object,
 	case PROP_NO_UPDATE:
 		db->priv->no_update = g_value_get_boolean (value);
 		break;
+	case PROP_PRECOMPUTE_KEYS:
+		db->priv->precompute_keys = g_value_get_boolean (value);
+		break;
+	case PROP_PROFILE_QUERIES:
+		db->priv->profile_queries = g_value_get_boolean (value);
+		break;
+	case PROP_METADATA_WORKERS:
+		db->priv->metadata_workers = g_value_get_uint (value);
+		rhythmdb_update_metadata_workers (db);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -1213,6 +1559,15 @@ rhythmdb_get_property (GObject *object,
 	case PROP_NO_UPDATE:
 		g_value_set_boolean (value, source->priv->no_update);
 		break;
+	case PROP_PRECOMPUTE_KEYS:
+		g_value_set_boolean (value, source->priv->precompute_keys);
+		break;
+	case PROP_PROFILE_QUERIES:
+		g_value_set_boolean (value, source->priv->profile_queries);
+		break;
+	case PROP_METADATA_WORKERS:
+		g_value_set_uint (value, source->priv->metadata_workers);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -1333,10 +1688,12 @@ rhythmdb_emit_entry_signals_idle (RhythmDB *db)
 	GList *added_entries;
 	GList *deleted_entries;
 	GHashTable *changed_entries;
+	GPtrArray *entries;
 	GList *l;
 	GHashTableIter iter;
 	RhythmDBEntry *entry;
 	GSList *entry_changes;
+	guint i;
 
 	/* get lists of entries to emit, reset source id value */
 	g_mutex_lock (db->priv->change_mutex);
@@ -1352,12 +1709,22 @@ rhythmdb_emit_entry_signals_idle (RhythmDB *db)
 
 	db->priv->emit_entry_signals_id = 0;
 
+	/* everything committed so far is being signalled now, and nothing
+	 * else runs on the main thread until that's done.
+	 */
+	db->priv->emitted_generation = db->priv->generation;
+
 	g_mutex_unlock (db->priv->change_mutex);
 
 	GDK_THREADS_ENTER ();
 
-	/* emit changed entries */
+	/* emit changed entries, first as a batch, then one at a time */
 	if (changed_entries != NULL) {
+		GPtrArray *changes;
+
+		entries = g_ptr_array_sized_new (g_hash_table_size (changed_entries));
+		changes = g_ptr_array_sized_new (g_hash_table_size (changed_entries));
+
 		g_hash_table_iter_init (&iter, changed_entries);
 		while (g_hash_table_iter_next (&iter, (gpointer *)&entry, (gpointer *)&entry_changes)) {
 			GValueArray *emit_changes;
@@ -1371,24 +1738,52 @@ rhythmdb_emit_entry_signals_idle (RhythmDB *db)
 				g_value_array_append (emit_changes, &v);
 				g_value_unset (&v);
 			}
-			g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRY_CHANGED], 0, entry, emit_changes);
-			g_value_array_free (emit_changes);
-			g_hash_table_iter_remove (&iter);
+			g_ptr_array_add (entries, entry);
+			g_ptr_array_add (changes, emit_changes);
 		}
+
+		g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRIES_CHANGED], 0, entries, changes);
+		for (i = 0; i < entries->len; i++) {
+			g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRY_CHANGED], 0,
+				       g_ptr_array_index (entries, i),
+				       g_ptr_array_index (changes, i));
+			g_value_array_free (g_ptr_array_index (changes, i));
+		}
+
+		g_ptr_array_free (entries, TRUE);
+		g_ptr_array_free (changes, TRUE);
 	}
 
 	/* emit added entries */
-	for (l = added_entries; l; l = g_list_next (l)) {
-		entry = (RhythmDBEntry *)l->data;
-		g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRY_ADDED], 0, entry);
-		rhythmdb_entry_unref (entry);
+	if (added_entries != NULL) {
+		entries = g_ptr_array_new ();
+		for (l = added_entries; l; l = g_list_next (l)) {
+			g_ptr_array_add (entries, l->data);
+		}
+
+		g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRIES_ADDED], 0, entries);
+		for (i = 0; i < entries->len; i++) {
+			entry = g_ptr_array_index (entries, i);
+			g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRY_ADDED], 0, entry);
+			rhythmdb_entry_unref (entry);
+		}
+		g_ptr_array_free (entries, TRUE);
 	}
 
 	/* emit deleted entries */
-	for (l = deleted_entries; l; l = g_list_next (l)) {
-		entry = (RhythmDBEntry *)l->data;
-		g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRY_DELETED], 0, entry);
-		rhythmdb_entry_unref (entry);
+	if (deleted_entries != NULL) {
+		entries = g_ptr_array_new ();
+		for (l = deleted_entries; l; l = g_list_next (l)) {
+			g_ptr_array_add (entries, l->data);
+		}
+
+		g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRIES_DELETED], 0, entries);
+		for (i = 0; i < entries->len; i++) {
+			entry = g_ptr_array_index (entries, i);
+			g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRY_DELETED], 0, entry);
+			rhythmdb_entry_unref (entry);
+		}
+		g_ptr_array_free (entries, TRUE);
 	}
 
 	GDK_THREADS_LEAVE ();
@@ -1401,6 +1796,126 @@ rhythmdb_emit_entry_signals_idle (RhythmDB *db)
 	return FALSE;
 }
 
+/* must be called with the change mutex held */
+static void
+journal_entry (RhythmDB *db,
+	       RhythmDBEntry *entry,
+	       RhythmDBJournalOp op)
+{
+	gpointer existing;
+
+	existing = g_hash_table_lookup (db->priv->journal_entries, entry);
+	if (existing == NULL) {
+		rhythmdb_entry_ref (entry);
+		g_hash_table_insert (db->priv->journal_entries, entry, GINT_TO_POINTER (op));
+	} else if (GPOINTER_TO_INT (existing) != RHYTHMDB_JOURNAL_ENTRY_DELETED) {
+		g_hash_table_replace (db->priv->journal_entries, entry, GINT_TO_POINTER (op));
+	}
+}
+
+/**
+ * rhythmdb_journal_take:
+ * @db: a #RhythmDB.
+ * @generation: returns the database generation the journal brings the saved
+ *   database up to, or a random one if there are changes that haven't been
+ *   committed yet
+ *
+ * Takes the set of entries that have been added, changed or deleted since
+ * the last time this was called, for database backends that save changes
+ * incrementally.  The returned hash table maps each entry to a
+ * #RhythmDBJournalOp and holds a reference on it.
+ *
+ * Return value: the journal hash table, to be destroyed by the caller
+ */
+GHashTable *
+rhythmdb_journal_take (RhythmDB *db, guint64 *generation)
+{
+	GHashTable *journal;
+
+	g_mutex_lock (db->priv->change_mutex);
+	*generation = db->priv->generation;
+
+	/* entries are saved as they are, so changes that haven't been
+	 * committed yet would be saved along with a generation that
+	 * doesn't include them.  no generation matches the saved
+	 * contents in that case.
+	 */
+	if (g_hash_table_size (db->priv->changed_entries) > 0 ||
+	    g_hash_table_size (db->priv->added_entries) > 0 ||
+	    g_hash_table_size (db->priv->deleted_entries) > 0) {
+		rb_debug ("saving uncommitted changes, so the saved generation won't match");
+		*generation = ((guint64) g_random_int () << 32) | g_random_int ();
+	}
+
+	journal = db->priv->journal_entries;
+	db->priv->journal_entries = g_hash_table_new_full (NULL,
+							   NULL,
+							   (GDestroyNotify) rhythmdb_entry_unref,
+							   NULL);
+	g_mutex_unlock (db->priv->change_mutex);
+
+	return journal;
+}
+
+/**
+ * rhythmdb_journal_clear:
+ * @db: a #RhythmDB.
+ *
+ * Forgets all journalled changes, for use after the backend has
+ * written out the full database or has just loaded it.
+ */
+void
+rhythmdb_journal_clear (RhythmDB *db)
+{
+	g_mutex_lock (db->priv->change_mutex);
+	g_hash_table_remove_all (db->priv->journal_entries);
+	g_mutex_unlock (db->priv->change_mutex);
+}
+
+/**
+ * rhythmdb_set_generation:
+ * @db: a #RhythmDB.
+ * @generation: the generation of the database contents
+ *
+ * Sets the generation of the database, for use by database backends once
+ * the saved database has been loaded.  The generation should be one that
+ * was saved along with the database, or a random one if the contents of the
+ * database don't match any saved generation.
+ */
+void
+rhythmdb_set_generation (RhythmDB *db, guint64 generation)
+{
+	g_mutex_lock (db->priv->change_mutex);
+	db->priv->generation = generation;
+	db->priv->emitted_generation = generation;
+	g_mutex_unlock (db->priv->change_mutex);
+}
+
+/**
+ * rhythmdb_get_generation:
+ * @db: a #RhythmDB.
+ *
+ * Returns the generation of the database contents, as seen through the
+ * entry-added, entry-changed and entry-deleted signals.  The generation
+ * changes whenever a commit changes anything in the database, and is saved
+ * with the database, so results derived from the database can be saved
+ * along with the generation they were derived at and reused later if the
+ * generation still matches.
+ *
+ * Return value: the current database generation
+ */
+guint64
+rhythmdb_get_generation (RhythmDB *db)
+{
+	guint64 generation;
+
+	g_mutex_lock (db->priv->change_mutex);
+	generation = db->priv->emitted_generation;
+	g_mutex_unlock (db->priv->change_mutex);
+
+	return generation;
+}
+
 static gboolean
 process_added_entries_cb (RhythmDBEntry *entry,
 			  GThread *thread,
@@ -1409,11 +1924,13 @@ process_added_entries_cb (RhythmDBEntry *entry,
 	if (thread != g_thread_self ())
 		return FALSE;
 
-	if (entry->type == RHYTHMDB_ENTRY_TYPE_SONG) {
+	if (entry->type == RHYTHMDB_ENTRY_TYPE_SONG ||
+	    entry->type == RHYTHMDB_ENTRY_TYPE_IGNORE ||
+	    entry->type == RHYTHMDB_ENTRY_TYPE_IMPORT_ERROR) {
 		const gchar *uri;
 
 		uri = rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION);
-		if (uri == NULL)
+		if (uri == NULL && entry->type == RHYTHMDB_ENTRY_TYPE_SONG)
 			return TRUE;
 
 		/* something to think about: only do the stat if the mountpoint is
@@ -1433,17 +1950,25 @@ process_added_entries_cb (RhythmDBEntry *entry,
 		 * maybe it should be atomicised?
 		 */
 		g_mutex_lock (db->priv->stat_mutex);
-		if (db->priv->action_thread_running == FALSE) {
-			rhythmdb_add_to_stat_list (db, uri, entry,
-						   RHYTHMDB_ENTRY_TYPE_INVALID,
-						   RHYTHMDB_ENTRY_TYPE_IGNORE,
-						   RHYTHMDB_ENTRY_TYPE_IMPORT_ERROR);
+		if (uri != NULL && db->priv->action_thread_running == FALSE) {
+			/* entries for any kind of file count towards the number of
+			 * files expected in the directory when checking it.
+			 */
+			rhythmdb_dir_cache_count_entry (db, uri);
+
+			if (entry->type == RHYTHMDB_ENTRY_TYPE_SONG) {
+				rhythmdb_add_to_stat_list (db, uri, entry,
+							   RHYTHMDB_ENTRY_TYPE_INVALID,
+							   RHYTHMDB_ENTRY_TYPE_IGNORE,
+							   RHYTHMDB_ENTRY_TYPE_IMPORT_ERROR);
+			}
 		}
 		g_mutex_unlock (db->priv->stat_mutex);
 	}
 
 	g_assert ((entry->flags & RHYTHMDB_ENTRY_INSERTED) == 0);
 	entry->flags |= RHYTHMDB_ENTRY_INSERTED;
+	journal_entry (db, entry, RHYTHMDB_JOURNAL_ENTRY_CHANGED);
 
 	rhythmdb_entry_ref (entry);
 	db->priv->added_entries_to_emit = g_list_prepend (db->priv->added_entries_to_emit, entry);
@@ -1462,6 +1987,7 @@ process_deleted_entries_cb (RhythmDBEntry *entry,
 	rhythmdb_entry_ref (entry);
 	g_assert ((entry->flags & RHYTHMDB_ENTRY_INSERTED) != 0);
 	entry->flags &= ~(RHYTHMDB_ENTRY_INSERTED);
+	journal_entry (db, entry, RHYTHMDB_JOURNAL_ENTRY_DELETED);
 	db->priv->deleted_entries_to_emit = g_list_prepend (db->priv->deleted_entries_to_emit, entry);
 
 	return TRUE;
@@ -1499,6 +2025,11 @@ process_changed_entries_cb (RhythmDBEntry *entry,
 	}
 
 	g_hash_table_insert (db->priv->changed_entries_to_emit, entry, changes);
+
+	/* journalled here rather than when the change is made, so the
+	 * generation saved with the journal includes it.
+	 */
+	journal_entry (db, entry, RHYTHMDB_JOURNAL_ENTRY_CHANGED);
 	return TRUE;
 }
 
@@ -1537,6 +2068,8 @@ rhythmdb_commit_internal (RhythmDB *db,
 			  gboolean sync_changes,
 			  GThread *thread)
 {
+	guint processed;
+
 	g_mutex_lock (db->priv->change_mutex);
 	
 	if (sync_changes) {
@@ -1544,9 +2077,11 @@ rhythmdb_commit_internal (RhythmDB *db,
 	}
 
 	/* update the sets of entry changed/added/deleted signals to emit */
-	g_hash_table_foreach_remove (db->priv->changed_entries, (GHRFunc) process_changed_entries_cb, db);
-	g_hash_table_foreach_remove (db->priv->added_entries, (GHRFunc) process_added_entries_cb, db);
-	g_hash_table_foreach_remove (db->priv->deleted_entries, (GHRFunc) process_deleted_entries_cb, db);
+	processed = g_hash_table_foreach_remove (db->priv->changed_entries, (GHRFunc) process_changed_entries_cb, db);
+	processed += g_hash_table_foreach_remove (db->priv->added_entries, (GHRFunc) process_added_entries_cb, db);
+	processed += g_hash_table_foreach_remove (db->priv->deleted_entries, (GHRFunc) process_deleted_entries_cb, db);
+	if (processed > 0)
+		db->priv->generation++;
 
 	/* if there are some signals to emit, add a new idle callback if required */
 	if (db->priv->added_entries_to_emit || db->priv->deleted_entries_to_emit || db->priv->changed_entries_to_emit) {
@@ -1647,7 +2182,7 @@ rhythmdb_entry_allocate (RhythmDB *db,
 	if (type->entry_type_data_size) {
 		size = ALIGN_STRUCT (sizeof (RhythmDBEntry)) + type->entry_type_data_size;
 	}
-	ret = g_malloc0 (size);
+	ret = rhythmdb_entry_pool_alloc (RHYTHMDB_ENTRY_TYPE_GET_POOL (type), size);
 	ret->id = (guint) g_atomic_int_exchange_and_add (&db->priv->next_entry_id, 1);
 
 	ret->type = type;
@@ -1655,10 +2190,6 @@ rhythmdb_entry_allocate (RhythmDB *db,
 	ret->genre = rb_refstring_ref (db->priv->empty_string);
 	ret->artist = rb_refstring_ref (db->priv->empty_string);
 	ret->album = rb_refstring_ref (db->priv->empty_string);
-	ret->musicbrainz_trackid = rb_refstring_ref (db->priv->empty_string);
-	ret->musicbrainz_artistid = rb_refstring_ref (db->priv->empty_string);
-	ret->musicbrainz_albumid = rb_refstring_ref (db->priv->empty_string);
-	ret->musicbrainz_albumartistid = rb_refstring_ref (db->priv->empty_string);
 	ret->artist_sortname = rb_refstring_ref (db->priv->empty_string);
 	ret->album_sortname = rb_refstring_ref (db->priv->empty_string);
 	ret->mimetype = rb_refstring_ref (db->priv->octet_stream_str);
@@ -1676,6 +2207,55 @@ rhythmdb_entry_allocate (RhythmDB *db,
 	return ret;
 }
 
+/**
+ * rhythmdb_entry_get_cold_fields:
+ * @entry: a #RhythmDBEntry
+ * @create: whether to allocate the fields if they don't exist yet
+ *
+ * Retrieves the structure holding the rarely used fields of the entry.
+ * This is allocated the first time one of these fields is set, so it will
+ * be NULL for most entries unless @create is TRUE.
+ *
+ * This should only be used by RhythmDB itself, or a backend (such as rhythmdb-tree).
+ *
+ * Return value: the entry's #RhythmDBEntryColdFields, or NULL
+ */
+RhythmDBEntryColdFields *
+rhythmdb_entry_get_cold_fields (RhythmDBEntry *entry,
+				gboolean create)
+{
+	RhythmDBEntryColdFields *cold;
+
+	cold = g_atomic_pointer_get (&entry->cold);
+	if (cold != NULL || create == FALSE)
+		return cold;
+
+	/* the mirrored string properties can be updated from any thread */
+	cold = g_new0 (RhythmDBEntryColdFields, 1);
+	if (g_atomic_pointer_compare_and_exchange ((gpointer *)&entry->cold, NULL, cold) == FALSE) {
+		g_free (cold);
+		cold = g_atomic_pointer_get (&entry->cold);
+	}
+	return cold;
+}
+
+static void
+rhythmdb_entry_free_cold_fields (RhythmDBEntryColdFields *cold)
+{
+	if (cold == NULL)
+		return;
+
+	rb_refstring_unref (cold->musicbrainz_trackid);
+	rb_refstring_unref (cold->musicbrainz_artistid);
+	rb_refstring_unref (cold->musicbrainz_albumid);
+	rb_refstring_unref (cold->musicbrainz_albumartistid);
+	rb_refstring_unref (cold->last_played_str);
+	rb_refstring_unref (cold->first_seen_str);
+	rb_refstring_unref (cold->last_seen_str);
+	rb_refstring_unref (cold->playback_error);
+	g_free (cold);
+}
+
 /**
  * rhythmdb_entry_get_type_data:
  * @entry: a #RhythmDBEntry
@@ -1846,20 +2426,16 @@ rhythmdb_entry_finalize (RhythmDBEntry *entry)
 		(type->pre_entry_destroy)(entry, type->pre_entry_destroy_data);
 
 	rb_refstring_unref (entry->location);
-	rb_refstring_unref (entry->playback_error);
 	rb_refstring_unref (entry->title);
 	rb_refstring_unref (entry->genre);
 	rb_refstring_unref (entry->artist);
 	rb_refstring_unref (entry->album);
-	rb_refstring_unref (entry->musicbrainz_trackid);
-	rb_refstring_unref (entry->musicbrainz_artistid);
-	rb_refstring_unref (entry->musicbrainz_albumid);
-	rb_refstring_unref (entry->musicbrainz_albumartistid);
 	rb_refstring_unref (entry->artist_sortname);
 	rb_refstring_unref (entry->album_sortname);
 	rb_refstring_unref (entry->mimetype);
+	rhythmdb_entry_free_cold_fields (entry->cold);
 
-	g_free (entry);
+	rhythmdb_entry_pool_free (RHYTHMDB_ENTRY_TYPE_GET_POOL (type), entry);
 }
 
 /**
@@ -2110,6 +2686,26 @@ is_ghost_entry (RhythmDBEntry *entry)
 	return (last_seen + grace_period < time.tv_sec);
 }
 
+static void
+rhythmdb_entry_seen (RhythmDB *db, RhythmDBEntry *entry)
+{
+	GValue val = {0, };
+	GTimeVal time;
+
+	rhythmdb_entry_set_visibility (db, entry, TRUE);
+
+	/* Update last seen time.  It's also updated when a volume
+	 * is unmounted.
+	 */
+	g_get_current_time (&time);
+	g_value_init (&val, G_TYPE_ULONG);
+	g_value_set_ulong (&val, time.tv_sec);
+	rhythmdb_entry_set_internal (db, entry, TRUE,
+				     RHYTHMDB_PROP_LAST_SEEN,
+				     &val);
+	g_value_unset (&val);
+}
+
 static void
 rhythmdb_process_stat_event (RhythmDB *db,
 			     RhythmDBEvent *event)
@@ -2145,6 +2741,15 @@ rhythmdb_process_stat_event (RhythmDB *db,
 		return;
 	}
 
+	/* the file's directory hasn't changed, so it's still there */
+	if (event->unchanged) {
+		if (entry != NULL) {
+			rhythmdb_entry_seen (db, entry);
+			rhythmdb_commit (db);
+		}
+		return;
+	}
+
 	g_assert (event->file_info != NULL);
 
 	/* figure out what to do based on the file type */
@@ -2154,8 +2759,6 @@ rhythmdb_process_stat_event (RhythmDB *db,
 	case G_FILE_TYPE_UNKNOWN:
 	case G_FILE_TYPE_REGULAR:
 		if (entry != NULL) {
-			GValue val = {0, };
-			GTimeVal time;
 			guint64 new_mtime;
 			guint64 new_size;
 
@@ -2166,18 +2769,7 @@ rhythmdb_process_stat_event (RhythmDB *db,
 			if (entry->type == event->ignore_type)
 				rb_debug ("ignoring %p", entry);
 
-			rhythmdb_entry_set_visibility (db, entry, TRUE);
-
-			/* Update last seen time. It will also be updated
-			 * upon saving and when a volume is unmounted.
-			 */
-			g_get_current_time (&time);
-			g_value_init (&val, G_TYPE_ULONG);
-			g_value_set_ulong (&val, time.tv_sec);
-			rhythmdb_entry_set_internal (db, entry, TRUE,
-						     RHYTHMDB_PROP_LAST_SEEN,
-						     &val);
-			g_value_unset (&val);
+			rhythmdb_entry_seen (db, entry);
 
 			/* compare modification time and size to the values in the database.
 			 * if either has changed, we'll re-read the file.
@@ -2520,13 +3112,24 @@ rhythmdb_missing_plugins_cb (gpointer duh, gboolean should_retry, RhythmDBEvent
 	}
 }
 
+/*
+ * Lets metadata loads continue after missing plugins have been processed.
+ * Each load thread can be waiting for this, so they all need to be woken up.
+ * Must be called with the metadata lock held.
+ */
+void
+rhythmdb_unblock_metadata (RhythmDB *db)
+{
+	db->priv->metadata_blocked = FALSE;
+	g_cond_broadcast (db->priv->metadata_cond);
+}
+
 static void
 rhythmdb_missing_plugin_event_cleanup (RhythmDBEvent *event)
 {
 	rb_debug ("cleaning up missing plugin event %p", event);
 
-	event->db->priv->metadata_blocked = FALSE;
-	g_cond_signal (event->db->priv->metadata_cond);
+	rhythmdb_unblock_metadata (event->db);
 
 	g_mutex_unlock (event->db->priv->metadata_lock);
 	rhythmdb_event_free (event->db, event);
@@ -2578,8 +3181,7 @@ rhythmdb_process_metadata_load (RhythmDB *db,
 			  rb_metadata_has_other_data (event->metadata));
 
 		g_mutex_lock (db->priv->metadata_lock);
-		db->priv->metadata_blocked = FALSE;
-		g_cond_signal (db->priv->metadata_cond);
+		rhythmdb_unblock_metadata (db);
 		g_mutex_unlock (db->priv->metadata_lock);
 	}
 
@@ -2807,8 +3409,9 @@ rhythmdb_execute_stat (RhythmDB *db,
 	g_object_unref (file);
 }
 
-static void
-rhythmdb_execute_load (RhythmDB *db,
+/* resolves symlinks and fetches file info for a load; returns FALSE on error */
+static gboolean
+rhythmdb_prepare_load (RhythmDB *db,
 		       const char *uri,
 		       RhythmDBEvent *event)
 {
@@ -2839,28 +3442,151 @@ rhythmdb_execute_load (RhythmDB *db,
 			g_object_unref (event->file_info);
 			event->file_info = NULL;
 		}
-	} else if (event->type == RHYTHMDB_EVENT_METADATA_LOAD) {
-		g_mutex_lock (event->db->priv->metadata_lock);
-		while (event->db->priv->metadata_blocked) {
-			g_cond_wait (event->db->priv->metadata_cond, event->db->priv->metadata_lock);
-		}
+		return FALSE;
+	}
 
+	return TRUE;
+}
+
+static void
+rhythmdb_wait_for_metadata (RhythmDB *db)
+{
+	g_mutex_lock (db->priv->metadata_lock);
+	while (db->priv->metadata_blocked) {
+		g_cond_wait (db->priv->metadata_cond, db->priv->metadata_lock);
+	}
+	g_mutex_unlock (db->priv->metadata_lock);
+}
+
+/*
+ * If we're missing some plugins, block further attempts to read
+ * metadata until we've processed them.  If another load got there first,
+ * the metadata must be read again once its plugins have been processed,
+ * as they may be the ones we need; returns FALSE in that case.
+ */
+static gboolean
+rhythmdb_check_missing_plugins (RhythmDB *db,
+				RhythmDBEvent *event)
+{
+	gboolean result = TRUE;
+
+	if (rb_metadata_has_missing_plugins (event->metadata) == FALSE)
+		return TRUE;
+
+	g_mutex_lock (db->priv->metadata_lock);
+	if (db->priv->metadata_blocked == FALSE) {
+		db->priv->metadata_blocked = TRUE;
+	} else {
+		rb_debug ("already processing missing plugins; retrying %s later",
+			  rb_refstring_get (event->real_uri));
+		g_object_unref (event->metadata);
+		event->metadata = NULL;
+		g_clear_error (&event->error);
+		result = FALSE;
+	}
+	g_mutex_unlock (db->priv->metadata_lock);
+
+	return result;
+}
+
+static void
+rhythmdb_read_metadata (RhythmDB *db,
+			RhythmDBEvent *event)
+{
+	do {
+		rhythmdb_wait_for_metadata (db);
+
+		/* other load threads may be reading metadata at the same time */
 		event->metadata = rb_metadata_new ();
 		rb_metadata_load (event->metadata,
 				  rb_refstring_get (event->real_uri),
 				  &event->error);
+	} while (rhythmdb_check_missing_plugins (db, event) == FALSE);
+}
 
-		/* if we're missing some plugins, block further attempts to
-		 * read metadata until we've processed them.
-		 */
-		if (rb_metadata_has_missing_plugins (event->metadata)) {
-			event->db->priv->metadata_blocked = TRUE;
+static void
+rhythmdb_execute_load (RhythmDB *db,
+		       const char *uri,
+		       RhythmDBEvent *event)
+{
+	if (rhythmdb_prepare_load (db, uri, event) &&
+	    event->type == RHYTHMDB_EVENT_METADATA_LOAD) {
+		rhythmdb_read_metadata (db, event);
+	}
+
+	rhythmdb_push_event (db, event);
+}
+
+typedef struct {
+	RhythmDB *db;
+	RhythmDBEvent **events;
+	GSList *retry;
+} RhythmDBLoadBatch;
+
+static void
+load_batch_result_cb (RBMetaData *md,
+		      guint index,
+		      GError *error,
+		      RhythmDBLoadBatch *batch)
+{
+	RhythmDBEvent *event = batch->events[index];
+
+	event->metadata = md;
+	event->error = error;
+	if (rhythmdb_check_missing_plugins (batch->db, event)) {
+		rhythmdb_push_event (batch->db, event);
+	} else {
+		batch->retry = g_slist_prepend (batch->retry, event);
+	}
+}
+
+/*
+ * Reads metadata for a batch of files using a single request to the
+ * metadata helper, pushing an event for each one as it completes.
+ */
+static void
+rhythmdb_execute_load_batch (RhythmDB *db,
+			     RhythmDBEvent **events,
+			     guint count)
+{
+	RhythmDBLoadBatch batch = {0,};
+	char **uris;
+	GSList *l;
+	guint n = 0;
+	guint i;
+
+	batch.db = db;
+	batch.events = g_new0 (RhythmDBEvent *, count);
+	uris = g_new0 (char *, count + 1);
+	for (i = 0; i < count; i++) {
+		if (rhythmdb_prepare_load (db, rb_refstring_get (events[i]->uri), events[i]) == FALSE) {
+			rhythmdb_push_event (db, events[i]);
+			continue;
 		}
 
-		g_mutex_unlock (event->db->priv->metadata_lock);
+		batch.events[n] = events[i];
+		uris[n] = g_strdup (rb_refstring_get (events[i]->real_uri));
+		n++;
 	}
 
-	rhythmdb_push_event (db, event);
+	if (n > 0) {
+		rb_debug ("loading metadata for a batch of %u files", n);
+		rhythmdb_wait_for_metadata (db);
+		rb_metadata_load_batch (uris, (RBMetaDataLoadFunc) load_batch_result_cb, &batch);
+	}
+
+	/* reload anything that ran into missing plugins being processed */
+	batch.retry = g_slist_reverse (batch.retry);
+	for (l = batch.retry; l != NULL; l = l->next) {
+		RhythmDBEvent *event = l->data;
+
+		rhythmdb_read_metadata (db, event);
+		rhythmdb_push_event (db, event);
+	}
+
+	g_slist_free (batch.retry);
+	g_strfreev (uris);
+	g_free (batch.events);
 }
 
 static void
@@ -2869,9 +3595,31 @@ rhythmdb_execute_enum_dir (RhythmDB *db,
 {
 	GFile *dir;
 	GFileEnumerator *dir_enum;
+	GFileInfo *dir_info;
 	GError *error = NULL;
+	GTimeVal scan_time;
+	guint64 dir_mtime = 0;
+	gboolean complete = TRUE;
+	guint n_files = 0;
 
 	dir = g_file_new_for_uri (rb_refstring_get (action->uri));
+
+	/* read the modification time first, so anything changed while
+	 * we're enumerating shows up as a change next time.
+	 */
+	g_get_current_time (&scan_time);
+	dir_info = g_file_query_info (dir,
+				      G_FILE_ATTRIBUTE_TIME_MODIFIED,
+				      G_FILE_QUERY_INFO_NONE,
+				      db->priv->exiting,
+				      NULL);
+	if (dir_info != NULL) {
+		dir_mtime = g_file_info_get_attribute_uint64 (dir_info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+		g_object_unref (dir_info);
+	} else {
+		complete = FALSE;
+	}
+
 	dir_enum = g_file_enumerate_children (dir,
 					      RHYTHMDB_FILE_CHILD_INFO_ATTRIBUTES,
 					      G_FILE_QUERY_INFO_NONE,
@@ -2906,6 +3654,7 @@ rhythmdb_execute_enum_dir (RhythmDB *db,
 
 			g_warning ("error getting next file: %s", error->message);
 			g_clear_error (&error);
+			complete = FALSE;
 			continue;
 		}
 
@@ -2915,6 +3664,9 @@ rhythmdb_execute_enum_dir (RhythmDB *db,
 			continue;
 		}
 
+		if (g_file_info_get_attribute_uint32 (file_info, G_FILE_ATTRIBUTE_STANDARD_TYPE) == G_FILE_TYPE_REGULAR)
+			n_files++;
+
 		child = g_file_get_child (dir, g_file_info_get_name (file_info));
 		child_uri = g_file_get_uri (child);
 
@@ -2939,6 +3691,10 @@ rhythmdb_execute_enum_dir (RhythmDB *db,
 		g_error_free (error);
 	}
 
+	if (complete && !g_cancellable_is_cancelled (db->priv->exiting)) {
+		rhythmdb_dir_cache_record (db, rb_refstring_get (action->uri), dir_mtime, scan_time.tv_sec, n_files);
+	}
+
 	g_object_unref (dir);
 	g_object_unref (dir_enum);
 }
@@ -2962,8 +3718,6 @@ rhythmdb_entry_get (RhythmDB *db,
 	g_return_if_fail (entry != NULL);
 	g_return_if_fail (entry->refcount > 0);
 
-	rhythmdb_entry_sync_mirrored (entry, propid);
-
 	g_assert (G_VALUE_TYPE (val) == rhythmdb_get_property_type (db, propid));
 	switch (rhythmdb_property_type_map[propid]) {
 	case G_TYPE_STRING:
@@ -3008,15 +3762,191 @@ emit_save_error_idle (RhythmDBSaveErrorData *data)
 	return FALSE;
 }
 
+static guint
+rhythmdb_get_metadata_workers (RhythmDB *db)
+{
+	if (db->priv->metadata_workers > 0)
+		return db->priv->metadata_workers;
+
+	/* each worker has its own metadata helper process */
+	return CLAMP (rb_get_num_processors (), 1, 4);
+}
+
+static void
+rhythmdb_update_metadata_workers (RhythmDB *db)
+{
+	guint workers;
+
+	workers = rhythmdb_get_metadata_workers (db);
+	rb_debug ("using %u metadata load threads", workers);
+	rb_metadata_set_max_helpers (workers);
+
+	g_mutex_lock (db->priv->load_mutex);
+	if (db->priv->load_thread_pool != NULL)
+		g_thread_pool_set_max_threads (db->priv->load_thread_pool, workers, NULL);
+	g_mutex_unlock (db->priv->load_mutex);
+}
+
+/* maximum number of files to read metadata from in one helper request */
+#define RHYTHMDB_LOAD_BATCH_SIZE	16
+
+/* must be called with the load mutex held */
+static void
+rhythmdb_queue_load (RhythmDB *db,
+		     RhythmDBAction *action,
+		     GPtrArray *batch)
+{
+	GQueue *deferred;
+
+	deferred = g_hash_table_lookup (db->priv->loading_uris, action->uri);
+	if (deferred != NULL) {
+		rb_debug ("deferring RHYTHMDB_ACTION_LOAD for \"%s\"", rb_refstring_get (action->uri));
+		g_queue_push_tail (deferred, action);
+	} else {
+		g_hash_table_insert (db->priv->loading_uris,
+				     rb_refstring_ref (action->uri),
+				     g_queue_new ());
+		g_ptr_array_add (batch, action);
+	}
+}
+
+/*
+ * Metadata loads run on a pool of load threads.  Loads waiting in the
+ * action queue together are grouped into batches, which are read using a
+ * single request to a metadata helper.  Batches are kept small enough
+ * that all the load threads get some work.  Only one load for a given URI
+ * runs at a time; further loads for that URI are held in the loading_uris
+ * table and run in order once the current one finishes.
+ *
+ * Returns the first action taken from the queue that isn't a load, if any.
+ */
+static RhythmDBAction *
+rhythmdb_dispatch_load (RhythmDB *db,
+			RhythmDBAction *action)
+{
+	GPtrArray *batch;
+	guint batch_size;
+	gint queued;
+
+	queued = g_async_queue_length (db->priv->action_queue);
+	batch_size = (MAX (queued, 0) + 1) / rhythmdb_get_metadata_workers (db);
+	batch_size = CLAMP (batch_size, 1, RHYTHMDB_LOAD_BATCH_SIZE);
+
+	batch = g_ptr_array_new ();
+	g_mutex_lock (db->priv->load_mutex);
+	while (TRUE) {
+		rhythmdb_queue_load (db, action, batch);
+		if (batch->len == batch_size) {
+			action = NULL;
+			break;
+		}
+
+		action = g_async_queue_try_pop (db->priv->action_queue);
+		if (action == NULL || action->type != RHYTHMDB_ACTION_LOAD)
+			break;
+	}
+
+	if (batch->len > 0) {
+		g_thread_pool_push (db->priv->load_thread_pool, batch, NULL);
+	} else {
+		g_ptr_array_free (batch, TRUE);
+	}
+	g_mutex_unlock (db->priv->load_mutex);
+
+	return action;
+}
+
+static void
+rhythmdb_wait_for_load (RhythmDB *db,
+			RBRefString *uri)
+{
+	g_mutex_lock (db->priv->load_mutex);
+	while (g_hash_table_lookup (db->priv->loading_uris, uri) != NULL) {
+		g_cond_wait (db->priv->load_cond, db->priv->load_mutex);
+	}
+	g_mutex_unlock (db->priv->load_mutex);
+}
+
+static void
+load_thread_main (GPtrArray *batch,
+		  RhythmDB *db)
+{
+	RhythmDBEvent **events;
+	RhythmDBAction *action;
+	RhythmDBAction *next;
+	GQueue *deferred;
+	guint i;
+
+	if (!g_cancellable_is_cancelled (db->priv->exiting)) {
+		events = g_new0 (RhythmDBEvent *, batch->len);
+		for (i = 0; i < batch->len; i++) {
+			action = g_ptr_array_index (batch, i);
+			rb_debug ("executing RHYTHMDB_ACTION_LOAD for \"%s\"", rb_refstring_get (action->uri));
+
+			events[i] = g_slice_new0 (RhythmDBEvent);
+			events[i]->db = db;
+			events[i]->type = RHYTHMDB_EVENT_METADATA_LOAD;
+			events[i]->uri = rb_refstring_ref (action->uri);
+			events[i]->entry_type = action->data.types.entry_type;
+			events[i]->error_type = action->data.types.error_type;
+			events[i]->ignore_type = action->data.types.ignore_type;
+		}
+
+		if (batch->len == 1) {
+			rhythmdb_execute_load (db, rb_refstring_get (events[0]->uri), events[0]);
+		} else {
+			rhythmdb_execute_load_batch (db, events, batch->len);
+		}
+		g_free (events);
+	}
+
+	g_mutex_lock (db->priv->load_mutex);
+	for (i = 0; i < batch->len; i++) {
+		action = g_ptr_array_index (batch, i);
+		deferred = g_hash_table_lookup (db->priv->loading_uris, action->uri);
+		next = g_queue_pop_head (deferred);
+		if (next != NULL && db->priv->load_thread_pool != NULL) {
+			GPtrArray *next_batch;
+
+			next_batch = g_ptr_array_new ();
+			g_ptr_array_add (next_batch, next);
+			g_thread_pool_push (db->priv->load_thread_pool, next_batch, NULL);
+		} else {
+			/* if the pool is being shut down, drop anything deferred */
+			while (next != NULL) {
+				rhythmdb_action_free (db, next);
+				next = g_queue_pop_head (deferred);
+			}
+			g_queue_free (deferred);
+			g_hash_table_remove (db->priv->loading_uris, action->uri);
+		}
+	}
+	g_cond_broadcast (db->priv->load_cond);
+	g_mutex_unlock (db->priv->load_mutex);
+
+	for (i = 0; i < batch->len; i++) {
+		rhythmdb_action_free (db, g_ptr_array_index (batch, i));
+	}
+	g_ptr_array_free (batch, TRUE);
+}
+
 static gpointer
 action_thread_main (RhythmDB *db)
 {
 	RhythmDBEvent *result;
+	RhythmDBAction *pending = NULL;
+	GThreadPool *pool;
 
 	while (!g_cancellable_is_cancelled (db->priv->exiting)) {
 		RhythmDBAction *action;
 
-		action = g_async_queue_pop (db->priv->action_queue);
+		/* dispatching a batch of loads can take the next action from the queue */
+		if (pending != NULL) {
+			action = pending;
+			pending = NULL;
+		} else {
+			action = g_async_queue_pop (db->priv->action_queue);
+		}
 
 		/* hrm, do we need this check at all? */
 		if (!g_cancellable_is_cancelled (db->priv->exiting)) {
@@ -3035,17 +3965,9 @@ action_thread_main (RhythmDB *db)
 				break;
 
 			case RHYTHMDB_ACTION_LOAD:
-				result = g_slice_new0 (RhythmDBEvent);
-				result->db = db;
-				result->type = RHYTHMDB_EVENT_METADATA_LOAD;
-				result->entry_type = action->data.types.entry_type;
-				result->error_type = action->data.types.error_type;
-				result->ignore_type = action->data.types.ignore_type;
-
-				rb_debug ("executing RHYTHMDB_ACTION_LOAD for \"%s\"", rb_refstring_get (action->uri));
-
-				rhythmdb_execute_load (db, rb_refstring_get (action->uri), result);
-				break;
+				/* the load thread frees the action */
+				pending = rhythmdb_dispatch_load (db, action);
+				continue;
 
 			case RHYTHMDB_ACTION_ENUM_DIR:
 				rb_debug ("executing RHYTHMDB_ACTION_ENUM_DIR for \"%s\"", rb_refstring_get (action->uri));
@@ -3063,6 +3985,9 @@ action_thread_main (RhythmDB *db)
 					break;
 				}
 
+				/* don't write tags while they're being read */
+				rhythmdb_wait_for_load (db, action->uri);
+
 				entry = rhythmdb_entry_lookup_by_location_refstring (db, action->uri);
 				if (!entry)
 					break;
@@ -3098,6 +4023,17 @@ action_thread_main (RhythmDB *db)
 		rhythmdb_action_free (db, action);
 	}
 
+	if (pending != NULL)
+		rhythmdb_action_free (db, pending);
+
+	/* wait for any metadata loads in progress to finish */
+	g_mutex_lock (db->priv->load_mutex);
+	pool = db->priv->load_thread_pool;
+	db->priv->load_thread_pool = NULL;
+	g_mutex_unlock (db->priv->load_mutex);
+	if (pool != NULL)
+		g_thread_pool_free (pool, FALSE, TRUE);
+
 	rb_debug ("exiting action thread");
 	result = g_slice_new0 (RhythmDBEvent);
 	result->db = db;
@@ -3231,6 +4167,117 @@ rhythmdb_load_error_cb (GError *error)
 	return FALSE;
 }
 
+static void
+report_entry_pool (const char *name,
+		   RhythmDBEntryType entry_type,
+		   gpointer data)
+{
+	rhythmdb_entry_pool_report (RHYTHMDB_ENTRY_TYPE_GET_POOL (entry_type), name);
+}
+
+/* string properties that are searched and sorted on, which are worth
+ * computing folded strings and sort keys for in advance.
+ */
+static const RhythmDBPropType precompute_key_props[] = {
+	RHYTHMDB_PROP_TITLE,
+	RHYTHMDB_PROP_ARTIST,
+	RHYTHMDB_PROP_ALBUM,
+	RHYTHMDB_PROP_GENRE,
+	RHYTHMDB_PROP_ARTIST_SORTNAME,
+	RHYTHMDB_PROP_ALBUM_SORTNAME
+};
+
+#define RHYTHMDB_PRECOMPUTE_KEYS_CHUNK	1024
+
+static void
+collect_entry_key_strings (RhythmDBEntry *entry,
+			   GHashTable *strings)
+{
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (precompute_key_props); i++) {
+		RBRefString *str;
+
+		str = rhythmdb_entry_get_refstring (entry, precompute_key_props[i]);
+		if (str == NULL)
+			continue;
+
+		if ((rb_refstring_peek_folded (str) != NULL && rb_refstring_peek_sort_key (str) != NULL) ||
+		    g_hash_table_lookup (strings, str) != NULL) {
+			rb_refstring_unref (str);
+			continue;
+		}
+
+		g_hash_table_insert (strings, str, str);
+	}
+}
+
+static void
+precompute_keys_chunk (GPtrArray *chunk,
+		       RhythmDB *db)
+{
+	guint i;
+
+	for (i = 0; i < chunk->len; i++) {
+		RBRefString *str = g_ptr_array_index (chunk, i);
+
+		if (g_cancellable_is_cancelled (db->priv->exiting))
+			break;
+
+		rb_refstring_get_folded (str);
+		rb_refstring_get_sort_key (str);
+	}
+
+	g_ptr_array_free (chunk, TRUE);
+}
+
+/*
+ * Fills in the folded strings and sort keys for all strings that will be
+ * used for searching and sorting, spread across a pool of worker threads,
+ * so the first search or sort after startup doesn't have to compute them
+ * all on the main thread.  Strings loaded from a database snapshot already
+ * have their keys, so this usually only has work to do for new strings.
+ */
+static void
+rhythmdb_precompute_keys (RhythmDB *db)
+{
+	GHashTable *strings;
+	GThreadPool *pool;
+	GPtrArray *chunk = NULL;
+	GHashTableIter iter;
+	gpointer str;
+
+	rb_profile_start ("precomputing string keys");
+
+	strings = g_hash_table_new_full (rb_refstring_hash, rb_refstring_equal,
+					 (GDestroyNotify) rb_refstring_unref, NULL);
+	rhythmdb_entry_foreach (db, (GFunc) collect_entry_key_strings, strings);
+	rb_debug ("computing keys for %u strings", g_hash_table_size (strings));
+
+	pool = g_thread_pool_new ((GFunc) precompute_keys_chunk, db,
+				  rb_get_num_processors (), FALSE, NULL);
+
+	g_hash_table_iter_init (&iter, strings);
+	while (g_hash_table_iter_next (&iter, &str, NULL)) {
+		if (chunk == NULL)
+			chunk = g_ptr_array_sized_new (RHYTHMDB_PRECOMPUTE_KEYS_CHUNK);
+
+		g_ptr_array_add (chunk, str);
+		if (chunk->len == RHYTHMDB_PRECOMPUTE_KEYS_CHUNK) {
+			g_thread_pool_push (pool, chunk, NULL);
+			chunk = NULL;
+		}
+	}
+	if (chunk != NULL)
+		g_thread_pool_push (pool, chunk, NULL);
+
+	/* wait for the workers to finish before releasing the strings */
+	g_thread_pool_free (pool, FALSE, TRUE);
+	g_hash_table_destroy (strings);
+
+	rb_profile_end ("precomputing string keys");
+}
+
 static gpointer
 rhythmdb_load_thread_main (RhythmDB *db)
 {
@@ -3240,6 +4287,7 @@ rhythmdb_load_thread_main (RhythmDB *db)
 
 	rb_profile_start ("loading db");
 	g_mutex_lock (db->priv->saving_mutex);
+	rhythmdb_dir_cache_load (db);
 	if (klass->impl_load (db, db->priv->exiting, &error) == FALSE) {
 		rb_debug ("db load failed: disabling saving");
 		db->priv->can_save = FALSE;
@@ -3250,6 +4298,8 @@ rhythmdb_load_thread_main (RhythmDB *db)
 	}
 	g_mutex_unlock (db->priv->saving_mutex);
 
+	rhythmdb_entry_type_foreach (db, (GHFunc) report_entry_pool, NULL);
+
 	g_object_ref (db);
 	g_timeout_add_seconds (10, (GSourceFunc) rhythmdb_sync_library_idle, db);
 
@@ -3258,6 +4308,9 @@ rhythmdb_load_thread_main (RhythmDB *db)
 	result->type = RHYTHMDB_EVENT_DB_LOAD;
 	g_async_queue_push (db->priv->event_queue, result);
 
+	if (db->priv->precompute_keys && !g_cancellable_is_cancelled (db->priv->exiting))
+		rhythmdb_precompute_keys (db);
+
 	rb_debug ("exiting");
 	result = g_slice_new0 (RhythmDBEvent);
 	result->type = RHYTHMDB_EVENT_THREAD_EXITED;
@@ -3292,6 +4345,10 @@ rhythmdb_save_thread_main (RhythmDB *db)
 	db->priv->save_count++;
 	g_cond_broadcast (db->priv->saving_condition);
 
+	/* directory records change without the database changing */
+	if (db->priv->can_save)
+		rhythmdb_dir_cache_save (db);
+
 	if (!(db->priv->dirty && db->priv->can_save)) {
 		rb_debug ("no save needed, ignoring");
 		g_mutex_unlock (db->priv->saving_mutex);
@@ -3468,6 +4525,7 @@ rhythmdb_entry_set_internal (RhythmDB *db,
 	RhythmDBClass *klass = RHYTHMDB_GET_CLASS (db);
 	gboolean handled;
 	RhythmDBPodcastFields *podcast = NULL;
+	RhythmDBEntryColdFields *cold;
 	GValue old_value = {0,};
 	gboolean nop;
 
@@ -3506,8 +4564,15 @@ rhythmdb_entry_set_internal (RhythmDB *db,
 		break;
 	}
 	
-	if (nop == FALSE && (entry->flags & RHYTHMDB_ENTRY_INSERTED) && notify_if_inserted) {
-		record_entry_change (db, entry, propid, &old_value, value);
+	if (nop == FALSE && (entry->flags & RHYTHMDB_ENTRY_INSERTED)) {
+		if (notify_if_inserted) {
+			record_entry_change (db, entry, propid, &old_value, value);
+		} else {
+			/* silent changes still need to be saved */
+			g_mutex_lock (db->priv->change_mutex);
+			journal_entry (db, entry, RHYTHMDB_JOURNAL_ENTRY_CHANGED);
+			g_mutex_unlock (db->priv->change_mutex);
+		}
 	}
 	g_value_unset (&old_value);
 
@@ -3589,11 +4654,14 @@ rhythmdb_entry_set_internal (RhythmDB *db,
 			entry->location = rb_refstring_new (g_value_get_string (value));
 			break;
 		case RHYTHMDB_PROP_PLAYBACK_ERROR:
-			rb_refstring_unref (entry->playback_error);
+			cold = rhythmdb_entry_get_cold_fields (entry, g_value_get_string (value) != NULL);
+			if (cold == NULL)
+				break;
+			rb_refstring_unref (cold->playback_error);
 			if (g_value_get_string (value))
-				entry->playback_error = rb_refstring_new (g_value_get_string (value));
+				cold->playback_error = rb_refstring_new (g_value_get_string (value));
 			else
-				entry->playback_error = NULL;
+				cold->playback_error = NULL;
 			break;
 		case RHYTHMDB_PROP_MOUNTPOINT:
 			if (entry->mountpoint != NULL) {
@@ -3632,20 +4700,24 @@ rhythmdb_entry_set_internal (RhythmDB *db,
 			entry->flags |= RHYTHMDB_ENTRY_LAST_PLAYED_DIRTY;
 			break;
 		case RHYTHMDB_PROP_MUSICBRAINZ_TRACKID:
-			rb_refstring_unref (entry->musicbrainz_trackid);
-			entry->musicbrainz_trackid = rb_refstring_new (g_value_get_string (value));
+			cold = rhythmdb_entry_get_cold_fields (entry, TRUE);
+			rb_refstring_unref (cold->musicbrainz_trackid);
+			cold->musicbrainz_trackid = rb_refstring_new (g_value_get_string (value));
 			break;
 		case RHYTHMDB_PROP_MUSICBRAINZ_ARTISTID:
-			rb_refstring_unref (entry->musicbrainz_artistid);
-			entry->musicbrainz_artistid = rb_refstring_new (g_value_get_string (value));
+			cold = rhythmdb_entry_get_cold_fields (entry, TRUE);
+			rb_refstring_unref (cold->musicbrainz_artistid);
+			cold->musicbrainz_artistid = rb_refstring_new (g_value_get_string (value));
 			break;
 		case RHYTHMDB_PROP_MUSICBRAINZ_ALBUMID:
-			rb_refstring_unref (entry->musicbrainz_albumid);
-			entry->musicbrainz_albumid = rb_refstring_new (g_value_get_string (value));
+			cold = rhythmdb_entry_get_cold_fields (entry, TRUE);
+			rb_refstring_unref (cold->musicbrainz_albumid);
+			cold->musicbrainz_albumid = rb_refstring_new (g_value_get_string (value));
 			break;
 		case RHYTHMDB_PROP_MUSICBRAINZ_ALBUMARTISTID:
-			rb_refstring_unref (entry->musicbrainz_albumartistid);
-			entry->musicbrainz_albumartistid = rb_refstring_new (g_value_get_string (value));
+			cold = rhythmdb_entry_get_cold_fields (entry, TRUE);
+			rb_refstring_unref (cold->musicbrainz_albumartistid);
+			cold->musicbrainz_albumartistid = rb_refstring_new (g_value_get_string (value));
 			break;
 		case RHYTHMDB_PROP_ARTIST_SORTNAME:
 			rb_refstring_unref (entry->artist_sortname);
@@ -3717,111 +4789,180 @@ rhythmdb_entry_set_internal (RhythmDB *db,
 	db->priv->dirty = TRUE;
 }
 
+/*
+ * Returns TRUE if the mirrored string version of a time property doesn't
+ * depend on the time itself, storing the string in @value.  This covers
+ * times that have never been set and last seen times of entries that
+ * aren't hidden, which is most entries.
+ */
+static gboolean
+rhythmdb_entry_mirrored_is_constant (RhythmDBEntry *entry,
+				     guint propid,
+				     const char **value)
+{
+	static const char *never;
+
+	if (never == NULL)
+		never = _("Never");
+
+	switch (propid) {
+	case RHYTHMDB_PROP_LAST_PLAYED_STR:
+		*value = never;
+		return (entry->last_played == 0);
+	case RHYTHMDB_PROP_FIRST_SEEN_STR:
+		*value = never;
+		return (entry->first_seen == 0);
+	case RHYTHMDB_PROP_LAST_SEEN_STR:
+		/* only store last seen time as a string for hidden entries */
+		*value = NULL;
+		return ((entry->flags & RHYTHMDB_ENTRY_HIDDEN) == 0);
+	default:
+		g_assert_not_reached ();
+		return FALSE;
+	}
+}
+
+/* formats the mirrored string version of a time property */
+static RBRefString *
+rhythmdb_entry_format_mirrored (RhythmDBEntry *entry,
+				guint propid)
+{
+	RBRefString *ret;
+	const char *constant;
+	char *val;
+
+	if (rhythmdb_entry_mirrored_is_constant (entry, propid, &constant))
+		return constant ? rb_refstring_new (constant) : NULL;
+
+	switch (propid) {
+	case RHYTHMDB_PROP_LAST_PLAYED_STR:
+		val = rb_utf_friendly_time (entry->last_played);
+		break;
+	case RHYTHMDB_PROP_FIRST_SEEN_STR:
+		val = rb_utf_friendly_time (entry->first_seen);
+		break;
+	case RHYTHMDB_PROP_LAST_SEEN_STR:
+		val = rb_utf_friendly_time (entry->last_seen);
+		break;
+	default:
+		g_assert_not_reached ();
+		return NULL;
+	}
+
+	ret = rb_refstring_new (val);
+	g_free (val);
+	return ret;
+}
+
+static gpointer *
+rhythmdb_entry_mirrored_field (RhythmDBEntryColdFields *cold,
+			       guint propid)
+{
+	switch (propid) {
+	case RHYTHMDB_PROP_LAST_PLAYED_STR:
+		return &cold->last_played_str;
+	case RHYTHMDB_PROP_FIRST_SEEN_STR:
+		return &cold->first_seen_str;
+	case RHYTHMDB_PROP_LAST_SEEN_STR:
+		return &cold->last_seen_str;
+	default:
+		g_assert_not_reached ();
+		return NULL;
+	}
+}
+
 /**
  * rhythmdb_entry_sync_mirrored:
- * @db: a #RhythmDB.
- * @type: a #RhythmDBEntry.
+ * @entry: a #RhythmDBEntry.
  * @propid: the property to sync the mirrored version of.
+ * @create: whether to allocate the cold fields to store the string in
  *
  * Synchronise "mirrored" properties, such as the string version of the last-played
- * time. This should be called when a property is directly modified, passing the
- * original property.
+ * time.  If the entry has no cold fields and @create is FALSE, nothing is stored.
  *
  * This should only be used by RhythmDB itself, or a backend (such as rhythmdb-tree).
  */
 static void
 rhythmdb_entry_sync_mirrored (RhythmDBEntry *entry,
-			      guint propid)
+			      guint propid,
+			      gboolean create)
 {
-	static const char *never;
-	char *val;
-
-	if (never == NULL)
-		never = _("Never");
+	RhythmDBEntryColdFields *cold;
+	RBRefString *old, *new;
+	gpointer *field;
+	guint dirty;
 
 	switch (propid) {
 	case RHYTHMDB_PROP_LAST_PLAYED_STR:
-	{
-		RBRefString *old, *new;
+		dirty = RHYTHMDB_ENTRY_LAST_PLAYED_DIRTY;
+		break;
+	case RHYTHMDB_PROP_FIRST_SEEN_STR:
+		dirty = RHYTHMDB_ENTRY_FIRST_SEEN_DIRTY;
+		break;
+	case RHYTHMDB_PROP_LAST_SEEN_STR:
+		dirty = RHYTHMDB_ENTRY_LAST_SEEN_DIRTY;
+		break;
+	default:
+		return;
+	}
 
-		if (!(entry->flags & RHYTHMDB_ENTRY_LAST_PLAYED_DIRTY))
-			break;
+	if (!(entry->flags & dirty))
+		return;
 
-		old = g_atomic_pointer_get (&entry->last_played_str);
-		if (entry->last_played == 0) {
-			new = rb_refstring_new (never);
-		} else {
-			val = rb_utf_friendly_time (entry->last_played);
-			new = rb_refstring_new (val);
-			g_free (val);
-		}
+	cold = rhythmdb_entry_get_cold_fields (entry, create);
+	if (cold == NULL)
+		return;
 
-		if (g_atomic_pointer_compare_and_exchange (&entry->last_played_str, old, new)) {
-			if (old != NULL) {
-				rb_refstring_unref (old);
-			}
-		} else {
-			rb_refstring_unref (new);
-		}
+	field = rhythmdb_entry_mirrored_field (cold, propid);
+	old = g_atomic_pointer_get (field);
+	new = rhythmdb_entry_format_mirrored (entry, propid);
 
-		break;
+	if (g_atomic_pointer_compare_and_exchange (field, old, new)) {
+		if (old != NULL) {
+			rb_refstring_unref (old);
+		}
+	} else if (new != NULL) {
+		rb_refstring_unref (new);
 	}
-	case RHYTHMDB_PROP_FIRST_SEEN_STR:
-	{
-		RBRefString *old, *new;
-
-		if (!(entry->flags & RHYTHMDB_ENTRY_FIRST_SEEN_DIRTY))
-			break;
+}
 
-		old = g_atomic_pointer_get (&entry->first_seen_str);
- 		if (entry->first_seen == 0) {
-			new = rb_refstring_new (never);
- 		} else {
- 			val = rb_utf_friendly_time (entry->first_seen);
- 			new = rb_refstring_new (val);
- 			g_free (val);
- 		}
-
-		if (g_atomic_pointer_compare_and_exchange (&entry->first_seen_str, old, new)) {
-			if (old != NULL) {
-				rb_refstring_unref (old);
-			}
-		} else {
-			rb_refstring_unref (new);
-		}
+/*
+ * Returns the mirrored string version of a time property.  The strings
+ * that don't depend on the time are returned directly, so the cold fields
+ * are only allocated to hold strings for times that are actually set.
+ */
+static const char *
+rhythmdb_entry_get_mirrored_string (RhythmDBEntry *entry,
+				    guint propid)
+{
+	RhythmDBEntryColdFields *cold;
+	const char *constant;
 
-		break;
-	}
-	case RHYTHMDB_PROP_LAST_SEEN_STR:
-	{
-		RBRefString *old, *new;
+	if (rhythmdb_entry_mirrored_is_constant (entry, propid, &constant))
+		return constant;
 
-		if (!(entry->flags & RHYTHMDB_ENTRY_LAST_SEEN_DIRTY))
-			break;
+	rhythmdb_entry_sync_mirrored (entry, propid, TRUE);
+	cold = rhythmdb_entry_get_cold_fields (entry, FALSE);
+	return rb_refstring_get (*rhythmdb_entry_mirrored_field (cold, propid));
+}
 
-		old = g_atomic_pointer_get (&entry->last_seen_str);
-		/* only store last seen time as a string for hidden entries */
-		if (entry->flags & RHYTHMDB_ENTRY_HIDDEN) {
-			val = rb_utf_friendly_time (entry->last_seen);
-			new = rb_refstring_new (val);
-			g_free (val);
-		} else {
-			new = NULL;
-		}
+/*
+ * Returns a reference to the mirrored string version of a time property.
+ * The string is only cached if the entry already has cold fields;
+ * otherwise it is formatted for the caller.
+ */
+static RBRefString *
+rhythmdb_entry_get_mirrored_refstring (RhythmDBEntry *entry,
+				       guint propid)
+{
+	RhythmDBEntryColdFields *cold;
 
-		if (g_atomic_pointer_compare_and_exchange (&entry->last_seen_str, old, new)) {
-			if (old != NULL) {
-				rb_refstring_unref (old);
-			}
-		} else {
-			rb_refstring_unref (new);
-		}
+	cold = rhythmdb_entry_get_cold_fields (entry, FALSE);
+	if (cold == NULL)
+		return rhythmdb_entry_format_mirrored (entry, propid);
 
-		break;
-	}
-	default:
-		break;
-	}
+	rhythmdb_entry_sync_mirrored (entry, propid, FALSE);
+	return rb_refstring_ref (*rhythmdb_entry_mirrored_field (cold, propid));
 }
 
 /**
@@ -4155,53 +5296,85 @@ rhythmdb_query_internal (RhythmDBQueryThreadData *data)
 				   data->results,
 				   &data->cancel);
 
-	rb_debug ("completed");
+	rb_debug (data->cancel ? "cancelled" : "completed");
 	rhythmdb_query_results_query_complete (data->results);
 
+	rhythmdb_query_free (data->query);
+	data->query = NULL;
+
+	/* the event takes ownership of the thread data, as the cancellable
+	 * handler has to be disconnected in the main thread.
+	 */
 	result = g_slice_new0 (RhythmDBEvent);
 	result->db = data->db;
 	result->type = RHYTHMDB_EVENT_QUERY_COMPLETE;
 	result->results = data->results;
+	result->query_data = data;
 	rhythmdb_push_event (data->db, result);
-
-	rhythmdb_query_free (data->query);
 }
 
 static gpointer
 query_thread_main (RhythmDBQueryThreadData *data)
 {
 	RhythmDBEvent *result;
+	RhythmDB *db = data->db;
 
 	rb_debug ("entering query thread");
 
 	rhythmdb_query_internal (data);
 
 	result = g_slice_new0 (RhythmDBEvent);
-	result->db = data->db;
+	result->db = db;
 	result->type = RHYTHMDB_EVENT_THREAD_EXITED;
-	rhythmdb_push_event (data->db, result);
-	g_free (data);
+	rhythmdb_push_event (db, result);
 	return NULL;
 }
 
+static void
+query_cancelled_cb (GCancellable *cancellable, RhythmDBQueryThreadData *data)
+{
+	rb_debug ("cancelling query");
+	data->cancel = TRUE;
+}
+
+static void
+rhythmdb_query_thread_data_free (RhythmDBQueryThreadData *data)
+{
+	if (data == NULL)
+		return;
+
+	if (data->cancellable != NULL) {
+		g_signal_handler_disconnect (data->cancellable, data->cancelled_id);
+		g_object_unref (data->cancellable);
+	}
+	rhythmdb_query_free (data->query);
+	g_free (data);
+}
+
 /**
- * rhythmdb_do_full_query_async_parsed:
+ * rhythmdb_do_full_query_async_cancellable:
  * @db: the #RhythmDB
  * @results: a #RhythmDBQueryResults instance to feed results to
  * @query: the query to run
+ * @cancellable: a #GCancellable, or NULL
  *
  * Asynchronously runs a parsed query across the database, feeding matching
  * entries to @results in chunks.  This can only be called from the
  * main thread.
  *
- * Since @results is always a @RhythmDBQueryModel,
- * use the RhythmDBQueryModel::complete signal to identify when the
- * query is complete.
+ * If @cancellable is cancelled while the query is running, the query
+ * thread stops searching the database as soon as it notices, and
+ * @results is told that the query is complete.  This is intended for
+ * queries that are superseded by newer ones, such as searches that are
+ * repeated as the user types.  To also discard results that have already
+ * been passed to a #RhythmDBQueryModel, set its "cancellable" property
+ * to the same #GCancellable.
  */
 void
-rhythmdb_do_full_query_async_parsed (RhythmDB *db,
-				     RhythmDBQueryResults *results,
-				     GPtrArray *query)
+rhythmdb_do_full_query_async_cancellable (RhythmDB *db,
+					  RhythmDBQueryResults *results,
+					  GPtrArray *query,
+					  GCancellable *cancellable)
 {
 	RhythmDBQueryThreadData *data;
 
@@ -4211,6 +5384,16 @@ rhythmdb_do_full_query_async_parsed (RhythmDB *db,
 	data->results = results;
 	data->cancel = FALSE;
 
+	if (cancellable != NULL) {
+		data->cancellable = g_object_ref (cancellable);
+		data->cancelled_id = g_signal_connect (cancellable,
+						       "cancelled",
+						       G_CALLBACK (query_cancelled_cb),
+						       data);
+		if (g_cancellable_is_cancelled (cancellable))
+			data->cancel = TRUE;
+	}
+
 	rhythmdb_read_enter (db);
 
 	rhythmdb_query_results_set_query (results, query);
@@ -4223,6 +5406,28 @@ rhythmdb_do_full_query_async_parsed (RhythmDB *db,
 	g_thread_pool_push (db->priv->query_thread_pool, data, NULL);
 }
 
+/**
+ * rhythmdb_do_full_query_async_parsed:
+ * @db: the #RhythmDB
+ * @results: a #RhythmDBQueryResults instance to feed results to
+ * @query: the query to run
+ *
+ * Asynchronously runs a parsed query across the database, feeding matching
+ * entries to @results in chunks.  This can only be called from the
+ * main thread.
+ *
+ * Since @results is always a @RhythmDBQueryModel,
+ * use the RhythmDBQueryModel::complete signal to identify when the
+ * query is complete.
+ */
+void
+rhythmdb_do_full_query_async_parsed (RhythmDB *db,
+				     RhythmDBQueryResults *results,
+				     GPtrArray *query)
+{
+	rhythmdb_do_full_query_async_cancellable (db, results, query, NULL);
+}
+
 /**
  * rhythmdb_do_full_query_async:
  * @db: the #RhythmDB
@@ -4277,7 +5482,6 @@ rhythmdb_do_full_query_internal (RhythmDB *db,
 	g_object_ref (results);
 
 	rhythmdb_query_internal (data);
-	g_free (data);
 }
 
 /**
@@ -4479,6 +5683,13 @@ void
 rhythmdb_emit_entry_deleted (RhythmDB *db,
 			     RhythmDBEntry *entry)
 {
+	GPtrArray *entries;
+
+	entries = g_ptr_array_sized_new (1);
+	g_ptr_array_add (entries, entry);
+	g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRIES_DELETED], 0, entries);
+	g_ptr_array_free (entries, TRUE);
+
 	g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRY_DELETED], 0, entry);
 }
 
@@ -4665,6 +5876,28 @@ rhythmdb_is_busy (RhythmDB *db)
 		(db->priv->outstanding_stats != NULL));
 }
 
+/**
+ * rhythmdb_get_stat_progress:
+ * @db: a #RhythmDB.
+ * @done: returns the number of files checked so far
+ * @total: returns the number of files to check
+ *
+ * Reports the progress of the check for changed files made
+ * when the database is loaded.
+ *
+ * Returns: %TRUE if the files are still being checked
+ */
+gboolean
+rhythmdb_get_stat_progress (RhythmDB *db, guint *done, guint *total)
+{
+	if (!db->priv->stat_thread_running)
+		return FALSE;
+
+	*done = g_atomic_int_get (&db->priv->stat_done);
+	*total = g_atomic_int_get (&db->priv->stat_total);
+	return (*total > 0);
+}
+
 /**
  * rhythmdb_compute_status_normal:
  * @n_songs: the number of tracks.
@@ -4834,7 +6067,8 @@ rhythmdb_entry_register_type (RhythmDB *db,
 
 	g_assert (name != NULL);
 
-	type = g_new0 (RhythmDBEntryType_, 1);
+	type = (RhythmDBEntryType) g_new0 (RhythmDBEntryTypePrivate, 1);
+	RHYTHMDB_ENTRY_TYPE_GET_POOL (type) = rhythmdb_entry_pool_new ();
 	type->can_sync_metadata = (RhythmDBEntryCanSyncFunc)rb_false_function;
 	type->sync_metadata = default_sync_metadata;
 	type->name = g_strdup (name);
@@ -5201,6 +6435,7 @@ rhythmdb_entry_get_string (RhythmDBEntry *entry,
 			   RhythmDBPropType propid)
 {
 	RhythmDBPodcastFields *podcast = NULL;
+	RhythmDBEntryColdFields *cold;
 
 	g_return_val_if_fail (entry != NULL, NULL);
 	g_return_val_if_fail (entry->refcount > 0, NULL);
@@ -5209,7 +6444,7 @@ rhythmdb_entry_get_string (RhythmDBEntry *entry,
 	    entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_POST)
 		podcast = RHYTHMDB_ENTRY_GET_TYPE_DATA (entry, RhythmDBPodcastFields);
 
-	rhythmdb_entry_sync_mirrored (entry, propid);
+	cold = rhythmdb_entry_get_cold_fields (entry, FALSE);
 
 	switch (propid) {
 	case RHYTHMDB_PROP_TITLE:
@@ -5221,13 +6456,13 @@ rhythmdb_entry_get_string (RhythmDBEntry *entry,
 	case RHYTHMDB_PROP_GENRE:
 		return rb_refstring_get (entry->genre);
 	case RHYTHMDB_PROP_MUSICBRAINZ_TRACKID:
-		return rb_refstring_get (entry->musicbrainz_trackid);
+		return (cold && cold->musicbrainz_trackid) ? rb_refstring_get (cold->musicbrainz_trackid) : "";
 	case RHYTHMDB_PROP_MUSICBRAINZ_ARTISTID:
-		return rb_refstring_get (entry->musicbrainz_artistid);
+		return (cold && cold->musicbrainz_artistid) ? rb_refstring_get (cold->musicbrainz_artistid) : "";
 	case RHYTHMDB_PROP_MUSICBRAINZ_ALBUMID:
-		return rb_refstring_get (entry->musicbrainz_albumid);
+		return (cold && cold->musicbrainz_albumid) ? rb_refstring_get (cold->musicbrainz_albumid) : "";
 	case RHYTHMDB_PROP_MUSICBRAINZ_ALBUMARTISTID:
-		return rb_refstring_get (entry->musicbrainz_albumartistid);
+		return (cold && cold->musicbrainz_albumartistid) ? rb_refstring_get (cold->musicbrainz_albumartistid) : "";
 	case RHYTHMDB_PROP_ARTIST_SORTNAME:
 		return rb_refstring_get (entry->artist_sortname);
 	case RHYTHMDB_PROP_ALBUM_SORTNAME:
@@ -5263,13 +6498,13 @@ rhythmdb_entry_get_string (RhythmDBEntry *entry,
 	case RHYTHMDB_PROP_MOUNTPOINT:
 		return rb_refstring_get (entry->mountpoint);
 	case RHYTHMDB_PROP_LAST_PLAYED_STR:
-		return rb_refstring_get (entry->last_played_str);
+		return rhythmdb_entry_get_mirrored_string (entry, propid);
 	case RHYTHMDB_PROP_PLAYBACK_ERROR:
-		return rb_refstring_get (entry->playback_error);
+		return cold ? rb_refstring_get (cold->playback_error) : NULL;
 	case RHYTHMDB_PROP_FIRST_SEEN_STR:
-		return rb_refstring_get (entry->first_seen_str);
+		return rhythmdb_entry_get_mirrored_string (entry, propid);
 	case RHYTHMDB_PROP_LAST_SEEN_STR:
-		return rb_refstring_get (entry->last_seen_str);
+		return rhythmdb_entry_get_mirrored_string (entry, propid);
 
 	/* synthetic properties */
 	case RHYTHMDB_PROP_SEARCH_MATCH:
@@ -5328,10 +6563,12 @@ RBRefString *
 rhythmdb_entry_get_refstring (RhythmDBEntry *entry,
 			      RhythmDBPropType propid)
 {
+	RhythmDBEntryColdFields *cold;
+
 	g_return_val_if_fail (entry != NULL, NULL);
 	g_return_val_if_fail (entry->refcount > 0, NULL);
 
-	rhythmdb_entry_sync_mirrored (entry, propid);
+	cold = rhythmdb_entry_get_cold_fields (entry, FALSE);
 
 	switch (propid) {
 	case RHYTHMDB_PROP_TITLE:
@@ -5343,13 +6580,13 @@ rhythmdb_entry_get_refstring (RhythmDBEntry *entry,
 	case RHYTHMDB_PROP_GENRE:
 		return rb_refstring_ref (entry->genre);
 	case RHYTHMDB_PROP_MUSICBRAINZ_TRACKID:
-		return rb_refstring_ref (entry->musicbrainz_trackid);
+		return (cold && cold->musicbrainz_trackid) ? rb_refstring_ref (cold->musicbrainz_trackid) : rb_refstring_new ("");
 	case RHYTHMDB_PROP_MUSICBRAINZ_ARTISTID:
-		return rb_refstring_ref (entry->musicbrainz_artistid);
+		return (cold && cold->musicbrainz_artistid) ? rb_refstring_ref (cold->musicbrainz_artistid) : rb_refstring_new ("");
 	case RHYTHMDB_PROP_MUSICBRAINZ_ALBUMID:
-		return rb_refstring_ref (entry->musicbrainz_albumid);
+		return (cold && cold->musicbrainz_albumid) ? rb_refstring_ref (cold->musicbrainz_albumid) : rb_refstring_new ("");
 	case RHYTHMDB_PROP_MUSICBRAINZ_ALBUMARTISTID:
-		return rb_refstring_ref (entry->musicbrainz_albumartistid);
+		return (cold && cold->musicbrainz_albumartistid) ? rb_refstring_ref (cold->musicbrainz_albumartistid) : rb_refstring_new ("");
 	case RHYTHMDB_PROP_ARTIST_SORTNAME:
 		return rb_refstring_ref (entry->artist_sortname);
 	case RHYTHMDB_PROP_ALBUM_SORTNAME:
@@ -5359,15 +6596,15 @@ rhythmdb_entry_get_refstring (RhythmDBEntry *entry,
 	case RHYTHMDB_PROP_MOUNTPOINT:
 		return rb_refstring_ref (entry->mountpoint);
 	case RHYTHMDB_PROP_LAST_PLAYED_STR:
-		return rb_refstring_ref (entry->last_played_str);
+		return rhythmdb_entry_get_mirrored_refstring (entry, propid);
 	case RHYTHMDB_PROP_FIRST_SEEN_STR:
-		return rb_refstring_ref (entry->first_seen_str);
+		return rhythmdb_entry_get_mirrored_refstring (entry, propid);
 	case RHYTHMDB_PROP_LAST_SEEN_STR:
-		return rb_refstring_ref (entry->last_seen_str);
+		return rhythmdb_entry_get_mirrored_refstring (entry, propid);
 	case RHYTHMDB_PROP_LOCATION:
 		return rb_refstring_ref (entry->location);
 	case RHYTHMDB_PROP_PLAYBACK_ERROR:
-		return rb_refstring_ref (entry->playback_error);
+		return cold ? rb_refstring_ref (cold->playback_error) : NULL;
 	default:
 		g_assert_not_reached ();
 		return NULL;
@@ -5593,6 +6830,18 @@ rhythmdb_entry_get_playback_uri (RhythmDBEntry *entry)
 		return rhythmdb_entry_dup_string (entry, RHYTHMDB_PROP_LOCATION);
 }
 
+/* keywords are changed without a commit, so they're journalled directly */
+static void
+rhythmdb_journal_keywords_changed (RhythmDB *db,
+				   RhythmDBEntry *entry)
+{
+	if ((entry->flags & RHYTHMDB_ENTRY_INSERTED) == 0)
+		return;
+
+	g_mutex_lock (db->priv->change_mutex);
+	journal_entry (db, entry, RHYTHMDB_JOURNAL_ENTRY_CHANGED);
+	g_mutex_unlock (db->priv->change_mutex);
+}
 
 /**
  * rhythmdb_entry_keyword_add:
@@ -5614,6 +6863,7 @@ rhythmdb_entry_keyword_add	(RhythmDB *db,
 
 	ret = klass->impl_entry_keyword_add (db, entry, keyword);
 	if (!ret) {
+		rhythmdb_journal_keywords_changed (db, entry);
 		g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRY_KEYWORD_ADDED], 0, entry, keyword);
 	}
 	return ret;
@@ -5639,6 +6889,7 @@ rhythmdb_entry_keyword_remove	(RhythmDB *db,
 
 	ret = klass->impl_entry_keyword_remove (db, entry, keyword);
 	if (ret) {
+		rhythmdb_journal_keywords_changed (db, entry);
 		g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRY_KEYWORD_REMOVED], 0, entry, keyword);
 	}
 	return ret;
@@ -108,6 +108,7 @@ GType rhythmdb_entry_type_get_type (void);
 #define RHYTHMDB_IS_ENTRY_TYPE(o)	(G_TYPE_CHECK_INSTANCE_TYPE ((o), RHYTHMDB_TYPE_ENTRY_TYPE))
 
 typedef GPtrArray RhythmDBQuery;
+typedef struct _RhythmDBCompiledQuery RhythmDBCompiledQuery;
 GType rhythmdb_query_get_type (void);
 #define RHYTHMDB_TYPE_QUERY	(rhythmdb_query_get_type ())
 #define RHYTHMDB_QUERY(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), RHYTHMDB_TYPE_QUERY, RhythmDBQuery))
@@ -294,6 +295,9 @@ struct _RhythmDBClass
 	void	(*entry_added)		(RhythmDB *db, RhythmDBEntry *entry);
 	void	(*entry_changed)	(RhythmDB *db, RhythmDBEntry *entry, GSList *changes); /* list of RhythmDBEntryChanges */
 	void	(*entry_deleted)	(RhythmDB *db, RhythmDBEntry *entry);
+	void	(*entries_added)	(RhythmDB *db, GPtrArray *entries);
+	void	(*entries_changed)	(RhythmDB *db, GPtrArray *entries, GPtrArray *changes); /* GValueArrays of RhythmDBEntryChanges */
+	void	(*entries_deleted)	(RhythmDB *db, GPtrArray *entries);
 	void	(*entry_keyword_added)	(RhythmDB *db, RhythmDBEntry *entry, RBRefString *keyword);
 	void	(*entry_keyword_removed)(RhythmDB *db, RhythmDBEntry *entry, RBRefString *keyword);
 	GValue *(*entry_extra_metadata_request) (RhythmDB *db, RhythmDBEntry *entry);
@@ -407,6 +411,8 @@ RhythmDBEntry *	rhythmdb_entry_lookup_by_id     (RhythmDB *db, gint id);
 
 RhythmDBEntry * rhythmdb_entry_lookup_from_string (RhythmDB *db, const char *str, gboolean is_id);
 
+guint64		rhythmdb_get_generation (RhythmDB *db);
+
 gboolean	rhythmdb_evaluate_query		(RhythmDB *db, RhythmDBQuery *query,
 						 RhythmDBEntry *entry);
 
@@ -465,6 +471,10 @@ void		rhythmdb_do_full_query_async		(RhythmDB *db,
 void		rhythmdb_do_full_query_async_parsed	(RhythmDB *db,
 							 RhythmDBQueryResults *results,
 							 RhythmDBQuery *query);
+void		rhythmdb_do_full_query_async_cancellable (RhythmDB *db,
+							 RhythmDBQueryResults *results,
+							 RhythmDBQuery *query,
+							 GCancellable *cancellable);
 
 RhythmDBQuery *	rhythmdb_query_parse			(RhythmDB *db, ...);
 void		rhythmdb_query_append			(RhythmDB *db, RhythmDBQuery *query, ...);
@@ -484,6 +494,11 @@ char *		rhythmdb_query_to_string		(RhythmDB *db, RhythmDBQuery *query);
 
 gboolean	rhythmdb_query_is_time_relative		(RhythmDB *db, RhythmDBQuery *query);
 
+RhythmDBCompiledQuery *	rhythmdb_query_compile		(RhythmDB *db, RhythmDBQuery *query);
+gboolean	rhythmdb_compiled_query_evaluate	(RhythmDBCompiledQuery *query, RhythmDBEntry *entry);
+gulong		rhythmdb_compiled_query_get_next_change (RhythmDBCompiledQuery *query, RhythmDBEntry *entry);
+void		rhythmdb_compiled_query_free		(RhythmDBCompiledQuery *query);
+
 const xmlChar *	rhythmdb_nice_elt_name_from_propid	(RhythmDB *db, RhythmDBPropType propid);
 int		rhythmdb_propid_from_nice_elt_name	(RhythmDB *db, const xmlChar *name);
 
@@ -495,6 +510,9 @@ RBStringValueMap* rhythmdb_entry_gather_metadata	(RhythmDB *db, RhythmDBEntry *e
 void		rhythmdb_emit_entry_extra_metadata_notify (RhythmDB *db, RhythmDBEntry *entry, const gchar *property_name, const GValue *metadata);
 
 gboolean	rhythmdb_is_busy			(RhythmDB *db);
+gboolean	rhythmdb_get_stat_progress		(RhythmDB *db,
+							 guint *done,
+							 guint *total);
 char *		rhythmdb_compute_status_normal		(gint n_songs, glong duration,
 							 guint64 size,
 							 const char *singular,
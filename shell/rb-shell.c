@@ -3010,6 +3010,25 @@ rb_shell_do_notify (RBShell *shell, gboolean requested, GError **error)
 	return TRUE;
 }
 
+/**
+ * rb_shell_set_query_profiling:
+ * @shell: the #RBShell
+ * @enabled: if %TRUE, print query plans and timings
+ * @error: not used
+ *
+ * Turns query profiling on or off.  See the #RhythmDB:profile-queries
+ * property for details.
+ *
+ * Return value: not important
+ */
+gboolean
+rb_shell_set_query_profiling (RBShell *shell, gboolean enabled, GError **error)
+{
+	rb_debug ("%s query profiling", enabled ? "enabling" : "disabling");
+	g_object_set (shell->priv->db, "profile-queries", enabled, NULL);
+	return TRUE;
+}
+
 /**
  * rb_shell_error_quark:
  *
@@ -151,6 +151,9 @@ void            rb_shell_notify_custom  (RBShell *shell,
 gboolean	rb_shell_do_notify (RBShell *shell,
 				    gboolean requested,
 				    GError **error);
+gboolean	rb_shell_set_query_profiling (RBShell *shell,
+					      gboolean enabled,
+					      GError **error);
 
 void            rb_shell_register_entry_type_for_source (RBShell *shell,
 							 RBSource *source,
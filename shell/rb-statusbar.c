@@ -444,6 +444,17 @@ rb_statusbar_sync_status (RBStatusbar *status)
 			status_text ? status_text : "", progress_text ? progress_text : "", progress);
 	}
 
+	/* checking for changed files at startup? */
+	if (progress < (0.0f - EPSILON) && progress_text == NULL) {
+		guint done;
+		guint total;
+
+		if (rhythmdb_get_stat_progress (status->priv->db, &done, &total)) {
+			progress_text = g_strdup_printf (_("Checking files (%u of %u)"), done, total);
+			progress = (float) done / total;
+		}
+	}
+
         /* internal progress bar moving? */
         if (status->priv->progress_fraction < (1.0 - EPSILON) || status->priv->progress_changed) {
 		g_free (progress_text);
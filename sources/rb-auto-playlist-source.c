@@ -86,6 +86,13 @@ static GList *impl_get_search_actions (RBSource *source);
 static void impl_save_contents_to_xml (RBPlaylistSource *source,
 				       xmlNodePtr node);
 
+static void rb_auto_playlist_source_set_query_internal (RBAutoPlaylistSource *source,
+							GPtrArray *query,
+							RhythmDBQueryModelLimitType limit_type,
+							GValueArray *limit_value,
+							const char *sort_key,
+							gint sort_order,
+							xmlNodePtr results);
 static void rb_auto_playlist_source_songs_sort_order_changed_cb (RBEntryView *view,
 								 RBAutoPlaylistSource *source);
 static void rb_auto_playlist_source_do_query (RBAutoPlaylistSource *source,
@@ -120,6 +127,7 @@ typedef struct _RBAutoPlaylistSourcePrivate RBAutoPlaylistSourcePrivate;
 struct _RBAutoPlaylistSourcePrivate
 {
 	RhythmDBQueryModel *cached_all_query;
+	gboolean cached_all_complete;
 	GPtrArray *query;
 	gboolean query_resetting;
 	RhythmDBQueryModelLimitType limit_type;
@@ -381,6 +389,7 @@ rb_auto_playlist_source_new_from_xml (RBShell *shell, xmlNodePtr node)
 	GValueArray *limit_value = NULL;
 	gchar *sort_key = NULL;
 	gint sort_direction = 0;
+	xmlNodePtr results = NULL;
 	GValue val = {0,};
 
 	child = node->children;
@@ -390,6 +399,14 @@ rb_auto_playlist_source_new_from_xml (RBShell *shell, xmlNodePtr node)
 	query = rhythmdb_query_deserialize (rb_playlist_source_get_db (RB_PLAYLIST_SOURCE (source)),
 					    child);
 
+	for (child = child->next; child != NULL; child = child->next) {
+		if (xmlNodeIsText (child) == FALSE &&
+		    xmlStrcmp (child->name, RB_PLAYLIST_RESULTS) == 0) {
+			results = child;
+			break;
+		}
+	}
+
 	limit_value = g_value_array_new (0);
 	tmp = xmlGetProp (node, RB_PLAYLIST_LIMIT_COUNT);
 	if (!tmp) /* Backwards compatibility */
@@ -452,11 +469,12 @@ rb_auto_playlist_source_new_from_xml (RBShell *shell, xmlNodePtr node)
 		sort_direction = 0;
 	}
 
-	rb_auto_playlist_source_set_query (source, query,
-					   limit_type,
-					   limit_value,
-					   sort_key,
-					   sort_direction);
+	rb_auto_playlist_source_set_query_internal (source, query,
+						    limit_type,
+						    limit_value,
+						    sort_key,
+						    sort_direction,
+						    results);
 	g_free (sort_key);
 	g_value_array_free (limit_value);
 	rhythmdb_query_free (query);
@@ -662,6 +680,131 @@ _save_write_uint64 (xmlNodePtr node, GValueArray *limit_value, const xmlChar *ke
 	g_free (str);
 }
 
+static gboolean
+rb_auto_playlist_source_results_reusable (RBAutoPlaylistSource *source)
+{
+	RBAutoPlaylistSourcePrivate *priv = GET_PRIVATE (source);
+	RhythmDB *db = rb_playlist_source_get_db (RB_PLAYLIST_SOURCE (source));
+
+	/* limited playlists depend on the order entries were found in, and
+	 * time-relative queries change without the database changing.
+	 */
+	return (priv->limit_type == RHYTHMDB_QUERY_MODEL_LIMIT_NONE &&
+		rhythmdb_query_is_time_relative (db, priv->query) == FALSE);
+}
+
+/*
+ * Saves the entries currently matching the query, along with the database
+ * generation they match, so the query doesn't need to be run again on
+ * startup if the database hasn't changed since.
+ */
+static void
+rb_auto_playlist_source_save_results (RBAutoPlaylistSource *source,
+				      xmlNodePtr node)
+{
+	RBAutoPlaylistSourcePrivate *priv = GET_PRIVATE (source);
+	RhythmDB *db = rb_playlist_source_get_db (RB_PLAYLIST_SOURCE (source));
+	GtkTreeModel *model;
+	xmlNodePtr results;
+	GtkTreeIter iter;
+	char *str;
+
+	if (priv->cached_all_query == NULL ||
+	    priv->cached_all_complete == FALSE ||
+	    rhythmdb_query_model_has_pending_changes (priv->cached_all_query) ||
+	    rb_auto_playlist_source_results_reusable (source) == FALSE)
+		return;
+	model = GTK_TREE_MODEL (priv->cached_all_query);
+
+	results = xmlNewChild (node, NULL, RB_PLAYLIST_RESULTS, NULL);
+	str = g_strdup_printf ("%" G_GUINT64_FORMAT, rhythmdb_get_generation (db));
+	xmlSetProp (results, RB_PLAYLIST_GENERATION, BAD_CAST str);
+	g_free (str);
+
+	if (!gtk_tree_model_get_iter_first (model, &iter))
+		return;
+
+	do {
+		xmlNodePtr child_node = xmlNewChild (results, NULL, RB_PLAYLIST_LOCATION, NULL);
+		RhythmDBEntry *entry;
+		xmlChar *encoded;
+		const char *location;
+
+		entry = rhythmdb_query_model_iter_to_entry (priv->cached_all_query, &iter);
+
+		location = rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION);
+		encoded = xmlEncodeEntitiesReentrant (NULL, BAD_CAST location);
+
+		xmlNodeSetContent (child_node, encoded);
+
+		g_free (encoded);
+		rhythmdb_entry_unref (entry);
+	} while (gtk_tree_model_iter_next (model, &iter));
+}
+
+/*
+ * Fills in the query model from saved results, if they match the current
+ * database generation and all the entries can still be found.  The query
+ * model then keeps itself up to date as entries change, just as it would
+ * after running the query.
+ */
+static gboolean
+rb_auto_playlist_source_load_results (RBAutoPlaylistSource *source,
+				      xmlNodePtr node)
+{
+	RBAutoPlaylistSourcePrivate *priv = GET_PRIVATE (source);
+	RhythmDB *db = rb_playlist_source_get_db (RB_PLAYLIST_SOURCE (source));
+	RhythmDBQueryResults *results;
+	GPtrArray *entries;
+	xmlNodePtr child;
+	xmlChar *tmp;
+	guint64 generation;
+
+	if (rb_auto_playlist_source_results_reusable (source) == FALSE)
+		return FALSE;
+
+	tmp = xmlGetProp (node, RB_PLAYLIST_GENERATION);
+	if (tmp == NULL)
+		return FALSE;
+	generation = g_ascii_strtoull ((char *) tmp, NULL, 10);
+	xmlFree (tmp);
+
+	if (generation != rhythmdb_get_generation (db)) {
+		rb_debug ("saved playlist results are out of date");
+		return FALSE;
+	}
+
+	entries = g_ptr_array_new ();
+	for (child = node->children; child; child = child->next) {
+		RhythmDBEntry *entry;
+		xmlChar *location;
+
+		if (xmlNodeIsText (child))
+			continue;
+
+		if (xmlStrcmp (child->name, RB_PLAYLIST_LOCATION))
+			continue;
+
+		location = xmlNodeGetContent (child);
+		entry = rhythmdb_entry_lookup_by_location (db, (char *) location);
+		xmlFree (location);
+
+		if (entry == NULL || rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN)) {
+			rb_debug ("saved playlist results don't match the database");
+			g_ptr_array_free (entries, TRUE);
+			return FALSE;
+		}
+		g_ptr_array_add (entries, entry);
+	}
+
+	rb_debug ("reusing %u saved playlist results", entries->len);
+	results = RHYTHMDB_QUERY_RESULTS (priv->cached_all_query);
+	rhythmdb_query_results_set_query (results, priv->query);
+	rhythmdb_query_results_add_results (results, entries);
+	rhythmdb_query_results_query_complete (results);
+	return TRUE;
+}
+
 static void
 impl_save_contents_to_xml (RBPlaylistSource *psource,
 			   xmlNodePtr node)
@@ -716,6 +859,8 @@ impl_save_contents_to_xml (RBPlaylistSource *psource,
 	rhythmdb_query_serialize (rb_playlist_source_get_db (psource), query, node);
 	rhythmdb_query_free (query);
 
+	rb_auto_playlist_source_save_results (source, node);
+
 	if (limit_value != NULL) {
 		g_value_array_free (limit_value);
 	}
@@ -814,6 +959,31 @@ rb_auto_playlist_source_set_query (RBAutoPlaylistSource *source,
 				   GValueArray *limit_value,
 				   const char *sort_key,
 				   gint sort_order)
+{
+	rb_auto_playlist_source_set_query_internal (source, query,
+						    limit_type, limit_value,
+						    sort_key, sort_order,
+						    NULL);
+}
+
+static void
+rb_auto_playlist_source_all_query_complete_cb (RhythmDBQueryModel *model,
+					       RBAutoPlaylistSource *source)
+{
+	RBAutoPlaylistSourcePrivate *priv = GET_PRIVATE (source);
+
+	if (model == priv->cached_all_query)
+		priv->cached_all_complete = TRUE;
+}
+
+static void
+rb_auto_playlist_source_set_query_internal (RBAutoPlaylistSource *source,
+					    GPtrArray *query,
+					    RhythmDBQueryModelLimitType limit_type,
+					    GValueArray *limit_value,
+					    const char *sort_key,
+					    gint sort_order,
+					    xmlNodePtr results)
 {
 	RBAutoPlaylistSourcePrivate *priv = GET_PRIVATE (source);
 	RhythmDB *db = rb_playlist_source_get_db (RB_PLAYLIST_SOURCE (source));
@@ -845,10 +1015,16 @@ rb_auto_playlist_source_set_query (RBAutoPlaylistSource *source,
 					       "limit-type", priv->limit_type,
 					       "limit-value", priv->limit_value,
 					       NULL);
+	priv->cached_all_complete = FALSE;
+	g_signal_connect_object (priv->cached_all_query,
+				 "complete", G_CALLBACK (rb_auto_playlist_source_all_query_complete_cb),
+				 source, 0);
 	rb_library_browser_set_model (priv->browser, priv->cached_all_query, TRUE);
-	rhythmdb_do_full_query_async_parsed (db,
-					     RHYTHMDB_QUERY_RESULTS (priv->cached_all_query),
-					     priv->query);
+	if (results == NULL || rb_auto_playlist_source_load_results (source, results) == FALSE) {
+		rhythmdb_do_full_query_async_parsed (db,
+						     RHYTHMDB_QUERY_RESULTS (priv->cached_all_query),
+						     priv->query);
+	}
 
 	priv->query_resetting = FALSE;
 }
@@ -69,6 +69,8 @@ static void rb_browser_source_init (RBBrowserSource *source);
 static void rb_browser_source_constructed (GObject *object);
 static void rb_browser_source_dispose (GObject *object);
 static void rb_browser_source_finalize (GObject *object);
+static void rb_browser_source_cancel_query (RBBrowserSource *source);
+static void rb_browser_source_clear_search_cache (RBBrowserSource *source);
 static void rb_browser_source_set_property (GObject *object,
 			                  guint prop_id,
 			                  const GValue *value,
@@ -118,6 +120,16 @@ static void rb_browser_source_do_query (RBBrowserSource *source,
 					gboolean subset);
 static void rb_browser_source_populate (RBBrowserSource *source);
 
+/* number of recent search results kept for each source */
+#define SEARCH_CACHE_SIZE	8
+
+typedef struct
+{
+	RBSourceSearch *search;
+	char *text;
+	RhythmDBQueryModel *model;
+} RBBrowserSourceCachedSearch;
+
 struct RBBrowserSourcePrivate
 {
 	RhythmDB *db;
@@ -133,6 +145,12 @@ struct RBBrowserSourcePrivate
 	gboolean populate;
 	gboolean query_active;
 	gboolean search_on_completion;
+	GCancellable *query_cancellable;
+
+	RBSourceSearch *search;
+	char *search_text;
+	GQueue *search_cache;
+	RBBrowserSourceCachedSearch *pending_search;
 	RBSourceSearch *default_search;
 
 	GtkActionGroup *action_group;
@@ -250,6 +268,8 @@ static void
 rb_browser_source_init (RBBrowserSource *source)
 {
 	source->priv = RB_BROWSER_SOURCE_GET_PRIVATE (source);
+
+	source->priv->search_cache = g_queue_new ();
 }
 
 static void
@@ -265,6 +285,14 @@ rb_browser_source_dispose (GObject *object)
 	/* Make sure dispose does not run twice. */
 	source->priv->dispose_has_run = TRUE;
 
+	rb_browser_source_cancel_query (source);
+	rb_browser_source_clear_search_cache (source);
+
+	if (source->priv->search != NULL) {
+		g_object_unref (source->priv->search);
+		source->priv->search = NULL;
+	}
+
 	if (source->priv->db != NULL) {
 		g_object_unref (source->priv->db);
 		source->priv->db = NULL;
@@ -310,6 +338,8 @@ rb_browser_source_finalize (GObject *object)
 	g_return_if_fail (source->priv != NULL);
 
 	g_free (source->priv->sorting_key);
+	g_free (source->priv->search_text);
+	g_queue_free (source->priv->search_cache);
 
 	G_OBJECT_CLASS (rb_browser_source_parent_class)->finalize (object);
 }
@@ -641,6 +671,14 @@ impl_search (RBSource *asource, RBSourceSearch *search, const char *cur_text, co
 	}
 	source->priv->search_query = rb_source_search_create_query (search, source->priv->db, new_text);
 
+	if (source->priv->search != search) {
+		if (source->priv->search != NULL)
+			g_object_unref (source->priv->search);
+		source->priv->search = g_object_ref (search);
+	}
+	g_free (source->priv->search_text);
+	source->priv->search_text = g_strdup (new_text);
+
 	/* for subset searches, we have to wait until the query
 	 * has finished before we can refine the results.
 	 */
@@ -863,6 +901,116 @@ rb_browser_source_browser_changed_cb (RBLibraryBrowser *browser,
 	rb_source_notify_filter_changed (RB_SOURCE (source));
 }
 
+static void
+cached_search_free (RBBrowserSourceCachedSearch *cached)
+{
+	g_object_unref (cached->search);
+	g_free (cached->text);
+	rhythmdb_query_model_thaw (cached->model);
+	g_object_unref (cached->model);
+	g_free (cached);
+}
+
+static RBBrowserSourceCachedSearch *
+cached_search_new (RBBrowserSource *source, RhythmDBQueryModel *model)
+{
+	RBBrowserSourceCachedSearch *cached;
+
+	cached = g_new0 (RBBrowserSourceCachedSearch, 1);
+	cached->search = g_object_ref (source->priv->search);
+	cached->text = g_strdup (source->priv->search_text);
+	cached->model = g_object_ref (model);
+	return cached;
+}
+
+static void
+rb_browser_source_clear_search_cache (RBBrowserSource *source)
+{
+	RBBrowserSourceCachedSearch *cached;
+
+	if (source->priv->pending_search != NULL) {
+		cached_search_free (source->priv->pending_search);
+		source->priv->pending_search = NULL;
+	}
+
+	while ((cached = g_queue_pop_head (source->priv->search_cache)) != NULL) {
+		cached_search_free (cached);
+	}
+}
+
+/* adds the results of a completed search to the head of the cache,
+ * dropping the least recently used searches once it's full.
+ */
+static void
+rb_browser_source_cache_search (RBBrowserSource *source, RBBrowserSourceCachedSearch *cached)
+{
+	g_queue_push_head (source->priv->search_cache, cached);
+
+	while (g_queue_get_length (source->priv->search_cache) > SEARCH_CACHE_SIZE) {
+		cached_search_free (g_queue_pop_tail (source->priv->search_cache));
+	}
+}
+
+/* freezes the cached query models other than @active, so searches that
+ * aren't being shown don't process every database change.
+ */
+static void
+rb_browser_source_freeze_inactive_searches (RBBrowserSource *source, RhythmDBQueryModel *active)
+{
+	GList *l;
+
+	for (l = source->priv->search_cache->head; l != NULL; l = l->next) {
+		RBBrowserSourceCachedSearch *cached = l->data;
+
+		if (cached->model != active)
+			rhythmdb_query_model_freeze (cached->model);
+	}
+}
+
+/* finds the cached results for the current search, or if @exact is FALSE,
+ * the most recently used search whose results contain those of the
+ * current search.  the model is thawed; cached searches whose models
+ * missed database changes while they were frozen are dropped.
+ */
+static RhythmDBQueryModel *
+rb_browser_source_lookup_search (RBBrowserSource *source, gboolean exact)
+{
+	GList *l;
+	GList *next;
+
+	for (l = source->priv->search_cache->head; l != NULL; l = next) {
+		RBBrowserSourceCachedSearch *cached = l->data;
+
+		next = l->next;
+
+		if (cached->search != source->priv->search)
+			continue;
+
+		if (exact) {
+			if (strcmp (cached->text, source->priv->search_text) != 0)
+				continue;
+		} else if (rb_source_search_is_subset (cached->search,
+						       cached->text,
+						       source->priv->search_text) == FALSE) {
+			continue;
+		}
+
+		if (rhythmdb_query_model_thaw (cached->model) == FALSE) {
+			rb_debug ("dropping out of date results for \"%s\"", cached->text);
+			g_queue_delete_link (source->priv->search_cache, l);
+			cached_search_free (cached);
+			continue;
+		}
+
+		/* move it to the head of the cache */
+		g_queue_unlink (source->priv->search_cache, l);
+		g_queue_push_head_link (source->priv->search_cache, l);
+		return cached->model;
+	}
+
+	return NULL;
+}
+
 static void
 rb_browser_source_query_complete_cb (RhythmDBQueryModel *query_model,
 				     RBBrowserSource *source)
@@ -870,6 +1018,14 @@ rb_browser_source_query_complete_cb (RhythmDBQueryModel *query_model,
 	rb_library_browser_set_model (source->priv->browser, query_model, FALSE);
 
 	source->priv->query_active = FALSE;
+	if (source->priv->query_cancellable != NULL) {
+		g_object_unref (source->priv->query_cancellable);
+		source->priv->query_cancellable = NULL;
+	}
+	if (source->priv->pending_search != NULL) {
+		rb_browser_source_cache_search (source, source->priv->pending_search);
+		source->priv->pending_search = NULL;
+	}
 	if (source->priv->search_on_completion) {
 		rb_debug ("performing deferred search");
 		source->priv->search_on_completion = FALSE;
@@ -878,18 +1034,53 @@ rb_browser_source_query_complete_cb (RhythmDBQueryModel *query_model,
 	}
 }
 
+static void
+rb_browser_source_cancel_query (RBBrowserSource *source)
+{
+	if (source->priv->query_cancellable == NULL)
+		return;
+
+	rb_debug ("cancelling superseded query");
+	g_cancellable_cancel (source->priv->query_cancellable);
+	g_object_unref (source->priv->query_cancellable);
+	source->priv->query_cancellable = NULL;
+
+	/* the cancelled query model won't emit 'complete' */
+	source->priv->query_active = FALSE;
+	source->priv->search_on_completion = FALSE;
+
+	/* and its results are incomplete, so don't cache them */
+	if (source->priv->pending_search != NULL) {
+		cached_search_free (source->priv->pending_search);
+		source->priv->pending_search = NULL;
+	}
+}
+
 static void
 rb_browser_source_do_query (RBBrowserSource *source, gboolean subset)
 {
 	RhythmDBQueryModel *query_model;
+	RhythmDBQueryModel *base = NULL;
 	GPtrArray *query;
 	RhythmDBEntryType entry_type;
 
+	/* any query still running is for an older search, so stop it */
+	rb_browser_source_cancel_query (source);
+
 	/* use the cached 'all' query to optimise the no-search case */
 	if (source->priv->search_query == NULL) {
 		rb_library_browser_set_model (source->priv->browser,
 					      source->priv->cached_all_query,
 					      FALSE);
+		rb_browser_source_freeze_inactive_searches (source, NULL);
+		return;
+	}
+
+	query_model = rb_browser_source_lookup_search (source, TRUE);
+	if (query_model != NULL) {
+		rb_debug ("using cached results for \"%s\"", source->priv->search_text);
+		rb_library_browser_set_model (source->priv->browser, query_model, FALSE);
+		rb_browser_source_freeze_inactive_searches (source, query_model);
 		return;
 	}
 
@@ -903,36 +1094,57 @@ rb_browser_source_do_query (RBBrowserSource *source, gboolean subset)
 				      RHYTHMDB_QUERY_END);
 	g_boxed_free (RHYTHMDB_TYPE_ENTRY_TYPE, entry_type);
 
-	if (subset) {
+	/* a search whose results are still cached (after backspacing, or
+	 * switching back to an earlier search) doesn't need a query at all.
+	 * otherwise, if an earlier search matched a superset of the new
+	 * search's results, we can refine those.
+	 */
+	base = rb_browser_source_lookup_search (source, FALSE);
+	if (base != NULL) {
+		g_object_ref (base);
+	} else if (subset) {
 		/* if we're appending text to an existing search string, the results will be a subset
 		 * of the existing results, so rather than doing a whole new query, we can copy the
 		 * results to a new query model with a more restrictive query.
 		 */
-		RhythmDBQueryModel *old;
-		g_object_get (source->priv->browser, "input-model", &old, NULL);
+		g_object_get (source->priv->browser, "input-model", &base, NULL);
+	}
 
+	if (base != NULL) {
 		query_model = rhythmdb_query_model_new_empty (source->priv->db);
 		g_object_set (query_model, "query", query, NULL);
-		rhythmdb_query_model_copy_contents (query_model, old);
-		g_object_unref (old);
+		rhythmdb_query_model_copy_contents (query_model, base);
+		g_object_unref (base);
 
 		rb_library_browser_set_model (source->priv->browser, query_model, FALSE);
+		rb_browser_source_cache_search (source, cached_search_new (source, query_model));
+		rb_browser_source_freeze_inactive_searches (source, query_model);
 		g_object_unref (query_model);
 
 	} else {
 		/* otherwise build a query based on the search text, and feed it to the browser
 		 * when the query finishes.
 		 */ 
+		source->priv->query_cancellable = g_cancellable_new ();
 		query_model = rhythmdb_query_model_new_empty (source->priv->db);
+		g_object_set (query_model, "cancellable", source->priv->query_cancellable, NULL);
 		source->priv->query_active = TRUE;
 		source->priv->search_on_completion = FALSE;
+		source->priv->pending_search = cached_search_new (source, query_model);
 		g_signal_connect_object (query_model,
 					 "complete", G_CALLBACK (rb_browser_source_query_complete_cb),
 					 source, 0);
-		rhythmdb_do_full_query_async_parsed (source->priv->db,
-						     RHYTHMDB_QUERY_RESULTS (query_model),
-						     query);
+		rhythmdb_do_full_query_async_cancellable (source->priv->db,
+							  RHYTHMDB_QUERY_RESULTS (query_model),
+							  query,
+							  source->priv->query_cancellable);
 		g_object_unref (query_model);
+
+		/* the browser keeps showing the current results until the query completes */
+		g_object_get (source->priv->browser, "input-model", &query_model, NULL);
+		rb_browser_source_freeze_inactive_searches (source, query_model);
+		if (query_model != NULL)
+			g_object_unref (query_model);
 	}
 
 	rhythmdb_query_free (query);
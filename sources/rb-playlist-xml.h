@@ -59,4 +59,8 @@
 #define RB_PLAYLIST_SORT_DIRECTION (xmlChar *) "sort-direction"
 #define RB_PLAYLIST_LIMIT (xmlChar *) "limit"
 
+/* saved results for auto playlists */
+#define RB_PLAYLIST_RESULTS (xmlChar *) "results"
+#define RB_PLAYLIST_GENERATION (xmlChar *) "generation"
+
 #endif	/* __RB_PLAYLIST_XML_H */
@@ -0,0 +1,398 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+/*
+ * Measures metadata loading speed.  A set of small tagged MP3 and FLAC
+ * files is generated in a temporary directory, then metadata is read
+ * from each of them in-process, once through the fast readers and once
+ * through the GStreamer pipeline, and the results are compared.
+ *
+ * usage: bench-metadata-load [files per format] [seconds per file]
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#include "rb-debug.h"
+
+#include "rb-metadata.h"
+#include "rb-metadata-fast.h"
+
+/* MPEG 1 layer III, 128kbps, 44.1kHz, stereo */
+#define MP3_FRAME_HEADER	"\xff\xfb\x90\x00"
+#define MP3_FRAME_SIZE		417
+#define MP3_FRAME_SAMPLES	1152
+
+#define FLAC_BLOCK_SIZE		4096
+#define FLAC_RATE		44100
+
+typedef struct {
+	char *uri;
+	char *title;
+	gulong duration;
+} BenchFile;
+
+static void
+append_uint32_be (GByteArray *data, guint32 v)
+{
+	guint8 b[4] = { v >> 24, v >> 16, v >> 8, v };
+	g_byte_array_append (data, b, 4);
+}
+
+static void
+append_uint32_le (GByteArray *data, guint32 v)
+{
+	guint8 b[4] = { v, v >> 8, v >> 16, v >> 24 };
+	g_byte_array_append (data, b, 4);
+}
+
+static void
+append_id3_frame (GByteArray *data, const char *id, const char *value)
+{
+	guint8 flags[3] = { 0, 0, 0 };	/* two flag bytes, then ISO-8859-1 encoding */
+
+	g_byte_array_append (data, (const guint8 *)id, 4);
+	append_uint32_be (data, strlen (value) + 1);
+	g_byte_array_append (data, flags, 3);
+	g_byte_array_append (data, (const guint8 *)value, strlen (value));
+}
+
+static GByteArray *
+create_mp3 (const char *title, const char *artist, const char *album, guint track, guint seconds)
+{
+	GByteArray *data;
+	GByteArray *frames;
+	guint8 header[10] = { 'I', 'D', '3', 3, 0, 0 };
+	guint8 *frame;
+	char *track_str;
+	guint n_frames;
+	guint i;
+
+	frames = g_byte_array_new ();
+	track_str = g_strdup_printf ("%u", track);
+	append_id3_frame (frames, "TIT2", title);
+	append_id3_frame (frames, "TPE1", artist);
+	append_id3_frame (frames, "TALB", album);
+	append_id3_frame (frames, "TRCK", track_str);
+	g_free (track_str);
+
+	/* tag size is syncsafe */
+	header[6] = (frames->len >> 21) & 0x7f;
+	header[7] = (frames->len >> 14) & 0x7f;
+	header[8] = (frames->len >> 7) & 0x7f;
+	header[9] = frames->len & 0x7f;
+
+	data = g_byte_array_new ();
+	g_byte_array_append (data, header, sizeof (header));
+	g_byte_array_append (data, frames->data, frames->len);
+	g_byte_array_free (frames, TRUE);
+
+	/* frames of silence: with all side info zeroed, there's no main data */
+	frame = g_malloc0 (MP3_FRAME_SIZE);
+	memcpy (frame, MP3_FRAME_HEADER, 4);
+	n_frames = (seconds * 44100) / MP3_FRAME_SAMPLES;
+	for (i = 0; i < n_frames; i++)
+		g_byte_array_append (data, frame, MP3_FRAME_SIZE);
+	g_free (frame);
+
+	return data;
+}
+
+static guint8
+flac_crc8 (const guint8 *data, gsize len)
+{
+	guint8 crc = 0;
+	gsize i;
+	int b;
+
+	for (i = 0; i < len; i++) {
+		crc ^= data[i];
+		for (b = 0; b < 8; b++)
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+	}
+	return crc;
+}
+
+static guint16
+flac_crc16 (const guint8 *data, gsize len)
+{
+	guint16 crc = 0;
+	gsize i;
+	int b;
+
+	for (i = 0; i < len; i++) {
+		crc ^= data[i] << 8;
+		for (b = 0; b < 8; b++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : (crc << 1);
+	}
+	return crc;
+}
+
+static void
+append_vorbis_comment (GByteArray *data, const char *key, const char *value)
+{
+	char *comment;
+
+	comment = g_strdup_printf ("%s=%s", key, value);
+	append_uint32_le (data, strlen (comment));
+	g_byte_array_append (data, (const guint8 *)comment, strlen (comment));
+	g_free (comment);
+}
+
+static GByteArray *
+create_flac (const char *title, const char *artist, const char *album, guint track, guint seconds)
+{
+	GByteArray *data;
+	GByteArray *comments;
+	guint8 streaminfo[4 + 34];
+	guint64 packed;
+	guint n_frames;
+	char *track_str;
+	guint i;
+
+	/* whole blocks only, and few enough that frame numbers fit in one byte */
+	n_frames = MIN ((seconds * FLAC_RATE) / FLAC_BLOCK_SIZE, 127);
+
+	data = g_byte_array_new ();
+	g_byte_array_append (data, (const guint8 *)"fLaC", 4);
+
+	memset (streaminfo, 0, sizeof (streaminfo));
+	streaminfo[0] = 0;		/* STREAMINFO, not last */
+	streaminfo[3] = 34;
+	streaminfo[4] = FLAC_BLOCK_SIZE >> 8;
+	streaminfo[5] = FLAC_BLOCK_SIZE & 0xff;
+	streaminfo[6] = FLAC_BLOCK_SIZE >> 8;
+	streaminfo[7] = FLAC_BLOCK_SIZE & 0xff;
+	/* sample rate, channels - 1, bits per sample - 1, total samples */
+	packed = ((guint64)FLAC_RATE << 44) | ((guint64)0 << 41) | ((guint64)15 << 36) | ((guint64)n_frames * FLAC_BLOCK_SIZE);
+	for (i = 0; i < 8; i++)
+		streaminfo[4 + 10 + i] = packed >> (56 - i * 8);
+	g_byte_array_append (data, streaminfo, sizeof (streaminfo));
+
+	comments = g_byte_array_new ();
+	append_uint32_le (comments, strlen ("bench"));
+	g_byte_array_append (comments, (const guint8 *)"bench", strlen ("bench"));
+	append_uint32_le (comments, 4);
+	track_str = g_strdup_printf ("%u", track);
+	append_vorbis_comment (comments, "TITLE", title);
+	append_vorbis_comment (comments, "ARTIST", artist);
+	append_vorbis_comment (comments, "ALBUM", album);
+	append_vorbis_comment (comments, "TRACKNUMBER", track_str);
+	g_free (track_str);
+
+	append_uint32_be (data, 0x84000000 | comments->len);	/* VORBIS_COMMENT, last */
+	g_byte_array_append (data, comments->data, comments->len);
+	g_byte_array_free (comments, TRUE);
+
+	/* mono 16 bit frames, each one a single constant subframe of silence */
+	for (i = 0; i < n_frames; i++) {
+		guint8 frame[10];
+		guint16 crc;
+
+		frame[0] = 0xff;
+		frame[1] = 0xf8;	/* fixed block size */
+		frame[2] = 0xc9;	/* 4096 samples, 44.1kHz */
+		frame[3] = 0x08;	/* mono, 16 bits */
+		frame[4] = i;		/* frame number */
+		frame[5] = flac_crc8 (frame, 5);
+		frame[6] = 0x00;	/* CONSTANT subframe */
+		frame[7] = 0x00;
+		frame[8] = 0x00;
+		crc = flac_crc16 (frame, 9);
+		g_byte_array_append (data, frame, 9);
+		frame[0] = crc >> 8;
+		frame[1] = crc & 0xff;
+		g_byte_array_append (data, frame, 2);
+	}
+
+	return data;
+}
+
+static BenchFile *
+write_file (const char *dir, const char *ext, GByteArray *data, const char *title)
+{
+	BenchFile *file;
+	GError *error = NULL;
+	char *filename;
+	char *basename;
+
+	basename = g_strdup_printf ("%s.%s", title, ext);
+	filename = g_build_filename (dir, basename, NULL);
+	g_free (basename);
+
+	if (!g_file_set_contents (filename, (const char *)data->data, data->len, &error)) {
+		g_printerr ("couldn't write %s: %s\n", filename, error->message);
+		exit (1);
+	}
+
+	file = g_new0 (BenchFile, 1);
+	file->uri = g_filename_to_uri (filename, NULL, NULL);
+	file->title = g_strdup (title);
+	g_free (filename);
+	g_byte_array_free (data, TRUE);
+	return file;
+}
+
+static GPtrArray *
+create_files (const char *dir, guint count, guint seconds)
+{
+	GPtrArray *files;
+	guint i;
+
+	files = g_ptr_array_new ();
+	for (i = 0; i < count; i++) {
+		char *title;
+		char *artist;
+		char *album;
+
+		artist = g_strdup_printf ("Artist %u", i % 50);
+		album = g_strdup_printf ("Album %u", i % 200);
+
+		title = g_strdup_printf ("mp3 track %u", i);
+		g_ptr_array_add (files, write_file (dir, "mp3", create_mp3 (title, artist, album, i % 20 + 1, seconds), title));
+		g_free (title);
+
+		title = g_strdup_printf ("flac track %u", i);
+		g_ptr_array_add (files, write_file (dir, "flac", create_flac (title, artist, album, i % 20 + 1, seconds), title));
+		g_free (title);
+
+		g_free (artist);
+		g_free (album);
+	}
+
+	return files;
+}
+
+static void
+bench_load (GPtrArray *files, gboolean fast)
+{
+	RBMetaData *md;
+	GTimer *timer;
+	guint failed = 0;
+	guint mismatched = 0;
+	double elapsed;
+	guint i;
+
+	rb_metadata_fast_set_enabled (fast);
+
+	md = rb_metadata_new ();
+	timer = g_timer_new ();
+	for (i = 0; i < files->len; i++) {
+		BenchFile *file = g_ptr_array_index (files, i);
+		GError *error = NULL;
+		GValue val = {0,};
+		gulong duration = 0;
+		const char *title = NULL;
+
+		rb_metadata_load (md, file->uri, &error);
+		if (error != NULL) {
+			rb_debug ("failed to load %s: %s", file->uri, error->message);
+			g_error_free (error);
+			failed++;
+			continue;
+		}
+
+		if (rb_metadata_get (md, RB_METADATA_FIELD_DURATION, &val)) {
+			duration = g_value_get_ulong (&val);
+			g_value_unset (&val);
+		}
+		if (rb_metadata_get (md, RB_METADATA_FIELD_TITLE, &val)) {
+			title = g_value_get_string (&val);
+		}
+
+		if (g_strcmp0 (title, file->title) != 0 ||
+		    (file->duration != 0 && duration != file->duration)) {
+			g_print ("%s: title \"%s\", duration %lu; expected \"%s\", %lu\n",
+				 file->uri, title ? title : "", duration, file->title, file->duration);
+			mismatched++;
+		}
+		file->duration = duration;
+
+		if (title != NULL)
+			g_value_unset (&val);
+	}
+	elapsed = g_timer_elapsed (timer, NULL);
+	g_timer_destroy (timer);
+	g_object_unref (md);
+
+	g_print ("%-10s %6u files in %8.3f s, %10.1f files/s, %u failed, %u mismatched\n",
+		 fast ? "fast" : "pipeline",
+		 files->len, elapsed, files->len / elapsed,
+		 failed, mismatched);
+}
+
+int
+main (int argc, char **argv)
+{
+	GPtrArray *files;
+	char *dir;
+	guint count = 200;
+	guint seconds = 10;
+	guint i;
+
+	if (argc > 1)
+		count = strtoul (argv[1], NULL, 10);
+	if (argc > 2)
+		seconds = MAX (1, strtoul (argv[2], NULL, 10));
+
+	g_thread_init (NULL);
+	g_type_init ();
+	gst_init (&argc, &argv);
+	rb_debug_init (FALSE);
+
+	dir = g_build_filename (g_get_tmp_dir (), "bench-metadata-load-XXXXXX", NULL);
+	if (mkdtemp (dir) == NULL) {
+		g_printerr ("couldn't create temporary directory\n");
+		return 1;
+	}
+
+	files = create_files (dir, count, seconds);
+
+	/* the pipeline run checks the generated files and records durations for the fast run */
+	bench_load (files, FALSE);
+	bench_load (files, TRUE);
+
+	for (i = 0; i < files->len; i++) {
+		BenchFile *file = g_ptr_array_index (files, i);
+		char *filename;
+
+		filename = g_filename_from_uri (file->uri, NULL, NULL);
+		g_unlink (filename);
+		g_free (filename);
+		g_free (file->uri);
+		g_free (file->title);
+		g_free (file);
+	}
+	g_ptr_array_free (files, TRUE);
+	g_rmdir (dir);
+	g_free (dir);
+
+	return 0;
+}
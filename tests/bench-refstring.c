@@ -0,0 +1,154 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+/*
+ * Measures contention on the refstring intern table.  Each thread
+ * repeatedly interns, looks up and releases strings drawn from a pool
+ * shared by all threads, the way the database loader and metadata
+ * import threads do.
+ *
+ * Runs with 1, 2, 4 and so on threads, up to and including the given
+ * maximum.
+ *
+ * usage: bench-refstring [threads] [iterations per thread]
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <glib.h>
+
+#include "rb-debug.h"
+#include "rb-util.h"
+#include "rb-refstring.h"
+
+#define POOL_SIZE	4096
+#define HELD_STRINGS	64
+
+static char *pool[POOL_SIZE];
+static int iterations = 200000;
+
+static gpointer
+bench_thread (gpointer data)
+{
+	RBRefString *held[HELD_STRINGS] = { NULL, };
+	GRand *rand;
+	int i;
+
+	rand = g_rand_new_with_seed (GPOINTER_TO_UINT (data));
+
+	for (i = 0; i < iterations; i++) {
+		const char *str;
+		RBRefString *ref;
+		int slot;
+
+		str = pool[g_rand_int_range (rand, 0, POOL_SIZE)];
+		slot = i % HELD_STRINGS;
+
+		/* keep some strings alive across iterations, so both the
+		 * existing-string and new-string paths are exercised.
+		 */
+		rb_refstring_unref (held[slot]);
+		held[slot] = rb_refstring_new (str);
+
+		ref = rb_refstring_find (str);
+		rb_refstring_unref (ref);
+
+		ref = rb_refstring_ref (held[slot]);
+		rb_refstring_unref (ref);
+	}
+
+	for (i = 0; i < HELD_STRINGS; i++)
+		rb_refstring_unref (held[i]);
+
+	g_rand_free (rand);
+	return NULL;
+}
+
+static double
+run (int n_threads)
+{
+	GThread **threads;
+	GTimer *timer;
+	double elapsed;
+	int i;
+
+	threads = g_new0 (GThread *, n_threads);
+	timer = g_timer_new ();
+
+	for (i = 0; i < n_threads; i++)
+		threads[i] = g_thread_create (bench_thread, GINT_TO_POINTER (i + 1), TRUE, NULL);
+	for (i = 0; i < n_threads; i++)
+		g_thread_join (threads[i]);
+
+	elapsed = g_timer_elapsed (timer, NULL);
+	g_timer_destroy (timer);
+	g_free (threads);
+	return elapsed;
+}
+
+int
+main (int argc, char **argv)
+{
+	int max_threads;
+	int n;
+	int i;
+
+	g_thread_init (NULL);
+	rb_threads_init ();
+	rb_debug_init (FALSE);
+	rb_refstring_system_init ();
+
+	max_threads = (argc > 1) ? atoi (argv[1]) : rb_get_num_processors ();
+	max_threads = MAX (max_threads, 1);
+	if (argc > 2)
+		iterations = atoi (argv[2]);
+
+	for (i = 0; i < POOL_SIZE; i++)
+		pool[i] = g_strdup_printf ("Artist %d - Album %d", i, i % 97);
+
+	n = 1;
+	while (TRUE) {
+		double elapsed;
+		double ops;
+
+		elapsed = run (n);
+		ops = (double) n * iterations * 6;
+		g_print ("%2d threads: %.3f s, %.2f million refstring ops/s\n",
+			 n, elapsed, ops / elapsed / 1000000.0);
+
+		if (n >= max_threads)
+			break;
+		/* finish with a run at the maximum if it's not a power of two */
+		n = MIN (n * 2, max_threads);
+	}
+
+	for (i = 0; i < POOL_SIZE; i++)
+		g_free (pool[i]);
+
+	rb_refstring_system_shutdown ();
+	return 0;
+}
@@ -0,0 +1,306 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+/*
+ * Measures query evaluation speed.  A database is filled with generated
+ * song entries, then a set of typical browser, search and auto-playlist
+ * queries is evaluated against every entry, both directly and in
+ * compiled form.
+ *
+ * usage: bench-rhythmdb-query [entries] [passes]
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <gtk/gtk.h>
+
+#include "rb-debug.h"
+#include "rb-file-helpers.h"
+#include "rb-util.h"
+
+#include "rhythmdb.h"
+#include "rhythmdb-tree.h"
+
+#define N_ARTISTS	2000
+#define N_GENRES	40
+#define ALBUMS_PER_ARTIST 4
+
+typedef struct {
+	RhythmDB *db;
+	GPtrArray *query;
+	RhythmDBCompiledQuery *compiled;
+	guint matches;
+} BenchQueryData;
+
+static void
+set_string (RhythmDB *db, RhythmDBEntry *entry, RhythmDBPropType propid, const char *str)
+{
+	GValue val = {0,};
+
+	g_value_init (&val, G_TYPE_STRING);
+	g_value_set_string (&val, str);
+	rhythmdb_entry_set (db, entry, propid, &val);
+	g_value_unset (&val);
+}
+
+static void
+set_ulong (RhythmDB *db, RhythmDBEntry *entry, RhythmDBPropType propid, gulong v)
+{
+	GValue val = {0,};
+
+	g_value_init (&val, G_TYPE_ULONG);
+	g_value_set_ulong (&val, v);
+	rhythmdb_entry_set (db, entry, propid, &val);
+	g_value_unset (&val);
+}
+
+static void
+create_entries (RhythmDB *db, guint n_entries)
+{
+	GRand *rand;
+	GTimeVal now;
+	guint i;
+
+	g_get_current_time (&now);
+	rand = g_rand_new_with_seed (42);
+
+	for (i = 0; i < n_entries; i++) {
+		RhythmDBEntry *entry;
+		GValue val = {0,};
+		guint artist;
+		char *str;
+
+		str = g_strdup_printf ("file:///music/bench/%u.ogg", i);
+		entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_SONG, str);
+		g_free (str);
+
+		artist = g_rand_int_range (rand, 0, N_ARTISTS);
+
+		str = g_strdup_printf ("Track %u of the Night", i);
+		set_string (db, entry, RHYTHMDB_PROP_TITLE, str);
+		g_free (str);
+
+		str = g_strdup_printf ("Artist %u", artist);
+		set_string (db, entry, RHYTHMDB_PROP_ARTIST, str);
+		g_free (str);
+
+		str = g_strdup_printf ("Album %u by Artist %u",
+				       g_rand_int_range (rand, 0, ALBUMS_PER_ARTIST), artist);
+		set_string (db, entry, RHYTHMDB_PROP_ALBUM, str);
+		g_free (str);
+
+		str = g_strdup_printf ("Genre %u", artist % N_GENRES);
+		set_string (db, entry, RHYTHMDB_PROP_GENRE, str);
+		g_free (str);
+
+		set_ulong (db, entry, RHYTHMDB_PROP_TRACK_NUMBER, g_rand_int_range (rand, 1, 20));
+		set_ulong (db, entry, RHYTHMDB_PROP_DURATION, g_rand_int_range (rand, 60, 600));
+		set_ulong (db, entry, RHYTHMDB_PROP_PLAY_COUNT, g_rand_int_range (rand, 0, 50));
+		set_ulong (db, entry, RHYTHMDB_PROP_FIRST_SEEN,
+			   now.tv_sec - g_rand_int_range (rand, 0, 365 * 24 * 60 * 60));
+		if (g_rand_boolean (rand)) {
+			set_ulong (db, entry, RHYTHMDB_PROP_LAST_PLAYED,
+				   now.tv_sec - g_rand_int_range (rand, 0, 60 * 24 * 60 * 60));
+		}
+
+		g_value_init (&val, G_TYPE_DOUBLE);
+		g_value_set_double (&val, (double) g_rand_int_range (rand, 0, 6));
+		rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_RATING, &val);
+		g_value_unset (&val);
+	}
+
+	g_rand_free (rand);
+	rhythmdb_commit (db);
+}
+
+static void
+evaluate_entry (RhythmDBEntry *entry, BenchQueryData *data)
+{
+	if (rhythmdb_evaluate_query (data->db, data->query, entry))
+		data->matches++;
+}
+
+static void
+evaluate_entry_compiled (RhythmDBEntry *entry, BenchQueryData *data)
+{
+	if (rhythmdb_compiled_query_evaluate (data->compiled, entry))
+		data->matches++;
+}
+
+static double
+time_passes (RhythmDB *db, GFunc func, BenchQueryData *data, guint passes)
+{
+	GTimer *timer;
+	double elapsed;
+	guint i;
+
+	timer = g_timer_new ();
+	for (i = 0; i < passes; i++) {
+		data->matches = 0;
+		rhythmdb_entry_foreach (db, func, data);
+	}
+	elapsed = g_timer_elapsed (timer, NULL);
+	g_timer_destroy (timer);
+
+	return (elapsed * 1000.0) / passes;
+}
+
+static void
+bench_query (RhythmDB *db, const char *description, GPtrArray *query, guint passes)
+{
+	BenchQueryData data;
+	double interpreted;
+	double compiled;
+	guint matches;
+
+	rhythmdb_query_preprocess (db, query);
+
+	data.db = db;
+	data.query = query;
+	data.compiled = rhythmdb_query_compile (db, query);
+
+	interpreted = time_passes (db, (GFunc) evaluate_entry, &data, passes);
+	matches = data.matches;
+	compiled = time_passes (db, (GFunc) evaluate_entry_compiled, &data, passes);
+
+	if (matches != data.matches) {
+		g_warning ("%s: compiled query matched %u entries, expected %u",
+			   description, data.matches, matches);
+	}
+
+	g_print ("%-40s %8u matches %10.2f ms/pass %10.2f ms/pass compiled\n",
+		 description, matches, interpreted, compiled);
+
+	rhythmdb_compiled_query_free (data.compiled);
+	rhythmdb_query_free (query);
+}
+
+int
+main (int argc, char **argv)
+{
+	RhythmDB *db;
+	GPtrArray *subquery;
+	GTimer *timer;
+	guint n_entries = 100000;
+	guint passes = 10;
+
+	if (argc > 1)
+		n_entries = strtoul (argv[1], NULL, 10);
+	if (argc > 2)
+		passes = MAX (1, strtoul (argv[2], NULL, 10));
+
+	g_thread_init (NULL);
+	rb_threads_init ();
+	gtk_set_locale ();
+	gtk_init (&argc, &argv);
+	rb_debug_init (FALSE);
+	rb_refstring_system_init ();
+	rb_file_helpers_init (TRUE);
+
+	GDK_THREADS_ENTER ();
+
+	db = rhythmdb_tree_new ("test");
+
+	timer = g_timer_new ();
+	create_entries (db, n_entries);
+	g_print ("created %u entries in %.2f s\n", n_entries, g_timer_elapsed (timer, NULL));
+	g_timer_destroy (timer);
+
+	bench_query (db, "type (library browser)",
+		     rhythmdb_query_parse (db,
+					   RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_SONG,
+					   RHYTHMDB_QUERY_END),
+		     passes);
+
+	bench_query (db, "type, artist",
+		     rhythmdb_query_parse (db,
+					   RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_SONG,
+					   RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_ARTIST, "Artist 17",
+					   RHYTHMDB_QUERY_END),
+		     passes);
+
+	bench_query (db, "search match",
+		     rhythmdb_query_parse (db,
+					   RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_SONG,
+					   RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "night album 3",
+					   RHYTHMDB_QUERY_END),
+		     passes);
+
+	bench_query (db, "title like",
+		     rhythmdb_query_parse (db,
+					   RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_TITLE_FOLDED, "track 99",
+					   RHYTHMDB_QUERY_END),
+		     passes);
+
+	bench_query (db, "rating or play count",
+		     rhythmdb_query_parse (db,
+					   RHYTHMDB_QUERY_PROP_GREATER, RHYTHMDB_PROP_RATING, 4.0,
+					   RHYTHMDB_QUERY_DISJUNCTION,
+					   RHYTHMDB_QUERY_PROP_GREATER, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 40,
+					   RHYTHMDB_QUERY_END),
+		     passes);
+
+	bench_query (db, "played within a week",
+		     rhythmdb_query_parse (db,
+					   RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_SONG,
+					   RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN, RHYTHMDB_PROP_LAST_PLAYED, (gulong) (7 * 24 * 60 * 60),
+					   RHYTHMDB_QUERY_END),
+		     passes);
+
+	subquery = rhythmdb_query_parse (db,
+					 RHYTHMDB_QUERY_PROP_GREATER, RHYTHMDB_PROP_RATING, 4.0,
+					 RHYTHMDB_QUERY_DISJUNCTION,
+					 RHYTHMDB_QUERY_PROP_GREATER, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 40,
+					 RHYTHMDB_QUERY_END);
+	bench_query (db, "recently added favourites",
+		     rhythmdb_query_parse (db,
+					   RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_SONG,
+					   RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN, RHYTHMDB_PROP_FIRST_SEEN, (gulong) (30 * 24 * 60 * 60),
+					   RHYTHMDB_QUERY_SUBQUERY, subquery,
+					   RHYTHMDB_QUERY_END),
+		     passes);
+	rhythmdb_query_free (subquery);
+
+	bench_query (db, "genre, short tracks",
+		     rhythmdb_query_parse (db,
+					   RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_SONG,
+					   RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, "Genre 7",
+					   RHYTHMDB_QUERY_PROP_LESS, RHYTHMDB_PROP_DURATION, (gulong) 180,
+					   RHYTHMDB_QUERY_END),
+		     passes);
+
+	rhythmdb_shutdown (db);
+	g_object_unref (G_OBJECT (db));
+	db = NULL;
+
+	rb_file_helpers_shutdown ();
+	rb_refstring_system_shutdown ();
+
+	GDK_THREADS_LEAVE ();
+
+	return 0;
+}
@@ -0,0 +1,386 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+/*
+ * Runs batch metadata loads against a fake metadata helper, which is
+ * found through RB_DBUS_METADATA_ADDRESS.  The fake helper sends a failed
+ * load result for each URI, with an error message identifying the batch
+ * item, and can be told to disconnect or send the wrong index part way
+ * through a batch.  Anything it didn't return should be loaded one at a
+ * time through a real metadata helper instead.
+ *
+ * The helper address is only read once per process, so each test relies
+ * on check running it in its own process.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib-object.h>
+#include <dbus/dbus.h>
+#include <dbus/dbus-glib-lowlevel.h>
+
+#include <check.h>
+#include "rb-debug.h"
+#include "rb-util.h"
+
+#include "rb-metadata.h"
+#include "rb-metadata-dbus.h"
+
+#define BATCH_SIZE		8
+#define FAKE_RESULT_FORMAT	"fake result %u"
+
+typedef enum {
+	FAKE_HELPER_COMPLETE,
+	FAKE_HELPER_DISCONNECT,
+	FAKE_HELPER_BAD_INDEX
+} FakeHelperMode;
+
+typedef struct {
+	FakeHelperMode mode;
+	guint fail_at;
+
+	DBusServer *server;
+	DBusConnection *connection;
+	GMainContext *context;
+	GMainLoop *loop;
+	GThread *thread;
+	guint batches;
+} FakeHelper;
+
+static gboolean
+append_fake_result (DBusMessageIter *iter, guint32 index)
+{
+	gboolean no = FALSE;
+	const char *mimetype = "";
+	guint32 error_code = RB_METADATA_ERROR_GENERAL;
+	char *message;
+	gboolean ret;
+
+	/* same layout as the real helper's results, for a failed load */
+	message = g_strdup_printf (FAKE_RESULT_FORMAT, index);
+	ret = rb_metadata_dbus_add_strv (iter, NULL) &&
+	      rb_metadata_dbus_add_strv (iter, NULL) &&
+	      dbus_message_iter_append_basic (iter, DBUS_TYPE_BOOLEAN, &no) &&
+	      dbus_message_iter_append_basic (iter, DBUS_TYPE_BOOLEAN, &no) &&
+	      dbus_message_iter_append_basic (iter, DBUS_TYPE_BOOLEAN, &no) &&
+	      dbus_message_iter_append_basic (iter, DBUS_TYPE_STRING, &mimetype) &&
+	      dbus_message_iter_append_basic (iter, DBUS_TYPE_BOOLEAN, &no) &&
+	      dbus_message_iter_append_basic (iter, DBUS_TYPE_UINT32, &error_code) &&
+	      dbus_message_iter_append_basic (iter, DBUS_TYPE_STRING, &message);
+	g_free (message);
+	return ret;
+}
+
+static void
+fake_load_batch (FakeHelper *fake, DBusConnection *connection, DBusMessage *message)
+{
+	DBusMessageIter iter;
+	DBusMessage *reply;
+	char **uris = NULL;
+	guint32 count;
+
+	fake->batches++;
+	if (!dbus_message_iter_init (message, &iter) ||
+	    !rb_metadata_dbus_get_strv (&iter, &uris)) {
+		rb_debug ("fake helper couldn't read batch load request");
+		return;
+	}
+
+	for (count = 0; uris != NULL && uris[count] != NULL; count++) {
+		DBusMessage *result;
+		guint32 index = count;
+
+		if (count == fake->fail_at) {
+			if (fake->mode == FAKE_HELPER_DISCONNECT) {
+				rb_debug ("fake helper disconnecting at batch item %u", count);
+				dbus_connection_close (connection);
+				g_strfreev (uris);
+				return;
+			} else if (fake->mode == FAKE_HELPER_BAD_INDEX) {
+				rb_debug ("fake helper skipping batch item %u", count);
+				index++;
+			}
+		}
+
+		result = dbus_message_new_signal (RB_METADATA_DBUS_OBJECT_PATH,
+						  RB_METADATA_DBUS_INTERFACE,
+						  "loadResult");
+		dbus_message_iter_init_append (result, &iter);
+		if (dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT32, &index) &&
+		    append_fake_result (&iter, index)) {
+			dbus_connection_send (connection, result, NULL);
+		}
+		dbus_message_unref (result);
+	}
+	g_strfreev (uris);
+
+	reply = dbus_message_new_method_return (message);
+	dbus_message_append_args (reply, DBUS_TYPE_UINT32, &count, DBUS_TYPE_INVALID);
+	dbus_connection_send (connection, reply, NULL);
+	dbus_connection_flush (connection);
+	dbus_message_unref (reply);
+}
+
+static DBusHandlerResult
+fake_handle_message (DBusConnection *connection, DBusMessage *message, FakeHelper *fake)
+{
+	DBusMessage *reply;
+
+	rb_debug ("fake helper handling message: %s", dbus_message_get_member (message));
+	if (dbus_message_is_method_call (message, RB_METADATA_DBUS_INTERFACE, "loadBatch")) {
+		fake_load_batch (fake, connection, message);
+		return DBUS_HANDLER_RESULT_HANDLED;
+	} else if (dbus_message_is_method_call (message, RB_METADATA_DBUS_INTERFACE, "getSaveableTypes")) {
+		DBusMessageIter iter;
+
+		reply = dbus_message_new_method_return (message);
+		dbus_message_iter_init_append (reply, &iter);
+		rb_metadata_dbus_add_strv (&iter, NULL);
+	} else if (dbus_message_is_method_call (message, RB_METADATA_DBUS_INTERFACE, "ping")) {
+		reply = dbus_message_new_method_return (message);
+	} else {
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	}
+
+	dbus_connection_send (connection, reply, NULL);
+	dbus_message_unref (reply);
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static void
+fake_unregister_handler (DBusConnection *connection, void *data)
+{
+}
+
+static void
+fake_new_connection (DBusServer *server, DBusConnection *connection, FakeHelper *fake)
+{
+	DBusObjectPathVTable vt = {
+		fake_unregister_handler,
+		(DBusObjectPathMessageFunction) fake_handle_message,
+		NULL, NULL, NULL, NULL
+	};
+
+	/* the client only connects to the address in the environment once */
+	if (fake->connection != NULL) {
+		rb_debug ("second connection to the fake metadata helper");
+		return;
+	}
+
+	dbus_connection_register_object_path (connection, RB_METADATA_DBUS_OBJECT_PATH, &vt, fake);
+	fake->connection = dbus_connection_ref (connection);
+	dbus_connection_setup_with_g_main (connection, fake->context);
+}
+
+static gpointer
+fake_helper_main (FakeHelper *fake)
+{
+	g_main_loop_run (fake->loop);
+	return NULL;
+}
+
+static FakeHelper *
+fake_helper_start (FakeHelperMode mode, guint fail_at)
+{
+	FakeHelper *fake;
+	DBusError dbus_error = {0,};
+	char *address;
+
+	fake = g_new0 (FakeHelper, 1);
+	fake->mode = mode;
+	fake->fail_at = fail_at;
+
+	fake->server = dbus_server_listen ("unix:tmpdir=/tmp", &dbus_error);
+	fail_unless (fake->server != NULL, "couldn't start the fake metadata helper");
+	dbus_server_set_new_connection_function (fake->server,
+						 (DBusNewConnectionFunction) fake_new_connection,
+						 fake,
+						 NULL);
+
+	fake->context = g_main_context_new ();
+	fake->loop = g_main_loop_new (fake->context, FALSE);
+	dbus_server_setup_with_g_main (fake->server, fake->context);
+	fake->thread = g_thread_create ((GThreadFunc) fake_helper_main, fake, TRUE, NULL);
+
+	address = dbus_server_get_address (fake->server);
+	g_setenv ("RB_DBUS_METADATA_ADDRESS", address, TRUE);
+	dbus_free (address);
+
+	return fake;
+}
+
+static void
+fake_helper_stop (FakeHelper *fake)
+{
+	g_main_loop_quit (fake->loop);
+	g_thread_join (fake->thread);
+
+	if (fake->connection != NULL) {
+		dbus_connection_close (fake->connection);
+		dbus_connection_unref (fake->connection);
+	}
+	dbus_server_disconnect (fake->server);
+	dbus_server_unref (fake->server);
+
+	g_main_loop_unref (fake->loop);
+	g_main_context_unref (fake->context);
+	g_unsetenv ("RB_DBUS_METADATA_ADDRESS");
+	g_free (fake);
+}
+
+static void
+batch_result_cb (RBMetaData *md, guint index, GError *error, GPtrArray *results)
+{
+	/* each URI gets exactly one result, in order */
+	fail_unless (index == results->len, "got result %u, expected %u", index, results->len);
+	fail_unless (error != NULL, "loading %u succeeded", index);
+
+	g_ptr_array_add (results, g_strdup (error->message));
+	g_error_free (error);
+	g_object_unref (md);
+}
+
+/*
+ * Loads a batch through the fake helper, and returns how many of the
+ * results came from it.  The rest must have been loaded separately.
+ */
+static guint
+run_batch (FakeHelper *fake)
+{
+	GPtrArray *results;
+	char **uris;
+	guint from_helper = 0;
+	guint i;
+
+	uris = g_new0 (char *, BATCH_SIZE + 1);
+	for (i = 0; i < BATCH_SIZE; i++) {
+		uris[i] = g_strdup_printf ("file:///nonexistent/test-metadata-batch-%u.mp3", i);
+	}
+
+	results = g_ptr_array_new ();
+	rb_metadata_load_batch (uris, (RBMetaDataLoadFunc) batch_result_cb, results);
+	fail_unless (results->len == BATCH_SIZE, "got %u results for %u URIs", results->len, BATCH_SIZE);
+	fail_unless (fake->batches == 1, "%u batch requests", fake->batches);
+
+	for (i = 0; i < results->len; i++) {
+		char *expected = g_strdup_printf (FAKE_RESULT_FORMAT, i);
+		const char *message = g_ptr_array_index (results, i);
+
+		if (strcmp (message, expected) == 0) {
+			/* nothing from the helper is accepted after something goes wrong */
+			fail_unless (from_helper == i, "result %u from the fake helper after a missing one", i);
+			from_helper++;
+		}
+		g_free (expected);
+	}
+
+	g_ptr_array_foreach (results, (GFunc) g_free, NULL);
+	g_ptr_array_free (results, TRUE);
+	g_strfreev (uris);
+	return from_helper;
+}
+
+START_TEST (test_batch_complete)
+{
+	FakeHelper *fake;
+	guint from_helper;
+
+	fake = fake_helper_start (FAKE_HELPER_COMPLETE, G_MAXUINT);
+	from_helper = run_batch (fake);
+	fail_unless (from_helper == BATCH_SIZE, "only %u results from the helper", from_helper);
+	fake_helper_stop (fake);
+}
+END_TEST
+
+START_TEST (test_batch_helper_disconnected)
+{
+	FakeHelper *fake;
+	guint from_helper;
+
+	/* the results sent before the helper went away are kept, and the
+	 * rest of the batch is loaded one at a time.
+	 */
+	fake = fake_helper_start (FAKE_HELPER_DISCONNECT, 3);
+	from_helper = run_batch (fake);
+	fail_unless (from_helper == 3, "%u results from the helper", from_helper);
+	fake_helper_stop (fake);
+}
+END_TEST
+
+START_TEST (test_batch_bad_index)
+{
+	FakeHelper *fake;
+	guint from_helper;
+
+	/* a result for the wrong URI means the helper can't be trusted with
+	 * the rest of the batch.
+	 */
+	fake = fake_helper_start (FAKE_HELPER_BAD_INDEX, 5);
+	from_helper = run_batch (fake);
+	fail_unless (from_helper == 5, "%u results from the helper", from_helper);
+	fake_helper_stop (fake);
+}
+END_TEST
+
+static Suite *
+rb_metadata_batch_suite (void)
+{
+	Suite *s = suite_create ("rb-metadata-batch");
+	TCase *tc_chain = tcase_create ("rb-metadata-batch-core");
+
+	suite_add_tcase (s, tc_chain);
+
+	tcase_add_test (tc_chain, test_batch_complete);
+	tcase_add_test (tc_chain, test_batch_helper_disconnected);
+	tcase_add_test (tc_chain, test_batch_bad_index);
+
+	return s;
+}
+
+int
+main (int argc, char **argv)
+{
+	int ret;
+	SRunner *sr;
+	Suite *s;
+
+	g_thread_init (NULL);
+	g_type_init ();
+	dbus_threads_init_default ();
+	rb_debug_init (TRUE);
+
+	s = rb_metadata_batch_suite ();
+	sr = srunner_create (s);
+
+	/* each test needs a fresh metadata client */
+	srunner_set_fork_status (sr, CK_FORK);
+	srunner_run_all (sr, CK_NORMAL);
+	ret = srunner_ntests_failed (sr);
+	srunner_free (sr);
+
+	return ret;
+}
@@ -0,0 +1,552 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+
+/*
+ * Feeds truncated and corrupt files to the fast metadata readers.  Any
+ * file a reader can't make sense of should be rejected, so metadata
+ * gets loaded through the GStreamer pipeline instead.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include <check.h>
+#include "rb-debug.h"
+#include "rb-util.h"
+
+#include "rb-metadata.h"
+#include "rb-metadata-fast.h"
+
+/* MPEG 1 layer III, 128kbps, 44.1kHz, stereo */
+#define MP3_FRAME_HEADER	"\xff\xfb\x90\x00"
+#define MP3_FRAME_SIZE		417
+
+#define TEST_RATE		44100
+#define TEST_SECONDS		10
+
+/* tag values written to each of the test files */
+#define TEST_TITLE		"Title"
+#define TEST_ARTIST		"Artist"
+#define TEST_ALBUM		"Album"
+#define TEST_TRACK		3
+#define TEST_TRACKS		12
+#define TEST_GENRE		"Rock"
+#define TEST_GENRE_ID3		17
+
+static const char * const test_comments[] = {
+	"TITLE=" TEST_TITLE,
+	"ARTIST=" TEST_ARTIST,
+	"ALBUM=" TEST_ALBUM,
+	"TRACKNUMBER=3",
+	"TRACKTOTAL=12",
+	"GENRE=" TEST_GENRE
+};
+
+static void
+append_uint32_be (GByteArray *data, guint32 v)
+{
+	guint8 b[4] = { v >> 24, v >> 16, v >> 8, v };
+	g_byte_array_append (data, b, 4);
+}
+
+static void
+append_uint32_le (GByteArray *data, guint32 v)
+{
+	guint8 b[4] = { v, v >> 8, v >> 16, v >> 24 };
+	g_byte_array_append (data, b, 4);
+}
+
+static void
+append_syncsafe (GByteArray *data, guint32 v)
+{
+	guint8 b[4] = { (v >> 21) & 0x7f, (v >> 14) & 0x7f, (v >> 7) & 0x7f, v & 0x7f };
+	g_byte_array_append (data, b, 4);
+}
+
+static void
+append_vorbis_comments (GByteArray *data, guint32 count)
+{
+	int i;
+
+	/* vendor string, then the test comments, whatever the count says */
+	append_uint32_le (data, strlen ("test"));
+	g_byte_array_append (data, (const guint8 *)"test", strlen ("test"));
+	append_uint32_le (data, count);
+	for (i = 0; i < G_N_ELEMENTS (test_comments); i++) {
+		append_uint32_le (data, strlen (test_comments[i]));
+		g_byte_array_append (data, (const guint8 *)test_comments[i], strlen (test_comments[i]));
+	}
+}
+
+static void
+append_mp3_frames (GByteArray *data, guint n_frames)
+{
+	guint8 *frame;
+	guint i;
+
+	frame = g_malloc0 (MP3_FRAME_SIZE);
+	memcpy (frame, MP3_FRAME_HEADER, 4);
+	for (i = 0; i < n_frames; i++)
+		g_byte_array_append (data, frame, MP3_FRAME_SIZE);
+	g_free (frame);
+}
+
+/* ID3v2.3 tag holding a TIT2 frame claiming frame_size bytes, followed by n_frames MP3 frames */
+static GByteArray *
+create_mp3 (guint32 frame_size, guint n_frames)
+{
+	GByteArray *data;
+	guint8 header[10] = { 'I', 'D', '3', 3, 0, 0, 0, 0, 0, 15 };
+	guint8 flags[3] = { 0, 0, 0 };	/* two flag bytes, then ISO-8859-1 encoding */
+
+	data = g_byte_array_new ();
+	g_byte_array_append (data, header, sizeof (header));
+	g_byte_array_append (data, (const guint8 *)"TIT2", 4);
+	append_uint32_be (data, frame_size);
+	g_byte_array_append (data, flags, 3);
+	g_byte_array_append (data, (const guint8 *)"test", 4);
+
+	append_mp3_frames (data, n_frames);
+	return data;
+}
+
+/* text frame, ISO-8859-1 in ID3v2.3 and UTF-8 in ID3v2.4 */
+static void
+append_id3v2_text_frame (GByteArray *tag, int major, const char *id, const char *value)
+{
+	guint8 flags[3] = { 0, 0, (major == 4) ? 3 : 0 };
+
+	g_byte_array_append (tag, (const guint8 *)id, 4);
+	if (major == 4)
+		append_syncsafe (tag, strlen (value) + 1);
+	else
+		append_uint32_be (tag, strlen (value) + 1);
+	g_byte_array_append (tag, flags, 3);
+	g_byte_array_append (tag, (const guint8 *)value, strlen (value));
+}
+
+/* ID3v2 tag holding the test values, followed by n_frames MP3 frames */
+static GByteArray *
+create_tagged_mp3 (int major, guint n_frames)
+{
+	GByteArray *data;
+	GByteArray *tag;
+	guint8 header[6] = { 'I', 'D', '3', major, 0, 0 };
+
+	tag = g_byte_array_new ();
+	append_id3v2_text_frame (tag, major, "TIT2", TEST_TITLE);
+	append_id3v2_text_frame (tag, major, "TPE1", TEST_ARTIST);
+	append_id3v2_text_frame (tag, major, "TALB", TEST_ALBUM);
+	append_id3v2_text_frame (tag, major, "TRCK", "3/12");
+	/* ID3v2.3 genres are often references to the ID3v1 genre list */
+	append_id3v2_text_frame (tag, major, "TCON", (major == 4) ? TEST_GENRE : "(17)");
+
+	data = g_byte_array_new ();
+	g_byte_array_append (data, header, sizeof (header));
+	append_syncsafe (data, tag->len);
+	g_byte_array_append (data, tag->data, tag->len);
+	g_byte_array_free (tag, TRUE);
+
+	append_mp3_frames (data, n_frames);
+	return data;
+}
+
+/* ID3v1.1 tag holding the test values, with the given title */
+static void
+append_id3v1 (GByteArray *data, const char *title)
+{
+	guint8 tag[128];
+
+	memset (tag, 0, sizeof (tag));
+	memcpy (tag, "TAG", 3);
+	memcpy (tag + 3, title, strlen (title));
+	memcpy (tag + 33, TEST_ARTIST, strlen (TEST_ARTIST));
+	memcpy (tag + 63, TEST_ALBUM, strlen (TEST_ALBUM));
+	memcpy (tag + 93, "2009", 4);
+	tag[126] = TEST_TRACK;
+	tag[127] = TEST_GENRE_ID3;
+	g_byte_array_append (data, tag, sizeof (tag));
+}
+
+static void
+append_ogg_page (GByteArray *data, guint64 granule, guint32 seq, const guint8 *packet, guint8 len)
+{
+	guint8 header[27];
+	int i;
+
+	memset (header, 0, sizeof (header));
+	memcpy (header, "OggS", 4);
+	header[5] = (seq == 0) ? 0x02 : 0x00;
+	for (i = 0; i < 8; i++)
+		header[6 + i] = granule >> (i * 8);
+	header[14] = 0x42;		/* serial */
+	header[18] = seq;
+	header[26] = 1;			/* a single segment */
+	g_byte_array_append (data, header, sizeof (header));
+	g_byte_array_append (data, &len, 1);
+	g_byte_array_append (data, packet, len);
+}
+
+/* identification, comment and final pages of a vorbis stream */
+static GByteArray *
+create_vorbis (guint32 comment_count)
+{
+	GByteArray *data;
+	GByteArray *packet;
+	guint8 framing = 1;
+
+	data = g_byte_array_new ();
+
+	packet = g_byte_array_new ();
+	g_byte_array_append (packet, (const guint8 *)"\001vorbis", 7);
+	append_uint32_le (packet, 0);		/* version */
+	g_byte_array_append (packet, (const guint8 *)"\002", 1);
+	append_uint32_le (packet, TEST_RATE);
+	append_uint32_le (packet, 0);		/* maximum bitrate */
+	append_uint32_le (packet, 128000);	/* nominal bitrate */
+	append_uint32_le (packet, 0);		/* minimum bitrate */
+	g_byte_array_append (packet, (const guint8 *)"\xb8", 1);
+	g_byte_array_append (packet, &framing, 1);
+	append_ogg_page (data, 0, 0, packet->data, packet->len);
+	g_byte_array_free (packet, TRUE);
+
+	packet = g_byte_array_new ();
+	g_byte_array_append (packet, (const guint8 *)"\003vorbis", 7);
+	append_vorbis_comments (packet, comment_count);
+	g_byte_array_append (packet, &framing, 1);
+	append_ogg_page (data, 0, 1, packet->data, packet->len);
+	g_byte_array_free (packet, TRUE);
+
+	append_ogg_page (data, TEST_RATE * TEST_SECONDS, 2, &framing, 1);
+	return data;
+}
+
+/* STREAMINFO, then a vorbis comment block claiming comment_len bytes */
+static GByteArray *
+create_flac (guint32 comment_len)
+{
+	GByteArray *data;
+	GByteArray *comments;
+	guint8 streaminfo[34];
+	guint64 packed;
+	int i;
+
+	data = g_byte_array_new ();
+	g_byte_array_append (data, (const guint8 *)"fLaC", 4);
+
+	memset (streaminfo, 0, sizeof (streaminfo));
+	streaminfo[0] = streaminfo[2] = 0x10;	/* 4096 sample blocks */
+	/* sample rate, channels - 1, bits per sample - 1, total samples */
+	packed = ((guint64)TEST_RATE << 44) | ((guint64)15 << 36) | (TEST_RATE * TEST_SECONDS);
+	for (i = 0; i < 8; i++)
+		streaminfo[10 + i] = packed >> (56 - i * 8);
+	append_uint32_be (data, sizeof (streaminfo));	/* STREAMINFO, not last */
+	g_byte_array_append (data, streaminfo, sizeof (streaminfo));
+
+	comments = g_byte_array_new ();
+	append_vorbis_comments (comments, G_N_ELEMENTS (test_comments));
+	if (comment_len == 0)
+		comment_len = comments->len;
+	append_uint32_be (data, 0x84000000 | comment_len);	/* VORBIS_COMMENT, last */
+	g_byte_array_append (data, comments->data, comments->len);
+	g_byte_array_free (comments, TRUE);
+
+	return data;
+}
+
+/* reads a file with the given reader, returning its metadata, or NULL if it was rejected */
+static GHashTable *
+fast_read_metadata (const RBMetaDataFastReader *reader, const guint8 *data, gsize len, char **mimetype)
+{
+	RBMetaDataFastFile file;
+	GHashTable *metadata;
+	char *type = NULL;
+	gboolean ret;
+
+	if (!reader->identify (data, MIN (len, RB_METADATA_FAST_HEADER_SIZE)))
+		return NULL;
+
+	metadata = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) rb_value_free);
+	file.stream = g_memory_input_stream_new_from_data (data, len, NULL);
+	file.size = len;
+
+	ret = reader->read (&file, metadata, &type);
+	g_object_unref (file.stream);
+	if (ret == FALSE) {
+		g_free (type);
+		g_hash_table_destroy (metadata);
+		return NULL;
+	}
+
+	fail_unless (type != NULL, "reader didn't set a mimetype");
+	fail_unless (g_hash_table_lookup (metadata, GINT_TO_POINTER (RB_METADATA_FIELD_DURATION)) != NULL,
+		     "reader didn't set a duration");
+
+	if (mimetype != NULL)
+		*mimetype = type;
+	else
+		g_free (type);
+	return metadata;
+}
+
+static gboolean
+fast_read (const RBMetaDataFastReader *reader, const guint8 *data, gsize len, gulong *duration)
+{
+	GHashTable *metadata;
+
+	metadata = fast_read_metadata (reader, data, len, NULL);
+	if (metadata == NULL)
+		return FALSE;
+
+	if (duration != NULL) {
+		GValue *val = g_hash_table_lookup (metadata, GINT_TO_POINTER (RB_METADATA_FIELD_DURATION));
+		*duration = g_value_get_ulong (val);
+	}
+
+	g_hash_table_destroy (metadata);
+	return TRUE;
+}
+
+static void
+check_string (GHashTable *metadata, RBMetaDataField field, const char *expected)
+{
+	GValue *val;
+
+	val = g_hash_table_lookup (metadata, GINT_TO_POINTER (field));
+	fail_unless (val != NULL, "%s not set", rb_metadata_get_field_name (field));
+	fail_unless (strcmp (g_value_get_string (val), expected) == 0,
+		     "%s is \"%s\", not \"%s\"",
+		     rb_metadata_get_field_name (field), g_value_get_string (val), expected);
+}
+
+static void
+check_ulong (GHashTable *metadata, RBMetaDataField field, gulong expected)
+{
+	GValue *val;
+
+	val = g_hash_table_lookup (metadata, GINT_TO_POINTER (field));
+	if (expected == 0) {
+		fail_unless (val == NULL, "%s set", rb_metadata_get_field_name (field));
+		return;
+	}
+
+	fail_unless (val != NULL, "%s not set", rb_metadata_get_field_name (field));
+	fail_unless (g_value_get_ulong (val) == expected,
+		     "%s is %lu, not %lu",
+		     rb_metadata_get_field_name (field), g_value_get_ulong (val), expected);
+}
+
+/* reads a file that must be accepted, and checks it has the test tag values */
+static void
+check_tags (const RBMetaDataFastReader *reader, GByteArray *data, const char *mimetype, gulong max_track)
+{
+	GHashTable *metadata;
+	char *type = NULL;
+
+	metadata = fast_read_metadata (reader, data->data, data->len, &type);
+	fail_unless (metadata != NULL, "%s file rejected", reader->name);
+	fail_unless (strcmp (type, mimetype) == 0, "mimetype is %s, not %s", type, mimetype);
+
+	check_string (metadata, RB_METADATA_FIELD_TITLE, TEST_TITLE);
+	check_string (metadata, RB_METADATA_FIELD_ARTIST, TEST_ARTIST);
+	check_string (metadata, RB_METADATA_FIELD_ALBUM, TEST_ALBUM);
+	check_string (metadata, RB_METADATA_FIELD_GENRE, TEST_GENRE);
+	check_ulong (metadata, RB_METADATA_FIELD_TRACK_NUMBER, TEST_TRACK);
+	check_ulong (metadata, RB_METADATA_FIELD_MAX_TRACK_NUMBER, max_track);
+
+	g_free (type);
+	g_hash_table_destroy (metadata);
+}
+
+/* every truncated copy of a file must be read or rejected without crashing */
+static void
+check_truncated (const RBMetaDataFastReader *reader, GByteArray *data)
+{
+	gsize len;
+
+	for (len = 0; len < data->len; len++)
+		fast_read (reader, data->data, len, NULL);
+}
+
+START_TEST (test_mp3_frame_past_tag_end)
+{
+	GByteArray *data;
+	gulong duration = 0;
+
+	data = create_mp3 (5, 100);
+	fail_unless (fast_read (&rb_metadata_fast_mp3_reader, data->data, data->len, &duration), "valid MP3 rejected");
+	fail_unless (duration == (100 * 1152) / TEST_RATE, "wrong duration %lu", duration);
+	check_truncated (&rb_metadata_fast_mp3_reader, data);
+	g_byte_array_free (data, TRUE);
+
+	data = create_mp3 (1000, 100);
+	fail_if (fast_read (&rb_metadata_fast_mp3_reader, data->data, data->len, NULL), "ID3v2 frame past the end of the tag accepted");
+	g_byte_array_free (data, TRUE);
+}
+END_TEST
+
+START_TEST (test_mp3_single_frame)
+{
+	GByteArray *data;
+	gulong duration = G_MAXULONG;
+
+	data = create_mp3 (5, 1);
+	fail_unless (fast_read (&rb_metadata_fast_mp3_reader, data->data, data->len, &duration), "single frame MP3 rejected");
+	fail_unless (duration == 0, "wrong duration %lu", duration);
+	check_truncated (&rb_metadata_fast_mp3_reader, data);
+	g_byte_array_free (data, TRUE);
+}
+END_TEST
+
+START_TEST (test_vorbis_comment_count)
+{
+	GByteArray *data;
+	GByteArray *comments;
+	GHashTable *metadata;
+	gulong duration = 0;
+
+	data = create_vorbis (G_N_ELEMENTS (test_comments));
+	fail_unless (fast_read (&rb_metadata_fast_vorbis_reader, data->data, data->len, &duration), "valid vorbis file rejected");
+	fail_unless (duration == TEST_SECONDS, "wrong duration %lu", duration);
+	check_truncated (&rb_metadata_fast_vorbis_reader, data);
+	g_byte_array_free (data, TRUE);
+
+	data = create_vorbis (G_MAXUINT32);
+	fail_if (fast_read (&rb_metadata_fast_vorbis_reader, data->data, data->len, NULL), "vorbis comment count past the end of the packet accepted");
+	g_byte_array_free (data, TRUE);
+
+	metadata = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) rb_value_free);
+	comments = g_byte_array_new ();
+	append_vorbis_comments (comments, G_N_ELEMENTS (test_comments) + 1);
+	fail_if (rb_metadata_fast_read_vorbis_comments (comments->data, comments->len, metadata),
+		 "vorbis comment count past the end of the data accepted");
+	g_byte_array_free (comments, TRUE);
+	g_hash_table_destroy (metadata);
+}
+END_TEST
+
+START_TEST (test_flac_block_past_eof)
+{
+	GByteArray *data;
+	gulong duration = 0;
+
+	data = create_flac (0);
+	fail_unless (fast_read (&rb_metadata_fast_flac_reader, data->data, data->len, &duration), "valid FLAC file rejected");
+	fail_unless (duration == TEST_SECONDS, "wrong duration %lu", duration);
+	check_truncated (&rb_metadata_fast_flac_reader, data);
+	g_byte_array_free (data, TRUE);
+
+	data = create_flac (1000);
+	fail_if (fast_read (&rb_metadata_fast_flac_reader, data->data, data->len, NULL), "FLAC block past the end of the file accepted");
+	g_byte_array_free (data, TRUE);
+
+	/* too big to be read as a comment block, so only the length is checked */
+	data = create_flac (0xffffff);
+	fail_if (fast_read (&rb_metadata_fast_flac_reader, data->data, data->len, NULL), "FLAC block past the end of the file accepted");
+	g_byte_array_free (data, TRUE);
+}
+END_TEST
+
+START_TEST (test_mp3_tag_values)
+{
+	GByteArray *data;
+
+	data = create_tagged_mp3 (3, 100);
+	check_tags (&rb_metadata_fast_mp3_reader, data, "application/x-id3", TEST_TRACKS);
+	g_byte_array_free (data, TRUE);
+
+	data = create_tagged_mp3 (4, 100);
+	check_tags (&rb_metadata_fast_mp3_reader, data, "application/x-id3", TEST_TRACKS);
+	g_byte_array_free (data, TRUE);
+
+	/* ID3v1 only; there's nowhere to put the number of tracks */
+	data = g_byte_array_new ();
+	append_mp3_frames (data, 100);
+	append_id3v1 (data, TEST_TITLE);
+	check_tags (&rb_metadata_fast_mp3_reader, data, "audio/mpeg", 0);
+	g_byte_array_free (data, TRUE);
+
+	/* ID3v1 only fills in what the ID3v2 tag doesn't have */
+	data = create_tagged_mp3 (3, 100);
+	append_id3v1 (data, "Other Title");
+	check_tags (&rb_metadata_fast_mp3_reader, data, "application/x-id3", TEST_TRACKS);
+	g_byte_array_free (data, TRUE);
+}
+END_TEST
+
+START_TEST (test_xiph_tag_values)
+{
+	GByteArray *data;
+
+	data = create_vorbis (G_N_ELEMENTS (test_comments));
+	check_tags (&rb_metadata_fast_vorbis_reader, data, "application/ogg", TEST_TRACKS);
+	g_byte_array_free (data, TRUE);
+
+	data = create_flac (0);
+	check_tags (&rb_metadata_fast_flac_reader, data, "audio/x-flac", TEST_TRACKS);
+	g_byte_array_free (data, TRUE);
+}
+END_TEST
+
+static Suite *
+rb_metadata_fast_suite (void)
+{
+	Suite *s = suite_create ("rb-metadata-fast");
+	TCase *tc_chain = tcase_create ("rb-metadata-fast-core");
+
+	suite_add_tcase (s, tc_chain);
+
+	tcase_add_test (tc_chain, test_mp3_frame_past_tag_end);
+	tcase_add_test (tc_chain, test_mp3_single_frame);
+	tcase_add_test (tc_chain, test_vorbis_comment_count);
+	tcase_add_test (tc_chain, test_flac_block_past_eof);
+	tcase_add_test (tc_chain, test_mp3_tag_values);
+	tcase_add_test (tc_chain, test_xiph_tag_values);
+
+	return s;
+}
+
+int
+main (int argc, char **argv)
+{
+	int ret;
+	SRunner *sr;
+	Suite *s;
+
+	g_thread_init (NULL);
+	g_type_init ();
+	rb_debug_init (TRUE);
+
+	s = rb_metadata_fast_suite ();
+	sr = srunner_create (s);
+	srunner_run_all (sr, CK_NORMAL);
+	ret = srunner_ntests_failed (sr);
+	srunner_free (sr);
+
+	return ret;
+}
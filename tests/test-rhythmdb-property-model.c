@@ -663,17 +663,162 @@ START_TEST (test_rhythmdb_property_model_empty_strings)
 }
 END_TEST
 
+#define SWITCH_BENCH_ENTRIES	200000
+#define SWITCH_BENCH_ARTISTS	5000
+#define SWITCH_BENCH_GENRES	20
+
+static RhythmDBQueryModel *
+_genre_query_model (guint first_genre, guint n_genres)
+{
+	RhythmDBQueryModel *model;
+	GPtrArray *query;
+	guint i;
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_IGNORE,
+				      RHYTHMDB_QUERY_END);
+	if (n_genres > 0) {
+		GPtrArray *genres = g_ptr_array_new ();
+
+		for (i = first_genre; i < first_genre + n_genres; i++) {
+			char *genre = g_strdup_printf ("genre %u", i);
+
+			if (i > first_genre)
+				rhythmdb_query_append (db, genres, RHYTHMDB_QUERY_DISJUNCTION, RHYTHMDB_QUERY_END);
+			rhythmdb_query_append (db, genres,
+					       RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, genre,
+					       RHYTHMDB_QUERY_END);
+			g_free (genre);
+		}
+		rhythmdb_query_append (db, query, RHYTHMDB_QUERY_SUBQUERY, genres, RHYTHMDB_QUERY_END);
+		rhythmdb_query_free (genres);
+	}
+
+	model = rhythmdb_query_model_new_empty (db);
+	rhythmdb_do_full_query_parsed (db, RHYTHMDB_QUERY_RESULTS (model), query);
+	rhythmdb_query_free (query);
+	return model;
+}
+
+static double
+_time_switch (RhythmDBPropertyModel *propmodel, RhythmDBQueryModel *model, gboolean delta)
+{
+	GTimer *timer;
+	double elapsed;
+
+	timer = g_timer_new ();
+	if (delta == FALSE) {
+		/* detaching first forces the property model to be rebuilt */
+		g_object_set (propmodel, "query-model", NULL, NULL);
+	}
+	g_object_set (propmodel, "query-model", model, NULL);
+	elapsed = g_timer_elapsed (timer, NULL);
+	g_timer_destroy (timer);
+
+	return elapsed * 1000.0;
+}
+
+/* measures switching the query model of a property model, as the library
+ * browser does when the selection in another property view changes, and
+ * checks that applying the differences produces the same counts as
+ * rebuilding the property model.
+ */
+START_TEST (test_rhythmdb_property_model_switch_benchmark)
+{
+	RhythmDBQueryModel *models[4];
+	RhythmDBPropertyModel *propmodel;
+	RhythmDBPropertyModel *rebuilt;
+	RhythmDBEntry *entry;
+	const char *names[] = { "all", "one genre", "two genres", "all" };
+	double delta_ms, rebuild_ms;
+	GTimer *timer;
+	GList *entries = NULL;
+	GList *l;
+	guint i;
+
+	start_test_case ();
+
+	/* per-entry debug output would swamp the timings */
+	rb_debug_init (FALSE);
+
+	timer = g_timer_new ();
+	for (i = 0; i < SWITCH_BENCH_ENTRIES; i++) {
+		char *str;
+
+		str = g_strdup_printf ("file:///bench/%u.ogg", i);
+		entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, str);
+		g_free (str);
+
+		str = g_strdup_printf ("artist %u", i % SWITCH_BENCH_ARTISTS);
+		set_entry_string (db, entry, RHYTHMDB_PROP_ARTIST, str);
+		g_free (str);
+
+		str = g_strdup_printf ("genre %u", (i % SWITCH_BENCH_ARTISTS) % SWITCH_BENCH_GENRES);
+		set_entry_string (db, entry, RHYTHMDB_PROP_GENRE, str);
+		g_free (str);
+
+		entries = g_list_prepend (entries, entry);
+	}
+	rhythmdb_commit (db);
+	end_step ();
+	g_print ("created %u entries in %.2f s\n", SWITCH_BENCH_ENTRIES, g_timer_elapsed (timer, NULL));
+	g_timer_destroy (timer);
+
+	models[0] = _genre_query_model (0, 0);
+	models[1] = _genre_query_model (0, 1);
+	models[2] = _genre_query_model (0, 2);
+	models[3] = models[0];
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (models[0]), NULL) == SWITCH_BENCH_ENTRIES);
+
+	propmodel = rhythmdb_property_model_new (db, RHYTHMDB_PROP_ARTIST);
+	rebuilt = rhythmdb_property_model_new (db, RHYTHMDB_PROP_ARTIST);
+
+	for (i = 0; i < G_N_ELEMENTS (names); i++) {
+		delta_ms = _time_switch (propmodel, models[i], TRUE);
+		rebuild_ms = _time_switch (rebuilt, models[i], FALSE);
+		g_print ("switch to %-12s %10.2f ms delta %10.2f ms rebuild\n",
+			 names[i], delta_ms, rebuild_ms);
+
+		fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (propmodel), NULL) ==
+			     gtk_tree_model_iter_n_children (GTK_TREE_MODEL (rebuilt), NULL));
+		fail_unless (_get_property_count (propmodel, "artist 0") ==
+			     _get_property_count (rebuilt, "artist 0"));
+		fail_unless (_get_property_count (propmodel, "artist 1") ==
+			     _get_property_count (rebuilt, "artist 1"));
+	}
+
+	g_object_unref (propmodel);
+	g_object_unref (rebuilt);
+	g_object_unref (models[0]);
+	g_object_unref (models[1]);
+	g_object_unref (models[2]);
+
+	for (l = entries; l != NULL; l = l->next) {
+		rhythmdb_entry_delete (db, l->data);
+	}
+	g_list_free (entries);
+	rhythmdb_commit (db);
+
+	rb_debug_init (TRUE);
+	end_test_case ();
+}
+END_TEST
+
 static Suite *
 rhythmdb_property_model_suite (void)
 {
 	Suite *s = suite_create ("rhythmdb-property-model");
 	TCase *tc_chain = tcase_create ("rhythmdb-property-model-core");
 	TCase *tc_bugs = tcase_create ("rhythmdb-property-model-bugs");
+	TCase *tc_bench = tcase_create ("rhythmdb-property-model-bench");
 
 	suite_add_tcase (s, tc_chain);
 	tcase_add_checked_fixture (tc_chain, test_rhythmdb_setup, test_rhythmdb_shutdown);
 	suite_add_tcase (s, tc_bugs);
 	tcase_add_checked_fixture (tc_bugs, test_rhythmdb_setup, test_rhythmdb_shutdown);
+	suite_add_tcase (s, tc_bench);
+	tcase_add_checked_fixture (tc_bench, test_rhythmdb_setup, test_rhythmdb_shutdown);
+	tcase_set_timeout (tc_bench, 600);
 
 	/* test core functionality */
 	tcase_add_test (tc_chain, test_rhythmdb_property_model_static);
@@ -685,6 +830,9 @@ rhythmdb_property_model_suite (void)
 /*	tcase_add_test (tc_bugs, test_hidden_chain_filter);*/
 	tcase_add_test (tc_chain, test_rhythmdb_property_model_empty_strings);
 
+	/* benchmarks */
+	tcase_add_test (tc_bench, test_rhythmdb_property_model_switch_benchmark);
+
 	return s;
 }
 
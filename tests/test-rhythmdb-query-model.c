@@ -211,6 +211,426 @@ START_TEST (test_hidden_chain_filter)
 }
 END_TEST
 
+static void
+add_results (RhythmDBQueryModel *model, RhythmDBEntry **entries, const int *order, int n)
+{
+	GPtrArray *results;
+	int i;
+
+	/* the model takes ownership of the array */
+	results = g_ptr_array_new ();
+	for (i = 0; i < n; i++) {
+		g_ptr_array_add (results, entries[order[i]]);
+	}
+	rhythmdb_query_results_add_results (RHYTHMDB_QUERY_RESULTS (model), results);
+}
+
+/* this tests that entries added in chunks end up sorted, and that the
+ * row-inserted signals report the final positions.
+ */
+START_TEST (test_bulk_insert_sorted)
+{
+	RhythmDBQueryModel *model;
+	RhythmDBEntry *entries[6];
+	GtkTreeIter iter;
+	const int first[] = { 2, 0, 4 };
+	const int second[] = { 3, 5, 1, 0 };
+	int i;
+
+	start_test_case ();
+
+	for (i = 0; i < G_N_ELEMENTS (entries); i++) {
+		char *uri = g_strdup_printf ("file:///bulk-%d.ogg", i);
+		entries[i] = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, uri);
+		g_free (uri);
+	}
+	rhythmdb_commit (db);
+
+	model = rhythmdb_query_model_new_empty (db);
+	g_object_set (model, "sort-func", rhythmdb_query_model_location_sort_func, NULL);
+
+	/* first chunk into an empty model */
+	add_results (model, entries, first, G_N_ELEMENTS (first));
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == 3);
+
+	end_step ();
+
+	/* second chunk merged in, including an entry that's already there */
+	add_results (model, entries, second, G_N_ELEMENTS (second));
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == 6);
+
+	fail_unless (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter));
+	for (i = 0; i < G_N_ELEMENTS (entries); i++) {
+		RhythmDBEntry *entry;
+
+		entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+		fail_unless (entry == entries[i], "entry %d out of order", i);
+		rhythmdb_entry_unref (entry);
+
+		fail_unless (gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter) == (i < G_N_ELEMENTS (entries) - 1));
+	}
+
+	end_step ();
+
+	/* tidy up */
+	g_object_unref (model);
+	for (i = 0; i < G_N_ELEMENTS (entries); i++) {
+		rhythmdb_entry_delete (db, entries[i]);
+	}
+	rhythmdb_commit (db);
+
+	end_test_case ();
+}
+END_TEST
+
+static void
+check_sorted (RhythmDBQueryModel *model, GCompareDataFunc sort_func, gboolean reverse)
+{
+	RhythmDBEntry *prev = NULL;
+	GtkTreeIter iter;
+
+	fail_unless (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter));
+	do {
+		RhythmDBEntry *entry;
+
+		entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+		if (prev != NULL) {
+			int cmp = sort_func (prev, entry, NULL);
+			fail_unless (reverse ? cmp >= 0 : cmp <= 0, "entries out of order");
+			rhythmdb_entry_unref (prev);
+		}
+		prev = entry;
+	} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter));
+
+	rhythmdb_entry_unref (prev);
+}
+
+/* this tests that re-sorting the model by album, artist or genre, which
+ * sorts precomputed keys, matches the sort functions.
+ */
+START_TEST (test_resort_by_keys)
+{
+	RhythmDBQueryModel *model;
+	RhythmDBEntry *entries[64];
+	GPtrArray *results;
+	GCompareDataFunc funcs[] = {
+		(GCompareDataFunc) rhythmdb_query_model_album_sort_func,
+		(GCompareDataFunc) rhythmdb_query_model_artist_sort_func,
+		(GCompareDataFunc) rhythmdb_query_model_genre_sort_func,
+		(GCompareDataFunc) rhythmdb_query_model_track_sort_func,
+	};
+	GRand *rand;
+	int i;
+
+	start_test_case ();
+
+	rand = g_rand_new_with_seed (7);
+	for (i = 0; i < G_N_ELEMENTS (entries); i++) {
+		char *str;
+
+		str = g_strdup_printf ("file:///resort-%d.ogg", i);
+		entries[i] = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, str);
+		g_free (str);
+
+		str = g_strdup_printf ("Genre %d", g_rand_int_range (rand, 0, 3));
+		set_entry_string (db, entries[i], RHYTHMDB_PROP_GENRE, str);
+		g_free (str);
+
+		/* long shared prefixes, so the packed prefix often ties */
+		str = g_strdup_printf ("The Long Artist Name %d", g_rand_int_range (rand, 0, 4));
+		set_entry_string (db, entries[i], RHYTHMDB_PROP_ARTIST, str);
+		g_free (str);
+		if (g_rand_int_range (rand, 0, 4) == 0)
+			set_entry_string (db, entries[i], RHYTHMDB_PROP_ARTIST_SORTNAME, "Artist Name, The");
+
+		str = g_strdup_printf ("Album %d", g_rand_int_range (rand, 0, 3));
+		set_entry_string (db, entries[i], RHYTHMDB_PROP_ALBUM, str);
+		g_free (str);
+
+		set_entry_ulong (db, entries[i], RHYTHMDB_PROP_DISC_NUMBER, g_rand_int_range (rand, 0, 3));
+		set_entry_ulong (db, entries[i], RHYTHMDB_PROP_TRACK_NUMBER, g_rand_int_range (rand, 0, 5));
+	}
+	g_rand_free (rand);
+	rhythmdb_commit (db);
+
+	model = rhythmdb_query_model_new_empty (db);
+	results = g_ptr_array_new ();
+	for (i = 0; i < G_N_ELEMENTS (entries); i++) {
+		g_ptr_array_add (results, entries[i]);
+	}
+	rhythmdb_query_results_add_results (RHYTHMDB_QUERY_RESULTS (model), results);
+
+	for (i = 0; i < G_N_ELEMENTS (funcs); i++) {
+		rhythmdb_query_model_set_sort_order (model, funcs[i], NULL, NULL, FALSE);
+		check_sorted (model, funcs[i], FALSE);
+		rhythmdb_query_model_set_sort_order (model, funcs[i], NULL, NULL, TRUE);
+		check_sorted (model, funcs[i], TRUE);
+
+		end_step ();
+	}
+
+	/* tidy up */
+	g_object_unref (model);
+	for (i = 0; i < G_N_ELEMENTS (entries); i++) {
+		rhythmdb_entry_delete (db, entries[i]);
+	}
+	rhythmdb_commit (db);
+
+	end_test_case ();
+}
+END_TEST
+
+static RhythmDBQueryModel *
+run_time_query (RhythmDBQueryType type)
+{
+	RhythmDBQueryModel *model;
+	GPtrArray *query;
+
+	query = rhythmdb_query_parse (db,
+				      type, RHYTHMDB_PROP_LAST_PLAYED, (gulong) 60,
+				      RHYTHMDB_QUERY_END);
+	model = rhythmdb_query_model_new_empty (db);
+
+	set_waiting_signal (G_OBJECT (model), "complete");
+	rhythmdb_do_full_query_async_parsed (db, RHYTHMDB_QUERY_RESULTS (model), query);
+	wait_for_signal ();
+	rhythmdb_query_free (query);
+
+	return model;
+}
+
+/* this tests that entries move in and out of time-relative query models
+ * when the time window passes them.
+ */
+START_TEST (test_time_relative_expiry)
+{
+	RhythmDBQueryModel *within;
+	RhythmDBQueryModel *not_within;
+	RhythmDBEntry *recent;
+	RhythmDBEntry *old;
+	GtkTreeIter iter;
+	GTimeVal now;
+	GValue val = {0,};
+
+	start_test_case ();
+
+	g_get_current_time (&now);
+	g_value_init (&val, G_TYPE_ULONG);
+
+	/* leaves the last 60 seconds in a few seconds */
+	recent = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///recent.ogg");
+	g_value_set_ulong (&val, now.tv_sec - 57);
+	rhythmdb_entry_set (db, recent, RHYTHMDB_PROP_LAST_PLAYED, &val);
+
+	old = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///old.ogg");
+	g_value_set_ulong (&val, now.tv_sec - 3600);
+	rhythmdb_entry_set (db, old, RHYTHMDB_PROP_LAST_PLAYED, &val);
+	rhythmdb_commit (db);
+	g_value_unset (&val);
+
+	within = run_time_query (RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN);
+	not_within = run_time_query (RHYTHMDB_QUERY_PROP_CURRENT_TIME_NOT_WITHIN);
+
+	fail_unless (rhythmdb_query_model_entry_to_iter (within, recent, &iter));
+	fail_if (rhythmdb_query_model_entry_to_iter (within, old, &iter));
+	fail_if (rhythmdb_query_model_entry_to_iter (not_within, recent, &iter));
+	fail_unless (rhythmdb_query_model_entry_to_iter (not_within, old, &iter));
+
+	end_step ();
+
+	/* wait for the window to pass the recent entry */
+	while (rhythmdb_query_model_entry_to_iter (within, recent, &iter))
+		gtk_main_iteration ();
+	while (!rhythmdb_query_model_entry_to_iter (not_within, recent, &iter))
+		gtk_main_iteration ();
+
+	g_get_current_time (&now);
+	fail_unless (now.tv_sec >= rhythmdb_entry_get_ulong (recent, RHYTHMDB_PROP_LAST_PLAYED) + 60,
+		     "entry moved before the window passed it");
+	fail_unless (rhythmdb_query_model_entry_to_iter (not_within, old, &iter));
+
+	end_step ();
+
+	/* tidy up */
+	g_object_unref (within);
+	g_object_unref (not_within);
+	rhythmdb_entry_delete (db, recent);
+	rhythmdb_entry_delete (db, old);
+	rhythmdb_commit (db);
+
+	end_test_case ();
+}
+END_TEST
+
+static RhythmDBQueryModel *
+run_artist_query (const char *artist)
+{
+	RhythmDBQueryModel *model;
+	GPtrArray *query;
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_IGNORE,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_ARTIST, artist,
+				      RHYTHMDB_QUERY_END);
+	model = rhythmdb_query_model_new_empty (db);
+	g_object_set (model, "query", query, NULL);
+
+	set_waiting_signal (G_OBJECT (model), "complete");
+	rhythmdb_do_full_query_async_parsed (db, RHYTHMDB_QUERY_RESULTS (model), query);
+	wait_for_signal ();
+	rhythmdb_query_free (query);
+
+	return model;
+}
+
+/* this tests that frozen models, as used for cached searches that aren't
+ * being shown, report database changes they missed, and follow changes
+ * again once thawed.
+ */
+START_TEST (test_frozen_model)
+{
+	RhythmDBQueryModel *model;
+	RhythmDBEntry *a;
+	RhythmDBEntry *b;
+	GtkTreeIter iter;
+
+	start_test_case ();
+
+	a = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///frozen-a.ogg");
+	set_entry_string (db, a, RHYTHMDB_PROP_ARTIST, "Pixies");
+	b = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///frozen-b.ogg");
+	set_entry_string (db, b, RHYTHMDB_PROP_ARTIST, "Nirvana");
+	set_waiting_signal (G_OBJECT (db), "entry-added");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	model = run_artist_query ("Pixies");
+	fail_unless (rhythmdb_query_model_entry_to_iter (model, a, &iter));
+	fail_if (rhythmdb_query_model_entry_to_iter (model, b, &iter));
+
+	/* nothing changed while it was frozen */
+	rhythmdb_query_model_freeze (model);
+	fail_unless (rhythmdb_query_model_thaw (model), "unchanged model reported as out of date");
+
+	end_step ();
+
+	/* a change made while frozen isn't applied, but is reported */
+	rhythmdb_query_model_freeze (model);
+	set_entry_string (db, b, RHYTHMDB_PROP_ARTIST, "Pixies");
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	fail_if (rhythmdb_query_model_entry_to_iter (model, b, &iter), "frozen model followed a change");
+	fail_if (rhythmdb_query_model_thaw (model), "out of date model reported as current");
+	g_object_unref (model);
+
+	/* so the search is run again, and includes the change */
+	model = run_artist_query ("Pixies");
+	fail_unless (rhythmdb_query_model_entry_to_iter (model, b, &iter), "new results missing changed entry");
+
+	end_step ();
+
+	/* a thawed model follows changes again */
+	rhythmdb_query_model_freeze (model);
+	fail_unless (rhythmdb_query_model_thaw (model));
+	set_entry_string (db, a, RHYTHMDB_PROP_ARTIST, "Nirvana");
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	fail_if (rhythmdb_query_model_entry_to_iter (model, a, &iter), "thawed model didn't follow a change");
+	fail_unless (rhythmdb_query_model_entry_to_iter (model, b, &iter));
+
+	/* tidy up */
+	g_object_unref (model);
+	rhythmdb_entry_delete (db, a);
+	rhythmdb_entry_delete (db, b);
+	rhythmdb_commit (db);
+
+	end_test_case ();
+}
+END_TEST
+
+static void
+count_complete_cb (RhythmDBQueryModel *model, int *count)
+{
+	(*count)++;
+}
+
+static void
+read_only_cb (RhythmDB *db, gboolean readonly, gboolean *result)
+{
+	*result = readonly;
+}
+
+/* this tests that a cancelled query doesn't add any results to its
+ * query model, and doesn't tell it that the query is complete.
+ */
+START_TEST (test_cancelled_query)
+{
+	RhythmDBQueryModel *model;
+	GCancellable *cancellable;
+	GPtrArray *query;
+	gboolean readonly = FALSE;
+	gulong readonly_id;
+	int completed = 0;
+	int i;
+
+	start_test_case ();
+
+	for (i = 0; i < 100; i++) {
+		char *uri = g_strdup_printf ("file:///cancel-%d.ogg", i);
+		rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, uri);
+		g_free (uri);
+	}
+	set_waiting_signal (G_OBJECT (db), "entry-added");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_IGNORE,
+				      RHYTHMDB_QUERY_END);
+
+	cancellable = g_cancellable_new ();
+	model = rhythmdb_query_model_new_empty (db);
+	g_object_set (model, "cancellable", cancellable, NULL);
+	g_signal_connect (model, "complete", G_CALLBACK (count_complete_cb), &completed);
+	readonly_id = g_signal_connect (db, "read-only", G_CALLBACK (read_only_cb), &readonly);
+	rhythmdb_do_full_query_async_cancellable (db, RHYTHMDB_QUERY_RESULTS (model), query, cancellable);
+	g_cancellable_cancel (cancellable);
+
+	/* the database is read-only until the query thread finishes */
+	fail_unless (readonly, "database not read-only during the query");
+	while (readonly || rhythmdb_query_model_has_pending_changes (model))
+		gtk_main_iteration ();
+	g_signal_handler_disconnect (db, readonly_id);
+
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == 0,
+		     "cancelled query returned results");
+	fail_unless (completed == 0, "cancelled query completed");
+	g_object_unref (model);
+	g_object_unref (cancellable);
+
+	end_step ();
+
+	/* the same query without cancelling it */
+	model = rhythmdb_query_model_new_empty (db);
+	g_signal_connect (model, "complete", G_CALLBACK (count_complete_cb), &completed);
+	set_waiting_signal (G_OBJECT (model), "complete");
+	rhythmdb_do_full_query_async_parsed (db, RHYTHMDB_QUERY_RESULTS (model), query);
+	wait_for_signal ();
+
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == 100,
+		     "query returned the wrong number of results");
+	fail_unless (completed == 1, "query completed %d times", completed);
+	g_object_unref (model);
+
+	rhythmdb_query_free (query);
+	end_test_case ();
+}
+END_TEST
+
 static Suite *
 rhythmdb_query_model_suite (void)
 {
@@ -225,6 +645,11 @@ rhythmdb_query_model_suite (void)
 
 	/* test core functionality */
 	tcase_add_test (tc_chain, test_rhythmdb_db_queries);
+	tcase_add_test (tc_chain, test_bulk_insert_sorted);
+	tcase_add_test (tc_chain, test_resort_by_keys);
+	tcase_add_test (tc_chain, test_time_relative_expiry);
+	tcase_add_test (tc_chain, test_frozen_model);
+	tcase_add_test (tc_chain, test_cancelled_query);
 
 	/* tests for breakable bug fixes */
 	tcase_add_test (tc_bugs, test_hidden_chain_filter);
@@ -31,6 +31,9 @@
 #include <gtk/gtk.h>
 #include <string.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
+#include <utime.h>
 
 #include "test-utils.h"
 
@@ -39,6 +42,7 @@
 #include "rb-util.h"
 
 #include "rhythmdb.h"
+#include "rhythmdb-private.h"
 #include "rhythmdb-tree.h"
 #include "rhythmdb-query-model.h"
 
@@ -507,17 +511,1166 @@ START_TEST (test_rhythmdb_commit_change_merging)
 }
 END_TEST
 
+static void
+check_saved_generation (const char *name, guint64 generation)
+{
+	RhythmDB *loaded;
+
+	loaded = rhythmdb_tree_new (name);
+	set_waiting_signal (G_OBJECT (loaded), "load-complete");
+	rhythmdb_load (loaded);
+	wait_for_signal ();
+
+	fail_unless (rhythmdb_get_generation (loaded) == generation, "generation not restored");
+
+	rhythmdb_shutdown (loaded);
+	g_object_unref (G_OBJECT (loaded));
+}
+
+START_TEST (test_rhythmdb_generation)
+{
+	RhythmDBEntry *entry;
+	guint64 generation;
+	GValue val = {0,};
+	char *name;
+	char *journal;
+
+	name = g_build_filename (g_get_tmp_dir (), "test-rhythmdb-generation.xml", NULL);
+	journal = g_strconcat (name, ".journal", NULL);
+	g_unlink (name);
+	g_unlink (journal);
+	g_object_set (G_OBJECT (db), "name", name, NULL);
+
+	generation = rhythmdb_get_generation (db);
+	entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///whee.ogg");
+	fail_unless (entry != NULL, "failed to create entry");
+	set_waiting_signal (G_OBJECT (db), "entry-added");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+	fail_unless (rhythmdb_get_generation (db) != generation, "generation not changed by commit");
+
+	/* full save */
+	generation = rhythmdb_get_generation (db);
+	rhythmdb_save (db);
+	check_saved_generation (name, generation);
+
+	/* appended to the journal */
+	g_value_init (&val, G_TYPE_STRING);
+	g_value_set_static_string (&val, "Anything");
+	rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_GENRE, &val);
+	g_value_unset (&val);
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+	fail_unless (rhythmdb_get_generation (db) != generation, "generation not changed by commit");
+
+	generation = rhythmdb_get_generation (db);
+	rhythmdb_save (db);
+	fail_unless (g_file_test (journal, G_FILE_TEST_EXISTS), "changes not saved to the journal");
+	check_saved_generation (name, generation);
+
+	g_unlink (name);
+	g_unlink (journal);
+	g_free (journal);
+	g_free (name);
+}
+END_TEST
+
+static RhythmDB *
+load_saved_db (const char *name)
+{
+	RhythmDB *loaded;
+
+	loaded = rhythmdb_tree_new (name);
+	set_waiting_signal (G_OBJECT (loaded), "load-complete");
+	rhythmdb_load (loaded);
+	wait_for_signal ();
+	return loaded;
+}
+
+static void
+check_journalled_entries (RhythmDB *loaded)
+{
+	RhythmDBEntry *entry;
+	RBRefString *keyword;
+
+	entry = rhythmdb_entry_lookup_by_location (loaded, "file:///journal-a.ogg");
+	fail_unless (entry != NULL, "changed entry missing");
+	fail_unless (strcmp (rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_TITLE), "Changed") == 0,
+		     "change not replayed");
+	keyword = rb_refstring_new ("journalled");
+	fail_unless (rhythmdb_entry_keyword_has (loaded, entry, keyword), "keyword not replayed");
+	rb_refstring_unref (keyword);
+
+	fail_unless (rhythmdb_entry_lookup_by_location (loaded, "file:///journal-b.ogg") == NULL,
+		     "deleted entry came back");
+
+	entry = rhythmdb_entry_lookup_by_location (loaded, "file:///journal-c.ogg");
+	fail_unless (entry != NULL, "entry deleted and added again missing");
+	fail_unless (strcmp (rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_TITLE), "Added again") == 0,
+		     "entry deleted and added again has the old title");
+}
+
+START_TEST (test_rhythmdb_journal)
+{
+	RhythmDBEntry *a, *b, *c;
+	RhythmDB *loaded;
+	RBRefString *keyword;
+	char *name;
+	char *journal;
+	char *contents;
+	gsize length;
+
+	name = g_build_filename (g_get_tmp_dir (), "test-rhythmdb-journal.xml", NULL);
+	journal = g_strconcat (name, ".journal", NULL);
+	g_unlink (name);
+	g_unlink (journal);
+	g_object_set (G_OBJECT (db), "name", name, NULL);
+
+	a = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///journal-a.ogg");
+	b = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///journal-b.ogg");
+	c = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///journal-c.ogg");
+	set_entry_string (db, a, RHYTHMDB_PROP_TITLE, "Original");
+	set_entry_string (db, c, RHYTHMDB_PROP_TITLE, "Original");
+	set_waiting_signal (G_OBJECT (db), "entry-added");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	/* full save */
+	rhythmdb_save (db);
+	fail_if (g_file_test (journal, G_FILE_TEST_EXISTS), "full save wrote a journal");
+
+	/* a change and a deletion, appended to the journal */
+	set_entry_string (db, a, RHYTHMDB_PROP_TITLE, "Changed");
+	rhythmdb_entry_delete (db, b);
+	set_waiting_signal (G_OBJECT (db), "entry-deleted");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+	rhythmdb_save (db);
+	fail_unless (g_file_test (journal, G_FILE_TEST_EXISTS), "changes not saved to the journal");
+
+	/* a location deleted and used again, and a keyword, in one save */
+	rhythmdb_entry_delete (db, c);
+	rhythmdb_commit (db);
+	c = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///journal-c.ogg");
+	fail_unless (c != NULL, "couldn't add an entry for a deleted location");
+	set_entry_string (db, c, RHYTHMDB_PROP_TITLE, "Added again");
+	set_waiting_signal (G_OBJECT (db), "entry-added");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+	keyword = rb_refstring_new ("journalled");
+	rhythmdb_entry_keyword_add (db, a, keyword);
+	rb_refstring_unref (keyword);
+	rhythmdb_save (db);
+
+	loaded = load_saved_db (name);
+	check_journalled_entries (loaded);
+	rhythmdb_shutdown (loaded);
+	g_object_unref (G_OBJECT (loaded));
+
+	/* a journal cut off partway through the last record is still replayed up to there */
+	fail_unless (g_file_get_contents (journal, &contents, &length, NULL), "couldn't read the journal");
+	fail_unless (length > 10);
+	fail_unless (g_file_set_contents (journal, contents, length - 10, NULL), "couldn't truncate the journal");
+	g_free (contents);
+
+	loaded = load_saved_db (name);
+	check_journalled_entries (loaded);
+	rhythmdb_shutdown (loaded);
+	g_object_unref (G_OBJECT (loaded));
+
+	g_unlink (name);
+	g_unlink (journal);
+	g_free (journal);
+	g_free (name);
+}
+END_TEST
+
+#define ENTRY_POOL_TEST_ENTRIES	2000
+
+START_TEST (test_rhythmdb_entry_pool_usage)
+{
+	RhythmDB *loaded;
+	RhythmDBEntry *entry;
+	RhythmDBEntryType entry_type;
+	char *name;
+	guint n_entries;
+	gsize entry_size;
+	gsize bytes;
+	int i;
+
+	name = g_build_filename (g_get_tmp_dir (), "test-rhythmdb-entry-pool.xml", NULL);
+	g_unlink (name);
+	g_object_set (G_OBJECT (db), "name", name, NULL);
+
+	for (i = 0; i < ENTRY_POOL_TEST_ENTRIES; i++) {
+		char *uri = g_strdup_printf ("file:///pool-%d.ogg", i);
+		rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, uri);
+		g_free (uri);
+	}
+	set_waiting_signal (G_OBJECT (db), "entry-added");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+	rhythmdb_save (db);
+
+	loaded = load_saved_db (name);
+	entry = rhythmdb_entry_lookup_by_location (loaded, "file:///pool-0.ogg");
+	fail_unless (entry != NULL, "entry not loaded");
+	entry_type = rhythmdb_entry_get_entry_type (entry);
+
+	rhythmdb_entry_pool_get_usage (RHYTHMDB_ENTRY_TYPE_GET_POOL (entry_type), &n_entries, &entry_size, &bytes);
+	fail_unless (n_entries == ENTRY_POOL_TEST_ENTRIES, "%u entries in the pool", n_entries);
+
+	/* each entry only takes its own size, plus alignment */
+	fail_unless (entry_size >= sizeof (RhythmDBEntry) + entry_type->entry_type_data_size);
+	fail_unless (entry_size < sizeof (RhythmDBEntry) + entry_type->entry_type_data_size + 2 * sizeof (gdouble),
+		     "%" G_GSIZE_FORMAT " bytes per entry", entry_size);
+
+	/* and only the last slab is partly used */
+	fail_unless (bytes >= n_entries * entry_size);
+	fail_unless (bytes - n_entries * entry_size < 64 * 1024,
+		     "%" G_GSIZE_FORMAT " bytes of slabs for %u entries of %" G_GSIZE_FORMAT " bytes",
+		     bytes, n_entries, entry_size);
+
+	rhythmdb_shutdown (loaded);
+	g_object_unref (G_OBJECT (loaded));
+	g_unlink (name);
+	g_free (name);
+}
+END_TEST
+
+static int
+count_query_results (GPtrArray *query)
+{
+	RhythmDBQueryModel *model;
+	int count;
+
+	model = rhythmdb_query_model_new_empty (db);
+	set_waiting_signal (G_OBJECT (model), "complete");
+	rhythmdb_do_full_query_async_parsed (db, RHYTHMDB_QUERY_RESULTS (model), query);
+	wait_for_signal ();
+	count = gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL);
+	g_object_unref (model);
+
+	return count;
+}
+
+START_TEST (test_rhythmdb_query_profile)
+{
+	RhythmDBEntry *entry;
+	GPtrArray *query;
+	GValue val = {0,};
+	const char *artists[] = { "Nine Inch Nails", "Nina Simone", "Pixies" };
+	int profiled;
+	int i;
+
+	g_value_init (&val, G_TYPE_STRING);
+	for (i = 0; i < G_N_ELEMENTS (artists); i++) {
+		char *uri = g_strdup_printf ("file:///profile-%d.ogg", i);
+
+		entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, uri);
+		g_value_set_static_string (&val, artists[i]);
+		rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_ARTIST, &val);
+		g_free (uri);
+	}
+	g_value_unset (&val);
+	set_waiting_signal (G_OBJECT (db), "entry-added");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	/* a search, which is split into words, and a disjunction */
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_IGNORE,
+				      RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "nin",
+				      RHYTHMDB_QUERY_DISJUNCTION,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_ARTIST, "Pixies",
+				      RHYTHMDB_QUERY_END);
+
+	g_object_set (G_OBJECT (db), "profile-queries", TRUE, NULL);
+	profiled = count_query_results (query);
+	g_object_set (G_OBJECT (db), "profile-queries", FALSE, NULL);
+
+	fail_unless (profiled == 3, "wrong number of results when profiling");
+	fail_unless (count_query_results (query) == profiled, "profiling changed the query results");
+
+	rhythmdb_query_free (query);
+}
+END_TEST
+
+static int
+compare_string_ptrs (const char **a, const char **b)
+{
+	return strcmp (*a, *b);
+}
+
+static int
+count_search_results (RhythmDBPropType prop, const char *text)
+{
+	GPtrArray *query;
+	int count;
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_IGNORE,
+				      RHYTHMDB_QUERY_PROP_LIKE, prop, text,
+				      RHYTHMDB_QUERY_END);
+	count = count_query_results (query);
+	rhythmdb_query_free (query);
+	return count;
+}
+
+START_TEST (test_rhythmdb_word_index)
+{
+	RhythmDBEntry *nin;
+	RhythmDBEntry *pixies;
+	RhythmDBEntry *entry;
+
+	nin = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///words-1.ogg");
+	set_entry_string (db, nin, RHYTHMDB_PROP_TITLE, "Head Like a Hole");
+	set_entry_string (db, nin, RHYTHMDB_PROP_ARTIST, "Nine Inch Nails");
+	entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///words-2.ogg");
+	set_entry_string (db, entry, RHYTHMDB_PROP_TITLE, "Ninety Nine");
+	set_entry_string (db, entry, RHYTHMDB_PROP_ARTIST, "Nena");
+	pixies = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///words-3.ogg");
+	set_entry_string (db, pixies, RHYTHMDB_PROP_TITLE, "Debaser");
+	set_entry_string (db, pixies, RHYTHMDB_PROP_ARTIST, "Pixies");
+	set_waiting_signal (G_OBJECT (db), "entry-added");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	/* substrings running across the end of one word into the next */
+	fail_unless (count_search_results (RHYTHMDB_PROP_ARTIST_FOLDED, "e inch") == 1, "substring across words not found");
+	fail_unless (count_search_results (RHYTHMDB_PROP_TITLE_FOLDED, "ty ni") == 1, "substring across words not found");
+	fail_unless (count_search_results (RHYTHMDB_PROP_SEARCH_MATCH, "like hole") == 1, "search words not found");
+
+	/* too short to look up in the index, so every entry is checked */
+	fail_unless (count_search_results (RHYTHMDB_PROP_SEARCH_MATCH, "ni") == 2, "short search word");
+	fail_unless (count_search_results (RHYTHMDB_PROP_ARTIST_FOLDED, "s") == 2, "single character substring");
+	fail_unless (count_search_results (RHYTHMDB_PROP_SEARCH_MATCH, "xyz") == 0, "unknown trigram matched");
+
+	/* the index follows title and artist changes */
+	set_entry_string (db, pixies, RHYTHMDB_PROP_TITLE, "Gigantic");
+	set_entry_string (db, nin, RHYTHMDB_PROP_ARTIST, "Bauhaus");
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	fail_unless (count_search_results (RHYTHMDB_PROP_SEARCH_MATCH, "gigan") == 1, "new title not indexed");
+	fail_unless (count_search_results (RHYTHMDB_PROP_SEARCH_MATCH, "debaser") == 0, "old title still indexed");
+	fail_unless (count_search_results (RHYTHMDB_PROP_SEARCH_MATCH, "bauhaus") == 1, "new artist not indexed");
+	fail_unless (count_search_results (RHYTHMDB_PROP_ARTIST_FOLDED, "e inch") == 0, "old artist still indexed");
+	fail_unless (count_search_results (RHYTHMDB_PROP_SEARCH_MATCH, "nin") == 1, "shared word lost with the old artist");
+}
+END_TEST
+
+/* returns the locations of the entries matching the query, in the order
+ * they were returned or sorted
+ */
+static char *
+query_result_locations (RhythmDB *query_db, GPtrArray *query, gboolean sorted)
+{
+	RhythmDBQueryModel *model;
+	GPtrArray *locations;
+	GtkTreeIter iter;
+	char *result;
+
+	model = rhythmdb_query_model_new_empty (query_db);
+	set_waiting_signal (G_OBJECT (model), "complete");
+	rhythmdb_do_full_query_parsed (query_db, RHYTHMDB_QUERY_RESULTS (model), query);
+	wait_for_signal ();
+
+	locations = g_ptr_array_new ();
+	if (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter)) {
+		do {
+			RhythmDBEntry *entry;
+
+			entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+			g_ptr_array_add (locations, (gpointer) rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION));
+			rhythmdb_entry_unref (entry);
+		} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter));
+	}
+	if (sorted)
+		g_ptr_array_sort (locations, (GCompareFunc) compare_string_ptrs);
+	g_ptr_array_add (locations, NULL);
+
+	result = g_strjoinv (" ", (char **) locations->pdata);
+	g_ptr_array_free (locations, TRUE);
+	g_object_unref (model);
+	return result;
+}
+
+static void
+check_indexed_query (GPtrArray *query, const char *desc)
+{
+	char *unindexed;
+	char *indexed;
+
+	g_object_set (G_OBJECT (db), "secondary-indexes", FALSE, NULL);
+	unindexed = query_result_locations (db, query, TRUE);
+	g_object_set (G_OBJECT (db), "secondary-indexes", TRUE, NULL);
+	indexed = query_result_locations (db, query, TRUE);
+
+	fail_unless (unindexed[0] != '\0', "no results for %s", desc);
+	fail_unless (strcmp (indexed, unindexed) == 0,
+		     "indexed results for %s differ: \"%s\", expected \"%s\"", desc, indexed, unindexed);
+
+	g_free (indexed);
+	g_free (unindexed);
+}
+
+START_TEST (test_rhythmdb_prop_indexes)
+{
+	RhythmDBEntry *entries[40];
+	GPtrArray *greater;
+	GPtrArray *less;
+	GPtrArray *between;
+	GPtrArray *rating;
+	GValue val = {0,};
+	int i;
+
+	g_value_init (&val, G_TYPE_DOUBLE);
+	for (i = 0; i < G_N_ELEMENTS (entries); i++) {
+		char *uri = g_strdup_printf ("file:///index-%02d.ogg", i);
+
+		entries[i] = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, uri);
+		set_entry_ulong (db, entries[i], RHYTHMDB_PROP_PLAY_COUNT, i);
+		g_value_set_double (&val, i % 6);
+		rhythmdb_entry_set (db, entries[i], RHYTHMDB_PROP_RATING, &val);
+		g_free (uri);
+	}
+	set_waiting_signal (G_OBJECT (db), "entry-added");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	/* each of these matches few enough entries for the index to be used */
+	greater = rhythmdb_query_parse (db,
+					RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_IGNORE,
+					RHYTHMDB_QUERY_PROP_GREATER, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 35,
+					RHYTHMDB_QUERY_END);
+	less = rhythmdb_query_parse (db,
+				     RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_IGNORE,
+				     RHYTHMDB_QUERY_PROP_LESS, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 3,
+				     RHYTHMDB_QUERY_END);
+	between = rhythmdb_query_parse (db,
+					RHYTHMDB_QUERY_PROP_GREATER, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 10,
+					RHYTHMDB_QUERY_PROP_LESS, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 12,
+					RHYTHMDB_QUERY_END);
+	rating = rhythmdb_query_parse (db,
+				       RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_RATING, 5.0,
+				       RHYTHMDB_QUERY_END);
+
+	check_indexed_query (greater, "play count greater than");
+	check_indexed_query (less, "play count less than");
+	check_indexed_query (between, "play count range");
+	check_indexed_query (rating, "rating equal to");
+
+	/* move entries in and out of the ranges, and delete one */
+	g_object_set (G_OBJECT (db), "secondary-indexes", TRUE, NULL);
+	set_entry_ulong (db, entries[0], RHYTHMDB_PROP_PLAY_COUNT, 100);
+	set_entry_ulong (db, entries[39], RHYTHMDB_PROP_PLAY_COUNT, 1);
+	set_entry_ulong (db, entries[20], RHYTHMDB_PROP_PLAY_COUNT, 11);
+	g_value_set_double (&val, 5.0);
+	rhythmdb_entry_set (db, entries[1], RHYTHMDB_PROP_RATING, &val);
+	g_value_set_double (&val, 0.0);
+	rhythmdb_entry_set (db, entries[5], RHYTHMDB_PROP_RATING, &val);
+	rhythmdb_entry_delete (db, entries[11]);
+	g_value_unset (&val);
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	check_indexed_query (greater, "play count greater than, after changes");
+	check_indexed_query (less, "play count less than, after changes");
+	check_indexed_query (between, "play count range, after changes");
+	check_indexed_query (rating, "rating equal to, after changes");
+
+	rhythmdb_query_free (greater);
+	rhythmdb_query_free (less);
+	rhythmdb_query_free (between);
+	rhythmdb_query_free (rating);
+}
+END_TEST
+
+/* results saved along with a generation may only be reused if the
+ * database loaded with that generation still gives the same results.
+ */
+static gboolean
+check_saved_results (const char *name, GPtrArray *query, guint64 generation, const char *results)
+{
+	RhythmDB *loaded;
+	gboolean reused;
+	char *current;
+
+	loaded = load_saved_db (name);
+	reused = (rhythmdb_get_generation (loaded) == generation);
+	if (reused) {
+		current = query_result_locations (loaded, query, TRUE);
+		fail_unless (strcmp (current, results) == 0,
+			     "saved results reused, but the query now gives \"%s\", not \"%s\"", current, results);
+		g_free (current);
+	}
+
+	rhythmdb_shutdown (loaded);
+	g_object_unref (G_OBJECT (loaded));
+	return reused;
+}
+
+START_TEST (test_rhythmdb_generation_saved_results)
+{
+	RhythmDBEntry *entry;
+	GPtrArray *query;
+	guint64 generation;
+	char *results;
+	char *name;
+	char *journal;
+
+	name = g_build_filename (g_get_tmp_dir (), "test-rhythmdb-saved-results.xml", NULL);
+	journal = g_strconcat (name, ".journal", NULL);
+	g_unlink (name);
+	g_unlink (journal);
+	g_object_set (G_OBJECT (db), "name", name, NULL);
+
+	entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///results-a.ogg");
+	set_entry_string (db, entry, RHYTHMDB_PROP_TITLE, "Match");
+	entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///results-b.ogg");
+	set_entry_string (db, entry, RHYTHMDB_PROP_TITLE, "Match");
+	set_waiting_signal (G_OBJECT (db), "entry-added");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_IGNORE,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TITLE, "Match",
+				      RHYTHMDB_QUERY_END);
+
+	/* the results are saved with the generation, as an auto playlist does */
+	rhythmdb_save (db);
+	results = query_result_locations (db, query, TRUE);
+	generation = rhythmdb_get_generation (db);
+	fail_unless (check_saved_results (name, query, generation, results), "unchanged results not reused");
+
+	/* an entry stops matching, and the database is saved in between
+	 * the change and its commit.
+	 */
+	set_entry_string (db, entry, RHYTHMDB_PROP_TITLE, "Changed");
+	rhythmdb_save (db);
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+	check_saved_results (name, query, generation, results);
+
+	/* once the committed change has been saved, the results are out of date */
+	rhythmdb_save (db);
+	fail_if (check_saved_results (name, query, generation, results), "out of date results reused");
+
+	g_free (results);
+	rhythmdb_query_free (query);
+	g_unlink (name);
+	g_unlink (journal);
+	g_free (journal);
+	g_free (name);
+}
+END_TEST
+
+START_TEST (test_rhythmdb_unset_cold_fields)
+{
+	RhythmDBEntry *entry;
+	RBRefString *mbid;
+	GValue val = {0,};
+
+	entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///cold.ogg");
+	fail_unless (entry != NULL, "failed to create entry");
+	rhythmdb_commit (db);
+
+	/* setting a playback error allocates the rarely used fields */
+	g_value_init (&val, G_TYPE_STRING);
+	g_value_set_static_string (&val, "Couldn't play");
+	rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_PLAYBACK_ERROR, &val);
+	g_value_unset (&val);
+	rhythmdb_commit (db);
+
+	/* musicbrainz IDs are still empty strings, as they were before */
+	fail_unless (rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_MUSICBRAINZ_TRACKID) != NULL,
+		     "unset track ID is NULL");
+	fail_unless (strcmp (rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_MUSICBRAINZ_TRACKID), "") == 0,
+		     "unset track ID isn't empty");
+	fail_unless (strcmp (rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_MUSICBRAINZ_ALBUMARTISTID), "") == 0,
+		     "unset album artist ID isn't empty");
+
+	mbid = rhythmdb_entry_get_refstring (entry, RHYTHMDB_PROP_MUSICBRAINZ_ARTISTID);
+	fail_unless (mbid != NULL, "unset artist ID refstring is NULL");
+	fail_unless (strcmp (rb_refstring_get (mbid), "") == 0, "unset artist ID refstring isn't empty");
+	rb_refstring_unref (mbid);
+}
+END_TEST
+
+START_TEST (test_rhythmdb_mirrored_cold_fields)
+{
+	RhythmDBEntry *entry;
+	RBRefString *str;
+
+	entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///mirrored.ogg");
+	fail_unless (entry != NULL, "failed to create entry");
+	rhythmdb_commit (db);
+
+	/* unset times and the last seen time of visible entries need no storage */
+	fail_unless (strcmp (rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LAST_PLAYED_STR), _("Never")) == 0,
+		     "unset last played time isn't 'Never'");
+	fail_unless (strcmp (rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_FIRST_SEEN_STR), _("Never")) == 0,
+		     "unset first seen time isn't 'Never'");
+	fail_unless (rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LAST_SEEN_STR) == NULL,
+		     "last seen time of a visible entry isn't NULL");
+	fail_unless (entry->cold == NULL, "reading unset time strings allocated the cold fields");
+
+	/* formatting a time for a refstring doesn't store it */
+	set_entry_ulong (db, entry, RHYTHMDB_PROP_LAST_PLAYED, 1354285);
+	rhythmdb_commit (db);
+	str = rhythmdb_entry_get_refstring (entry, RHYTHMDB_PROP_LAST_PLAYED_STR);
+	fail_unless (str != NULL && strlen (rb_refstring_get (str)) > 0, "last played time not formatted");
+	fail_unless (strcmp (rb_refstring_get (str), _("Never")) != 0, "set last played time is 'Never'");
+	fail_unless (entry->cold == NULL, "reading a time refstring allocated the cold fields");
+
+	/* the const string has to live somewhere, and matches the refstring */
+	fail_unless (strcmp (rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LAST_PLAYED_STR),
+			     rb_refstring_get (str)) == 0,
+		     "last played string doesn't match its refstring");
+	fail_unless (entry->cold != NULL, "last played string isn't stored");
+	rb_refstring_unref (str);
+}
+END_TEST
+
+START_TEST (test_rhythmdb_parallel_query)
+{
+	GPtrArray *query;
+	char *parallel;
+	char *serial;
+	int i;
+
+	for (i = 0; i < 500; i++) {
+		RhythmDBEntry *entry;
+		char *uri;
+		char *title;
+
+		uri = g_strdup_printf ("file:///parallel-%d.ogg", i);
+		title = g_strdup_printf ("Track %d", i);
+		entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, uri);
+		set_entry_string (db, entry, RHYTHMDB_PROP_TITLE, title);
+		set_entry_string (db, entry, RHYTHMDB_PROP_ARTIST, (i % 3) ? "Artist" : "Other Artist");
+		set_entry_string (db, entry, RHYTHMDB_PROP_ALBUM, (i % 7) ? "Album" : "Other Album");
+		g_free (title);
+		g_free (uri);
+	}
+	set_waiting_signal (G_OBJECT (db), "entry-added");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	/* too short for the word index, so every entry is checked */
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_IGNORE,
+				      RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_TITLE_FOLDED, "1",
+				      RHYTHMDB_QUERY_END);
+
+	g_object_set (G_OBJECT (db), "parallel-query-threshold", G_MAXUINT, NULL);
+	serial = query_result_locations (db, query, FALSE);
+	g_object_set (G_OBJECT (db), "parallel-query-threshold", 16, NULL);
+	parallel = query_result_locations (db, query, FALSE);
+
+	fail_unless (serial[0] != '\0', "no results");
+	fail_unless (strcmp (parallel, serial) == 0,
+		     "parallel results differ: \"%s\", expected \"%s\"", parallel, serial);
+
+	/* the pool is kept for the next query */
+	g_free (parallel);
+	parallel = query_result_locations (db, query, FALSE);
+	fail_unless (strcmp (parallel, serial) == 0, "second parallel query results differ");
+
+	g_free (parallel);
+	g_free (serial);
+	rhythmdb_query_free (query);
+}
+END_TEST
+
+#define LOAD_TEST_FILES		4
+#define LOAD_TEST_REPEATS	4
+
+static void
+set_file_mtime (const char *uri, time_t mtime)
+{
+	struct utimbuf times;
+	char *filename;
+
+	filename = g_filename_from_uri (uri, NULL, NULL);
+	times.actime = mtime;
+	times.modtime = mtime;
+	fail_unless (g_utime (filename, &times) == 0, "couldn't set the modification time of %s", filename);
+	g_free (filename);
+}
+
+static char **
+create_load_test_files (const char *dir, int count, time_t mtime)
+{
+	char **uris;
+	int i;
+
+	fail_unless (g_mkdir_with_parents (dir, 0700) == 0, "couldn't create %s", dir);
+
+	uris = g_new0 (char *, count + 1);
+	for (i = 0; i < count; i++) {
+		char *filename;
+		char *contents;
+
+		filename = g_strdup_printf ("%s/load-test-%d.txt", dir, i);
+		contents = g_strdup_printf ("not an audio file %d\n", i);
+		fail_unless (g_file_set_contents (filename, contents, -1, NULL), "couldn't write %s", filename);
+		uris[i] = g_filename_to_uri (filename, NULL, NULL);
+		set_file_mtime (uris[i], mtime);
+		g_free (contents);
+		g_free (filename);
+	}
+
+	return uris;
+}
+
+static void
+delete_load_test_files (const char *dir, char **uris)
+{
+	int i;
+
+	for (i = 0; uris[i] != NULL; i++) {
+		char *filename;
+
+		filename = g_filename_from_uri (uris[i], NULL, NULL);
+		g_unlink (filename);
+		g_free (filename);
+	}
+	g_rmdir (dir);
+	g_strfreev (uris);
+}
+
+static void
+run_main_loop_briefly (void)
+{
+	while (gtk_events_pending ())
+		gtk_main_iteration ();
+	g_usleep (G_USEC_PER_SEC / 100);
+}
+
+/*
+ * Runs the main loop until there are no loads left and the entry for
+ * each file has the given modification time, checking that it never goes
+ * backwards on the way.
+ */
+static gboolean
+wait_for_loaded_mtime (char **uris, gulong *seen, gulong mtime)
+{
+	int tries;
+	int i;
+
+	for (tries = 0; tries < 1000; tries++) {
+		gboolean done;
+
+		run_main_loop_briefly ();
+
+		g_mutex_lock (db->priv->load_mutex);
+		done = (g_hash_table_size (db->priv->loading_uris) == 0);
+		g_mutex_unlock (db->priv->load_mutex);
+
+		for (i = 0; uris[i] != NULL; i++) {
+			RhythmDBEntry *entry;
+			gulong entry_mtime;
+
+			entry = rhythmdb_entry_lookup_by_location (db, uris[i]);
+			if (entry == NULL) {
+				done = FALSE;
+				continue;
+			}
+
+			entry_mtime = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_MTIME);
+			fail_unless (entry_mtime >= seen[i], "mtime of %s went back from %lu to %lu",
+				     uris[i], seen[i], entry_mtime);
+			seen[i] = entry_mtime;
+			if (entry_mtime != mtime)
+				done = FALSE;
+		}
+
+		if (done)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+START_TEST (test_rhythmdb_load_ordering)
+{
+	gulong seen[LOAD_TEST_FILES] = {0,};
+	char **uris;
+	char *dir;
+	time_t base;
+	int round;
+	int i;
+	int j;
+
+	g_object_set (G_OBJECT (db), "metadata-workers", 4, NULL);
+
+	dir = g_strdup_printf ("%s/test-rhythmdb-load-%d", g_get_tmp_dir (), (int) getpid ());
+	base = time (NULL) - 1000;
+	uris = create_load_test_files (dir, LOAD_TEST_FILES, base);
+
+	for (round = 0; round < 3; round++) {
+		/* queue several loads of each file before any of them can finish,
+		 * so most of them are deferred until the previous one is done.
+		 */
+		for (i = 0; i < LOAD_TEST_FILES; i++) {
+			if (round > 0)
+				set_file_mtime (uris[i], base + round);
+			for (j = 0; j < LOAD_TEST_REPEATS; j++)
+				rhythmdb_add_uri (db, uris[i]);
+		}
+
+		fail_unless (wait_for_loaded_mtime (uris, seen, base + round),
+			     "loads didn't finish in round %d", round);
+	}
+
+	delete_load_test_files (dir, uris);
+	g_free (dir);
+}
+END_TEST
+
+START_TEST (test_rhythmdb_load_blocked)
+{
+	gulong seen[LOAD_TEST_FILES] = {0,};
+	char **uris;
+	char *dir;
+	time_t base;
+	int tries;
+	int i;
+
+	g_object_set (G_OBJECT (db), "metadata-workers", 4, NULL);
+
+	dir = g_strdup_printf ("%s/test-rhythmdb-blocked-%d", g_get_tmp_dir (), (int) getpid ());
+	base = time (NULL) - 1000;
+	uris = create_load_test_files (dir, LOAD_TEST_FILES, base);
+
+	/* block metadata loads, as if missing plugins were being installed */
+	g_mutex_lock (db->priv->metadata_lock);
+	db->priv->metadata_blocked = TRUE;
+	g_mutex_unlock (db->priv->metadata_lock);
+
+	for (i = 0; i < LOAD_TEST_FILES; i++) {
+		rhythmdb_add_uri (db, uris[i]);
+	}
+
+	/* give the files time to be dispatched to the load threads */
+	for (tries = 0; tries < 50; tries++) {
+		run_main_loop_briefly ();
+	}
+	for (i = 0; i < LOAD_TEST_FILES; i++) {
+		fail_unless (rhythmdb_entry_lookup_by_location (db, uris[i]) == NULL,
+			     "%s was loaded while metadata loads were blocked", uris[i]);
+	}
+
+	/* every waiting load thread should be released, not just one */
+	g_mutex_lock (db->priv->metadata_lock);
+	rhythmdb_unblock_metadata (db);
+	g_mutex_unlock (db->priv->metadata_lock);
+
+	fail_unless (wait_for_loaded_mtime (uris, seen, base), "waiting loads weren't released");
+
+	delete_load_test_files (dir, uris);
+	g_free (dir);
+}
+END_TEST
+
+static guint64
+get_dir_mtime (const char *uri)
+{
+	GFileInfo *info;
+	GFile *dir;
+	guint64 mtime;
+
+	dir = g_file_new_for_uri (uri);
+	info = g_file_query_info (dir, G_FILE_ATTRIBUTE_TIME_MODIFIED, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	fail_unless (info != NULL, "couldn't get the modification time of %s", uri);
+	mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+	g_object_unref (info);
+	g_object_unref (dir);
+
+	return mtime;
+}
+
+static gboolean
+dir_cache_has (RhythmDB *cache_db, const char *uri)
+{
+	gboolean ret;
+
+	g_mutex_lock (cache_db->priv->dir_cache_mutex);
+	ret = (g_hash_table_lookup (cache_db->priv->dir_cache, uri) != NULL);
+	g_mutex_unlock (cache_db->priv->dir_cache_mutex);
+	return ret;
+}
+
+static RhythmDB *
+load_dir_cache (const char *name, const char *contents)
+{
+	RhythmDB *loaded;
+	char *filename;
+
+	if (contents != NULL) {
+		filename = g_strconcat (name, ".dirs", NULL);
+		fail_unless (g_file_set_contents (filename, contents, -1, NULL), "couldn't write %s", filename);
+		g_free (filename);
+	}
+
+	loaded = rhythmdb_tree_new (name);
+	rhythmdb_dir_cache_load (loaded);
+	return loaded;
+}
+
+static void
+free_dir_cache_db (RhythmDB *cache_db)
+{
+	rhythmdb_shutdown (cache_db);
+	g_object_unref (G_OBJECT (cache_db));
+}
+
+START_TEST (test_rhythmdb_dir_cache_save_load)
+{
+	RhythmDB *saved;
+	RhythmDB *loaded;
+	char **uris;
+	char *dir;
+	char *dir_uri;
+	char *name;
+	char *filename;
+	char *contents;
+	guint64 mtime;
+	int i;
+
+	name = g_build_filename (g_get_tmp_dir (), "test-rhythmdb-dir-cache.xml", NULL);
+	filename = g_strconcat (name, ".dirs", NULL);
+	g_unlink (filename);
+
+	dir = g_strdup_printf ("%s/test-rhythmdb-dir-cache-%d", g_get_tmp_dir (), (int) getpid ());
+	uris = create_load_test_files (dir, LOAD_TEST_FILES, time (NULL) - 1000);
+	dir_uri = g_filename_to_uri (dir, NULL, NULL);
+	mtime = get_dir_mtime (dir_uri);
+
+	saved = load_dir_cache (name, NULL);
+	rhythmdb_dir_cache_record (saved, dir_uri, mtime, mtime + 1, LOAD_TEST_FILES);
+	rhythmdb_dir_cache_record (saved, "file:///nonexistent/dir", 100, 200, 5);
+	rhythmdb_dir_cache_save (saved);
+	free_dir_cache_db (saved);
+
+	fail_unless (g_file_get_contents (filename, &contents, NULL, NULL), "directory records not saved");
+	fail_unless (g_str_has_prefix (contents, "rhythmdb-dirs 1\n"), "no header in saved records");
+	g_free (contents);
+
+	/* both records come back, and the directory is still unchanged once
+	 * the entries for its files are loaded.
+	 */
+	loaded = load_dir_cache (name, NULL);
+	fail_unless (g_hash_table_size (loaded->priv->dir_cache) == 2, "%u records loaded",
+		     g_hash_table_size (loaded->priv->dir_cache));
+	fail_unless (dir_cache_has (loaded, "file:///nonexistent/dir"));
+	for (i = 0; uris[i] != NULL; i++) {
+		rhythmdb_dir_cache_count_entry (loaded, uris[i]);
+	}
+	fail_unless (rhythmdb_dir_cache_check (loaded, dir_uri, NULL), "loaded directory record doesn't match");
+
+	/* nothing has changed since loading, so nothing is written */
+	g_unlink (filename);
+	rhythmdb_dir_cache_save (loaded);
+	fail_if (g_file_test (filename, G_FILE_TEST_EXISTS), "unchanged records saved");
+	free_dir_cache_db (loaded);
+
+	/* a record cut off part way through is dropped, along with anything unreadable */
+	loaded = load_dir_cache (name,
+				 "rhythmdb-dirs 1\n"
+				 "100 5 file:///a\n"
+				 "300\n"
+				 "400 7 \n"
+				 "200 6 file:///b");
+	fail_unless (g_hash_table_size (loaded->priv->dir_cache) == 1, "%u records loaded from a truncated file",
+		     g_hash_table_size (loaded->priv->dir_cache));
+	fail_unless (dir_cache_has (loaded, "file:///a"), "complete record not loaded");
+	fail_if (dir_cache_has (loaded, "file:///b"), "truncated record loaded");
+	free_dir_cache_db (loaded);
+
+	/* records in a format we don't know are ignored */
+	loaded = load_dir_cache (name,
+				 "rhythmdb-dirs 2\n"
+				 "100 5 file:///a\n");
+	fail_unless (g_hash_table_size (loaded->priv->dir_cache) == 0, "records loaded from an unknown format");
+	free_dir_cache_db (loaded);
+
+	g_unlink (filename);
+	delete_load_test_files (dir, uris);
+	g_free (dir_uri);
+	g_free (dir);
+	g_free (filename);
+	g_free (name);
+}
+END_TEST
+
+START_TEST (test_rhythmdb_dir_cache_record)
+{
+	const char *uri = "file:///nonexistent/dir";
+
+	/* modified in the same second it was read, so it could have changed again */
+	rhythmdb_dir_cache_record (db, uri, 1000, 1000, 5);
+	fail_if (dir_cache_has (db, uri), "directory modified while it was read recorded");
+
+	rhythmdb_dir_cache_record (db, uri, 999, 1000, 5);
+	fail_unless (dir_cache_has (db, uri), "directory not recorded");
+
+	/* and an existing record is dropped rather than kept */
+	db->priv->dir_cache_dirty = FALSE;
+	rhythmdb_dir_cache_record (db, uri, 2000, 2000, 5);
+	fail_if (dir_cache_has (db, uri), "old record kept for a directory modified while it was read");
+	fail_unless (db->priv->dir_cache_dirty, "dropping a record didn't mark the records as changed");
+}
+END_TEST
+
+START_TEST (test_rhythmdb_dir_cache_check)
+{
+	char **uris;
+	char *dir;
+	char *dir_uri;
+	guint64 mtime;
+	int i;
+
+	dir = g_strdup_printf ("%s/test-rhythmdb-dir-check-%d", g_get_tmp_dir (), (int) getpid ());
+	uris = create_load_test_files (dir, LOAD_TEST_FILES, time (NULL) - 1000);
+	dir_uri = g_filename_to_uri (dir, NULL, NULL);
+	mtime = get_dir_mtime (dir_uri);
+
+	fail_if (rhythmdb_dir_cache_check (db, dir_uri, NULL), "unrecorded directory passed");
+
+	for (i = 0; uris[i] != NULL; i++) {
+		rhythmdb_dir_cache_count_entry (db, uris[i]);
+	}
+	rhythmdb_dir_cache_record (db, dir_uri, mtime, mtime + 1, LOAD_TEST_FILES);
+	fail_unless (rhythmdb_dir_cache_check (db, dir_uri, NULL), "unchanged directory failed");
+
+	/* a file was added or removed without an entry being added or removed */
+	rhythmdb_dir_cache_record (db, dir_uri, mtime, mtime + 1, LOAD_TEST_FILES + 1);
+	fail_if (rhythmdb_dir_cache_check (db, dir_uri, NULL), "directory with a missing entry passed");
+
+	rhythmdb_dir_cache_record (db, dir_uri, mtime, mtime + 1, LOAD_TEST_FILES);
+	fail_unless (rhythmdb_dir_cache_check (db, dir_uri, NULL), "unchanged directory failed");
+
+	/* the directory was modified */
+	set_file_mtime (dir_uri, mtime - 10);
+	fail_if (rhythmdb_dir_cache_check (db, dir_uri, NULL), "modified directory passed");
+
+	delete_load_test_files (dir, uris);
+	g_free (dir_uri);
+	g_free (dir);
+}
+END_TEST
+
+/* a few batches of RHYTHMDB_STAT_BATCH_SIZE, and part of another */
+#define STAT_TEST_FILES		(3 * 64 + 5)
+
+START_TEST (test_rhythmdb_stat_batches)
+{
+	RhythmDB *stat_db;
+	char **uris;
+	char *dir;
+	time_t mtime;
+	guint done;
+	guint total;
+	guint last_done = 0;
+	gboolean checking = TRUE;
+	int tries;
+	int i;
+
+	dir = g_strdup_printf ("%s/test-rhythmdb-stat-%d", g_get_tmp_dir (), (int) getpid ());
+	mtime = time (NULL) - 1000;
+	uris = create_load_test_files (dir, STAT_TEST_FILES, mtime);
+
+	/* entries for the files, as if they'd been loaded from the database,
+	 * all up to date so checking them doesn't need to read any metadata.
+	 */
+	stat_db = rhythmdb_tree_new ("test-stat");
+	for (i = 0; uris[i] != NULL; i++) {
+		RhythmDBEntry *entry;
+		GValue val = {0,};
+		char *filename;
+		struct stat st;
+
+		filename = g_filename_from_uri (uris[i], NULL, NULL);
+		fail_unless (g_stat (filename, &st) == 0, "couldn't stat %s", filename);
+		g_free (filename);
+
+		entry = rhythmdb_entry_new (stat_db, RHYTHMDB_ENTRY_TYPE_SONG, uris[i]);
+		g_value_init (&val, G_TYPE_ULONG);
+		g_value_set_ulong (&val, mtime);
+		rhythmdb_entry_set (stat_db, entry, RHYTHMDB_PROP_MTIME, &val);
+		g_value_unset (&val);
+		g_value_init (&val, G_TYPE_UINT64);
+		g_value_set_uint64 (&val, st.st_size);
+		rhythmdb_entry_set (stat_db, entry, RHYTHMDB_PROP_FILE_SIZE, &val);
+		g_value_unset (&val);
+	}
+	rhythmdb_commit (stat_db);
+
+	for (i = 0; uris[i] != NULL; i++) {
+		rhythmdb_add_uri (stat_db, uris[i]);
+	}
+
+	/* checking the files is split into batches once the action thread starts */
+	rhythmdb_start_action_thread (stat_db);
+	for (tries = 0; tries < 1000 && checking; tries++) {
+		run_main_loop_briefly ();
+
+		if (rhythmdb_get_stat_progress (stat_db, &done, &total)) {
+			fail_unless (total == STAT_TEST_FILES, "checking %u files, not %u", total, STAT_TEST_FILES);
+			fail_unless (done <= total, "%u of %u files checked", done, total);
+			fail_unless (done >= last_done, "checked files went from %u back to %u", last_done, done);
+			last_done = done;
+		}
+
+		/* each entry is seen once its stat result has been processed */
+		checking = stat_db->priv->stat_thread_running;
+		for (i = 0; uris[i] != NULL && !checking; i++) {
+			RhythmDBEntry *entry;
+
+			entry = rhythmdb_entry_lookup_by_location (stat_db, uris[i]);
+			checking = (rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_LAST_SEEN) == 0);
+		}
+	}
+	fail_if (checking, "files not checked");
+
+	/* each file was counted once */
+	fail_unless (g_atomic_int_get (&stat_db->priv->stat_total) == STAT_TEST_FILES);
+	fail_unless (g_atomic_int_get (&stat_db->priv->stat_done) == STAT_TEST_FILES,
+		     "%d of %d files checked", g_atomic_int_get (&stat_db->priv->stat_done), STAT_TEST_FILES);
+
+	rhythmdb_shutdown (stat_db);
+	g_object_weak_ref (G_OBJECT (stat_db), (GWeakNotify) gtk_main_quit, NULL);
+	g_idle_add ((GSourceFunc) g_object_unref, stat_db);
+	gtk_main ();
+
+	delete_load_test_files (dir, uris);
+	g_free (dir);
+}
+END_TEST
+
 static Suite *
 rhythmdb_suite (void)
 {
 	Suite *s = suite_create ("rhythmdb");
 	TCase *tc_chain = tcase_create ("rhythmdb-core");
 	TCase *tc_bugs = tcase_create ("rhythmdb-bugs");
+	TCase *tc_load = tcase_create ("rhythmdb-load");
 
 	suite_add_tcase (s, tc_chain);
 	tcase_add_checked_fixture (tc_chain, test_rhythmdb_setup, test_rhythmdb_shutdown);
 	suite_add_tcase (s, tc_bugs);
 	tcase_add_checked_fixture (tc_bugs, test_rhythmdb_setup, test_rhythmdb_shutdown);
+	suite_add_tcase (s, tc_load);
+	tcase_add_checked_fixture (tc_load, test_rhythmdb_setup, test_rhythmdb_shutdown);
+	tcase_set_timeout (tc_load, 30);
 
 	/* test core functionality */
 	/*tcase_add_test (tc_chain, test_refstring);*/
@@ -531,12 +1684,30 @@ rhythmdb_suite (void)
 	tcase_add_test (tc_chain, test_rhythmdb_deserialisation1);
 	tcase_add_test (tc_chain, test_rhythmdb_deserialisation2);
 	tcase_add_test (tc_chain, test_rhythmdb_deserialisation3);
+	tcase_add_test (tc_chain, test_rhythmdb_generation);
+	tcase_add_test (tc_chain, test_rhythmdb_journal);
+	tcase_add_test (tc_chain, test_rhythmdb_query_profile);
+	tcase_add_test (tc_chain, test_rhythmdb_prop_indexes);
+	tcase_add_test (tc_chain, test_rhythmdb_word_index);
+	tcase_add_test (tc_chain, test_rhythmdb_parallel_query);
+	tcase_add_test (tc_chain, test_rhythmdb_generation_saved_results);
 	/*tcase_add_test (tc_chain, test_rhythmdb_serialisation);*/
 
 	/* tests for breakable bug fixes */
 	tcase_add_test (tc_chain, test_rhythmdb_podcast_upgrade);
 	tcase_add_test (tc_chain, test_rhythmdb_modify_after_delete);
 	tcase_add_test (tc_chain, test_rhythmdb_commit_change_merging);
+	tcase_add_test (tc_chain, test_rhythmdb_unset_cold_fields);
+	tcase_add_test (tc_chain, test_rhythmdb_mirrored_cold_fields);
+	tcase_add_test (tc_chain, test_rhythmdb_entry_pool_usage);
+	tcase_add_test (tc_chain, test_rhythmdb_dir_cache_save_load);
+	tcase_add_test (tc_chain, test_rhythmdb_dir_cache_record);
+	tcase_add_test (tc_chain, test_rhythmdb_dir_cache_check);
+
+	/* metadata loads, which need the load threads */
+	tcase_add_test (tc_load, test_rhythmdb_load_ordering);
+	tcase_add_test (tc_load, test_rhythmdb_load_blocked);
+	tcase_add_test (tc_load, test_rhythmdb_stat_batches);
 
 	return s;
 }